@@ -0,0 +1,76 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Reference receiver for framed transfers (tycmd send --framed). Copy src/libty/xfer.c
+   and src/libty/xfer.h next to this sketch before building it.
+
+   Received data is forwarded to Serial1, replace handle_data() with your own code (for
+   example to write to an SD card). Everything that is not a valid frame is ignored. */
+
+/* The receiver needs about TY_XFER_MAX_BLOCK_SIZE * (TY_XFER_RECEIVER_WINDOW + 1) bytes of
+   RAM. On small boards (such as Teensy LC), lower these values in your copy of xfer.h: the
+   definitions must be the same for the sketch and for xfer.c. */
+
+extern "C" {
+#include "xfer.h"
+}
+
+static ty_xfer_receiver receiver;
+
+static int write_link(void *udata, const uint8_t *buf, size_t size)
+{
+    (void)udata;
+
+    Serial.write(buf, size);
+    return 0;
+}
+
+static uint32_t get_millis(void *udata)
+{
+    (void)udata;
+    return millis();
+}
+
+static int handle_data(void *udata, const uint8_t *buf, size_t size)
+{
+    (void)udata;
+
+    Serial1.write(buf, size);
+    return 0;
+}
+
+static const ty_xfer_link link = {
+    write_link,
+    NULL,
+    get_millis,
+    NULL
+};
+
+void setup()
+{
+    Serial.begin(115200);
+    Serial1.begin(115200);
+
+    ty_xfer_receiver_init(&receiver, &link, handle_data, NULL);
+}
+
+void loop()
+{
+    uint8_t buf[64];
+    size_t len = 0;
+
+    while (Serial.available() && len < sizeof(buf))
+        buf[len++] = (uint8_t)Serial.read();
+
+    if (len) {
+        // Returns 1 when a transfer completes, and a negative value on error
+        ty_xfer_receiver_process(&receiver, buf, len);
+    }
+}
@@ -13,6 +13,7 @@
 
 static hs_log_handler_func *log_handler = hs_log_default_handler;
 static void *log_handler_udata;
+static hs_log_level log_level = HS_LOG_DEBUG;
 
 static _HS_THREAD_LOCAL hs_error_code error_masks[32];
 static _HS_THREAD_LOCAL unsigned int error_masks_count;
@@ -55,12 +56,39 @@ void hs_log_set_handler(hs_log_handler_func *f, void *udata)
     log_handler_udata = udata;
 }
 
+void hs_log_set_level(hs_log_level level)
+{
+    log_level = level;
+}
+
+static int debug_is_enabled(void)
+{
+    static int init, debug;
+
+    if (!init) {
+        debug = !!getenv("LIBHS_DEBUG");
+        init = 1;
+    }
+
+    return debug;
+}
+
+static int log_is_wanted(hs_log_level level)
+{
+    if (level > log_level)
+        return 0;
+    if (level == HS_LOG_DEBUG && log_handler == hs_log_default_handler)
+        return debug_is_enabled();
+
+    return 1;
+}
+
 void hs_log_default_handler(hs_log_level level, int err, const char *msg, void *udata)
 {
     _HS_UNUSED(err);
     _HS_UNUSED(udata);
 
-    if (level == HS_LOG_DEBUG && !getenv("LIBHS_DEBUG"))
+    if (level == HS_LOG_DEBUG && !debug_is_enabled())
         return;
 
     fputs(msg, stderr);
@@ -106,6 +134,9 @@ void hs_log(hs_log_level level, const char *fmt, ...)
     va_list ap;
     char buf[sizeof(last_error_msg)];
 
+    if (!log_is_wanted(level))
+        return;
+
     va_start(ap, fmt);
     vsnprintf(buf, sizeof(buf), fmt, ap);
     va_end(ap);
@@ -194,6 +194,19 @@ void hs_log_default_handler(hs_log_level level, int err, const char *msg, void *
  * @sa hs_log_default_handler() is the default log handler.
  */
 void hs_log_set_handler(hs_log_handler_func *f, void *udata);
+/**
+ * @ingroup misc
+ * @brief Set the maximum level of messages passed to the log handler.
+ *
+ * Messages above this level are discarded before they are even formatted, which matters for
+ * debug messages in I/O paths. Errors are always formatted, see hs_error_last_message(). The
+ * default level is HS_LOG_DEBUG.
+ *
+ * @param level Maximum message level.
+ *
+ * @sa hs_log_set_handler()
+ */
+void hs_log_set_level(hs_log_level level);
 /**
  * @ingroup misc
  * @brief Call the log callback with a printf-formatted message.
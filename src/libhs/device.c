@@ -40,13 +40,15 @@ void hs_device_unref(hs_device *dev)
         __atomic_thread_fence(__ATOMIC_ACQUIRE);
 #endif
 
-        free(dev->key);
-        free(dev->location);
-        free(dev->path);
-
-        free(dev->manufacturer_string);
-        free(dev->product_string);
-        free(dev->serial_number_string);
+        if (!dev->packed_strings) {
+            free(dev->key);
+            free(dev->location);
+            free(dev->path);
+
+            free(dev->manufacturer_string);
+            free(dev->product_string);
+            free(dev->serial_number_string);
+        }
     }
 
     free(dev);
@@ -121,6 +123,7 @@ void hs_port_close(hs_port *port)
         } break;
 
         case HS_DEVICE_TYPE_SERIAL: {
+            _hs_serial_clear_queue(port);
             _hs_close_file_port(port);
             return;
         } break;
@@ -75,8 +75,9 @@ static const char *const hs_device_type_strings[] = {
 struct hs_device {
     /** @cond */
     unsigned int refcount;
-    _hs_htable_head hnode;
     char *key;
+    // Strings share the device allocation and must not be freed separately
+    bool packed_strings;
     /** @endcond */
 
     /** Device type, see @ref hs_device_type. */
@@ -112,6 +113,13 @@ struct hs_device {
 
     /** Match pointer, copied from udata in @ref hs_match_spec. */
     void *match_udata;
+    /**
+     * @brief Reception time of the notification for the last status change, from hs_micros().
+     *
+     * This is 0 for devices found by enumeration, and on platforms where notifications are
+     * not timestamped (only Linux does it for now).
+     */
+    uint64_t event_time;
 
     /** Contains type-specific information, see below. */
     union {
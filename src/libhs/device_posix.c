@@ -111,7 +111,8 @@ restart:
             goto error;
         }
         r = ioctl(port->u.file.fd, TIOCMBIS, &modem_bits);
-        if (r < 0) {
+        /* Virtual serial ports (such as pseudo-terminals) have no modem lines */
+        if (r < 0 && errno != ENOTTY && errno != EINVAL) {
             r = hs_error(HS_ERROR_SYSTEM, "ioctl(TIOCMBIS, TIOCM_DTR) failed on '%s': %s",
                          dev->path, strerror(errno));
             goto error;
@@ -122,6 +123,8 @@ restart:
                          dev->path, strerror(errno));
             goto error;
         }
+
+        port->serial_latency = HS_SERIAL_CONFIG_LATENCY_NORMAL;
     }
 #ifdef __linux__
     else if (dev->type == HS_DEVICE_TYPE_HID) {
@@ -12,7 +12,17 @@
 #define _HS_DEVICE_PRIV_H
 
 #include "common_priv.h"
+#include "array.h"
 #include "device.h"
+#include "serial.h"
+
+struct _hs_serial_chunk {
+    const uint8_t *buf;
+    size_t size;
+
+    hs_serial_release_func *release;
+    void *release_udata;
+};
 
 struct hs_port {
     hs_device_type type;
@@ -20,6 +30,14 @@ struct hs_port {
     hs_port_mode mode;
     hs_device *dev;
 
+    hs_serial_config_latency serial_latency;
+
+    // Transmit queue, chunks before tx_head are done and waiting for compaction
+    _HS_ARRAY(struct _hs_serial_chunk) tx_chunks;
+    size_t tx_head;
+    size_t tx_offset;
+    size_t tx_queued;
+
     union {
 #if defined(_WIN32)
         struct {
@@ -61,6 +79,9 @@ int _hs_open_file_port(hs_device *dev, hs_port_mode mode, hs_port **rport);
 void _hs_close_file_port(hs_port *port);
 hs_handle _hs_get_file_port_poll_handle(const hs_port *port);
 
+void _hs_serial_consume_queue(hs_port *port, size_t written);
+void _hs_serial_clear_queue(hs_port *port);
+
 #if defined(_WIN32)
 void _hs_win32_start_async_read(hs_port *port);
 void _hs_win32_finalize_async_read(hs_port *port, int timeout);
@@ -121,6 +121,8 @@ int _hs_open_file_port(hs_device *dev, hs_port_mode mode, hs_port **rport)
                          port->path, hs_win32_strerror(0));
             goto error;
         }
+
+        port->serial_latency = HS_SERIAL_CONFIG_LATENCY_NORMAL;
     }
 
     if (mode & HS_PORT_MODE_READ) {
@@ -11,60 +11,100 @@
 #include "common_priv.h"
 #include "htable.h"
 
-int _hs_htable_init(_hs_htable *table, unsigned int size)
-{
-    table->heads = (void **)malloc(size * sizeof(*table->heads));
-    if (!table->heads)
-        return hs_error(HS_ERROR_MEMORY, NULL);
-    table->size = size;
-
-    _hs_htable_clear(table);
-
-    return 0;
-}
+#define MIN_SIZE 16
 
 void _hs_htable_release(_hs_htable *table)
 {
-    free(table->heads);
+    free(table->buckets);
+    memset(table, 0, sizeof(*table));
 }
 
-_hs_htable_head *_hs_htable_get_head(_hs_htable *table, uint32_t key)
+static void insert_bucket(_hs_htable_bucket *buckets, size_t size, uint32_t hash, void *value)
 {
-    return (_hs_htable_head *)&table->heads[key % table->size];
+    size_t idx = hash & (size - 1);
+
+    while (buckets[idx].hash)
+        idx = (idx + 1) & (size - 1);
+
+    buckets[idx].hash = hash;
+    buckets[idx].value = value;
 }
 
-void _hs_htable_add(_hs_htable *table, uint32_t key, _hs_htable_head *n)
+static int grow_table(_hs_htable *table)
 {
-    _hs_htable_head *head = _hs_htable_get_head(table, key);
+    size_t new_size = table->size ? table->size * 2 : MIN_SIZE;
+    _hs_htable_bucket *new_buckets;
+
+    new_buckets = (_hs_htable_bucket *)calloc(new_size, sizeof(*new_buckets));
+    if (!new_buckets)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->buckets[i].hash)
+            insert_bucket(new_buckets, new_size, table->buckets[i].hash, table->buckets[i].value);
+    }
 
-    n->key = key;
+    free(table->buckets);
+    table->buckets = new_buckets;
+    table->size = new_size;
 
-    n->next = head->next;
-    head->next = n;
+    return 0;
 }
 
-void _hs_htable_insert(_hs_htable_head *prev, _hs_htable_head *n)
+int _hs_htable_add(_hs_htable *table, uint32_t hash, void *value)
 {
-    n->key = prev->key;
+    assert(hash);
+
+    // Grow when the table is 3/4 full, this keeps probe sequences short
+    if ((table->count + 1) * 4 > table->size * 3) {
+        int r = grow_table(table);
+        if (r < 0)
+            return r;
+    }
+
+    insert_bucket(table->buckets, table->size, hash, value);
+    table->count++;
 
-    n->next = prev->next;
-    prev->next = n;
+    return 0;
 }
 
-void _hs_htable_remove(_hs_htable_head *head)
+bool _hs_htable_remove(_hs_htable *table, uint32_t hash, const void *value)
 {
-    for (_hs_htable_head *prev = head->next; prev != head; prev = prev->next) {
-        if (prev->next == head) {
-            prev->next = head->next;
-            head->next = NULL;
+    size_t mask = table->size - 1;
+    size_t idx;
 
-            break;
+    if (!table->size)
+        return false;
+
+    idx = hash & mask;
+    while (table->buckets[idx].hash) {
+        if (table->buckets[idx].hash == hash && table->buckets[idx].value == value)
+            goto found;
+        idx = (idx + 1) & mask;
+    }
+    return false;
+
+found:
+    /* Backward shift deletion: move following entries back if this bucket is part of
+       their probe sequence, so that lookups never need tombstones. */
+    for (size_t next = (idx + 1) & mask; table->buckets[next].hash; next = (next + 1) & mask) {
+        size_t home = table->buckets[next].hash & mask;
+
+        if (((next - home) & mask) >= ((next - idx) & mask)) {
+            table->buckets[idx] = table->buckets[next];
+            idx = next;
         }
     }
+    table->buckets[idx].hash = 0;
+    table->buckets[idx].value = NULL;
+    table->count--;
+
+    return true;
 }
 
 void _hs_htable_clear(_hs_htable *table)
 {
-    for (unsigned int i = 0; i < table->size; i++)
-        table->heads[i] = (_hs_htable_head *)&table->heads[i];
+    if (table->size)
+        memset(table->buckets, 0, table->size * sizeof(*table->buckets));
+    table->count = 0;
 }
@@ -15,55 +15,114 @@
 
 HS_BEGIN_C
 
-typedef struct _hs_htable_head {
-    // Keep first!
-    struct _hs_htable_head *next;
-    uint32_t key;
-} _hs_htable_head;
+/* Open-addressing hash table (linear probing) mapping 32-bit hashes to pointers. The
+   table does not know about keys: the full hash of each entry is cached in its bucket and
+   compared first, and callers only compare the real keys when the hashes are equal. Several
+   values can share the same hash. The table grows automatically, a zeroed table is a valid
+   empty table. */
+
+typedef struct _hs_htable_bucket {
+    // Never 0 for used buckets, see _hs_htable_hash_finish()
+    uint32_t hash;
+    void *value;
+} _hs_htable_bucket;
 
 typedef struct _hs_htable {
-    unsigned int size;
-    void **heads;
+    _hs_htable_bucket *buckets;
+    size_t size;
+    size_t count;
 } _hs_htable;
 
-int _hs_htable_init(_hs_htable *table, unsigned int size);
 void _hs_htable_release(_hs_htable *table);
 
-_hs_htable_head *_hs_htable_get_head(_hs_htable *table, uint32_t key);
+int _hs_htable_add(_hs_htable *table, uint32_t hash, void *value);
+bool _hs_htable_remove(_hs_htable *table, uint32_t hash, const void *value);
+void _hs_htable_clear(_hs_htable *table);
 
-void _hs_htable_add(_hs_htable *table, uint32_t key, _hs_htable_head *head);
-void _hs_htable_insert(_hs_htable_head *prev, _hs_htable_head *head);
-void _hs_htable_remove(_hs_htable_head *head);
+static inline uint32_t _hs_htable_hash_finish(uint32_t hash)
+{
+    // Murmur3 finalizer, so that close keys end up in different buckets
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+
+    // 0 marks empty buckets
+    return hash ? hash : 1;
+}
 
-void _hs_htable_clear(_hs_htable *table);
+static inline uint32_t _hs_htable_hash_mem(const void *mem, size_t len)
+{
+    const unsigned char *ptr = (const unsigned char *)mem;
+    uint32_t hash = 2166136261u;
+
+    // FNV-1a
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ ptr[i]) * 16777619u;
+
+    return _hs_htable_hash_finish(hash);
+}
 
 static inline uint32_t _hs_htable_hash_str(const char *s)
 {
-    uint32_t hash = 0;
+    uint32_t hash = 2166136261u;
+
     while (*s)
-        hash = hash * 101 + (unsigned char)*s++;
+        hash = (hash ^ (unsigned char)*s++) * 16777619u;
 
-    return hash;
+    return _hs_htable_hash_finish(hash);
 }
 
 static inline uint32_t _hs_htable_hash_ptr(const void *p)
 {
-    return (uint32_t)((uintptr_t)p >> 3);
+    uint64_t u = (uint64_t)(uintptr_t)p;
+    return _hs_htable_hash_finish((uint32_t)(u >> 32) ^ (uint32_t)u);
+}
+
+static inline void *_hs_htable_next(const _hs_htable *table, size_t *ridx)
+{
+    for (size_t i = *ridx; i < table->size; i++) {
+        if (table->buckets[i].hash) {
+            *ridx = i + 1;
+            return table->buckets[i].value;
+        }
+    }
+
+    *ridx = table->size;
+    return NULL;
+}
+
+static inline void *_hs_htable_next_hash(const _hs_htable *table, uint32_t hash, size_t *ridx)
+{
+    if (!table->size)
+        return NULL;
+
+    // The table is never full, so we always find an empty bucket at some point
+    for (;;) {
+        const _hs_htable_bucket *bucket = &table->buckets[*ridx];
+
+        *ridx = (*ridx + 1) & (table->size - 1);
+        if (!bucket->hash)
+            return NULL;
+        if (bucket->hash == hash)
+            return bucket->value;
+    }
 }
 
-/* While a break will only end the inner loop, the outer loop will subsequently fail
-   the cur == HS_UNIQUE_ID(head) test and thus break out of the outer loop too. */
+/* Do not add or remove values while iterating, the outer loop only exists to declare
+   the iterator and runs once (a break in the inner loop ends both). */
 #define _hs_htable_foreach(cur, table) \
-    for (_hs_htable_head *_HS_UNIQUE_ID(head) = (_hs_htable_head *)(table)->heads, *cur = _HS_UNIQUE_ID(head), *_HS_UNIQUE_ID(next); \
-            cur == _HS_UNIQUE_ID(head) && _HS_UNIQUE_ID(head) < (_hs_htable_head *)((table)->heads + (table)->size); \
-            _HS_UNIQUE_ID(head) = (_hs_htable_head *)((_hs_htable_head **)_HS_UNIQUE_ID(head) + 1), cur = (_hs_htable_head *)((_hs_htable_head **)cur + 1)) \
-        for (cur = cur->next, _HS_UNIQUE_ID(next) = cur->next; cur != _HS_UNIQUE_ID(head); cur = _HS_UNIQUE_ID(next), _HS_UNIQUE_ID(next) = cur->next) \
-
-#define _hs_htable_foreach_hash(cur, table, k) \
-    if ((table)->size) \
-        for (_hs_htable_head *_HS_UNIQUE_ID(head) = _hs_htable_get_head((table), (k)), *cur = _HS_UNIQUE_ID(head)->next, *_HS_UNIQUE_ID(next) = cur->next; \
-             cur != _HS_UNIQUE_ID(head); cur = _HS_UNIQUE_ID(next), _HS_UNIQUE_ID(next) = cur->next) \
-            if (cur->key == (k))
+    for (size_t _HS_UNIQUE_ID(idx) = 0, _HS_UNIQUE_ID(once) = 1; _HS_UNIQUE_ID(once); _HS_UNIQUE_ID(once) = 0) \
+        for (void *cur; (cur = _hs_htable_next((table), &_HS_UNIQUE_ID(idx))); )
+
+// The hash expression is evaluated only once
+#define _hs_htable_foreach_hash(cur, table, h) \
+    for (uint32_t _HS_UNIQUE_ID(hash) = (h), _HS_UNIQUE_ID(hash_once) = 1; _HS_UNIQUE_ID(hash_once); \
+         _HS_UNIQUE_ID(hash_once) = 0) \
+        for (size_t _HS_UNIQUE_ID(idx) = (table)->size ? _HS_UNIQUE_ID(hash) & ((table)->size - 1) : 0, \
+                    _HS_UNIQUE_ID(once) = 1; _HS_UNIQUE_ID(once); _HS_UNIQUE_ID(once) = 0) \
+            for (void *cur; (cur = _hs_htable_next_hash((table), _HS_UNIQUE_ID(hash), &_HS_UNIQUE_ID(idx))); )
 
 HS_END_C
 
@@ -24,7 +24,7 @@
    Windows (MSVC)      | Nothing to do, libhs uses `#pragma comment(lib)`
    Windows (MinGW-w64) | Link _user32, advapi32, setupapi and hid_ `-luser32 -ladvapi32 -lsetupapi -lhid`
    OSX (Clang)         | Link _CoreFoundation and IOKit_ `-framework CoreFoundation -framework IOKit`
-   Linux (GCC)         | Link _libudev_ `-ludev`
+   Linux (GCC)         | Link _libudev_ `-ludev`, or define HS_NO_LIBUDEV to use sysfs and netlink
 
    Other systems are not supported at the moment. */
 
@@ -52,6 +52,7 @@
     #include "common_priv.h"
     #include "device_priv.h"
     #include "match_priv.h"
+    #include "monitor_priv.h"
 
     #include "common.c"
     #include "compat.c"
@@ -61,6 +62,7 @@
     #include "htable.c"
     #include "monitor_common.c"
     #include "platform.c"
+    #include "serial_common.c"
 
     #if defined(_WIN32)
         #include "device_win32.c"
@@ -77,7 +79,12 @@
     #elif defined(__linux__)
         #include "device_posix.c"
         #include "hid_linux.c"
-        #include "monitor_linux.c"
+        #include "monitor_linux_common.c"
+        #ifdef HS_NO_LIBUDEV
+            #include "monitor_linux_netlink.c"
+        #else
+            #include "monitor_linux.c"
+        #endif
         #include "platform_posix.c"
         #include "serial_posix.c"
     #else
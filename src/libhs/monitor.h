@@ -162,6 +162,33 @@ int hs_monitor_start(hs_monitor *monitor);
  */
 void hs_monitor_stop(hs_monitor *monitor);
 
+/**
+ * @ingroup monitor
+ * @brief Prepare a started monitor to be shared with a child process.
+ *
+ * After fork(), both processes share the source of device notifications, and each event
+ * only reaches one of them. Call this function before fork() to open a second source, then
+ * call hs_monitor_finish_fork() in both processes: the child keeps the original source, and
+ * the parent switches to the new one. Call hs_monitor_refresh() in the parent between
+ * hs_monitor_prepare_fork() and fork(), the child inherits the resulting device list.
+ *
+ * This is only supported on Linux.
+ *
+ * @param monitor Device monitor.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_monitor_finish_fork()
+ */
+int hs_monitor_prepare_fork(hs_monitor *monitor);
+/**
+ * @ingroup monitor
+ * @brief Finish sharing the monitor with a child process, see hs_monitor_prepare_fork().
+ *
+ * @param monitor Device monitor.
+ * @param child   True in the child process, false in the parent.
+ */
+void hs_monitor_finish_fork(hs_monitor *monitor, bool child);
+
 /**
  * @ingroup monitor
  * @brief Refresh the device list and fire device change events.
@@ -30,31 +30,42 @@ int hs_find(const hs_match_spec *matches, unsigned int count, hs_device **rdev)
 void _hs_monitor_clear_devices(_hs_htable *devices)
 {
     _hs_htable_foreach(cur, devices) {
-        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+        hs_device *dev = (hs_device *)cur;
         hs_device_unref(dev);
     }
     _hs_htable_clear(devices);
 }
 
-bool _hs_monitor_has_device(_hs_htable *devices, const char *key, uint8_t iface)
+static hs_device *find_device(_hs_htable *devices, uint32_t hash, const char *key, uint8_t iface)
 {
-    _hs_htable_foreach_hash(cur, devices, _hs_htable_hash_str(key)) {
-        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+    // Keys are only compared when the full hashes match
+    _hs_htable_foreach_hash(cur, devices, hash) {
+        hs_device *dev = (hs_device *)cur;
 
-        if (strcmp(dev->key, key) == 0 && dev->iface_number == iface)
-            return true;
+        if (dev->iface_number == iface && strcmp(dev->key, key) == 0)
+            return dev;
     }
 
-    return false;
+    return NULL;
+}
+
+bool _hs_monitor_has_device(_hs_htable *devices, const char *key, uint8_t iface)
+{
+    return find_device(devices, _hs_htable_hash_str(key), key, iface);
 }
 
 int _hs_monitor_add(_hs_htable *devices, hs_device *dev, hs_enumerate_func *f, void *udata)
 {
-    if (_hs_monitor_has_device(devices, dev->key, dev->iface_number))
+    uint32_t hash = _hs_htable_hash_str(dev->key);
+    int r;
+
+    if (find_device(devices, hash, dev->key, dev->iface_number))
         return 0;
 
+    r = _hs_htable_add(devices, hash, dev);
+    if (r < 0)
+        return r;
     hs_device_ref(dev);
-    _hs_htable_add(devices, _hs_htable_hash_str(dev->key), &dev->hnode);
 
     _hs_device_log(dev, "Add");
 
@@ -65,30 +76,41 @@ int _hs_monitor_add(_hs_htable *devices, hs_device *dev, hs_enumerate_func *f, v
     }
 }
 
-void _hs_monitor_remove(_hs_htable *devices, const char *key, hs_enumerate_func *f,
-                        void *udata)
+void _hs_monitor_remove(_hs_htable *devices, const char *key, uint64_t event_time,
+                        hs_enumerate_func *f, void *udata)
 {
-    _hs_htable_foreach_hash(cur, devices, _hs_htable_hash_str(key)) {
-        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+    uint32_t hash = _hs_htable_hash_str(key);
+    hs_device *dev;
+
+    // Removal reorders buckets, so start over after each device
+    do {
+        dev = NULL;
+        _hs_htable_foreach_hash(cur, devices, hash) {
+            if (strcmp(((hs_device *)cur)->key, key) == 0) {
+                dev = (hs_device *)cur;
+                break;
+            }
+        }
 
-        if (strcmp(dev->key, key) == 0) {
+        if (dev) {
             dev->status = HS_DEVICE_STATUS_DISCONNECTED;
+            dev->event_time = event_time;
 
             hs_log(HS_LOG_DEBUG, "Remove device '%s'", dev->key);
 
             if (f)
                 (*f)(dev, udata);
 
-            _hs_htable_remove(&dev->hnode);
+            _hs_htable_remove(devices, hash, dev);
             hs_device_unref(dev);
         }
-    }
+    } while (dev);
 }
 
 int _hs_monitor_list(_hs_htable *devices, hs_enumerate_func *f, void *udata)
 {
     _hs_htable_foreach(cur, devices) {
-        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+        hs_device *dev = (hs_device *)cur;
         int r;
 
         r = (*f)(dev, udata);
@@ -419,7 +419,8 @@ static void darwin_devices_detached(void *udata, io_iterator_t it)
             char key[32];
 
             sprintf(key, "%" PRIx64, session);
-            _hs_monitor_remove(&monitor->devices, key, monitor->callback, monitor->callback_udata);
+            _hs_monitor_remove(&monitor->devices, key, 0, monitor->callback,
+                               monitor->callback_udata);
         }
 
         IOObjectRelease(service);
@@ -525,10 +526,6 @@ int hs_monitor_new(const hs_match_spec *matches, unsigned int count, hs_monitor
     if (r < 0)
         goto error;
 
-    r = _hs_htable_init(&monitor->devices, 64);
-    if (r < 0)
-        goto error;
-
     monitor->notify_port = IONotificationPortCreate(kIOMasterPortDefault);
     if (!monitor->notify_port) {
         r = hs_error(HS_ERROR_SYSTEM, "IONotificationPortCreate() failed");
@@ -658,6 +655,20 @@ void hs_monitor_stop(hs_monitor *monitor)
     monitor->started = false;
 }
 
+int hs_monitor_prepare_fork(hs_monitor *monitor)
+{
+    assert(monitor);
+
+    // Mach ports are not inherited, the child would never get any notification
+    return hs_error(HS_ERROR_SYSTEM, "Device monitors cannot be shared with child processes");
+}
+
+void hs_monitor_finish_fork(hs_monitor *monitor, bool child)
+{
+    assert(monitor);
+    _HS_UNUSED(child);
+}
+
 int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
 {
     assert(monitor);
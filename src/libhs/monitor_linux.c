@@ -10,23 +10,27 @@
 
 #include "common_priv.h"
 #include <fcntl.h>
-#include <linux/hidraw.h>
 #include <libudev.h>
 #include <pthread.h>
 #include <sys/eventfd.h>
-#include <sys/ioctl.h>
 #include <unistd.h>
 #include "device_priv.h"
 #include "match_priv.h"
 #include "monitor_priv.h"
 #include "platform.h"
 
+/* The default netlink socket buffer is too small for bursts of events, such as when a
+   powered hub with many boards gets reset, and the kernel drops the events that don't fit. */
+#define MONITOR_RECEIVE_BUFFER_SIZE (4 * 1024 * 1024)
+
 struct hs_monitor {
     _hs_match_helper match_helper;
     _hs_htable devices;
 
     struct udev_monitor *udev_mon;
     int wait_fd;
+    // Second udev monitor for hs_monitor_prepare_fork()
+    struct udev_monitor *fork_mon;
 };
 
 struct device_subsystem {
@@ -54,302 +58,91 @@ static int common_eventfd = -1;
 int dup3(int oldfd, int newfd, int flags);
 #endif
 
-static int compute_device_location(struct udev_device *dev, char **rlocation)
-{
-    const char *busnum, *devpath;
-    char *location;
-    int r;
-
-    busnum = udev_device_get_sysattr_value(dev, "busnum");
-    devpath = udev_device_get_sysattr_value(dev, "devpath");
-
-    if (!busnum || !devpath)
-        return 0;
-
-    r = _hs_asprintf(&location, "usb-%s-%s", busnum, devpath);
-    if (r < 0)
-        return hs_error(HS_ERROR_MEMORY, NULL);
-
-    for (char *ptr = location; *ptr; ptr++) {
-        if (*ptr == '.')
-            *ptr = '-';
-    }
-
-    *rlocation = location;
-    return 1;
-}
-
-static int fill_device_details(struct udev_aggregate *agg, hs_device *dev)
+static bool read_device_identity(struct udev_aggregate *agg, hs_device *dev)
 {
     const char *buf;
-    int r;
 
     buf = udev_device_get_subsystem(agg->dev);
     if (!buf)
-        return 0;
+        return false;
 
     if (strcmp(buf, "hidraw") == 0) {
         dev->type = HS_DEVICE_TYPE_HID;
     } else if (strcmp(buf, "tty") == 0) {
         dev->type = HS_DEVICE_TYPE_SERIAL;
     } else {
-        return 0;
+        return false;
     }
 
-    buf = udev_device_get_devnode(agg->dev);
-    if (!buf || access(buf, F_OK) != 0)
-        return 0;
-    dev->path = strdup(buf);
-    if (!dev->path)
-        return hs_error(HS_ERROR_MEMORY, NULL);
-
-    dev->key = strdup(udev_device_get_devpath(agg->dev));
-    if (!dev->key)
-        return hs_error(HS_ERROR_MEMORY, NULL);
-
-    r = compute_device_location(agg->usb, &dev->location);
-    if (r <= 0)
-        return r;
-
     errno = 0;
     buf = udev_device_get_sysattr_value(agg->usb, "idVendor");
     if (!buf)
-        return 0;
+        return false;
     dev->vid = (uint16_t)strtoul(buf, NULL, 16);
     if (errno)
-        return 0;
+        return false;
 
     errno = 0;
     buf = udev_device_get_sysattr_value(agg->usb, "idProduct");
     if (!buf)
-        return 0;
+        return false;
     dev->pid = (uint16_t)strtoul(buf, NULL, 16);
     if (errno)
-        return 0;
-
-    buf = udev_device_get_sysattr_value(agg->usb, "manufacturer");
-    if (buf) {
-        dev->manufacturer_string = strdup(buf);
-        if (!dev->manufacturer_string)
-            return hs_error(HS_ERROR_MEMORY, NULL);
-    }
-
-    buf = udev_device_get_sysattr_value(agg->usb, "product");
-    if (buf) {
-        dev->product_string = strdup(buf);
-        if (!dev->product_string)
-            return hs_error(HS_ERROR_MEMORY, NULL);
-    }
-
-    buf = udev_device_get_sysattr_value(agg->usb, "serial");
-    if (buf) {
-        dev->serial_number_string = strdup(buf);
-        if (!dev->serial_number_string)
-            return hs_error(HS_ERROR_MEMORY, NULL);
-    }
+        return false;
 
     errno = 0;
     buf = udev_device_get_devpath(agg->iface);
     buf += strlen(buf) - 1;
     dev->iface_number = (uint8_t)strtoul(buf, NULL, 10);
     if (errno)
-        return 0;
+        return false;
 
-    return 1;
+    return true;
 }
 
-static size_t read_hid_descriptor_sysfs(struct udev_aggregate *agg, uint8_t *desc_buf,
-                                        size_t desc_buf_size)
-{
-    struct udev_device *hid_dev;
-    char report_path[4096];
-    int fd;
-    ssize_t r;
-
-    hid_dev = udev_device_get_parent_with_subsystem_devtype(agg->dev, "hid", NULL);
-    if (!hid_dev)
-        return 0;
-    snprintf(report_path, sizeof(report_path), "%s/report_descriptor",
-             udev_device_get_syspath(hid_dev));
-
-    fd = open(report_path, O_RDONLY);
-    if (fd < 0)
-        return 0;
-    r = read(fd, desc_buf, desc_buf_size);
-    close(fd);
-    if (r < 0)
-        return 0;
-
-    return (size_t)r;
-}
-
-static size_t read_hid_descriptor_hidraw(struct udev_aggregate *agg, uint8_t *desc_buf,
-                                         size_t desc_buf_size)
-{
-    const char *node_path;
-    int fd = -1;
-    int hidraw_desc_size = 0;
-    struct hidraw_report_descriptor hidraw_desc;
-    int r;
-
-    node_path = udev_device_get_devnode(agg->dev);
-    if (!node_path)
-        goto cleanup;
-    fd = open(node_path, O_RDONLY);
-    if (fd < 0)
-        goto cleanup;
-
-    r = ioctl(fd, HIDIOCGRDESCSIZE, &hidraw_desc_size);
-    if (r < 0)
-        goto cleanup;
-    hidraw_desc.size = (uint32_t)hidraw_desc_size;
-    r = ioctl(fd, HIDIOCGRDESC, &hidraw_desc);
-    if (r < 0) {
-        hidraw_desc_size = 0;
-        goto cleanup;
-    }
-
-    if (desc_buf_size > hidraw_desc.size)
-        desc_buf_size = hidraw_desc.size;
-    memcpy(desc_buf, hidraw_desc.value, desc_buf_size);
-
-cleanup:
-    close(fd);
-    return (size_t)hidraw_desc_size;
-}
-
-static void parse_hid_descriptor(hs_device *dev, uint8_t *desc, size_t desc_size)
-{
-    unsigned int collection_depth = 0;
-
-    unsigned int item_size = 0;
-    for (size_t i = 0; i < desc_size; i += item_size + 1) {
-        unsigned int item_type;
-        uint32_t item_data;
-
-        item_type = desc[i];
-
-        if (item_type == 0xFE) {
-            // not interested in long items
-            if (i + 1 < desc_size)
-                item_size = (unsigned int)desc[i + 1] + 2;
-            continue;
-        }
-
-        item_size = item_type & 3;
-        if (item_size == 3)
-            item_size = 4;
-        item_type &= 0xFC;
-
-        if (i + item_size >= desc_size) {
-            hs_log(HS_LOG_WARNING, "Invalid HID descriptor for device '%s'", dev->path);
-            return;
-        }
-
-        // little endian
-        switch (item_size) {
-            case 0: {
-                item_data = 0;
-            } break;
-            case 1: {
-                item_data = desc[i + 1];
-            } break;
-            case 2: {
-                item_data = (uint32_t)(desc[i + 2] << 8) | desc[i + 1];
-            } break;
-            case 4: {
-                item_data = (uint32_t)((desc[i + 4] << 24) | (desc[i + 3] << 16) |
-                                       (desc[i + 2] << 8) | desc[i + 1]);
-            } break;
-
-            // silence unitialized warning
-            default: {
-                item_data = 0;
-            } break;
-        }
-
-        switch (item_type) {
-            // main items
-            case 0xA0: {
-                collection_depth++;
-            } break;
-            case 0xC0: {
-                collection_depth--;
-            } break;
-
-            // global items
-            case 0x84: {
-                dev->u.hid.numbered_reports = true;
-            } break;
-            case 0x04: {
-                if (!collection_depth)
-                    dev->u.hid.usage_page = (uint16_t)item_data;
-            } break;
-
-            // local items
-            case 0x08: {
-                if (!collection_depth)
-                    dev->u.hid.usage = (uint16_t)item_data;
-            } break;
-        }
-    }
-}
-
-static void fill_hid_properties(struct udev_aggregate *agg, hs_device *dev)
-{
-    uint8_t desc[HID_MAX_DESCRIPTOR_SIZE];
-    size_t desc_size;
-
-    // The sysfs report_descriptor file appeared in 2011, somewhere around Linux 2.6.38
-    desc_size = read_hid_descriptor_sysfs(agg, desc, sizeof(desc));
-    if (!desc_size) {
-        desc_size = read_hid_descriptor_hidraw(agg, desc, sizeof(desc));
-        if (!desc_size) {
-            // This will happen pretty often on old kernels, most HID nodes are root-only
-            hs_log(HS_LOG_DEBUG, "Cannot get HID report descriptor from '%s'", dev->path);
-            return;
-        }
-    }
-
-    parse_hid_descriptor(dev, desc, desc_size);
-}
-
-static int read_device_information(struct udev_device *udev_dev, hs_device **rdev)
+static int read_device_information(struct udev_device *udev_dev,
+                                   const _hs_match_helper *match_helper, hs_device **rdev)
 {
     struct udev_aggregate agg;
-    hs_device *dev = NULL;
+    hs_device identity = {0};
+    struct _hs_linux_device_strings strings;
+    hs_device *dev;
     int r;
 
     agg.dev = udev_dev;
     agg.usb = udev_device_get_parent_with_subsystem_devtype(agg.dev, "usb", "usb_device");
     agg.iface = udev_device_get_parent_with_subsystem_devtype(agg.dev, "usb", "usb_interface");
-    if (!agg.usb || !agg.iface) {
-        r = 0;
-        goto cleanup;
-    }
+    if (!agg.usb || !agg.iface)
+        return 0;
 
-    dev = (hs_device *)calloc(1, sizeof(*dev));
-    if (!dev) {
-        r = hs_error(HS_ERROR_MEMORY, NULL);
-        goto cleanup;
-    }
-    dev->refcount = 1;
-    dev->status = HS_DEVICE_STATUS_ONLINE;
+    /* Matching only needs the type and USB identifiers, don't bother with strings and HID
+       descriptors for devices nobody cares about. */
+    if (!read_device_identity(&agg, &identity))
+        return 0;
+    if (!_hs_match_helper_match(match_helper, &identity, &identity.match_udata))
+        return 0;
+
+    strings.key = udev_device_get_devpath(agg.dev);
+    strings.path = udev_device_get_devnode(agg.dev);
+    strings.busnum = udev_device_get_sysattr_value(agg.usb, "busnum");
+    strings.usb_devpath = udev_device_get_sysattr_value(agg.usb, "devpath");
+    strings.manufacturer = udev_device_get_sysattr_value(agg.usb, "manufacturer");
+    strings.product = udev_device_get_sysattr_value(agg.usb, "product");
+    strings.serial = udev_device_get_sysattr_value(agg.usb, "serial");
 
-    r = fill_device_details(&agg, dev);
+    r = _hs_linux_create_device(&identity, &strings, &dev);
     if (r <= 0)
-        goto cleanup;
+        return r;
 
-    if (dev->type == HS_DEVICE_TYPE_HID)
-        fill_hid_properties(&agg, dev);
+    if (dev->type == HS_DEVICE_TYPE_HID) {
+        struct udev_device *hid_dev;
 
-    *rdev = dev;
-    dev = NULL;
+        hid_dev = udev_device_get_parent_with_subsystem_devtype(agg.dev, "hid", NULL);
+        _hs_linux_fill_hid_properties(dev, hid_dev ? udev_device_get_syspath(hid_dev) : NULL);
+    }
 
-    r = 1;
-cleanup:
-    hs_device_unref(dev);
-    return r;
+    *rdev = dev;
+    return 1;
 }
 
 static void release_udev(void)
@@ -442,21 +235,17 @@ static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void
             continue;
         }
 
-        r = read_device_information(udev_dev, &dev);
+        r = read_device_information(udev_dev, match_helper, &dev);
         udev_device_unref(udev_dev);
         if (r < 0)
             goto cleanup;
         if (!r)
             continue;
 
-        if (_hs_match_helper_match(match_helper, dev, &dev->match_udata)) {
-            r = (*f)(dev, udata);
-            hs_device_unref(dev);
-            if (r)
-                goto cleanup;
-        } else {
-            hs_device_unref(dev);
-        }
+        r = (*f)(dev, udata);
+        hs_device_unref(dev);
+        if (r)
+            goto cleanup;
     }
 
     r = 0;
@@ -522,10 +311,6 @@ int hs_monitor_new(const hs_match_spec *matches, unsigned int count, hs_monitor
     if (r < 0)
         goto error;
 
-    r = _hs_htable_init(&monitor->devices, 64);
-    if (r < 0)
-        goto error;
-
     r = init_udev();
     if (r < 0)
         goto error;
@@ -549,6 +334,7 @@ void hs_monitor_free(hs_monitor *monitor)
     if (monitor) {
         close(monitor->wait_fd);
         udev_monitor_unref(monitor->udev_mon);
+        udev_monitor_unref(monitor->fork_mon);
 
         _hs_monitor_clear_devices(&monitor->devices);
         _hs_htable_release(&monitor->devices);
@@ -564,24 +350,23 @@ static int monitor_enumerate_callback(hs_device *dev, void *udata)
     return _hs_monitor_add(&monitor->devices, dev, NULL, NULL);
 }
 
-int hs_monitor_start(hs_monitor *monitor)
+static int open_udev_monitor(hs_monitor *monitor, struct udev_monitor **rudev_mon)
 {
-    assert(monitor);
-
+    struct udev_monitor *udev_mon;
     int r;
 
-    if (monitor->udev_mon)
-        return 0;
+    udev_mon = udev_monitor_new_from_netlink(udev, "udev");
+    if (!udev_mon)
+        return hs_error(HS_ERROR_SYSTEM, "udev_monitor_new_from_netlink() failed");
 
-    monitor->udev_mon = udev_monitor_new_from_netlink(udev, "udev");
-    if (!monitor->udev_mon) {
-        r = hs_error(HS_ERROR_SYSTEM, "udev_monitor_new_from_netlink() failed");
-        goto error;
-    }
+    // This needs privileges to go beyond rmem_max, so don't fail if it does not work
+    r = udev_monitor_set_receive_buffer_size(udev_mon, MONITOR_RECEIVE_BUFFER_SIZE);
+    if (r < 0)
+        hs_log(HS_LOG_DEBUG, "Failed to enlarge udev monitor buffer: %s", strerror(-r));
 
     for (unsigned int i = 0; device_subsystems[i].subsystem; i++) {
         if (_hs_match_helper_has_type(&monitor->match_helper, device_subsystems[i].type)) {
-            r = udev_monitor_filter_add_match_subsystem_devtype(monitor->udev_mon, device_subsystems[i].subsystem, NULL);
+            r = udev_monitor_filter_add_match_subsystem_devtype(udev_mon, device_subsystems[i].subsystem, NULL);
             if (r < 0) {
                 r = hs_error(HS_ERROR_SYSTEM, "udev_monitor_filter_add_match_subsystem_devtype() failed");
                 goto error;
@@ -589,12 +374,33 @@ int hs_monitor_start(hs_monitor *monitor)
         }
     }
 
-    r = udev_monitor_enable_receiving(monitor->udev_mon);
+    r = udev_monitor_enable_receiving(udev_mon);
     if (r < 0) {
         r = hs_error(HS_ERROR_SYSTEM, "udev_monitor_enable_receiving() failed");
         goto error;
     }
 
+    *rudev_mon = udev_mon;
+    return 0;
+
+error:
+    udev_monitor_unref(udev_mon);
+    return r;
+}
+
+int hs_monitor_start(hs_monitor *monitor)
+{
+    assert(monitor);
+
+    int r;
+
+    if (monitor->udev_mon)
+        return 0;
+
+    r = open_udev_monitor(monitor, &monitor->udev_mon);
+    if (r < 0)
+        goto error;
+
     r = enumerate(&monitor->match_helper, monitor_enumerate_callback, monitor);
     if (r < 0)
         goto error;
@@ -622,6 +428,35 @@ void hs_monitor_stop(hs_monitor *monitor)
     dup3(common_eventfd, monitor->wait_fd, O_CLOEXEC);
     udev_monitor_unref(monitor->udev_mon);
     monitor->udev_mon = NULL;
+    udev_monitor_unref(monitor->fork_mon);
+    monitor->fork_mon = NULL;
+}
+
+int hs_monitor_prepare_fork(hs_monitor *monitor)
+{
+    assert(monitor);
+
+    if (!monitor->udev_mon || monitor->fork_mon)
+        return 0;
+
+    return open_udev_monitor(monitor, &monitor->fork_mon);
+}
+
+void hs_monitor_finish_fork(hs_monitor *monitor, bool child)
+{
+    assert(monitor);
+
+    if (!monitor->fork_mon)
+        return;
+
+    if (child) {
+        udev_monitor_unref(monitor->fork_mon);
+    } else {
+        udev_monitor_unref(monitor->udev_mon);
+        monitor->udev_mon = monitor->fork_mon;
+        dup3(udev_monitor_get_fd(monitor->udev_mon), monitor->wait_fd, O_CLOEXEC);
+    }
+    monitor->fork_mon = NULL;
 }
 
 hs_handle hs_monitor_get_poll_handle(const hs_monitor *monitor)
@@ -642,22 +477,24 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
 
     errno = 0;
     while ((udev_dev = udev_monitor_receive_device(monitor->udev_mon))) {
+        // Reading sysfs takes a while, stamp the event before we do
+        uint64_t event_time = hs_micros();
         const char *action = udev_device_get_action(udev_dev);
 
         r = 0;
         if (strcmp(action, "add") == 0) {
             hs_device *dev = NULL;
 
-            r = read_device_information(udev_dev, &dev);
+            r = read_device_information(udev_dev, &monitor->match_helper, &dev);
             if (r > 0) {
-                r = _hs_match_helper_match(&monitor->match_helper, dev, &dev->match_udata);
-                if (r)
-                    r = _hs_monitor_add(&monitor->devices, dev, f, udata);
+                dev->event_time = event_time;
+                r = _hs_monitor_add(&monitor->devices, dev, f, udata);
             }
 
             hs_device_unref(dev);
         } else if (strcmp(action, "remove") == 0) {
-            _hs_monitor_remove(&monitor->devices, udev_device_get_devpath(udev_dev), f, udata);
+            _hs_monitor_remove(&monitor->devices, udev_device_get_devpath(udev_dev), event_time,
+                               f, udata);
         }
         udev_device_unref(udev_dev);
         if (r)
@@ -667,6 +504,8 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
     }
     if (errno == ENOMEM)
         return hs_error(HS_ERROR_MEMORY, NULL);
+    if (errno == ENOBUFS)
+        hs_log(HS_LOG_WARNING, "Device events were lost because the udev monitor buffer is full");
 
     return 0;
 }
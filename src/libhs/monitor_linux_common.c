@@ -0,0 +1,314 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libraries
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include "device_priv.h"
+#include "monitor_priv.h"
+
+/* Code shared by the libudev and the netlink/sysfs device monitors, none of this depends
+   on libudev. */
+
+// Parsed HID report descriptors by devpath, shared by all monitors and enumerations
+#define HID_CACHE_SIZE 256
+struct hid_cache_entry {
+    uint16_t usage_page;
+    uint16_t usage;
+    bool numbered_reports;
+    char key[];
+};
+static pthread_mutex_t hid_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static _hs_htable hid_cache;
+static bool hid_cache_atexit;
+
+static size_t string_size(const char *str)
+{
+    return str ? strlen(str) + 1 : 0;
+}
+
+static char *pack_string(char **rptr, const char *str)
+{
+    char *copy = *rptr;
+
+    if (!str)
+        return NULL;
+
+    *rptr = _hs_stpcpy(copy, str) + 1;
+    return copy;
+}
+
+int _hs_linux_create_device(const hs_device *identity, const struct _hs_linux_device_strings *strings,
+                            hs_device **rdev)
+{
+    const char *key = strings->key, *path = strings->path;
+    const char *busnum = strings->busnum, *usb_devpath = strings->usb_devpath;
+    const char *manufacturer = strings->manufacturer, *product = strings->product;
+    const char *serial = strings->serial;
+    size_t location_size;
+    hs_device *dev;
+    char *ptr;
+
+    if (!key || !path || access(path, F_OK) != 0)
+        return 0;
+    if (!busnum || !usb_devpath)
+        return 0;
+    location_size = strlen("usb--") + strlen(busnum) + strlen(usb_devpath) + 1;
+
+    // Strings live right after the device, this saves six allocations per device
+    dev = (hs_device *)calloc(1, sizeof(*dev) + string_size(key) + string_size(path) +
+                                 location_size + string_size(manufacturer) +
+                                 string_size(product) + string_size(serial));
+    if (!dev)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    dev->refcount = 1;
+    dev->packed_strings = true;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+
+    dev->type = identity->type;
+    dev->vid = identity->vid;
+    dev->pid = identity->pid;
+    dev->iface_number = identity->iface_number;
+    dev->match_udata = identity->match_udata;
+
+    ptr = (char *)(dev + 1);
+    dev->key = pack_string(&ptr, key);
+    dev->path = pack_string(&ptr, path);
+    dev->location = ptr;
+    ptr += sprintf(ptr, "usb-%s-%s", busnum, usb_devpath) + 1;
+    for (char *loc = dev->location; *loc; loc++) {
+        if (*loc == '.')
+            *loc = '-';
+    }
+    dev->manufacturer_string = pack_string(&ptr, manufacturer);
+    dev->product_string = pack_string(&ptr, product);
+    dev->serial_number_string = pack_string(&ptr, serial);
+
+    *rdev = dev;
+    return 1;
+}
+
+static size_t read_hid_descriptor_sysfs(const char *hid_syspath, uint8_t *desc_buf,
+                                        size_t desc_buf_size)
+{
+    char report_path[4096];
+    int fd;
+    ssize_t r;
+
+    if (!hid_syspath)
+        return 0;
+    snprintf(report_path, sizeof(report_path), "%s/report_descriptor", hid_syspath);
+
+    fd = open(report_path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    r = read(fd, desc_buf, desc_buf_size);
+    close(fd);
+    if (r < 0)
+        return 0;
+
+    return (size_t)r;
+}
+
+static size_t read_hid_descriptor_hidraw(const char *node_path, uint8_t *desc_buf,
+                                         size_t desc_buf_size)
+{
+    int fd = -1;
+    int hidraw_desc_size = 0;
+    struct hidraw_report_descriptor hidraw_desc;
+    int r;
+
+    fd = open(node_path, O_RDONLY);
+    if (fd < 0)
+        goto cleanup;
+
+    r = ioctl(fd, HIDIOCGRDESCSIZE, &hidraw_desc_size);
+    if (r < 0)
+        goto cleanup;
+    hidraw_desc.size = (uint32_t)hidraw_desc_size;
+    r = ioctl(fd, HIDIOCGRDESC, &hidraw_desc);
+    if (r < 0) {
+        hidraw_desc_size = 0;
+        goto cleanup;
+    }
+
+    if (desc_buf_size > hidraw_desc.size)
+        desc_buf_size = hidraw_desc.size;
+    memcpy(desc_buf, hidraw_desc.value, desc_buf_size);
+
+cleanup:
+    close(fd);
+    return (size_t)hidraw_desc_size;
+}
+
+static void parse_hid_descriptor(hs_device *dev, uint8_t *desc, size_t desc_size)
+{
+    unsigned int collection_depth = 0;
+
+    unsigned int item_size = 0;
+    for (size_t i = 0; i < desc_size; i += item_size + 1) {
+        unsigned int item_type;
+        uint32_t item_data;
+
+        item_type = desc[i];
+
+        if (item_type == 0xFE) {
+            // not interested in long items
+            if (i + 1 < desc_size)
+                item_size = (unsigned int)desc[i + 1] + 2;
+            continue;
+        }
+
+        item_size = item_type & 3;
+        if (item_size == 3)
+            item_size = 4;
+        item_type &= 0xFC;
+
+        if (i + item_size >= desc_size) {
+            hs_log(HS_LOG_WARNING, "Invalid HID descriptor for device '%s'", dev->path);
+            return;
+        }
+
+        // little endian
+        switch (item_size) {
+            case 0: {
+                item_data = 0;
+            } break;
+            case 1: {
+                item_data = desc[i + 1];
+            } break;
+            case 2: {
+                item_data = (uint32_t)(desc[i + 2] << 8) | desc[i + 1];
+            } break;
+            case 4: {
+                item_data = (uint32_t)((desc[i + 4] << 24) | (desc[i + 3] << 16) |
+                                       (desc[i + 2] << 8) | desc[i + 1]);
+            } break;
+
+            // silence unitialized warning
+            default: {
+                item_data = 0;
+            } break;
+        }
+
+        switch (item_type) {
+            // main items
+            case 0xA0: {
+                collection_depth++;
+            } break;
+            case 0xC0: {
+                collection_depth--;
+            } break;
+
+            // global items
+            case 0x84: {
+                dev->u.hid.numbered_reports = true;
+            } break;
+            case 0x04: {
+                if (!collection_depth)
+                    dev->u.hid.usage_page = (uint16_t)item_data;
+            } break;
+
+            // local items
+            case 0x08: {
+                if (!collection_depth)
+                    dev->u.hid.usage = (uint16_t)item_data;
+            } break;
+        }
+    }
+}
+
+static bool find_hid_cache(hs_device *dev)
+{
+    struct hid_cache_entry *entry = NULL;
+
+    pthread_mutex_lock(&hid_cache_lock);
+    _hs_htable_foreach_hash(cur, &hid_cache, _hs_htable_hash_str(dev->key)) {
+        if (strcmp(((struct hid_cache_entry *)cur)->key, dev->key) == 0) {
+            entry = (struct hid_cache_entry *)cur;
+            break;
+        }
+    }
+    if (entry) {
+        dev->u.hid.usage_page = entry->usage_page;
+        dev->u.hid.usage = entry->usage;
+        dev->u.hid.numbered_reports = entry->numbered_reports;
+    }
+    pthread_mutex_unlock(&hid_cache_lock);
+
+    return entry;
+}
+
+static void clear_hid_cache(void)
+{
+    _hs_htable_foreach(cur, &hid_cache)
+        free(cur);
+    _hs_htable_clear(&hid_cache);
+}
+
+static void release_hid_cache(void)
+{
+    clear_hid_cache();
+    _hs_htable_release(&hid_cache);
+    pthread_mutex_destroy(&hid_cache_lock);
+}
+
+static void add_hid_cache(const hs_device *dev)
+{
+    struct hid_cache_entry *entry;
+
+    entry = (struct hid_cache_entry *)malloc(sizeof(*entry) + strlen(dev->key) + 1);
+    if (!entry)
+        return;
+    entry->usage_page = dev->u.hid.usage_page;
+    entry->usage = dev->u.hid.usage;
+    entry->numbered_reports = dev->u.hid.numbered_reports;
+    strcpy(entry->key, dev->key);
+
+    pthread_mutex_lock(&hid_cache_lock);
+    if (!hid_cache_atexit) {
+        atexit(release_hid_cache);
+        hid_cache_atexit = true;
+    }
+    // Devpaths of old devices are never reused, start over instead of tracking usage
+    if (hid_cache.count >= HID_CACHE_SIZE)
+        clear_hid_cache();
+    if (_hs_htable_add(&hid_cache, _hs_htable_hash_str(entry->key), entry) < 0)
+        free(entry);
+    pthread_mutex_unlock(&hid_cache_lock);
+}
+
+void _hs_linux_fill_hid_properties(hs_device *dev, const char *hid_syspath)
+{
+    uint8_t desc[HID_MAX_DESCRIPTOR_SIZE];
+    size_t desc_size;
+
+    /* The devpath includes the HID device instance number, so the same devpath always
+       refers to the same descriptor (e.g. when the monitor is restarted). */
+    if (find_hid_cache(dev))
+        return;
+
+    // The sysfs report_descriptor file appeared in 2011, somewhere around Linux 2.6.38
+    desc_size = read_hid_descriptor_sysfs(hid_syspath, desc, sizeof(desc));
+    if (!desc_size) {
+        desc_size = read_hid_descriptor_hidraw(dev->path, desc, sizeof(desc));
+        if (!desc_size) {
+            // This will happen pretty often on old kernels, most HID nodes are root-only
+            hs_log(HS_LOG_DEBUG, "Cannot get HID report descriptor from '%s'", dev->path);
+            return;
+        }
+    }
+
+    parse_hid_descriptor(dev, desc, desc_size);
+    add_hid_cache(dev);
+}
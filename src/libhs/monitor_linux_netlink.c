@@ -0,0 +1,638 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libraries
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "device_priv.h"
+#include "match_priv.h"
+#include "monitor_priv.h"
+#include "platform.h"
+
+/* This backend talks to sysfs and to the kernel uevent netlink socket directly, for systems
+   without libudev (static builds, containers, initramfs). Events are received straight from
+   the kernel, before udev (if any) had a chance to process them. Device nodes are created by
+   devtmpfs before the event is sent, but udev rules (permissions, symlinks) may not have been
+   applied yet when the device gets reported. */
+
+// See monitor_linux.c, the kernel drops events that don't fit
+#define MONITOR_RECEIVE_BUFFER_SIZE (4 * 1024 * 1024)
+#define UEVENT_BUFFER_SIZE 8192
+
+struct hs_monitor {
+    _hs_match_helper match_helper;
+    _hs_htable devices;
+
+    int netlink_fd;
+    int wait_fd;
+    // Second socket for hs_monitor_prepare_fork()
+    int fork_fd;
+};
+
+struct device_subsystem {
+    const char *subsystem;
+    hs_device_type type;
+};
+
+struct sysfs_aggregate {
+    char dev[4096];
+    char usb[4096];
+    char iface[4096];
+};
+
+static struct device_subsystem device_subsystems[] = {
+    {"hidraw", HS_DEVICE_TYPE_HID},
+    {"tty",    HS_DEVICE_TYPE_SERIAL},
+    {NULL}
+};
+
+static pthread_mutex_t netlink_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static int common_eventfd = -1;
+
+#ifndef _GNU_SOURCE
+int dup3(int oldfd, int newfd, int flags);
+#endif
+
+static const struct device_subsystem *find_subsystem(const char *subsystem)
+{
+    for (unsigned int i = 0; device_subsystems[i].subsystem; i++) {
+        if (strcmp(device_subsystems[i].subsystem, subsystem) == 0)
+            return &device_subsystems[i];
+    }
+
+    return NULL;
+}
+
+// Returns false if the attribute does not exist or cannot be read, trailing newline is stripped
+static bool read_sysfs_attribute(const char *dir, const char *name, char *buf, size_t size)
+{
+    char path[4096];
+    int fd;
+    ssize_t r;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    r = read(fd, buf, size - 1);
+    close(fd);
+    if (r < 0)
+        return false;
+
+    while (r && (buf[r - 1] == '\n' || buf[r - 1] == '\r'))
+        r--;
+    buf[r] = 0;
+
+    return true;
+}
+
+static bool sysfs_attribute_exists(const char *dir, const char *name)
+{
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return access(path, F_OK) == 0;
+}
+
+static bool find_usb_parents(struct sysfs_aggregate *agg)
+{
+    char path[4096];
+    char *ptr;
+
+    strcpy(path, agg->dev);
+    agg->iface[0] = 0;
+
+    /* Walk up the device hierarchy, the first directory with bInterfaceNumber is the USB
+       interface, and its parent with idVendor is the USB device. */
+    while ((ptr = strrchr(path, '/')) && ptr > path + strlen("/sys/devices")) {
+        *ptr = 0;
+
+        if (!agg->iface[0]) {
+            if (sysfs_attribute_exists(path, "bInterfaceNumber"))
+                strcpy(agg->iface, path);
+        } else if (sysfs_attribute_exists(path, "idVendor")) {
+            strcpy(agg->usb, path);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool read_device_identity(struct sysfs_aggregate *agg, hs_device_type type, hs_device *dev)
+{
+    char buf[32];
+
+    dev->type = type;
+
+    errno = 0;
+    if (!read_sysfs_attribute(agg->usb, "idVendor", buf, sizeof(buf)))
+        return false;
+    dev->vid = (uint16_t)strtoul(buf, NULL, 16);
+    if (errno)
+        return false;
+
+    errno = 0;
+    if (!read_sysfs_attribute(agg->usb, "idProduct", buf, sizeof(buf)))
+        return false;
+    dev->pid = (uint16_t)strtoul(buf, NULL, 16);
+    if (errno)
+        return false;
+
+    errno = 0;
+    if (!read_sysfs_attribute(agg->iface, "bInterfaceNumber", buf, sizeof(buf)))
+        return false;
+    dev->iface_number = (uint8_t)strtoul(buf, NULL, 16);
+    if (errno)
+        return false;
+
+    return true;
+}
+
+static bool read_device_node(const char *syspath, char *buf, size_t size)
+{
+    char uevent[UEVENT_BUFFER_SIZE];
+    const char *name;
+    size_t len;
+
+    if (!read_sysfs_attribute(syspath, "uevent", uevent, sizeof(uevent)))
+        return false;
+
+    name = strstr(uevent, "DEVNAME=");
+    if (!name || (name != uevent && name[-1] != '\n'))
+        return false;
+    name += strlen("DEVNAME=");
+    len = strcspn(name, "\n");
+
+    if (len + strlen("/dev/") + 1 > size)
+        return false;
+    snprintf(buf, size, "/dev/%.*s", (int)len, name);
+
+    return true;
+}
+
+static int read_device_information(const char *path, hs_device_type type,
+                                   const _hs_match_helper *match_helper, hs_device **rdev)
+{
+    struct sysfs_aggregate agg;
+    hs_device identity = {0};
+    struct _hs_linux_device_strings strings;
+    char node[256], busnum[32], usb_devpath[256];
+    char manufacturer[256], product[256], serial[256];
+    hs_device *dev;
+    int r;
+
+    // Class entries are symlinks, and we need the real hierarchy to find the parents
+    if (!realpath(path, agg.dev)) {
+        if (errno == ENOMEM)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+        return 0;
+    }
+    if (strncmp(agg.dev, "/sys/devices/", strlen("/sys/devices/")) != 0 || !strstr(agg.dev, "/usb"))
+        return 0;
+    if (!find_usb_parents(&agg))
+        return 0;
+
+    /* Matching only needs the type and USB identifiers, don't bother with strings and HID
+       descriptors for devices nobody cares about. */
+    if (!read_device_identity(&agg, type, &identity))
+        return 0;
+    if (!_hs_match_helper_match(match_helper, &identity, &identity.match_udata))
+        return 0;
+
+    if (!read_device_node(agg.dev, node, sizeof(node)))
+        return 0;
+
+    strings.key = agg.dev + strlen("/sys");
+    strings.path = node;
+    strings.busnum = read_sysfs_attribute(agg.usb, "busnum", busnum, sizeof(busnum)) ? busnum : NULL;
+    strings.usb_devpath = read_sysfs_attribute(agg.usb, "devpath", usb_devpath, sizeof(usb_devpath)) ? usb_devpath : NULL;
+    strings.manufacturer = read_sysfs_attribute(agg.usb, "manufacturer", manufacturer, sizeof(manufacturer)) ? manufacturer : NULL;
+    strings.product = read_sysfs_attribute(agg.usb, "product", product, sizeof(product)) ? product : NULL;
+    strings.serial = read_sysfs_attribute(agg.usb, "serial", serial, sizeof(serial)) ? serial : NULL;
+
+    r = _hs_linux_create_device(&identity, &strings, &dev);
+    if (r <= 0)
+        return r;
+
+    if (dev->type == HS_DEVICE_TYPE_HID) {
+        char hid_syspath[4096];
+        char *ptr;
+
+        // The hidraw node lives in <hid device>/hidraw/hidrawX
+        strcpy(hid_syspath, agg.dev);
+        for (unsigned int i = 0; i < 2 && (ptr = strrchr(hid_syspath, '/')); i++)
+            *ptr = 0;
+        _hs_linux_fill_hid_properties(dev, hid_syspath);
+    }
+
+    *rdev = dev;
+    return 1;
+}
+
+static void release_netlink(void)
+{
+    close(common_eventfd);
+    pthread_mutex_destroy(&netlink_init_lock);
+}
+
+static int init_netlink(void)
+{
+    static bool atexit_called;
+    int r;
+
+    // fast path
+    if (common_eventfd >= 0)
+        return 0;
+
+    pthread_mutex_lock(&netlink_init_lock);
+
+    if (!atexit_called) {
+        atexit(release_netlink);
+        atexit_called = true;
+    }
+
+    if (common_eventfd < 0) {
+        /* We use this as a never-ready placeholder descriptor for all newly created monitors,
+           until hs_monitor_start() creates the netlink socket. */
+        common_eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (common_eventfd < 0) {
+            r = hs_error(HS_ERROR_SYSTEM, "eventfd() failed: %s", strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    r = 0;
+cleanup:
+    pthread_mutex_unlock(&netlink_init_lock);
+    return r;
+}
+
+static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void *udata)
+{
+    DIR *dp = NULL;
+    int r;
+
+    for (unsigned int i = 0; device_subsystems[i].subsystem; i++) {
+        char class_path[256];
+        struct dirent *ent;
+
+        if (!_hs_match_helper_has_type(match_helper, device_subsystems[i].type))
+            continue;
+
+        snprintf(class_path, sizeof(class_path), "/sys/class/%s", device_subsystems[i].subsystem);
+        dp = opendir(class_path);
+        if (!dp) {
+            // The class directory does not exist until the first device of this type shows up
+            if (errno == ENOENT)
+                continue;
+            r = hs_error(HS_ERROR_SYSTEM, "opendir('%s') failed: %s", class_path, strerror(errno));
+            goto cleanup;
+        }
+
+        while ((ent = readdir(dp))) {
+            char path[512];
+            hs_device *dev;
+
+            if (ent->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", class_path, ent->d_name);
+
+            r = read_device_information(path, device_subsystems[i].type, match_helper, &dev);
+            if (r < 0)
+                goto cleanup;
+            if (!r)
+                continue;
+
+            r = (*f)(dev, udata);
+            hs_device_unref(dev);
+            if (r)
+                goto cleanup;
+        }
+
+        closedir(dp);
+        dp = NULL;
+    }
+
+    r = 0;
+cleanup:
+    if (dp)
+        closedir(dp);
+    return r;
+}
+
+struct enumerate_enumerate_context {
+    hs_enumerate_func *f;
+    void *udata;
+};
+
+static int enumerate_enumerate_callback(hs_device *dev, void *udata)
+{
+    struct enumerate_enumerate_context *ctx = (struct enumerate_enumerate_context *)udata;
+
+    _hs_device_log(dev, "Enumerate");
+    return (*ctx->f)(dev, ctx->udata);
+}
+
+int hs_enumerate(const hs_match_spec *matches, unsigned int count, hs_enumerate_func *f,
+                 void *udata)
+{
+    assert(f);
+
+    _hs_match_helper match_helper = {0};
+    struct enumerate_enumerate_context ctx;
+    int r;
+
+    r = _hs_match_helper_init(&match_helper, matches, count);
+    if (r < 0)
+        return r;
+
+    ctx.f = f;
+    ctx.udata = udata;
+
+    r = enumerate(&match_helper, enumerate_enumerate_callback, &ctx);
+
+    _hs_match_helper_release(&match_helper);
+    return r;
+}
+
+int hs_monitor_new(const hs_match_spec *matches, unsigned int count, hs_monitor **rmonitor)
+{
+    assert(rmonitor);
+
+    hs_monitor *monitor;
+    int r;
+
+    monitor = (hs_monitor *)calloc(1, sizeof(*monitor));
+    if (!monitor) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    monitor->netlink_fd = -1;
+    monitor->wait_fd = -1;
+    monitor->fork_fd = -1;
+
+    r = _hs_match_helper_init(&monitor->match_helper, matches, count);
+    if (r < 0)
+        goto error;
+
+    r = init_netlink();
+    if (r < 0)
+        goto error;
+
+    monitor->wait_fd = fcntl(common_eventfd, F_DUPFD_CLOEXEC, 0);
+    if (monitor->wait_fd < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "fcntl(F_DUPFD_CLOEXEC) failed: %s", strerror(errno));
+        goto error;
+    }
+
+    *rmonitor = monitor;
+    return 0;
+
+error:
+    hs_monitor_free(monitor);
+    return r;
+}
+
+void hs_monitor_free(hs_monitor *monitor)
+{
+    if (monitor) {
+        close(monitor->wait_fd);
+        close(monitor->netlink_fd);
+        close(monitor->fork_fd);
+
+        _hs_monitor_clear_devices(&monitor->devices);
+        _hs_htable_release(&monitor->devices);
+        _hs_match_helper_release(&monitor->match_helper);
+    }
+
+    free(monitor);
+}
+
+static int monitor_enumerate_callback(hs_device *dev, void *udata)
+{
+    hs_monitor *monitor = (hs_monitor *)udata;
+    return _hs_monitor_add(&monitor->devices, dev, NULL, NULL);
+}
+
+static int open_netlink_socket(int *rfd)
+{
+    struct sockaddr_nl addr = {0};
+    int fd, size;
+    int r;
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return hs_error(HS_ERROR_SYSTEM, "socket(AF_NETLINK) failed: %s", strerror(errno));
+
+    /* SO_RCVBUFFORCE needs privileges to go beyond rmem_max, fall back to SO_RCVBUF and
+       don't fail if neither works. */
+    size = MONITOR_RECEIVE_BUFFER_SIZE;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+        hs_log(HS_LOG_DEBUG, "Failed to enlarge netlink monitor buffer: %s", strerror(errno));
+
+    // Group 1 receives the raw kernel events
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "bind(AF_NETLINK) failed: %s", strerror(errno));
+        close(fd);
+        return r;
+    }
+
+    *rfd = fd;
+    return 0;
+}
+
+int hs_monitor_start(hs_monitor *monitor)
+{
+    assert(monitor);
+
+    int r;
+
+    if (monitor->netlink_fd >= 0)
+        return 0;
+
+    r = open_netlink_socket(&monitor->netlink_fd);
+    if (r < 0)
+        goto error;
+
+    r = enumerate(&monitor->match_helper, monitor_enumerate_callback, monitor);
+    if (r < 0)
+        goto error;
+
+    // See monitor_linux.c, nothing can reasonably make this fail
+    dup3(monitor->netlink_fd, monitor->wait_fd, O_CLOEXEC);
+
+    return 0;
+
+error:
+    hs_monitor_stop(monitor);
+    return r;
+}
+
+void hs_monitor_stop(hs_monitor *monitor)
+{
+    assert(monitor);
+
+    if (monitor->netlink_fd < 0)
+        return;
+
+    _hs_monitor_clear_devices(&monitor->devices);
+
+    dup3(common_eventfd, monitor->wait_fd, O_CLOEXEC);
+    close(monitor->netlink_fd);
+    monitor->netlink_fd = -1;
+    close(monitor->fork_fd);
+    monitor->fork_fd = -1;
+}
+
+int hs_monitor_prepare_fork(hs_monitor *monitor)
+{
+    assert(monitor);
+
+    if (monitor->netlink_fd < 0 || monitor->fork_fd >= 0)
+        return 0;
+
+    return open_netlink_socket(&monitor->fork_fd);
+}
+
+void hs_monitor_finish_fork(hs_monitor *monitor, bool child)
+{
+    assert(monitor);
+
+    if (monitor->fork_fd < 0)
+        return;
+
+    if (child) {
+        close(monitor->fork_fd);
+    } else {
+        close(monitor->netlink_fd);
+        monitor->netlink_fd = monitor->fork_fd;
+        dup3(monitor->netlink_fd, monitor->wait_fd, O_CLOEXEC);
+    }
+    monitor->fork_fd = -1;
+}
+
+hs_handle hs_monitor_get_poll_handle(const hs_monitor *monitor)
+{
+    assert(monitor);
+    return monitor->wait_fd;
+}
+
+static int process_uevent(hs_monitor *monitor, char *buf, size_t len, uint64_t event_time,
+                          hs_enumerate_func *f, void *udata)
+{
+    const char *action = NULL, *devpath = NULL, *subsystem = NULL;
+    const struct device_subsystem *device_subsystem;
+    int r;
+
+    // The header is "action@devpath", followed by KEY=VALUE properties, all NUL-terminated
+    for (size_t offset = strlen(buf) + 1; offset < len; offset += strlen(buf + offset) + 1) {
+        const char *property = buf + offset;
+
+        if (strncmp(property, "ACTION=", 7) == 0) {
+            action = property + 7;
+        } else if (strncmp(property, "DEVPATH=", 8) == 0) {
+            devpath = property + 8;
+        } else if (strncmp(property, "SUBSYSTEM=", 10) == 0) {
+            subsystem = property + 10;
+        }
+    }
+    if (!action || !devpath || !subsystem)
+        return 0;
+
+    device_subsystem = find_subsystem(subsystem);
+    if (!device_subsystem ||
+            !_hs_match_helper_has_type(&monitor->match_helper, device_subsystem->type))
+        return 0;
+
+    r = 0;
+    if (strcmp(action, "add") == 0) {
+        char syspath[4096];
+        hs_device *dev = NULL;
+
+        snprintf(syspath, sizeof(syspath), "/sys%s", devpath);
+
+        r = read_device_information(syspath, device_subsystem->type, &monitor->match_helper, &dev);
+        if (r > 0) {
+            dev->event_time = event_time;
+            r = _hs_monitor_add(&monitor->devices, dev, f, udata);
+        }
+
+        hs_device_unref(dev);
+    } else if (strcmp(action, "remove") == 0) {
+        _hs_monitor_remove(&monitor->devices, devpath, event_time, f, udata);
+    }
+
+    return r;
+}
+
+int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
+{
+    assert(monitor);
+
+    char buf[UEVENT_BUFFER_SIZE];
+    int r;
+
+    if (monitor->netlink_fd < 0)
+        return 0;
+
+    for (;;) {
+        struct sockaddr_nl addr;
+        struct iovec iov = {buf, sizeof(buf) - 1};
+        struct msghdr msg = {0};
+        ssize_t len;
+        uint64_t event_time;
+
+        msg.msg_name = &addr;
+        msg.msg_namelen = sizeof(addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        len = recvmsg(monitor->netlink_fd, &msg, 0);
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS) {
+                hs_log(HS_LOG_WARNING, "Device events were lost because the netlink monitor buffer is full");
+                continue;
+            }
+            return hs_error(HS_ERROR_SYSTEM, "recvmsg() failed on netlink socket: %s", strerror(errno));
+        }
+        buf[len] = 0;
+        // Reading sysfs takes a while, stamp the event before we do
+        event_time = hs_micros();
+
+        // Only trust messages sent by the kernel
+        if (addr.nl_pid || (msg.msg_flags & MSG_TRUNC))
+            continue;
+
+        r = process_uevent(monitor, buf, (size_t)len, event_time, f, udata);
+        if (r)
+            return r;
+    }
+
+    return 0;
+}
+
+int hs_monitor_list(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
+{
+    return _hs_monitor_list(&monitor->devices, f, udata);
+}
@@ -22,8 +22,25 @@ void _hs_monitor_clear_devices(_hs_htable *devices);
 bool _hs_monitor_has_device(_hs_htable *devices, const char *key, uint8_t iface);
 
 int _hs_monitor_add(_hs_htable *devices, struct hs_device *dev, hs_enumerate_func *f, void *udata);
-void _hs_monitor_remove(_hs_htable *devices, const char *key, hs_enumerate_func *f, void *udata);
+void _hs_monitor_remove(_hs_htable *devices, const char *key, uint64_t event_time,
+                        hs_enumerate_func *f, void *udata);
 
 int _hs_monitor_list(_hs_htable *devices, hs_enumerate_func *f, void *udata);
 
+#ifdef __linux__
+struct _hs_linux_device_strings {
+    const char *key;
+    const char *path;
+    const char *busnum;
+    const char *usb_devpath;
+    const char *manufacturer;
+    const char *product;
+    const char *serial;
+};
+
+int _hs_linux_create_device(const struct hs_device *identity,
+                            const struct _hs_linux_device_strings *strings, struct hs_device **rdev);
+void _hs_linux_fill_hid_properties(struct hs_device *dev, const char *hid_syspath);
+#endif
+
 #endif
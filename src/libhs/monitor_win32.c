@@ -1341,10 +1341,6 @@ int hs_monitor_new(const hs_match_spec *matches, unsigned int count, hs_monitor
     if (r < 0)
         goto error;
 
-    r = _hs_htable_init(&monitor->devices, 64);
-    if (r < 0)
-        goto error;
-
     InitializeCriticalSection(&monitor->events_lock);
     monitor->thread_event = CreateEvent(NULL, TRUE, FALSE, NULL);
     if (!monitor->thread_event) {
@@ -1441,6 +1437,18 @@ void hs_monitor_stop(hs_monitor *monitor)
     _hs_array_release(&monitor->refresh_events);
 }
 
+int hs_monitor_prepare_fork(hs_monitor *monitor)
+{
+    assert(monitor);
+    return hs_error(HS_ERROR_SYSTEM, "Device monitors cannot be shared with child processes");
+}
+
+void hs_monitor_finish_fork(hs_monitor *monitor, bool child)
+{
+    assert(monitor);
+    _HS_UNUSED(child);
+}
+
 static int process_arrival_event(hs_monitor *monitor, const char *key, hs_enumerate_func *f,
                                  void *udata)
 {
@@ -1506,7 +1514,7 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
             case DEVICE_EVENT_REMOVED: {
                 hs_log(HS_LOG_DEBUG, "Received removal notification for device '%s'",
                        event->device_key);
-                _hs_monitor_remove(&monitor->devices, event->device_key, f, udata);
+                _hs_monitor_remove(&monitor->devices, event->device_key, 0, f, udata);
             } break;
         }
     }
@@ -78,6 +78,16 @@ typedef struct hs_poll_source {
  * @return This function returns a mononotic time value in milliseconds.
  */
 uint64_t hs_millis(void);
+/**
+ * @ingroup misc
+ * @brief Get time from a finer monotonic clock, in microseconds.
+ *
+ * This clock is meant for short latency measurements, such as the timestamps of device
+ * notifications. Its origin is unrelated to hs_millis().
+ *
+ * @return This function returns a monotonic time value in microseconds.
+ */
+uint64_t hs_micros(void);
 
 /**
  * @ingroup misc
@@ -23,6 +23,15 @@ uint64_t hs_millis(void)
     return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000000;
 }
 
+uint64_t hs_micros(void)
+{
+    static mach_timebase_info_data_t tb;
+    if (!tb.numer)
+        mach_timebase_info(&tb);
+
+    return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000;
+}
+
 int hs_poll(hs_poll_source *sources, unsigned int count, int timeout)
 {
     assert(sources);
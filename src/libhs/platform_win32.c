@@ -52,6 +52,19 @@ uint64_t hs_millis(void)
     return GetTickCount64_();
 }
 
+uint64_t hs_micros(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+
+    return (uint64_t)(now.QuadPart / freq.QuadPart * 1000000 +
+                      now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+}
+
 int hs_poll(hs_poll_source *sources, unsigned int count, int timeout)
 {
     assert(sources);
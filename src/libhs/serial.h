@@ -137,6 +137,29 @@ typedef enum hs_serial_config_xonxoff {
     HS_SERIAL_CONFIG_XONXOFF_INOUT
 } hs_serial_config_xonxoff;
 
+/**
+ * @ingroup serial
+ * @brief Supported serial latency modes.
+ *
+ * Low-latency modes trade CPU time and throughput for faster round-trips, which matters
+ * for request/response protocols more than for bulk transfers.
+ *
+ * @sa hs_serial_config
+ */
+typedef enum hs_serial_config_latency {
+    /** Leave this setting unchanged. */
+    HS_SERIAL_CONFIG_LATENCY_INVALID = 0,
+
+    /** Default driver latency and blocking reads. */
+    HS_SERIAL_CONFIG_LATENCY_NORMAL,
+    /** Request low driver latency (ASYNC_LOW_LATENCY on Linux, when supported), and try
+        to read available data before waiting for it. */
+    HS_SERIAL_CONFIG_LATENCY_LOW,
+    /** Same as HS_SERIAL_CONFIG_LATENCY_LOW, but spin on non-blocking reads for a short
+        while before falling back to a blocking wait. This burns CPU time. */
+    HS_SERIAL_CONFIG_LATENCY_BUSY_POLL
+} hs_serial_config_latency;
+
 /**
  * @ingroup serial
  * @brief Serial device configuration.
@@ -164,6 +187,9 @@ typedef struct hs_serial_config {
     hs_serial_config_dtr dtr;
     /** Serial XON/XOFF (software) flow control. */
     hs_serial_config_xonxoff xonxoff;
+
+    /** Latency mode, this is a property of the open port and not of the device. */
+    hs_serial_config_latency latency;
 } hs_serial_config;
 
 /**
@@ -241,6 +267,80 @@ ssize_t hs_serial_read(hs_port *port, uint8_t *buf, size_t size, int timeout);
  */
 ssize_t hs_serial_write(hs_port *port, const uint8_t *buf, size_t size, int timeout);
 
+/**
+ * @ingroup serial
+ * @brief Function called when a queued buffer is no longer needed.
+ *
+ * @param udata Pointer to user-defined arbitrary data passed to hs_serial_queue().
+ *
+ * @sa hs_serial_queue()
+ */
+typedef void hs_serial_release_func(void *udata);
+
+/**
+ * @ingroup serial
+ * @brief Queue a buffer for transmission to a serial device.
+ *
+ * The buffer is not copied: it must stay valid until libhs calls @p f, which happens once
+ * it has been completely written by hs_serial_flush(), or when the port is closed. Pass
+ * NULL for @p f if you manage the buffer lifetime yourself.
+ *
+ * Nothing is written until you call hs_serial_flush(). This function never blocks, the
+ * return value tells you how many bytes are waiting in the queue so that you can stop
+ * queuing and flush when it grows too large (backpressure).
+ *
+ * @param port  Open serial device handle.
+ * @param buf   Data buffer.
+ * @param size  Size of the buffer.
+ * @param f     Release function, or NULL.
+ * @param udata Pointer to user-defined arbitrary data for the release function.
+ * @return This function returns the number of bytes queued (including this buffer), or a
+ *     negative @ref hs_error_code value. On error, @p f is not called.
+ *
+ * @sa hs_serial_flush()
+ */
+ssize_t hs_serial_queue(hs_port *port, const uint8_t *buf, size_t size,
+                        hs_serial_release_func *f, void *udata);
+/**
+ * @ingroup serial
+ * @brief Write queued buffers to a serial device.
+ *
+ * Wait for up to @p timeout milliseconds for the device to become writable, and then write
+ * as much queued data as the device accepts without blocking (with a single gather-write
+ * call where supported). Use a timeout of 0 to flush without waiting, for example when
+ * the port descriptor is reported as writable by your event loop.
+ *
+ * @param port    Open serial device handle.
+ * @param timeout Timeout in milliseconds, or -1 to block indefinitely.
+ * @return This function returns the number of bytes written, 0 if the timeout expired or
+ *     if the queue is empty, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_serial_queue()
+ */
+ssize_t hs_serial_flush(hs_port *port, int timeout);
+/**
+ * @ingroup serial
+ * @brief Get the number of bytes waiting in the transmit queue.
+ *
+ * @param port Open serial device handle.
+ * @return This function returns the number of bytes queued and not yet written.
+ */
+size_t hs_serial_get_queued(const hs_port *port);
+/**
+ * @ingroup serial
+ * @brief Drop the buffers waiting in the transmit queue.
+ *
+ * The release function of each queued buffer is called, including the one that may have
+ * been partially written. Call this before you free buffers queued without a release
+ * function if you stop flushing early (e.g. on error), the port keeps pointers to them
+ * otherwise.
+ *
+ * @param port Open serial device handle.
+ *
+ * @sa hs_serial_queue()
+ */
+void hs_serial_discard(hs_port *port);
+
 HS_END_C
 
 #endif
@@ -0,0 +1,101 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libraries
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "array.h"
+#include "device_priv.h"
+#include "serial.h"
+
+ssize_t hs_serial_queue(hs_port *port, const uint8_t *buf, size_t size,
+                        hs_serial_release_func *f, void *udata)
+{
+    assert(port);
+    assert(port->type == HS_DEVICE_TYPE_SERIAL);
+    assert(port->mode & HS_PORT_MODE_WRITE);
+    assert(buf || !size);
+
+    struct _hs_serial_chunk chunk;
+    int r;
+
+    /* Reclaim the space used by written chunks before growing the array, the queue
+       is usually drained faster than it is filled so this rarely moves much. */
+    if (port->tx_head && port->tx_chunks.count == port->tx_chunks.allocated) {
+        _hs_array_remove(&port->tx_chunks, 0, port->tx_head);
+        port->tx_head = 0;
+    }
+
+    chunk.buf = buf;
+    chunk.size = size;
+    chunk.release = f;
+    chunk.release_udata = udata;
+
+    r = _hs_array_push(&port->tx_chunks, chunk);
+    if (r < 0)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    port->tx_queued += size;
+
+    return (ssize_t)port->tx_queued;
+}
+
+size_t hs_serial_get_queued(const hs_port *port)
+{
+    assert(port);
+    return port->tx_queued;
+}
+
+void _hs_serial_consume_queue(hs_port *port, size_t written)
+{
+    assert(written <= port->tx_queued);
+
+    port->tx_queued -= written;
+    written += port->tx_offset;
+
+    while (port->tx_head < port->tx_chunks.count) {
+        struct _hs_serial_chunk *chunk = &port->tx_chunks.values[port->tx_head];
+
+        if (written < chunk->size)
+            break;
+        written -= chunk->size;
+
+        if (chunk->release)
+            (*chunk->release)(chunk->release_udata);
+        port->tx_head++;
+    }
+    port->tx_offset = written;
+
+    /* Keep the allocation around, ports tend to be flushed and refilled in a loop. */
+    if (port->tx_head == port->tx_chunks.count) {
+        port->tx_chunks.count = 0;
+        port->tx_head = 0;
+    }
+}
+
+void hs_serial_discard(hs_port *port)
+{
+    assert(port);
+    assert(port->type == HS_DEVICE_TYPE_SERIAL);
+
+    _hs_serial_clear_queue(port);
+}
+
+void _hs_serial_clear_queue(hs_port *port)
+{
+    for (size_t i = port->tx_head; i < port->tx_chunks.count; i++) {
+        struct _hs_serial_chunk *chunk = &port->tx_chunks.values[i];
+
+        if (chunk->release)
+            (*chunk->release)(chunk->release_udata);
+    }
+    _hs_array_release(&port->tx_chunks);
+
+    port->tx_head = 0;
+    port->tx_offset = 0;
+    port->tx_queued = 0;
+}
@@ -9,31 +9,95 @@
    See the LICENSE file for more details. */
 
 #include "common_priv.h"
+#ifdef __linux__
+    #include <linux/serial.h>
+#endif
 #include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
 #include "device_priv.h"
 #include "platform.h"
 #include "serial.h"
 
+/* Maximum number of queued chunks written by a single writev() call */
+#define MAX_FLUSH_CHUNKS 64
+/* Maximum time spent spinning on non-blocking reads in HS_SERIAL_CONFIG_LATENCY_BUSY_POLL mode */
+#define BUSY_POLL_DURATION 2
+
+static int get_modem_bits(hs_port *port, int *rbits)
+{
+    int r;
+
+    r = ioctl(port->u.file.fd, TIOCMGET, rbits);
+    if (r < 0) {
+        /* Virtual serial ports (such as pseudo-terminals) have no modem lines, don't
+           treat that as an error. */
+        if (errno == ENOTTY || errno == EINVAL)
+            return 0;
+
+        return hs_error(HS_ERROR_SYSTEM, "Unable to get modem bits from '%s': %s",
+                        port->path, strerror(errno));
+    }
+
+    return 1;
+}
+
+static int change_driver_latency(hs_port *port, bool low_latency)
+{
+#ifdef __linux__
+    struct serial_struct ss;
+    int r;
+
+    r = ioctl(port->u.file.fd, TIOCGSERIAL, &ss);
+    if (r < 0)
+        goto unsupported;
+
+    if (low_latency) {
+        ss.flags |= (int)ASYNC_LOW_LATENCY;
+    } else {
+        ss.flags &= ~(int)ASYNC_LOW_LATENCY;
+    }
+
+    r = ioctl(port->u.file.fd, TIOCSSERIAL, &ss);
+    if (r < 0)
+        goto unsupported;
+
+    return 0;
+
+unsupported:
+    /* Many drivers (USB CDC ACM, pseudo-terminals) ignore or refuse this flag, the
+       user-space part of the latency mode still works so don't fail. */
+    if (errno != ENOTTY && errno != EINVAL && errno != EPERM && errno != EOPNOTSUPP)
+        return hs_error(HS_ERROR_SYSTEM, "Unable to change driver latency of '%s': %s",
+                        port->path, strerror(errno));
+    hs_log(HS_LOG_DEBUG, "Driver latency setting is not supported by '%s'", port->path);
+    return 0;
+#else
+    _HS_UNUSED(port);
+    _HS_UNUSED(low_latency);
+    return 0;
+#endif
+}
+
 int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
 {
     assert(port);
     assert(config);
 
     struct termios tio;
-    int modem_bits;
+    int modem_bits = 0;
+    int has_modem_bits;
     int r;
 
     r = tcgetattr(port->u.file.fd, &tio);
     if (r < 0)
         return hs_error(HS_ERROR_SYSTEM, "Unable to get serial port settings from '%s': %s",
                         port->path, strerror(errno));
-    r = ioctl(port->u.file.fd, TIOCMGET, &modem_bits);
-    if (r < 0)
-        return hs_error(HS_ERROR_SYSTEM, "Unable to get modem bits from '%s': %s",
-                        port->path, strerror(errno));
+    has_modem_bits = get_modem_bits(port, &modem_bits);
+    if (has_modem_bits < 0)
+        return has_modem_bits;
 
     if (config->baudrate) {
         speed_t std_baudrate;
@@ -162,15 +226,35 @@ int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
         }
     }
 
-    r = ioctl(port->u.file.fd, TIOCMSET, &modem_bits);
-    if (r < 0)
-        return hs_error(HS_ERROR_SYSTEM, "Unable to set modem bits of '%s': %s",
-                        port->path, strerror(errno));
+    switch (config->latency) {
+        case 0:
+        case HS_SERIAL_CONFIG_LATENCY_NORMAL:
+        case HS_SERIAL_CONFIG_LATENCY_LOW:
+        case HS_SERIAL_CONFIG_LATENCY_BUSY_POLL: {} break;
+
+        default: {
+            return hs_error(HS_ERROR_SYSTEM, "Invalid latency setting: %d", config->latency);
+        } break;
+    }
+
+    if (has_modem_bits) {
+        r = ioctl(port->u.file.fd, TIOCMSET, &modem_bits);
+        if (r < 0)
+            return hs_error(HS_ERROR_SYSTEM, "Unable to set modem bits of '%s': %s",
+                            port->path, strerror(errno));
+    }
     r = tcsetattr(port->u.file.fd, TCSANOW, &tio);
     if (r < 0)
         return hs_error(HS_ERROR_SYSTEM, "Unable to change serial port settings of '%s': %s",
                         port->path, strerror(errno));
 
+    if (config->latency) {
+        r = change_driver_latency(port, config->latency != HS_SERIAL_CONFIG_LATENCY_NORMAL);
+        if (r < 0)
+            return r;
+        port->serial_latency = config->latency;
+    }
+
     return 0;
 }
 
@@ -179,17 +263,17 @@ int hs_serial_get_config(hs_port *port, hs_serial_config *config)
     assert(port);
 
     struct termios tio;
-    int modem_bits;
+    int modem_bits = 0;
+    int has_modem_bits;
     int r;
 
     r = tcgetattr(port->u.file.fd, &tio);
     if (r < 0)
         return hs_error(HS_ERROR_SYSTEM, "Unable to read port settings from '%s': %s",
                         port->path, strerror(errno));
-    r = ioctl(port->u.file.fd, TIOCMGET, &modem_bits);
-    if (r < 0)
-        return hs_error(HS_ERROR_SYSTEM, "Unable to get modem bits from '%s': %s",
-                        port->path, strerror(errno));
+    has_modem_bits = get_modem_bits(port, &modem_bits);
+    if (has_modem_bits < 0)
+        return has_modem_bits;
 
     /* 0 is the INVALID value for all parameters, we keep that value if we can't interpret
        a termios value (only a cross-platform subset of it is exposed in hs_serial_config). */
@@ -247,16 +331,20 @@ int hs_serial_get_config(hs_port *port, hs_serial_config *config)
 
     if (tio.c_cflag & CRTSCTS) {
         config->rts = HS_SERIAL_CONFIG_RTS_FLOW;
-    } else if (modem_bits & TIOCM_RTS) {
-        config->rts = HS_SERIAL_CONFIG_RTS_ON;
-    } else {
-        config->rts = HS_SERIAL_CONFIG_RTS_OFF;
+    } else if (has_modem_bits) {
+        if (modem_bits & TIOCM_RTS) {
+            config->rts = HS_SERIAL_CONFIG_RTS_ON;
+        } else {
+            config->rts = HS_SERIAL_CONFIG_RTS_OFF;
+        }
     }
 
-    if (modem_bits & TIOCM_DTR) {
-        config->dtr = HS_SERIAL_CONFIG_DTR_ON;
-    } else {
-        config->dtr = HS_SERIAL_CONFIG_DTR_OFF;
+    if (has_modem_bits) {
+        if (modem_bits & TIOCM_DTR) {
+            config->dtr = HS_SERIAL_CONFIG_DTR_ON;
+        } else {
+            config->dtr = HS_SERIAL_CONFIG_DTR_OFF;
+        }
     }
 
     switch (tio.c_iflag & (IXON | IXOFF)) {
@@ -266,6 +354,8 @@ int hs_serial_get_config(hs_port *port, hs_serial_config *config)
         case IXOFF | IXON: { config->xonxoff = HS_SERIAL_CONFIG_XONXOFF_INOUT; } break;
     }
 
+    config->latency = port->serial_latency;
+
     return 0;
 }
 
@@ -277,16 +367,32 @@ ssize_t hs_serial_read(hs_port *port, uint8_t *buf, size_t size, int timeout)
     assert(buf);
     assert(size);
 
+    uint64_t start;
     ssize_t r;
 
+    start = hs_millis();
+
+    /* In low-latency modes, the data we wait for is often already there (request/response
+       protocols) so try to read it right away and skip the poll() round-trip. */
+    if (timeout && port->serial_latency >= HS_SERIAL_CONFIG_LATENCY_LOW) {
+        do {
+            r = read(port->u.file.fd, buf, size);
+            if (r > 0)
+                return r;
+            if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return hs_error(HS_ERROR_IO, "I/O error while reading from '%s': %s",
+                                port->path, strerror(errno));
+        } while (port->serial_latency == HS_SERIAL_CONFIG_LATENCY_BUSY_POLL &&
+                 hs_millis() - start < BUSY_POLL_DURATION &&
+                 (timeout < 0 || hs_millis() - start < (uint64_t)timeout));
+    }
+
     if (timeout) {
         struct pollfd pfd;
-        uint64_t start;
 
         pfd.events = POLLIN;
         pfd.fd = port->u.file.fd;
 
-        start = hs_millis();
 restart:
         r = poll(&pfd, 1, hs_adjust_timeout(timeout, start));
         if (r < 0) {
@@ -360,3 +466,62 @@ ssize_t hs_serial_write(hs_port *port, const uint8_t *buf, size_t size, int time
 
     return (ssize_t)written;
 }
+
+ssize_t hs_serial_flush(hs_port *port, int timeout)
+{
+    assert(port);
+    assert(port->type == HS_DEVICE_TYPE_SERIAL);
+    assert(port->mode & HS_PORT_MODE_WRITE);
+
+    struct iovec iov[MAX_FLUSH_CHUNKS];
+    int iov_count;
+    struct pollfd pfd;
+    uint64_t start;
+    ssize_t r;
+
+    if (!port->tx_queued)
+        return 0;
+
+    iov_count = 0;
+    for (size_t i = port->tx_head; i < port->tx_chunks.count && iov_count < MAX_FLUSH_CHUNKS; i++) {
+        const struct _hs_serial_chunk *chunk = &port->tx_chunks.values[i];
+        size_t offset = (i == port->tx_head) ? port->tx_offset : 0;
+
+        if (chunk->size == offset)
+            continue;
+
+        iov[iov_count].iov_base = (void *)(chunk->buf + offset);
+        iov[iov_count].iov_len = chunk->size - offset;
+        iov_count++;
+    }
+
+    pfd.events = POLLOUT;
+    pfd.fd = port->u.file.fd;
+
+    start = hs_millis();
+restart:
+    r = poll(&pfd, 1, hs_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s': %s", port->path,
+                        strerror(errno));
+    }
+    if (!r)
+        return 0;
+
+    r = writev(port->u.file.fd, iov, iov_count);
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s': %s", port->path,
+                        strerror(errno));
+    }
+
+    _hs_serial_consume_queue(port, (size_t)r);
+    return r;
+}
@@ -174,11 +174,27 @@ int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
         } break;
     }
 
+    /* Reads are overlapped and complete as soon as data arrives, there is no driver latency
+       knob comparable to ASYNC_LOW_LATENCY so we only remember the setting. */
+    switch (config->latency) {
+        case 0:
+        case HS_SERIAL_CONFIG_LATENCY_NORMAL:
+        case HS_SERIAL_CONFIG_LATENCY_LOW:
+        case HS_SERIAL_CONFIG_LATENCY_BUSY_POLL: {} break;
+
+        default: {
+            return hs_error(HS_ERROR_SYSTEM, "Invalid latency setting: %d", config->latency);
+        } break;
+    }
+
     success = SetCommState(port->u.handle.h, &dcb);
     if (!success)
         return hs_error(HS_ERROR_SYSTEM, "SetCommState() failed on '%s': %s",
                         port->dev->path, hs_win32_strerror(0));
 
+    if (config->latency)
+        port->serial_latency = config->latency;
+
     return 0;
 }
 
@@ -242,6 +258,8 @@ int hs_serial_get_config(hs_port *port, hs_serial_config *config)
         config->xonxoff = HS_SERIAL_CONFIG_XONXOFF_OFF;
     }
 
+    config->latency = port->serial_latency;
+
     return 0;
 }
 
@@ -299,3 +317,32 @@ ssize_t hs_serial_write(hs_port *port, const uint8_t *buf, size_t size, int time
 
     return _hs_win32_write_sync(port, buf, size, timeout);
 }
+
+ssize_t hs_serial_flush(hs_port *port, int timeout)
+{
+    assert(port);
+    assert(port->type == HS_DEVICE_TYPE_SERIAL);
+    assert(port->mode & HS_PORT_MODE_WRITE);
+
+    const struct _hs_serial_chunk *chunk;
+    ssize_t r;
+
+    if (!port->tx_queued)
+        return 0;
+
+    /* There is no gather-write for communication devices on Windows, write the first chunk
+       and let the caller call us again for the next one. */
+    chunk = &port->tx_chunks.values[port->tx_head];
+    while (chunk->size == port->tx_offset) {
+        _hs_serial_consume_queue(port, 0);
+        chunk = &port->tx_chunks.values[port->tx_head];
+    }
+
+    r = _hs_win32_write_sync(port, chunk->buf + port->tx_offset, chunk->size - port->tx_offset,
+                             timeout);
+    if (r <= 0)
+        return r;
+
+    _hs_serial_consume_queue(port, (size_t)r);
+    return r;
+}
@@ -10,9 +10,11 @@
 
 #include "common_priv.h"
 #ifndef _WIN32
+    #include <sys/mman.h>
     #include <sys/stat.h>
 #endif
 #include "../libhs/device.h"
+#include "../libhs/serial.h"
 #include "board_priv.h"
 #include "class_priv.h"
 #include "firmware.h"
@@ -20,6 +22,27 @@
 #include "system.h"
 #include "task.h"
 #include "timer.h"
+#include "trace.h"
+#include "xfer.h"
+
+// Amount of data read from the file at a time when it cannot be mapped in memory
+#define SEND_FILE_BUFFER_SIZE 65536
+// Block size for HID serial emulation, the class code splits it further into reports
+#define SEND_HID_BLOCK_SIZE 1024
+// Minimum delay between two progress updates while sending data
+#define SEND_PROGRESS_INTERVAL 100
+// Maximum amount of data buffered for an attached interface, excess data is dropped
+#define ATTACH_BUFFER_SIZE 65536
+// Read timeout of the attach thread, bounds the time needed to stop it
+#define ATTACH_READ_TIMEOUT 50
+
+struct send_context {
+    ty_board_interface *iface;
+
+    uint64_t written;
+    uint64_t size;
+    uint64_t progress_time;
+};
 
 static const char *capability_names[] = {
     "unique",
@@ -65,6 +88,9 @@ void ty_board_unref(ty_board *board)
         free(board->description);
 
         ty_mutex_release(&board->ifaces_lock);
+        ty_mutex_release(&board->tasks_lock);
+        _hs_array_release(&board->pending_tasks);
+        ty_cond_release(&board->wait_cond);
 
         for (size_t i = 0; i < board->ifaces.count; i++) {
             ty_board_interface *iface = board->ifaces.values[i];
@@ -76,12 +102,7 @@ void ty_board_unref(ty_board *board)
     free(board);
 }
 
-struct board_id_part {
-    const char *ptr;
-    size_t len;
-};
-
-static void parse_board_id(const char *id, const char *delimiters, struct board_id_part parts[])
+static void parse_board_id(const char *id, const char *delimiters, struct _ty_board_id_part parts[])
 {
     size_t part_offset = 0;
     size_t delim_offset = 0;
@@ -99,45 +120,129 @@ static void parse_board_id(const char *id, const char *delimiters, struct board_
     } while (id[i++]);
 }
 
-static bool compare_board_id_parts(const struct board_id_part *part1,
-                                   const struct board_id_part *part2)
+void _ty_board_parse_id(ty_board *board)
+{
+    memset(board->id_parts, 0, sizeof(board->id_parts));
+    if (board->id)
+        parse_board_id(board->id, "-", board->id_parts);
+}
+
+static bool compare_board_id_parts(const struct _ty_board_id_part *part1,
+                                   const struct _ty_board_id_part *part2)
 {
     if (!part1->ptr || !part2->ptr)
         return true;
     return part1->len == part2->len && memcmp(part1->ptr, part2->ptr, part1->len) == 0;
 }
 
-static int match_board_interface(ty_board_interface *iface, void *udata)
+static void compile_matcher(ty_board_matcher *matcher, const char *tag)
 {
-    return ty_compare_paths(ty_board_interface_get_path(iface), udata);
+    matcher->tag = tag;
+    memset(matcher->parts, 0, sizeof(matcher->parts));
+    memset(&matcher->location_key, 0, sizeof(matcher->location_key));
+
+    if (tag) {
+        parse_board_id(tag, "-@", matcher->parts);
+        // The last part is necessarily NUL-terminated
+        if (matcher->parts[2].ptr)
+            ty_path_get_key(matcher->parts[2].ptr, &matcher->location_key);
+    }
 }
 
-bool ty_board_matches_tag(ty_board *board, const char *id)
+static bool match_interface_path(const ty_board_matcher *matcher, const ty_board_interface *iface)
 {
-    assert(board);
+    const ty_path_key *key1 = &matcher->location_key;
+    const ty_path_key *key2 = &iface->path_key;
 
-    if (!id)
-        return true;
-    if (board->tag != board->id && strcmp(id, board->tag) == 0)
-        return true;
+    if (key1->ino && key2->ino)
+        return key1->dev == key2->dev && key1->ino == key2->ino;
+#ifdef _WIN32
+    // No syscall involved on Windows
+    return ty_compare_paths(matcher->parts[2].ptr, iface->dev->path);
+#else
+    return strcmp(matcher->parts[2].ptr, iface->dev->path) == 0;
+#endif
+}
 
-    struct board_id_part parts1[3] = {0};
-    struct board_id_part parts2[2] = {0};
+static bool match_board(const ty_board_matcher *matcher, ty_board *board)
+{
+    const char *location;
+    bool match;
 
-    parse_board_id(id, "-@", parts1);
-    parse_board_id(board->id, "-", parts2);
+    if (!matcher->tag)
+        return true;
+    if (board->tag != board->id && strcmp(matcher->tag, board->tag) == 0)
+        return true;
 
-    if (!compare_board_id_parts(&parts1[0], &parts2[0]))
-        return false;
-    if (!compare_board_id_parts(&parts1[1], &parts2[1]))
+    if (!compare_board_id_parts(&matcher->parts[0], &board->id_parts[0]))
         return false;
-    /* The last part is necessarily NUL-terminated so we can just use regular
-       C string functions. */
-    if (parts1[2].ptr && strcmp(parts1[2].ptr, board->location) != 0 &&
-            !ty_board_list_interfaces(board, match_board_interface, (void *)parts1[2].ptr))
+    if (!compare_board_id_parts(&matcher->parts[1], &board->id_parts[1]))
         return false;
 
-    return true;
+    location = matcher->parts[2].ptr;
+    if (!location || strcmp(location, board->location) == 0)
+        return true;
+
+    match = false;
+    ty_mutex_lock(&board->ifaces_lock);
+    for (size_t i = 0; i < board->ifaces.count; i++) {
+        if (match_interface_path(matcher, board->ifaces.values[i])) {
+            match = true;
+            break;
+        }
+    }
+    ty_mutex_unlock(&board->ifaces_lock);
+
+    return match;
+}
+
+bool ty_board_matches_tag(ty_board *board, const char *id)
+{
+    assert(board);
+
+    ty_board_matcher matcher;
+
+    compile_matcher(&matcher, id);
+    return match_board(&matcher, board);
+}
+
+int ty_board_matcher_new(const char *tag, ty_board_matcher **rmatcher)
+{
+    assert(rmatcher);
+
+    ty_board_matcher *matcher;
+
+    matcher = calloc(1, sizeof(*matcher));
+    if (!matcher)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    if (tag) {
+        matcher->tag_buf = strdup(tag);
+        if (!matcher->tag_buf) {
+            free(matcher);
+            return ty_error(TY_ERROR_MEMORY, NULL);
+        }
+    }
+    compile_matcher(matcher, matcher->tag_buf);
+
+    *rmatcher = matcher;
+    return 0;
+}
+
+void ty_board_matcher_free(ty_board_matcher *matcher)
+{
+    if (matcher)
+        free(matcher->tag_buf);
+
+    free(matcher);
+}
+
+bool ty_board_matcher_match(const ty_board_matcher *matcher, ty_board *board)
+{
+    assert(matcher);
+    assert(board);
+
+    return match_board(matcher, board);
 }
 
 ty_monitor *ty_board_get_monitor(const ty_board *board)
@@ -176,6 +281,9 @@ int ty_board_set_tag(ty_board *board, const char *tag)
         free(board->tag);
     board->tag = new_tag;
 
+    if (board->monitor)
+        return _ty_monitor_index_board_tag(board);
+
     return 0;
 }
 
@@ -223,6 +331,42 @@ int ty_board_get_capabilities(const ty_board *board)
     return board->capabilities;
 }
 
+static void copy_stats(ty_board_stats *dest, const ty_board_stats *src)
+{
+    dest->read_calls = _ty_counter_get(&src->read_calls);
+    dest->read_bytes = _ty_counter_get(&src->read_bytes);
+    dest->read_full = _ty_counter_get(&src->read_full);
+    dest->write_calls = _ty_counter_get(&src->write_calls);
+    dest->write_bytes = _ty_counter_get(&src->write_bytes);
+    dest->write_short = _ty_counter_get(&src->write_short);
+    dest->io_errors = _ty_counter_get(&src->io_errors);
+    dest->dropped_bytes = _ty_counter_get(&src->dropped_bytes);
+    dest->reconnects = _ty_counter_get(&src->reconnects);
+    dest->uploads = _ty_counter_get(&src->uploads);
+    dest->upload_failures = _ty_counter_get(&src->upload_failures);
+    dest->upload_time = _ty_counter_get(&src->upload_time);
+}
+
+void ty_board_get_stats(const ty_board *board, ty_board_stats *rstats)
+{
+    assert(board);
+    assert(rstats);
+
+    copy_stats(rstats, &board->stats);
+}
+
+void ty_board_get_hotplug_timing(ty_board *board, ty_board_hotplug_timing *rtiming)
+{
+    assert(board);
+    assert(rtiming);
+
+    if (board->monitor) {
+        _ty_monitor_get_hotplug_timing(board, rtiming);
+    } else {
+        memset(rtiming, 0, sizeof(*rtiming));
+    }
+}
+
 int ty_board_list_interfaces(ty_board *board, ty_board_list_interfaces_func *f, void *udata)
 {
     assert(board);
@@ -296,18 +440,22 @@ int ty_board_wait_for(ty_board *board, ty_board_capability capability, int timeo
 {
     assert(board);
 
-    ty_monitor *monitor = board->monitor;
     struct wait_for_context ctx;
+    int r;
 
     if (board->status == TY_BOARD_STATUS_DROPPED)
         return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' has disappeared", board->tag);
-    if (!monitor)
+    if (!board->monitor)
         return ty_error(TY_ERROR_NOT_FOUND, "Cannot wait on unmonitored board '%s'", board->tag);
 
     ctx.board = board;
     ctx.capability = capability;
 
-    return ty_monitor_wait(monitor, wait_for_callback, &ctx, timeout);
+    ty_trace_begin(TY_TRACE_WAIT, "wait_for", board->tag);
+    r = _ty_monitor_wait_board(board, wait_for_callback, &ctx, timeout);
+    ty_trace_end(TY_TRACE_WAIT, "wait_for");
+
+    return r;
 }
 
 ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeout)
@@ -325,7 +473,30 @@ ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeou
     if (!r)
         return ty_error(TY_ERROR_MODE, "Board '%s' is not available for serial I/O", board->tag);
 
-    r = (*iface->class_vtable->serial_read)(iface, buf, size, timeout);
+    // Return data received while the interface was attached first
+    ty_mutex_lock(&iface->attach_lock);
+    if (iface->attach_offset < iface->attach_len) {
+        r = (ssize_t)TY_MIN(size, iface->attach_len - iface->attach_offset);
+        memcpy(buf, iface->attach_buf + iface->attach_offset, (size_t)r);
+        iface->attach_offset += (size_t)r;
+
+        if (iface->attach_offset == iface->attach_len) {
+            free(iface->attach_buf);
+            iface->attach_buf = NULL;
+            iface->attach_len = 0;
+            iface->attach_offset = 0;
+        }
+    } else {
+        r = 0;
+    }
+    ty_mutex_unlock(&iface->attach_lock);
+
+    if (!r) {
+        ty_trace_begin(TY_TRACE_IO, "serial_read", board->tag);
+        r = (*iface->class_vtable->serial_read)(iface, buf, size, timeout);
+        ty_trace_end(TY_TRACE_IO, "serial_read");
+        _ty_board_interface_count_io(iface, false, r, size);
+    }
 
     ty_board_interface_close(iface);
     return r;
@@ -345,7 +516,10 @@ ssize_t ty_board_serial_write(ty_board *board, const char *buf, size_t size)
     if (!r)
         return ty_error(TY_ERROR_MODE, "Board '%s' is not available for serial I/O", board->tag);
 
+    ty_trace_begin(TY_TRACE_IO, "serial_write", board->tag);
     r = (*iface->class_vtable->serial_write)(iface, buf, size);
+    ty_trace_end(TY_TRACE_IO, "serial_write");
+    _ty_board_interface_count_io(iface, true, r, size);
 
     ty_board_interface_close(iface);
     return r;
@@ -430,12 +604,128 @@ void ty_board_interface_unref(ty_board_interface *iface)
         hs_port_close(iface->port);
         hs_device_unref(iface->dev);
 
+        free(iface->attach_buf);
+        ty_mutex_release(&iface->attach_lock);
         ty_mutex_release(&iface->open_lock);
     }
 
     free(iface);
 }
 
+static int attach_thread(void *udata)
+{
+    ty_board_interface *iface = udata;
+    char buf[4096];
+    bool first = true;
+
+    // Errors are expected when the device goes away, the monitor takes care of it
+    ty_error_mask(TY_ERROR_IO);
+    ty_error_mask(TY_ERROR_SYSTEM);
+
+    while (true) {
+        ssize_t r;
+        size_t len;
+
+        ty_mutex_lock(&iface->attach_lock);
+        if (!iface->attach_run) {
+            ty_mutex_unlock(&iface->attach_lock);
+            break;
+        }
+        ty_mutex_unlock(&iface->attach_lock);
+
+        r = (*iface->class_vtable->serial_read)(iface, buf, sizeof(buf), ATTACH_READ_TIMEOUT);
+        if (r < 0)
+            break;
+        if (!r)
+            continue;
+        // Timeouts are expected while polling, and so are errors when the device goes away
+        _ty_board_interface_count_io(iface, false, r, sizeof(buf));
+
+        if (first) {
+            ty_log(TY_LOG_DEBUG, "Received first data from '%s' %" PRIu64 " ms after it appeared",
+                   iface->dev->path, ty_millis() - iface->appear_time);
+            first = false;
+        }
+
+        ty_mutex_lock(&iface->attach_lock);
+        if (!iface->attach_buf)
+            iface->attach_buf = malloc(ATTACH_BUFFER_SIZE);
+        if (iface->attach_buf) {
+            len = TY_MIN((size_t)r, ATTACH_BUFFER_SIZE - iface->attach_len);
+
+            memcpy(iface->attach_buf + iface->attach_len, buf, len);
+            iface->attach_len += len;
+        } else {
+            len = 0;
+        }
+        iface->attach_dropped += (size_t)r - len;
+        ty_mutex_unlock(&iface->attach_lock);
+
+        if (len < (size_t)r) {
+            _ty_counter_add(&iface->stats.dropped_bytes, (size_t)r - len);
+            if (iface->board)
+                _ty_counter_add(&iface->board->stats.dropped_bytes, (size_t)r - len);
+        }
+    }
+
+    ty_error_unmask();
+    ty_error_unmask();
+
+    return 0;
+}
+
+static void stop_attach_thread(ty_board_interface *iface)
+{
+    ty_mutex_lock(&iface->attach_lock);
+    iface->attach_run = false;
+    ty_mutex_unlock(&iface->attach_lock);
+
+    ty_thread_join(&iface->attach_thread);
+}
+
+int _ty_board_interface_attach(ty_board_interface *iface)
+{
+    int r;
+
+    if (!(iface->capabilities & (1 << TY_BOARD_CAPABILITY_SERIAL)))
+        return 0;
+
+    r = ty_board_interface_open(iface);
+    if (r < 0)
+        return r;
+
+    ty_mutex_lock(&iface->open_lock);
+
+    iface->attach_run = true;
+    r = ty_thread_create(&iface->attach_thread, attach_thread, iface);
+    if (r < 0) {
+        ty_mutex_unlock(&iface->open_lock);
+        ty_board_interface_close(iface);
+        return r;
+    }
+    iface->attached = true;
+
+    ty_mutex_unlock(&iface->open_lock);
+
+    return 0;
+}
+
+void _ty_board_interface_detach(ty_board_interface *iface)
+{
+    bool attached;
+
+    ty_mutex_lock(&iface->open_lock);
+    attached = iface->attached;
+    if (attached) {
+        stop_attach_thread(iface);
+        iface->attached = false;
+    }
+    ty_mutex_unlock(&iface->open_lock);
+
+    if (attached)
+        ty_board_interface_close(iface);
+}
+
 int ty_board_interface_open(ty_board_interface *iface)
 {
     assert(iface);
@@ -444,6 +734,22 @@ int ty_board_interface_open(ty_board_interface *iface)
 
     ty_mutex_lock(&iface->open_lock);
 
+    if (iface->attached) {
+        /* Take over the reference and the open count held by the attach thread, the
+           buffered data is returned by the next serial reads. */
+        stop_attach_thread(iface);
+        iface->attached = false;
+
+        ty_log(TY_LOG_DEBUG, "Attached to '%s' %" PRIu64 " ms after it appeared (%zu bytes buffered)",
+               iface->dev->path, ty_millis() - iface->appear_time, iface->attach_len);
+        if (iface->attach_dropped)
+            ty_log(TY_LOG_WARNING, "Dropped %zu bytes received on '%s' before it was opened",
+                   iface->attach_dropped, iface->dev->path);
+
+        r = 0;
+        goto cleanup;
+    }
+
     if (!iface->port) {
         r = (*iface->class_vtable->open_interface)(iface);
         if (r < 0)
@@ -484,6 +790,40 @@ int ty_board_interface_get_capabilities(const ty_board_interface *iface)
     return iface->capabilities;
 }
 
+void ty_board_interface_get_stats(const ty_board_interface *iface, ty_board_stats *rstats)
+{
+    assert(iface);
+    assert(rstats);
+
+    copy_stats(rstats, &iface->stats);
+}
+
+static void count_stats_io(ty_board_stats *stats, bool write, ssize_t r, size_t size)
+{
+    if (write) {
+        _ty_counter_add(&stats->write_calls, 1);
+        if (r > 0)
+            _ty_counter_add(&stats->write_bytes, (uint64_t)r);
+        if (r >= 0 && (size_t)r < size)
+            _ty_counter_add(&stats->write_short, 1);
+    } else {
+        _ty_counter_add(&stats->read_calls, 1);
+        if (r > 0)
+            _ty_counter_add(&stats->read_bytes, (uint64_t)r);
+        if (r > 0 && (size_t)r == size)
+            _ty_counter_add(&stats->read_full, 1);
+    }
+    if (r < 0)
+        _ty_counter_add(&stats->io_errors, 1);
+}
+
+void _ty_board_interface_count_io(ty_board_interface *iface, bool write, ssize_t r, size_t size)
+{
+    count_stats_io(&iface->stats, write, r, size);
+    if (iface->board)
+        count_stats_io(&iface->board->stats, write, r, size);
+}
+
 const char *ty_board_interface_get_path(const ty_board_interface *iface)
 {
     assert(iface);
@@ -517,33 +857,204 @@ void ty_board_interface_get_descriptors(const ty_board_interface *iface, struct
         ty_descriptor_set_add(set, hs_port_get_poll_handle(iface->port), id);
 }
 
-static int new_board_task(ty_board *board, const char *action, int (*run)(ty_task *task),
-                          ty_task **rtask)
+static int new_board_task(ty_board *board, const char *action, ty_task_priority priority,
+                          int (*run)(ty_task *task), ty_task **rtask)
 {
     char task_name_buf[64];
     ty_task *task = NULL;
     int r;
 
-    if (board->current_task)
-        return ty_error(TY_ERROR_BUSY, "Board '%s' is busy on task '%s'", board->tag,
-                        board->current_task->name);
-
     snprintf(task_name_buf, sizeof(task_name_buf), "%s@%s", action, board->tag);
     r = ty_task_new(task_name_buf, run, &task);
     if (r < 0)
         return r;
-
-    board->current_task = ty_task_ref(task);
+    task->priority = priority;
 
     *rtask = task;
     return 0;
 }
 
-static void cleanup_task_board(ty_board **board_ptr)
+static int run_upload(ty_task *task);
+static int run_reset(ty_task *task);
+static int run_reboot(ty_task *task);
+static int run_send(ty_task *task);
+static int run_send_file(ty_task *task);
+
+static bool same_firmware(const ty_firmware *fw1, const ty_firmware *fw2)
+{
+    return fw1 == fw2 || (fw1->size == fw2->size && !memcmp(fw1->image, fw2->image, fw1->size));
+}
+
+static bool same_board_task(const ty_task *task1, const ty_task *task2)
 {
-    ty_task_unref((*board_ptr)->current_task);
-    (*board_ptr)->current_task = NULL;
-    ty_board_unref(*board_ptr);
+    if (task1->task_run != task2->task_run)
+        return false;
+
+    if (task1->task_run == run_upload) {
+        if (task1->u.upload.flags != task2->u.upload.flags ||
+                task1->u.upload.fws_count != task2->u.upload.fws_count)
+            return false;
+        for (unsigned int i = 0; i < task1->u.upload.fws_count; i++) {
+            if (!same_firmware(task1->u.upload.fws[i], task2->u.upload.fws[i]))
+                return false;
+        }
+
+        return true;
+    } else if (task1->task_run == run_reset || task1->task_run == run_reboot) {
+        return true;
+    }
+
+    return false;
+}
+
+static ty_task **get_coalesced_ptr(ty_task *task)
+{
+    if (task->task_run == run_upload) {
+        return &task->u.upload.coalesced;
+    } else if (task->task_run == run_reset) {
+        return &task->u.reset.coalesced;
+    } else if (task->task_run == run_reboot) {
+        return &task->u.reboot.coalesced;
+    }
+
+    return NULL;
+}
+
+static ty_board *get_task_board(const ty_task *task)
+{
+    if (task->task_run == run_upload) {
+        return task->u.upload.board;
+    } else if (task->task_run == run_reset) {
+        return task->u.reset.board;
+    } else if (task->task_run == run_reboot) {
+        return task->u.reboot.board;
+    } else if (task->task_run == run_send) {
+        return task->u.send.board;
+    } else if (task->task_run == run_send_file) {
+        return task->u.send_file.board;
+    }
+
+    return NULL;
+}
+
+bool _ty_board_task_precedes(const ty_task *task, const ty_task *other)
+{
+    ty_board *board = get_task_board(task);
+    size_t task_idx = SIZE_MAX, other_idx = SIZE_MAX;
+
+    if (!board)
+        return false;
+
+    // Don't look at the board of the other task, it may be running and releasing it
+    ty_mutex_lock(&board->tasks_lock);
+    for (size_t i = 0; i <= board->pending_tasks.count; i++) {
+        ty_task *queued = i ? board->pending_tasks.values[i - 1] : board->current_task;
+
+        if (queued == task) {
+            task_idx = i;
+        } else if (queued == other) {
+            other_idx = i;
+        }
+    }
+    ty_mutex_unlock(&board->tasks_lock);
+
+    return task_idx < other_idx && other_idx != SIZE_MAX;
+}
+
+/* Call once the task is fully set up. The task runs as soon as the previous board tasks
+   are done, which may be right away. */
+static int queue_board_task(ty_board *board, ty_task *task)
+{
+    ty_task *previous;
+    int r;
+
+    ty_mutex_lock(&board->tasks_lock);
+
+    if (!board->current_task) {
+        board->current_task = ty_task_ref(task);
+
+        r = 0;
+        goto cleanup;
+    }
+
+    r = _hs_array_push(&board->pending_tasks, task);
+    if (r < 0) {
+        r = ty_libhs_translate_error(r);
+        goto cleanup;
+    }
+    ty_task_ref(task);
+    _ty_task_block(task);
+
+    /* Only coalesce with a task that has not started running yet, its outcome would not
+       reflect what we were asked to do otherwise. */
+    previous = board->pending_tasks.count > 1 ?
+               board->pending_tasks.values[board->pending_tasks.count - 2] : board->current_task;
+    if (board->monitor && _ty_monitor_coalesces_tasks(board->monitor) &&
+            previous->status <= TY_TASK_STATUS_PENDING && same_board_task(previous, task)) {
+        ty_task **coalesced_ptr = get_coalesced_ptr(task);
+        *coalesced_ptr = ty_task_ref(previous);
+    }
+
+    r = 0;
+cleanup:
+    ty_mutex_unlock(&board->tasks_lock);
+    return r;
+}
+
+/* Returns true and sets *rret if the task can reuse the outcome of the identical task it was
+   coalesced with. Only successful tasks count, we want another try if it failed (or never
+   got to run). The coalesced task is done but it may not be marked as finished yet, it
+   releases the board before that. */
+static bool reuse_coalesced_task(ty_task *task, ty_task *coalesced, int *rret)
+{
+    if (!coalesced || coalesced->status < TY_TASK_STATUS_RUNNING || coalesced->ret < 0)
+        return false;
+
+    ty_log(TY_LOG_INFO, "Task '%s' was coalesced with '%s'", task->name, coalesced->name);
+    *rret = coalesced->ret;
+    return true;
+}
+
+static void cleanup_task_board(ty_task *task, ty_board **board_ptr)
+{
+    ty_board *board = *board_ptr;
+    ty_task **coalesced_ptr;
+    ty_task *next = NULL;
+    bool queued = false;
+
+    ty_mutex_lock(&board->tasks_lock);
+    if (board->current_task == task) {
+        board->current_task = NULL;
+        if (board->pending_tasks.count) {
+            next = board->pending_tasks.values[0];
+            _hs_array_remove(&board->pending_tasks, 0, 1);
+
+            board->current_task = next;
+        }
+        queued = true;
+    } else {
+        for (size_t i = 0; i < board->pending_tasks.count; i++) {
+            if (board->pending_tasks.values[i] == task) {
+                _hs_array_remove(&board->pending_tasks, i, 1);
+                queued = true;
+                break;
+            }
+        }
+    }
+    ty_mutex_unlock(&board->tasks_lock);
+
+    if (next)
+        _ty_task_unblock(next);
+
+    coalesced_ptr = get_coalesced_ptr(task);
+    if (coalesced_ptr) {
+        ty_task_unref(*coalesced_ptr);
+        *coalesced_ptr = NULL;
+    }
+
+    if (queued)
+        ty_task_unref(task);
+    ty_board_unref(board);
     *board_ptr = NULL;
 }
 
@@ -612,7 +1123,7 @@ static void unref_upload_firmware(void *ptr)
     ty_firmware_unref(ptr);
 }
 
-static int run_upload(ty_task *task)
+static int upload_board_firmware(ty_task *task)
 {
     ty_board *board = task->u.upload.board;
     ty_firmware *fw;
@@ -666,6 +1177,12 @@ wait:
         return r;
 
     if (!(flags & TY_UPLOAD_NORESET)) {
+        /* Whoever opens the serial interface next (e.g. a serial monitor) should get what
+           the new firmware prints as it boots, even if it opens it late. */
+        ty_mutex_lock(&board->ifaces_lock);
+        board->attach_serial = true;
+        ty_mutex_unlock(&board->ifaces_lock);
+
         ty_log(TY_LOG_INFO, "Sending reset command");
         r = ty_board_reset(board);
         if (r < 0)
@@ -685,13 +1202,39 @@ wait:
     return 0;
 }
 
+static int run_upload(ty_task *task)
+{
+    ty_board *board = task->u.upload.board;
+    ty_task *coalesced = task->u.upload.coalesced;
+    uint64_t start;
+    int r;
+
+    if (reuse_coalesced_task(task, coalesced, &r)) {
+        if (coalesced->result) {
+            task->result = ty_firmware_ref(coalesced->result);
+            task->result_cleanup = unref_upload_firmware;
+        }
+        return r;
+    }
+
+    start = ty_millis();
+    r = upload_board_firmware(task);
+
+    _ty_counter_add(&board->stats.uploads, 1);
+    if (r < 0)
+        _ty_counter_add(&board->stats.upload_failures, 1);
+    _ty_counter_add(&board->stats.upload_time, ty_millis() - start);
+
+    return r;
+}
+
 static void finalize_upload(ty_task *task)
 {
     for (unsigned int i = 0; i < task->u.upload.fws_count; i++)
         ty_firmware_unref(task->u.upload.fws[i]);
     free(task->u.upload.fws);
 
-    cleanup_task_board(&task->u.upload.board);
+    cleanup_task_board(task, &task->u.upload.board);
 }
 
 int ty_upload(ty_board *board, ty_firmware **fws, unsigned int fws_count, int flags,
@@ -705,7 +1248,7 @@ int ty_upload(ty_board *board, ty_firmware **fws, unsigned int fws_count, int fl
     ty_task *task = NULL;
     int r;
 
-    r = new_board_task(board, "upload", run_upload, &task);
+    r = new_board_task(board, "upload", TY_TASK_PRIORITY_BULK, run_upload, &task);
     if (r < 0)
         goto error;
     task->u.upload.board = ty_board_ref(board);
@@ -729,6 +1272,10 @@ int ty_upload(ty_board *board, ty_firmware **fws, unsigned int fws_count, int fl
     task->u.upload.fws_count = fws_count;
     task->u.upload.flags = flags;
 
+    r = queue_board_task(board, task);
+    if (r < 0)
+        goto error;
+
     *rtask = task;
     return 0;
 
@@ -742,6 +1289,9 @@ static int run_reset(ty_task *task)
     ty_board *board = task->u.reset.board;
     int r;
 
+    if (reuse_coalesced_task(task, task->u.reset.coalesced, &r))
+        return r;
+
     ty_log(TY_LOG_INFO, "Resetting board '%s' (%s)", board->tag, ty_models[board->model].name);
 
     if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_RESET) &&
@@ -772,7 +1322,7 @@ static int run_reset(ty_task *task)
 
 static void finalize_reset(ty_task *task)
 {
-    cleanup_task_board(&task->u.reset.board);
+    cleanup_task_board(task, &task->u.reset.board);
 }
 
 int ty_reset(ty_board *board, ty_task **rtask)
@@ -783,12 +1333,18 @@ int ty_reset(ty_board *board, ty_task **rtask)
     ty_task *task = NULL;
     int r;
 
-    r = new_board_task(board, "reset", run_reset, &task);
+    r = new_board_task(board, "reset", TY_TASK_PRIORITY_INTERACTIVE, run_reset, &task);
     if (r < 0)
         return r;
     task->u.reset.board = ty_board_ref(board);
     task->task_finalize = finalize_reset;
 
+    r = queue_board_task(board, task);
+    if (r < 0) {
+        ty_task_unref(task);
+        return r;
+    }
+
     *rtask = task;
     return 0;
 }
@@ -798,6 +1354,9 @@ static int run_reboot(ty_task *task)
     ty_board *board = task->u.reboot.board;
     int r;
 
+    if (reuse_coalesced_task(task, task->u.reboot.coalesced, &r))
+        return r;
+
     ty_log(TY_LOG_INFO, "Rebooting board '%s' (%s)", board->tag, ty_models[board->model].name);
 
     if (ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD)) {
@@ -821,7 +1380,7 @@ static int run_reboot(ty_task *task)
 
 static void finalize_reboot(ty_task *task)
 {
-    cleanup_task_board(&task->u.reboot.board);
+    cleanup_task_board(task, &task->u.reboot.board);
 }
 
 int ty_reboot(ty_board *board, ty_task **rtask)
@@ -832,47 +1391,157 @@ int ty_reboot(ty_board *board, ty_task **rtask)
     ty_task *task = NULL;
     int r;
 
-    r = new_board_task(board, "reboot", run_reboot, &task);
+    r = new_board_task(board, "reboot", TY_TASK_PRIORITY_INTERACTIVE, run_reboot, &task);
     if (r < 0)
         return r;
     task->u.reboot.board = ty_board_ref(board);
     task->task_finalize = finalize_reboot;
 
+    r = queue_board_task(board, task);
+    if (r < 0) {
+        ty_task_unref(task);
+        return r;
+    }
+
     *rtask = task;
     return 0;
 }
 
-static int run_send(ty_task *task)
+static int open_send_interface(ty_board *board, struct send_context *ctx, uint64_t size)
 {
-    ty_board *board = task->u.send.board;
-    const char *buf = task->u.send.buf;
-    size_t size = task->u.send.size;
+    int r;
+
+    r = ty_board_open_interface(board, TY_BOARD_CAPABILITY_SERIAL, &ctx->iface);
+    if (r < 0)
+        return r;
+    if (!r)
+        return ty_error(TY_ERROR_MODE, "Board '%s' is not available for serial I/O", board->tag);
+
+    ctx->written = 0;
+    ctx->size = size;
+    ctx->progress_time = ty_millis();
+    ty_progress("Sending", 0, size);
+
+    return 0;
+}
+
+static void update_send_progress(struct send_context *ctx, size_t written)
+{
+    ctx->written += written;
+
+    /* Serial writes are often small (a few kB at most), so reporting progress after each
+       of them floods the message handlers with updates nobody can see. */
+    if (ctx->written == ctx->size || ty_millis() - ctx->progress_time >= SEND_PROGRESS_INTERVAL) {
+        ty_progress("Sending", ctx->written, ctx->size);
+        ctx->progress_time = ty_millis();
+    }
+}
+
+static int send_serial_block(struct send_context *ctx, const char *buf, size_t size)
+{
+    ty_board_interface *iface = ctx->iface;
     size_t written;
+    uint64_t start;
+    ssize_t r;
+
+    /* The caller owns the buffer for the duration of the call, so there is nothing to
+       release and no reason to copy anything. */
+    r = hs_serial_queue(iface->port, (const uint8_t *)buf, size, NULL, NULL);
+    if (r < 0)
+        return ty_libhs_translate_error((int)r);
 
     written = 0;
+    start = ty_millis();
     while (written < size) {
-        size_t block_size;
-        ssize_t r;
+        r = ty_task_check_canceled();
+        if (r < 0)
+            goto error;
 
-        ty_progress("Sending", written, size);
+        r = hs_serial_flush(iface->port,
+                            _ty_task_adjust_timeout(ty_adjust_timeout(5000, start)));
+        // Retries after a flush timeout are not writes, only count the final one
+        if (r)
+            _ty_board_interface_count_io(iface, true, r, size - written);
+        if (r < 0) {
+            r = ty_libhs_translate_error((int)r);
+            goto error;
+        }
+        if (!r) {
+            if (ty_adjust_timeout(5000, start))
+                continue;
+            _ty_board_interface_count_io(iface, true, 0, size - written);
+            r = ty_error(TY_ERROR_IO, "Timed out while writing to '%s'", iface->dev->path);
+            goto error;
+        }
+
+        start = ty_millis();
+        written += (size_t)r;
+        update_send_progress(ctx, (size_t)r);
+    }
+
+    return 0;
 
-        block_size = TY_MIN(1024, size - written);
-        r = ty_board_serial_write(board, buf + written, block_size);
+error:
+    /* The port stays open after we return if someone else uses it (e.g. a serial monitor),
+       don't leave it with pointers to a buffer the caller is about to free. */
+    hs_serial_discard(iface->port);
+    return (int)r;
+}
+
+static int send_block(struct send_context *ctx, const char *buf, size_t size)
+{
+    ty_board_interface *iface = ctx->iface;
+    size_t written;
+    ssize_t r;
+
+    if (iface->dev->type == HS_DEVICE_TYPE_SERIAL)
+        return send_serial_block(ctx, buf, size);
+
+    // HID serial emulation goes through the class code, which packs data in reports
+    written = 0;
+    while (written < size) {
+        size_t block_size = TY_MIN(SEND_HID_BLOCK_SIZE, size - written);
+
+        r = ty_task_check_canceled();
+        if (r < 0)
+            return (int)r;
+
+        r = (*iface->class_vtable->serial_write)(iface, buf + written, block_size);
         if (r < 0)
             return (int)r;
+
         written += (size_t)r;
+        update_send_progress(ctx, (size_t)r);
     }
 
     return 0;
 }
 
+static int run_send(ty_task *task)
+{
+    ty_board *board = task->u.send.board;
+    struct send_context ctx;
+    int r;
+
+    r = open_send_interface(board, &ctx, task->u.send.size);
+    if (r < 0)
+        return r;
+
+    r = send_block(&ctx, task->u.send.buf, task->u.send.size);
+
+    ty_board_interface_close(ctx.iface);
+    return r;
+}
+
 static void finalize_send(ty_task *task)
 {
-    free(task->u.send.buf);
-    cleanup_task_board(&task->u.send.board);
+    if (task->u.send.release)
+        (*task->u.send.release)(task->u.send.release_udata);
+    cleanup_task_board(task, &task->u.send.board);
 }
 
-int ty_send(ty_board *board, const char *buf, size_t size, ty_task **rtask)
+int ty_send(ty_board *board, const char *buf, size_t size, void (*release)(void *udata),
+            void *udata, ty_task **rtask)
 {
     assert(board);
     assert(buf);
@@ -881,67 +1550,261 @@ int ty_send(ty_board *board, const char *buf, size_t size, ty_task **rtask)
     ty_task *task = NULL;
     int r;
 
-    r = new_board_task(board, "send", run_send, &task);
-    if (r < 0)
-        goto error;
+    r = new_board_task(board, "send", TY_TASK_PRIORITY_BULK, run_send, &task);
+    if (r < 0) {
+        if (release)
+            (*release)(udata);
+        return r;
+    }
     task->u.send.board = ty_board_ref(board);
     task->task_finalize = finalize_send;
 
-    task->u.send.buf = malloc(size);
-    if (!task->u.send.buf) {
-        r = ty_error(TY_ERROR_MEMORY, NULL);
-        goto error;
-    }
-    memcpy(task->u.send.buf, buf, size);
+    task->u.send.buf = buf;
     task->u.send.size = size;
+    task->u.send.release = release;
+    task->u.send.release_udata = udata;
+
+    r = queue_board_task(board, task);
+    if (r < 0) {
+        ty_task_unref(task);
+        return r;
+    }
 
     *rtask = task;
     return 0;
+}
 
-error:
-    ty_task_unref(task);
+static int send_file_buffered(struct send_context *ctx, FILE *fp, const char *filename)
+{
+    char *buf;
+    int r;
+
+    buf = malloc(SEND_FILE_BUFFER_SIZE);
+    if (!buf)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    while (ctx->written < ctx->size) {
+        size_t block_size = fread(buf, 1, SEND_FILE_BUFFER_SIZE, fp);
+        if (!block_size) {
+            if (feof(fp))
+                break;
+
+            r = ty_error(TY_ERROR_IO, "I/O error while reading '%s'", filename);
+            goto cleanup;
+        }
+
+        r = send_block(ctx, buf, block_size);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    r = 0;
+cleanup:
+    free(buf);
     return r;
 }
 
+struct framed_source {
+    struct send_context *ctx;
+
+    FILE *fp;
+    const char *filename;
+    const uint8_t *map;
+
+    int error;
+};
+
+static int framed_link_write(void *udata, const uint8_t *buf, size_t size)
+{
+    struct framed_source *src = udata;
+    ty_board_interface *iface = src->ctx->iface;
+    size_t written = 0;
+
+    while (written < size) {
+        ssize_t r;
+
+        src->error = ty_task_check_canceled();
+        if (src->error < 0)
+            return src->error;
+
+        ty_trace_begin(TY_TRACE_IO, "framed_write", iface->dev->path);
+        r = hs_serial_write(iface->port, buf + written, size - written, 5000);
+        ty_trace_end(TY_TRACE_IO, "framed_write");
+        _ty_board_interface_count_io(iface, true, r, size - written);
+        if (r < 0) {
+            src->error = ty_libhs_translate_error((int)r);
+            return src->error;
+        }
+        if (!r) {
+            src->error = ty_error(TY_ERROR_IO, "Timed out while writing to '%s'",
+                                  iface->dev->path);
+            return src->error;
+        }
+        written += (size_t)r;
+    }
+
+    return 0;
+}
+
+static int framed_link_read(void *udata, uint8_t *buf, size_t size, int timeout)
+{
+    struct framed_source *src = udata;
+    ssize_t r;
+
+    src->error = ty_task_check_canceled();
+    if (src->error < 0)
+        return src->error;
+
+    ty_trace_begin(TY_TRACE_IO, "framed_read", src->ctx->iface->dev->path);
+    r = hs_serial_read(src->ctx->iface->port, buf, size, timeout);
+    ty_trace_end(TY_TRACE_IO, "framed_read");
+    _ty_board_interface_count_io(src->ctx->iface, false, r, size);
+    if (r < 0) {
+        src->error = ty_libhs_translate_error((int)r);
+        return src->error;
+    }
+
+    return (int)r;
+}
+
+static uint32_t framed_link_millis(void *udata)
+{
+    TY_UNUSED(udata);
+    return (uint32_t)ty_millis();
+}
+
+static int framed_source_read(void *udata, uint64_t offset, uint8_t *buf, size_t size)
+{
+    struct framed_source *src = udata;
+
+    if (src->map) {
+        memcpy(buf, src->map + offset, size);
+        return 0;
+    }
+
+#ifdef _WIN32
+    _fseeki64(src->fp, (__int64)offset, SEEK_SET);
+#else
+    fseeko(src->fp, (off_t)offset, SEEK_SET);
+#endif
+    if (fread(buf, 1, size, src->fp) != size) {
+        src->error = ty_error(TY_ERROR_IO, "I/O error while reading '%s'", src->filename);
+        return src->error;
+    }
+
+    return 0;
+}
+
+static void framed_source_progress(void *udata, uint64_t value, uint64_t max)
+{
+    struct framed_source *src = udata;
+
+    TY_UNUSED(max);
+    update_send_progress(src->ctx, (size_t)(value - src->ctx->written));
+}
+
+static int send_file_framed(struct send_context *ctx, FILE *fp, const char *filename,
+                            const uint8_t *map)
+{
+    ty_board_interface *iface = ctx->iface;
+    struct framed_source src = {0};
+    ty_xfer_link link = {0};
+    ty_xfer_source xfer_src = {0};
+    int r;
+
+    if (iface->dev->type != HS_DEVICE_TYPE_SERIAL)
+        return ty_error(TY_ERROR_MODE, "Framed transfers need a serial interface, '%s' is not one",
+                        iface->dev->path);
+
+    src.ctx = ctx;
+    src.fp = fp;
+    src.filename = filename;
+    src.map = map;
+
+    link.write = framed_link_write;
+    link.read = framed_link_read;
+    link.millis = framed_link_millis;
+    link.udata = &src;
+
+    xfer_src.read = framed_source_read;
+    xfer_src.progress = framed_source_progress;
+    xfer_src.size = ctx->size;
+    xfer_src.udata = &src;
+
+    r = ty_xfer_send(&link, &xfer_src);
+    switch (r) {
+        case TY_XFER_OK: { return 0; } break;
+        case TY_XFER_ERROR_LINK: { return src.error; } break;
+
+        case TY_XFER_ERROR_TIMEOUT: {
+            return ty_error(TY_ERROR_IO, "Timed out while sending '%s' to board '%s'",
+                            filename, ctx->iface->board->tag);
+        } break;
+        case TY_XFER_ERROR_UNSUPPORTED: {
+            return ty_error(TY_ERROR_UNSUPPORTED,
+                            "Board '%s' does not answer framed transfer requests",
+                            ctx->iface->board->tag);
+        } break;
+        case TY_XFER_ERROR_ABORTED: {
+            return ty_error(TY_ERROR_IO, "Board '%s' aborted the transfer",
+                            ctx->iface->board->tag);
+        } break;
+        case TY_XFER_ERROR_CHECKSUM: {
+            return ty_error(TY_ERROR_IO, "Board '%s' received corrupted data",
+                            ctx->iface->board->tag);
+        } break;
+    }
+
+    assert(false);
+    return 0;
+}
+
 static int run_send_file(ty_task *task)
 {
     ty_board *board = task->u.send_file.board;
     FILE *fp = task->u.send_file.fp;
     size_t size = task->u.send_file.size;
     const char *filename = task->u.send_file.filename;
-    size_t written;
-
-    written = 0;
-    while (written < size) {
-        char buf[1024];
-        size_t block_size;
-        size_t block_written;
-
-        ty_progress("Sending", written, size);
+    const uint8_t *map = NULL;
+    struct send_context ctx;
+    int r;
 
-        block_size = fread(buf, 1, sizeof(buf), fp);
-        if (!block_size) {
-            if (feof(fp)) {
-                break;
-            } else {
-                return ty_error(TY_ERROR_IO, "I/O error while reading '%s'", filename);
-            }
-        }
+    r = open_send_interface(board, &ctx, size);
+    if (r < 0)
+        return r;
 
-        block_written = 0;
-        while (block_written < block_size) {
-            ssize_t r = ty_board_serial_write(board, buf + block_written,
-                                              block_size - block_written);
-            if (r < 0)
-                return (int)r;
-            block_written += (size_t)r;
+#ifndef _WIN32
+    /* Map the file when we can and queue all of it at once, instead of going through a
+       bounce buffer. Sends are bound by the link anyway: over a pseudo-terminal, this is no
+       faster than buffered reads, which remain the fallback. */
+    {
+        void *ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+
+        if (ptr != MAP_FAILED) {
+    #ifdef MADV_SEQUENTIAL
+            madvise(ptr, size, MADV_SEQUENTIAL);
+    #endif
+            map = ptr;
         }
+    }
+#endif
 
-        written += block_size;
+    if (task->u.send_file.flags & TY_SEND_FRAMED) {
+        r = send_file_framed(&ctx, fp, filename, map);
+    } else if (map) {
+        r = send_block(&ctx, (const char *)map, size);
+    } else {
+        r = send_file_buffered(&ctx, fp, filename);
     }
-    ty_progress("Sending", size, size);
+    if (r >= 0 && ctx.written < ctx.size)
+        ty_progress("Sending", ctx.size, ctx.size);
 
-    return 0;
+#ifndef _WIN32
+    if (map)
+        munmap((void *)map, size);
+#endif
+    ty_board_interface_close(ctx.iface);
+    return r < 0 ? r : 0;
 }
 
 static void finalize_send_file(ty_task *task)
@@ -949,10 +1812,10 @@ static void finalize_send_file(ty_task *task)
     free(task->u.send_file.filename);
     if (task->u.send_file.fp)
         fclose(task->u.send_file.fp);
-    cleanup_task_board(&task->u.send_file.board);
+    cleanup_task_board(task, &task->u.send_file.board);
 }
 
-int ty_send_file(ty_board *board, const char *filename, ty_task **rtask)
+int ty_send_file(ty_board *board, const char *filename, int flags, ty_task **rtask)
 {
     assert(board);
     assert(filename);
@@ -961,11 +1824,12 @@ int ty_send_file(ty_board *board, const char *filename, ty_task **rtask)
     ty_task *task = NULL;
     int r;
 
-    r = new_board_task(board, "send", run_send_file, &task);
+    r = new_board_task(board, "send", TY_TASK_PRIORITY_BULK, run_send_file, &task);
     if (r < 0)
         goto error;
     task->u.send_file.board = ty_board_ref(board);
     task->task_finalize = finalize_send_file;
+    task->u.send_file.flags = flags;
 
 #ifdef _WIN32
     task->u.send_file.fp = fopen(filename, "rb");
@@ -1011,6 +1875,10 @@ int ty_send_file(ty_board *board, const char *filename, ty_task **rtask)
         goto error;
     }
 
+    r = queue_board_task(board, task);
+    if (r < 0)
+        goto error;
+
     *rtask = task;
     return 0;
 
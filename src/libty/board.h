@@ -25,6 +25,7 @@ struct ty_task;
 
 typedef struct ty_board ty_board;
 typedef struct ty_board_interface ty_board_interface;
+typedef struct ty_board_matcher ty_board_matcher;
 
 // Keep in sync with capability_names in board.c
 typedef enum ty_board_capability {
@@ -52,6 +53,50 @@ enum {
 
 #define TY_UPLOAD_MAX_FIRMWARES 256
 
+enum {
+    TY_SEND_FRAMED = 1
+};
+
+/* Counters are updated atomically as I/O happens and only cover this process. Board
+   counters accumulate over all the interfaces the board has had, interface counters
+   start from zero each time the device appears. */
+typedef struct ty_board_stats {
+    uint64_t read_calls;
+    uint64_t read_bytes;
+    // Reads that filled the whole buffer, the board may be sending faster than we read
+    uint64_t read_full;
+    uint64_t write_calls;
+    uint64_t write_bytes;
+    // Writes that timed out before everything was sent
+    uint64_t write_short;
+    uint64_t io_errors;
+    // Serial data lost because nobody was reading while the interface was attached
+    uint64_t dropped_bytes;
+
+    // Times the board came back after going missing (reboots included)
+    uint64_t reconnects;
+    uint64_t uploads;
+    uint64_t upload_failures;
+    // Total time spent in upload tasks, in milliseconds
+    uint64_t upload_time;
+} ty_board_stats;
+
+/* Timestamps from ty_micros() for the last device change of the board, as it goes through
+   the monitor. Stages that have not happened (yet) are 0. */
+typedef struct ty_board_hotplug_timing {
+    /* The device event was received by libhs, or the monitor refresh started on platforms
+       that don't timestamp device events */
+    uint64_t event;
+    // libhs has read the device information and reported it
+    uint64_t device;
+    // Board interfaces, capabilities and status updated
+    uint64_t board;
+    // Monitor callbacks have returned
+    uint64_t callbacks;
+    // A thread waiting for the board (e.g. in ty_board_wait_for()) has woken up
+    uint64_t wakeup;
+} ty_board_hotplug_timing;
+
 typedef int ty_board_list_interfaces_func(ty_board_interface *iface, void *udata);
 typedef int ty_board_upload_progress_func(const ty_board *board, const struct ty_firmware *fw,
                                           size_t uploaded_size, size_t flash_size, void *udata);
@@ -63,6 +108,12 @@ TY_PUBLIC void ty_board_unref(ty_board *board);
 
 TY_PUBLIC bool ty_board_matches_tag(ty_board *board, const char *id);
 
+/* Parse the tag once (and resolve the location path if it is one) to match many boards
+   cheaply, without any syscall. A NULL tag matches every board. */
+TY_PUBLIC int ty_board_matcher_new(const char *tag, ty_board_matcher **rmatcher);
+TY_PUBLIC void ty_board_matcher_free(ty_board_matcher *matcher);
+TY_PUBLIC bool ty_board_matcher_match(const ty_board_matcher *matcher, ty_board *board);
+
 TY_PUBLIC struct ty_monitor *ty_board_get_monitor(const ty_board *board);
 
 TY_PUBLIC ty_board_status ty_board_get_status(const ty_board *board);
@@ -87,6 +138,9 @@ static inline bool ty_board_has_capability(const ty_board *board, ty_board_capab
     return ty_board_get_capabilities(board) & (1 << cap);
 }
 
+TY_PUBLIC void ty_board_get_stats(const ty_board *board, ty_board_stats *rstats);
+TY_PUBLIC void ty_board_get_hotplug_timing(ty_board *board, ty_board_hotplug_timing *rtiming);
+
 TY_PUBLIC int ty_board_wait_for(ty_board *board, ty_board_capability capability, int timeout);
 
 TY_PUBLIC ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeout);
@@ -103,6 +157,7 @@ TY_PUBLIC void ty_board_interface_close(ty_board_interface *iface);
 
 TY_PUBLIC const char *ty_board_interface_get_name(const ty_board_interface *iface);
 TY_PUBLIC int ty_board_interface_get_capabilities(const ty_board_interface *iface);
+TY_PUBLIC void ty_board_interface_get_stats(const ty_board_interface *iface, ty_board_stats *rstats);
 
 TY_PUBLIC uint8_t ty_board_interface_get_interface_number(const ty_board_interface *iface);
 TY_PUBLIC const char *ty_board_interface_get_path(const ty_board_interface *iface);
@@ -115,8 +170,9 @@ TY_PUBLIC int ty_upload(ty_board *board, struct ty_firmware **fws, unsigned int
                          int flags, struct ty_task **rtask);
 TY_PUBLIC int ty_reset(ty_board *board, struct ty_task **rtask);
 TY_PUBLIC int ty_reboot(ty_board *board, struct ty_task **rtask);
-TY_PUBLIC int ty_send(ty_board *board, const char *buf, size_t size, struct ty_task **rtask);
-TY_PUBLIC int ty_send_file(ty_board *board, const char *filename, struct ty_task **rtask);
+TY_PUBLIC int ty_send(ty_board *board, const char *buf, size_t size,
+                      void (*release)(void *udata), void *udata, struct ty_task **rtask);
+TY_PUBLIC int ty_send_file(ty_board *board, const char *filename, int flags, struct ty_task **rtask);
 
 TY_C_END
 
@@ -14,19 +14,28 @@
 #include "common_priv.h"
 #include "board.h"
 #include "class_priv.h"
+#include "monitor.h"
 #include "../libhs/array.h"
 #include "../libhs/device.h"
 #include "../libhs/htable.h"
+#include "system.h"
 #include "task.h"
 #include "thread.h"
+#include "timer.h"
 
 TY_C_BEGIN
 
+struct _ty_board_id_part {
+    const char *ptr;
+    size_t len;
+};
+
 struct ty_board_interface {
     const struct _ty_class_vtable *class_vtable;
     unsigned int refcount;
 
-    _hs_htable_head monitor_hnode;
+    // Cached hash in the monitor interface table, 0 if not in the table
+    uint32_t monitor_hash;
     ty_board *board;
 
     const char *name;
@@ -34,21 +43,50 @@ struct ty_board_interface {
     ty_model model;
 
     hs_device *dev;
+    ty_path_key path_key;
     ty_mutex open_lock;
     unsigned int open_count;
     hs_port *port;
+
+    uint64_t appear_time;
+    ty_board_stats stats;
+
+    /* Attach-on-appear: the monitor opens the interface as soon as it appears and a
+       thread buffers incoming data until a consumer opens it. */
+    bool attached;
+    ty_thread attach_thread;
+    ty_mutex attach_lock;
+    bool attach_run;
+    char *attach_buf;
+    size_t attach_len;
+    size_t attach_offset;
+    size_t attach_dropped;
 };
 
 struct ty_board {
     unsigned int refcount;
 
     struct ty_monitor *monitor;
+    size_t monitor_index;
+    // Discovery order, removals don't preserve it in the monitor board array
+    uint64_t monitor_sequence;
+    // Cached hashes in the monitor board tables, 0 if not in the table
+    uint32_t monitor_location_hash;
+    uint32_t monitor_serial_hash;
+    uint32_t monitor_tag_hash;
 
     ty_board_status status;
     uint64_t missing_since;
+    ty_timer_entry drop_entry;
+
+    // Signaled after refreshes that touched this board, see ty_board_wait_for()
+    ty_cond wait_cond;
+    bool wait_pending;
 
     ty_model model;
     char *id;
+    // Serial and model parts of id, see _ty_board_parse_id()
+    struct _ty_board_id_part id_parts[2];
     char *tag;
     uint16_t vid;
     uint16_t pid;
@@ -60,10 +98,45 @@ struct ty_board {
     _HS_ARRAY(ty_board_interface *) ifaces;
     int capabilities;
     ty_board_interface *cap2iface[16];
-
+    // Attach the next serial interface even if the monitor does not do it for all boards
+    bool attach_serial;
+    ty_board_stats stats;
+    // Protected by the monitor refresh mutex, waiters update the wakeup stage
+    ty_board_hotplug_timing hotplug;
+
+    /* Board tasks run one at a time, in the order they were created. Tasks waiting for
+       their turn are blocked (see _ty_task_block()) and hold a reference. */
+    ty_mutex tasks_lock;
     ty_task *current_task;
+    _HS_ARRAY(ty_task *) pending_tasks;
+};
+
+struct ty_board_matcher {
+    char *tag_buf;
+
+    const char *tag;
+    // Serial, model and location parts
+    struct _ty_board_id_part parts[3];
+    ty_path_key location_key;
 };
 
+void _ty_board_parse_id(ty_board *board);
+static inline uint32_t _ty_board_hash_id_part(const struct _ty_board_id_part *part)
+{
+    return _hs_htable_hash_mem(part->ptr, part->len);
+}
+
+int _ty_monitor_index_board_tag(ty_board *board);
+int _ty_monitor_wait_board(ty_board *board, ty_monitor_wait_func *f, void *udata, int timeout);
+void _ty_monitor_get_hotplug_timing(ty_board *board, ty_board_hotplug_timing *rtiming);
+bool _ty_monitor_coalesces_tasks(const struct ty_monitor *monitor);
+
+// Update I/O counters of the interface and its board, r is the result of the I/O call
+void _ty_board_interface_count_io(ty_board_interface *iface, bool write, ssize_t r, size_t size);
+
+int _ty_board_interface_attach(ty_board_interface *iface);
+void _ty_board_interface_detach(ty_board_interface *iface);
+
 TY_C_END
 
 #endif
@@ -17,6 +17,7 @@
 #include "class_priv.h"
 #include "firmware.h"
 #include "system.h"
+#include "trace.h"
 
 #define SEREMU_TX_SIZE 32
 #define SEREMU_RX_SIZE 64
@@ -453,8 +454,9 @@ static ssize_t teensy_serial_write(ty_board_interface *iface, const char *buf, s
     return 0;
 }
 
-static int halfkay_send(hs_port *port, unsigned int halfkay_version, size_t block_size,
-                        size_t addr, const void *data, size_t size, unsigned int timeout)
+static int halfkay_send(ty_board_interface *iface, unsigned int halfkay_version,
+                        size_t block_size, size_t addr, const void *data, size_t size,
+                        unsigned int timeout)
 {
     uint8_t buf[2048] = {0};
     uint64_t start;
@@ -499,16 +501,21 @@ static int halfkay_send(hs_port *port, unsigned int halfkay_version, size_t bloc
     }
 
     /* We may get errors along the way (while the bootloader works) so try again
-       until timeout expires. */
+       until timeout expires, unless the task gets canceled in the meantime. */
     start = ty_millis();
     hs_error_mask(HS_ERROR_IO);
 restart:
-    r = hs_hid_write(port, buf, size);
-    if (r == HS_ERROR_IO && ty_millis() - start < timeout) {
+    ty_trace_begin(TY_TRACE_IO, "hid_write", NULL);
+    r = hs_hid_write(iface->port, buf, size);
+    ty_trace_end(TY_TRACE_IO, "hid_write");
+    if (r == HS_ERROR_IO && ty_millis() - start < timeout && !_ty_task_interrupted()) {
         ty_delay(20);
         goto restart;
     }
     hs_error_unmask();
+    _ty_board_interface_count_io(iface, true, r, size);
+    if (r == HS_ERROR_IO && _ty_task_interrupted())
+        return ty_task_check_canceled();
     if (r < 0) {
         if (r == HS_ERROR_IO)
             return ty_error(TY_ERROR_IO, "%s", hs_error_last_message());
@@ -611,7 +618,11 @@ static int teensy_upload(ty_board_interface *iface, ty_firmware *fw,
     for (size_t addr = 0; addr < fw->size; addr += block_size) {
         size_t write_size = TY_MIN(block_size, (size_t)(fw->size - addr));
 
-        r = halfkay_send(iface->port, halfkay_version, block_size,
+        r = ty_task_check_canceled();
+        if (r < 0)
+            return r;
+
+        r = halfkay_send(iface, halfkay_version, block_size,
                          addr, fw->image + addr, write_size, 3000);
         if (r < 0)
             return r;
@@ -635,7 +646,7 @@ static int teensy_reset(ty_board_interface *iface)
     if (r < 0)
         return r;
 
-    return halfkay_send(iface->port, halfkay_version, block_size, 0xFFFFFF, NULL, 0, 250);
+    return halfkay_send(iface, halfkay_version, block_size, 0xFFFFFF, NULL, 0, 250);
 }
 
 static int teensy_reboot(ty_board_interface *iface)
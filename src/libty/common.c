@@ -16,6 +16,7 @@
 #include <stdarg.h>
 #include "../libhs/common.h"
 #include "system.h"
+#include "thread.h"
 #include "version.h"
 #include "task.h"
 
@@ -29,6 +30,63 @@ static TY_THREAD_LOCAL unsigned int error_masks_count;
 
 static TY_THREAD_LOCAL char last_error_msg[512];
 
+static int progress_interval = 100;
+static unsigned int progress_delta = 5;
+
+// Each thread reports progress for one thing at a time (usually a task)
+static TY_THREAD_LOCAL struct {
+    char action[64];
+    uint64_t value;
+    uint64_t max;
+    uint64_t time;
+} last_progress;
+
+#define ASYNC_QUEUE_SIZE 128
+#define ASYNC_POLL_DELAY 20
+
+/* Copy of a log or progress ty_message_data. Producers format log messages before they get
+   here, so the record holds the resulting string and not a format with its arguments. The
+   context and the message (or action) are stored back to back in text, both NUL-terminated,
+   so that a record fits in one queue slot and does not reference memory owned by the
+   caller. */
+struct message_record {
+    ty_task *task;
+    uint64_t progress_value;
+    uint64_t progress_max;
+    int16_t err;
+    uint8_t type;
+    uint8_t level;
+    uint16_t ctx_len;
+    uint16_t msg_len;
+    char text[472];
+};
+
+struct async_slot {
+    unsigned int sequence;
+    struct message_record record;
+};
+
+/* Bounded multi-producer queue, each slot sequence tells whether it is free for the producer
+   that reserved it (sequence == position) or ready for the drain thread (position + 1). The
+   drain thread is the only consumer. Producers never block: when the queue is full, messages
+   are counted and dropped. */
+static struct {
+    struct async_slot slots[ASYNC_QUEUE_SIZE];
+    unsigned int tail;
+    unsigned int head;
+    unsigned int dropped;
+
+    bool init;
+    unsigned int running;
+    unsigned int producers;
+    unsigned int sleeping;
+    bool stop;
+
+    ty_thread thread;
+    ty_mutex mutex;
+    ty_cond cond;
+} async_queue;
+
 const char *ty_version_string(void)
 {
     return TY_VERSION;
@@ -115,6 +173,20 @@ void ty_message_redirect(ty_message_func *f, void *udata)
     message_handler_udata = udata;
 }
 
+// Custom handlers and task callbacks may want messages that would not be printed
+static bool log_is_wanted(ty_log_level level)
+{
+    ty_task *task;
+
+    if (message_handler != ty_message_default_handler)
+        return true;
+    task = ty_task_get_current();
+    if (task && task->user_callback)
+        return true;
+
+    return log_level_is_enabled(level);
+}
+
 void ty_log(ty_log_level level, const char *fmt, ...)
 {
     assert(fmt);
@@ -123,6 +195,10 @@ void ty_log(ty_log_level level, const char *fmt, ...)
     char buf[sizeof(last_error_msg)];
     ty_message_data msg = {0};
 
+    // Debug messages are common in hot paths, don't format them for nothing
+    if (!log_is_wanted(level))
+        return;
+
     va_start(ap, fmt);
     vsnprintf(buf, sizeof(buf), fmt, ap);
     va_end(ap);
@@ -153,6 +229,7 @@ static const char *generic_error(int err)
         case TY_ERROR_RANGE: { return "Out of range error"; } break;
         case TY_ERROR_SYSTEM: { return "System error"; } break;
         case TY_ERROR_PARSE: { return "Parse error"; } break;
+        case TY_ERROR_CANCELED: { return "Canceled"; } break;
 
         case TY_ERROR_OTHER: {} break;
     }
@@ -222,6 +299,43 @@ int ty_error(ty_err err, const char *fmt, ...)
     return err;
 }
 
+void ty_progress_set_rate_limit(int interval, unsigned int delta)
+{
+    assert(delta <= 100);
+
+    progress_interval = interval;
+    progress_delta = delta;
+}
+
+static bool progress_is_due(const char *action, uint64_t value, uint64_t max)
+{
+    uint64_t now;
+
+    if (progress_interval <= 0 && !progress_delta)
+        return true;
+
+    now = ty_millis();
+
+    // Beginning and end of each operation always get through
+    if (!value || value == max || value < last_progress.value || max != last_progress.max ||
+            strcmp(action, last_progress.action) != 0)
+        goto due;
+    if (progress_interval > 0 && now - last_progress.time >= (uint64_t)progress_interval)
+        goto due;
+    if (progress_delta && (value - last_progress.value) * 100 / max >= progress_delta)
+        goto due;
+
+    return false;
+
+due:
+    strncpy(last_progress.action, action, sizeof(last_progress.action) - 1);
+    last_progress.action[sizeof(last_progress.action) - 1] = 0;
+    last_progress.value = value;
+    last_progress.max = max;
+    last_progress.time = now;
+    return true;
+}
+
 void ty_progress(const char *action, uint64_t value, uint64_t max)
 {
     assert(value <= max);
@@ -229,14 +343,302 @@ void ty_progress(const char *action, uint64_t value, uint64_t max)
 
     ty_message_data msg = {0};
 
+    if (!action)
+        action = "Processing";
+    if (!progress_is_due(action, value, max))
+        return;
+
     msg.type = TY_MESSAGE_PROGRESS;
-    msg.u.progress.action = action ? action : "Processing";
+    msg.u.progress.action = action;
     msg.u.progress.value = value;
     msg.u.progress.max = max;
 
     ty_message(&msg);
 }
 
+static void dispatch_message(const ty_message_data *msg)
+{
+    (*message_handler)(msg, message_handler_udata);
+    if (msg->task && msg->task->user_callback)
+        (*msg->task->user_callback)(msg, msg->task->user_callback_udata);
+}
+
+#ifdef _MSC_VER
+
+static unsigned int load_queue_value(unsigned int *ptr)
+{
+    return (unsigned int)InterlockedCompareExchange((LONG *)ptr, 0, 0);
+}
+
+static void store_queue_value(unsigned int *ptr, unsigned int value)
+{
+    InterlockedExchange((LONG *)ptr, (LONG)value);
+}
+
+static bool exchange_queue_value(unsigned int *ptr, unsigned int *rexpected, unsigned int value)
+{
+    unsigned int previous = (unsigned int)InterlockedCompareExchange((LONG *)ptr, (LONG)value,
+                                                                     (LONG)*rexpected);
+    if (previous == *rexpected)
+        return true;
+    *rexpected = previous;
+    return false;
+}
+
+static unsigned int take_queue_value(unsigned int *ptr)
+{
+    return (unsigned int)InterlockedExchange((LONG *)ptr, 0);
+}
+
+static void add_queue_value(unsigned int *ptr, int delta)
+{
+    InterlockedExchangeAdd((LONG *)ptr, delta);
+}
+
+static void set_queue_flag(unsigned int *ptr, bool value)
+{
+    InterlockedExchange((LONG *)ptr, value);
+}
+
+static bool get_queue_flag(unsigned int *ptr)
+{
+    return InterlockedCompareExchange((LONG *)ptr, 0, 0);
+}
+
+#else
+
+static unsigned int load_queue_value(unsigned int *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void store_queue_value(unsigned int *ptr, unsigned int value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static bool exchange_queue_value(unsigned int *ptr, unsigned int *rexpected, unsigned int value)
+{
+    return __atomic_compare_exchange_n(ptr, rexpected, value, true, __ATOMIC_RELAXED,
+                                       __ATOMIC_RELAXED);
+}
+
+static unsigned int take_queue_value(unsigned int *ptr)
+{
+    return __atomic_exchange_n(ptr, 0, __ATOMIC_ACQ_REL);
+}
+
+// Sequentially consistent, see async_thread_main(), ty_message_stop_async() and ty_message()
+static void add_queue_value(unsigned int *ptr, int delta)
+{
+    __atomic_add_fetch(ptr, (unsigned int)delta, __ATOMIC_SEQ_CST);
+}
+
+static void set_queue_flag(unsigned int *ptr, bool value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static bool get_queue_flag(unsigned int *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+static void pack_message(struct message_record *rec, const ty_message_data *msg)
+{
+    const char *ctx = msg->ctx ? msg->ctx : "";
+    const char *str = msg->type == TY_MESSAGE_LOG ? msg->u.log.msg : msg->u.progress.action;
+    size_t ctx_len, msg_len;
+
+    rec->task = msg->task ? ty_task_ref(msg->task) : NULL;
+    rec->type = (uint8_t)msg->type;
+    if (msg->type == TY_MESSAGE_LOG) {
+        rec->level = (uint8_t)msg->u.log.level;
+        rec->err = (int16_t)msg->u.log.err;
+    } else {
+        rec->progress_value = msg->u.progress.value;
+        rec->progress_max = msg->u.progress.max;
+    }
+
+    // Truncate the context first, the message matters more
+    msg_len = TY_MIN(strlen(str), sizeof(rec->text) - 2);
+    ctx_len = TY_MIN(strlen(ctx), sizeof(rec->text) - msg_len - 2);
+    memcpy(rec->text, ctx, ctx_len);
+    rec->text[ctx_len] = 0;
+    memcpy(rec->text + ctx_len + 1, str, msg_len);
+    rec->text[ctx_len + 1 + msg_len] = 0;
+    rec->ctx_len = (uint16_t)ctx_len;
+    rec->msg_len = (uint16_t)msg_len;
+}
+
+static void unpack_message(const struct message_record *rec, ty_message_data *rmsg)
+{
+    memset(rmsg, 0, sizeof(*rmsg));
+
+    rmsg->task = rec->task;
+    rmsg->ctx = rec->ctx_len ? rec->text : NULL;
+    rmsg->type = (ty_message_type)rec->type;
+    if (rmsg->type == TY_MESSAGE_LOG) {
+        rmsg->u.log.level = (ty_log_level)rec->level;
+        rmsg->u.log.err = rec->err;
+        rmsg->u.log.msg = rec->text + rec->ctx_len + 1;
+    } else {
+        rmsg->u.progress.action = rec->text + rec->ctx_len + 1;
+        rmsg->u.progress.value = rec->progress_value;
+        rmsg->u.progress.max = rec->progress_max;
+    }
+}
+
+static void push_async_message(const ty_message_data *msg)
+{
+    struct async_slot *slot;
+    unsigned int pos;
+
+    pos = load_queue_value(&async_queue.tail);
+    for (;;) {
+        int diff;
+
+        slot = &async_queue.slots[pos % ASYNC_QUEUE_SIZE];
+        diff = (int)(load_queue_value(&slot->sequence) - pos);
+
+        if (!diff) {
+            if (exchange_queue_value(&async_queue.tail, &pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            _ty_refcount_increase(&async_queue.dropped);
+            return;
+        } else {
+            pos = load_queue_value(&async_queue.tail);
+        }
+    }
+
+    pack_message(&slot->record, msg);
+    store_queue_value(&slot->sequence, pos + 1);
+
+    /* We can still miss the drain thread right as it goes to sleep, it polls the queue
+       regularly anyway. */
+    if (get_queue_flag(&async_queue.sleeping))
+        ty_cond_signal(&async_queue.cond);
+}
+
+static bool async_queue_is_empty(void)
+{
+    const struct async_slot *slot = &async_queue.slots[async_queue.head % ASYNC_QUEUE_SIZE];
+    return load_queue_value((unsigned int *)&slot->sequence) != async_queue.head + 1;
+}
+
+// Only one thread at a time, the drain thread or ty_message_stop_async() once it has exited
+static void drain_async_messages(void)
+{
+    unsigned int dropped;
+
+    while (!async_queue_is_empty()) {
+        struct async_slot *slot = &async_queue.slots[async_queue.head % ASYNC_QUEUE_SIZE];
+        ty_message_data msg;
+
+        unpack_message(&slot->record, &msg);
+        dispatch_message(&msg);
+        ty_task_unref(slot->record.task);
+
+        store_queue_value(&slot->sequence, async_queue.head + ASYNC_QUEUE_SIZE);
+        async_queue.head++;
+    }
+
+    dropped = take_queue_value(&async_queue.dropped);
+    if (dropped) {
+        ty_message_data msg = {0};
+        char buf[64];
+
+        snprintf(buf, sizeof(buf), "Dropped %u messages, the log queue was full", dropped);
+        msg.type = TY_MESSAGE_LOG;
+        msg.u.log.level = TY_LOG_WARNING;
+        msg.u.log.msg = buf;
+        dispatch_message(&msg);
+    }
+}
+
+static int async_thread_main(void *udata)
+{
+    TY_UNUSED(udata);
+
+    ty_mutex_lock(&async_queue.mutex);
+    while (!async_queue.stop) {
+        ty_mutex_unlock(&async_queue.mutex);
+        drain_async_messages();
+        ty_mutex_lock(&async_queue.mutex);
+
+        // Producers only signal the condition once they see the sleeping flag
+        set_queue_flag(&async_queue.sleeping, true);
+        if (!async_queue.stop && async_queue_is_empty())
+            ty_cond_wait(&async_queue.cond, &async_queue.mutex, ASYNC_POLL_DELAY);
+        set_queue_flag(&async_queue.sleeping, false);
+    }
+    ty_mutex_unlock(&async_queue.mutex);
+
+    return 0;
+}
+
+int ty_message_start_async(void)
+{
+    int r;
+
+    if (async_queue.running)
+        return 0;
+
+    if (!async_queue.init) {
+        for (unsigned int i = 0; i < ASYNC_QUEUE_SIZE; i++)
+            async_queue.slots[i].sequence = i;
+        async_queue.init = true;
+    }
+
+    r = ty_mutex_init(&async_queue.mutex);
+    if (r < 0)
+        return r;
+    r = ty_cond_init(&async_queue.cond);
+    if (r < 0)
+        goto error;
+
+    async_queue.stop = false;
+    r = ty_thread_create(&async_queue.thread, async_thread_main, NULL);
+    if (r < 0)
+        goto error;
+
+    set_queue_flag(&async_queue.running, true);
+    return 0;
+
+error:
+    ty_cond_release(&async_queue.cond);
+    ty_mutex_release(&async_queue.mutex);
+    return r;
+}
+
+void ty_message_stop_async(void)
+{
+    if (!async_queue.running)
+        return;
+
+    set_queue_flag(&async_queue.running, false);
+
+    /* Producers that saw the queue running may still be pushing their message, and nobody
+       would drain it after we are done. New producers see it stopped and don't come in. */
+    while (get_queue_flag(&async_queue.producers))
+        ty_delay(1);
+
+    ty_mutex_lock(&async_queue.mutex);
+    async_queue.stop = true;
+    ty_cond_signal(&async_queue.cond);
+    ty_mutex_unlock(&async_queue.mutex);
+    ty_thread_join(&async_queue.thread);
+
+    // Deliver what was queued after the last pass of the drain thread
+    drain_async_messages();
+
+    ty_cond_release(&async_queue.cond);
+    ty_mutex_release(&async_queue.mutex);
+}
+
 void ty_message(ty_message_data *msg)
 {
     ty_task *task = msg->task;
@@ -247,9 +649,20 @@ void ty_message(ty_message_data *msg)
     if (!msg->ctx && task)
         msg->ctx = task->name;
 
-    (*message_handler)(msg, message_handler_udata);
-    if (task && task->user_callback)
-        (*task->user_callback)(msg, task->user_callback_udata);
+    /* Status changes stay synchronous, callers rely on them to track tasks. Logs and
+       progress updates can wait, printing them takes time away from the caller. */
+    if (msg->type != TY_MESSAGE_STATUS && get_queue_flag(&async_queue.running)) {
+        // Check again once registered, ty_message_stop_async() only waits for registered producers
+        add_queue_value(&async_queue.producers, 1);
+        if (get_queue_flag(&async_queue.running)) {
+            push_async_message(msg);
+            add_queue_value(&async_queue.producers, -1);
+            return;
+        }
+        add_queue_value(&async_queue.producers, -1);
+    }
+
+    dispatch_message(msg);
 }
 
 int ty_libhs_translate_error(int err)
@@ -315,3 +728,21 @@ unsigned int _ty_refcount_decrease(unsigned int *rrefcount)
     return 0;
 #endif
 }
+
+void _ty_counter_add(uint64_t *rcounter, uint64_t value)
+{
+#ifdef _MSC_VER
+    InterlockedExchangeAdd64((LONG64 *)rcounter, (LONG64)value);
+#else
+    __atomic_add_fetch(rcounter, value, __ATOMIC_RELAXED);
+#endif
+}
+
+uint64_t _ty_counter_get(const uint64_t *rcounter)
+{
+#ifdef _MSC_VER
+    return (uint64_t)InterlockedCompareExchange64((LONG64 *)rcounter, 0, 0);
+#else
+    return __atomic_load_n(rcounter, __ATOMIC_RELAXED);
+#endif
+}
@@ -113,7 +113,8 @@ typedef enum ty_err {
     TY_ERROR_RANGE         = -11,
     TY_ERROR_SYSTEM        = -12,
     TY_ERROR_PARSE         = -13,
-    TY_ERROR_OTHER         = -14
+    TY_ERROR_OTHER         = -14,
+    TY_ERROR_CANCELED      = -15
 } ty_err;
 
 typedef enum ty_message_type {
@@ -160,12 +161,21 @@ typedef struct ty_message_data {
 
 typedef void ty_message_func(const ty_message_data *msg, void *udata);
 
+typedef struct ty_message_batch ty_message_batch;
+typedef void ty_message_batch_func(const ty_message_data *msgs, unsigned int count, void *udata);
+
 TY_PUBLIC extern int ty_config_verbosity;
 
 TY_PUBLIC const char *ty_version_string(void);
 
 TY_PUBLIC void ty_message_default_handler(const ty_message_data *msg, void *udata);
 TY_PUBLIC void ty_message_redirect(ty_message_func *f, void *udata);
+/* Hand logs and progress updates over to a separate thread, so that slow handlers (e.g.
+   terminal output) don't get in the way of timing-sensitive I/O. Messages are still formatted
+   by the caller, only delivery is deferred. Stopping delivers every message queued before
+   it returns. */
+TY_PUBLIC int ty_message_start_async(void);
+TY_PUBLIC void ty_message_stop_async(void);
 
 TY_PUBLIC void ty_error_mask(ty_err err);
 TY_PUBLIC void ty_error_unmask(void);
@@ -177,6 +187,19 @@ TY_PUBLIC void ty_message(ty_message_data *msg);
 TY_PUBLIC void ty_log(ty_log_level level, const char *fmt, ...) TY_PRINTF_FORMAT(2, 3);
 TY_PUBLIC int ty_error(ty_err err, const char *fmt, ...) TY_PRINTF_FORMAT(2, 3);
 TY_PUBLIC void ty_progress(const char *action, uint64_t value, uint64_t max);
+/* Progress updates are dropped unless interval milliseconds have passed, or the progress has
+   moved by at least delta percent, since the last one. The first and last updates (0% and 100%)
+   always get through. Use 0 to disable either limit. Defaults to 100 ms and 5%. */
+TY_PUBLIC void ty_progress_set_rate_limit(int interval, unsigned int delta);
+
+/* Consumers watching many tasks can set ty_message_batch_add() as their user_callback (with
+   the batch as udata), and get all the messages at once from their own thread with
+   ty_message_batch_flush(). Consecutive progress updates from a task are merged. */
+TY_PUBLIC int ty_message_batch_new(ty_message_batch **rbatch);
+TY_PUBLIC void ty_message_batch_free(ty_message_batch *batch);
+TY_PUBLIC void ty_message_batch_add(const ty_message_data *msg, void *udata);
+TY_PUBLIC unsigned int ty_message_batch_flush(ty_message_batch *batch, ty_message_batch_func *f,
+                                              void *udata);
 
 TY_PUBLIC int ty_libhs_translate_error(int err);
 TY_PUBLIC void ty_libhs_log_handler(hs_log_level level, int err, const char *log, void *udata);
@@ -14,7 +14,33 @@
 #include "common.h"
 #include "compat_priv.h"
 
+struct ty_mutex;
+struct ty_cond;
+
 void _ty_refcount_increase(unsigned int *rrefcount);
 unsigned int _ty_refcount_decrease(unsigned int *rrefcount);
 
+// Relaxed statistics counters, cheap enough for I/O paths
+void _ty_counter_add(uint64_t *rcounter, uint64_t value);
+uint64_t _ty_counter_get(const uint64_t *rcounter);
+
+// Let the next thread reuse the trace ring of the current one, call it before the thread exits
+void _ty_trace_release_thread(void);
+
+/* Blocked tasks can be started, but they only get to run once every _ty_task_block()
+   call has been matched by _ty_task_unblock(). */
+void _ty_task_block(struct ty_task *task);
+void _ty_task_unblock(struct ty_task *task);
+bool _ty_task_interrupted(void);
+// Clamp poll timeouts to the task deadline, cond waits use _ty_task_set_wait() instead
+int _ty_task_adjust_timeout(int timeout);
+/* Let ty_task_cancel() wake up the current task while it waits on cond. Call
+   _ty_task_set_wait() before locking mutex, and _ty_task_clear_wait() once it is unlocked. */
+void _ty_task_set_wait(struct ty_mutex *mutex, struct ty_cond *cond);
+void _ty_task_clear_wait(void);
+
+/* Board tasks run one at a time in creation order. Returns true if task is queued before
+   other on the same board, in which case task cannot wait for other. */
+bool _ty_board_task_precedes(const struct ty_task *task, const struct ty_task *other);
+
 #endif
@@ -0,0 +1,206 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "../libhs/array.h"
+#include "task.h"
+#include "thread.h"
+
+/* Strings are copied to a single buffer, which may move while messages are added. Message
+   pointers are only resolved when the batch is flushed. */
+struct batch_strings {
+    size_t ctx;
+    size_t str;
+};
+
+struct ty_message_batch {
+    ty_mutex mutex;
+
+    _HS_ARRAY(ty_message_data) msgs;
+    _HS_ARRAY(struct batch_strings) offsets;
+    _HS_ARRAY(char) strings;
+};
+
+int ty_message_batch_new(ty_message_batch **rbatch)
+{
+    assert(rbatch);
+
+    ty_message_batch *batch;
+    int r;
+
+    batch = calloc(1, sizeof(*batch));
+    if (!batch)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    r = ty_mutex_init(&batch->mutex);
+    if (r < 0) {
+        free(batch);
+        return r;
+    }
+
+    *rbatch = batch;
+    return 0;
+}
+
+static void release_batch_messages(ty_message_data *msgs, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        ty_task_unref(msgs[i].task);
+}
+
+void ty_message_batch_free(ty_message_batch *batch)
+{
+    if (batch) {
+        release_batch_messages(batch->msgs.values, batch->msgs.count);
+        _hs_array_release(&batch->msgs);
+        _hs_array_release(&batch->offsets);
+        _hs_array_release(&batch->strings);
+
+        ty_mutex_release(&batch->mutex);
+    }
+
+    free(batch);
+}
+
+static size_t copy_batch_string(ty_message_batch *batch, const char *str)
+{
+    size_t offset, len;
+
+    if (!str)
+        return SIZE_MAX;
+
+    len = strlen(str) + 1;
+    if (_hs_array_grow(&batch->strings, len) < 0)
+        return SIZE_MAX;
+
+    offset = batch->strings.count;
+    memcpy(batch->strings.values + offset, str, len);
+    batch->strings.count += len;
+
+    return offset;
+}
+
+// Consecutive progress updates only matter to the consumer for the last value
+static bool merge_batch_progress(ty_message_batch *batch, const ty_message_data *msg)
+{
+    for (size_t i = batch->msgs.count; i-- > 0;) {
+        ty_message_data *prev = &batch->msgs.values[i];
+        size_t action;
+
+        if (prev->task != msg->task)
+            continue;
+        if (prev->type != TY_MESSAGE_PROGRESS)
+            return false;
+
+        action = batch->offsets.values[i].str;
+        if (strcmp(batch->strings.values + action, msg->u.progress.action) != 0)
+            return false;
+
+        prev->u.progress.value = msg->u.progress.value;
+        prev->u.progress.max = msg->u.progress.max;
+        return true;
+    }
+
+    return false;
+}
+
+void ty_message_batch_add(const ty_message_data *msg, void *udata)
+{
+    assert(msg);
+    assert(udata);
+
+    ty_message_batch *batch = udata;
+    struct batch_strings offsets;
+    size_t strings_count;
+
+    ty_mutex_lock(&batch->mutex);
+
+    if (msg->type == TY_MESSAGE_PROGRESS && merge_batch_progress(batch, msg))
+        goto cleanup;
+
+    /* We can't report errors from here: ty_error() would call us again. Without memory,
+       the message is simply lost. */
+    if (_hs_array_grow(&batch->msgs, 1) < 0 || _hs_array_grow(&batch->offsets, 1) < 0)
+        goto cleanup;
+
+    strings_count = batch->strings.count;
+    offsets.ctx = copy_batch_string(batch, msg->ctx);
+    offsets.str = SIZE_MAX;
+    switch (msg->type) {
+        case TY_MESSAGE_LOG: {
+            offsets.str = copy_batch_string(batch, msg->u.log.msg);
+        } break;
+        case TY_MESSAGE_PROGRESS: {
+            offsets.str = copy_batch_string(batch, msg->u.progress.action);
+        } break;
+        case TY_MESSAGE_STATUS: {
+        } break;
+    }
+    if ((msg->ctx && offsets.ctx == SIZE_MAX) ||
+            (msg->type != TY_MESSAGE_STATUS && offsets.str == SIZE_MAX)) {
+        batch->strings.count = strings_count;
+        goto cleanup;
+    }
+
+    batch->msgs.values[batch->msgs.count++] = *msg;
+    batch->offsets.values[batch->offsets.count++] = offsets;
+    if (msg->task)
+        ty_task_ref(msg->task);
+
+cleanup:
+    ty_mutex_unlock(&batch->mutex);
+}
+
+unsigned int ty_message_batch_flush(ty_message_batch *batch, ty_message_batch_func *f,
+                                    void *udata)
+{
+    assert(batch);
+    assert(f);
+
+    _HS_ARRAY(ty_message_data) msgs;
+    _HS_ARRAY(struct batch_strings) offsets;
+    _HS_ARRAY(char) strings;
+    unsigned int count;
+
+    // Producers can keep adding messages while the consumer goes through these ones
+    ty_mutex_lock(&batch->mutex);
+    _hs_array_move(&batch->msgs, &msgs);
+    _hs_array_move(&batch->offsets, &offsets);
+    _hs_array_move(&batch->strings, &strings);
+    ty_mutex_unlock(&batch->mutex);
+
+    for (size_t i = 0; i < msgs.count; i++) {
+        ty_message_data *msg = &msgs.values[i];
+        const struct batch_strings *off = &offsets.values[i];
+
+        msg->ctx = off->ctx != SIZE_MAX ? strings.values + off->ctx : NULL;
+        switch (msg->type) {
+            case TY_MESSAGE_LOG: {
+                msg->u.log.msg = strings.values + off->str;
+            } break;
+            case TY_MESSAGE_PROGRESS: {
+                msg->u.progress.action = strings.values + off->str;
+            } break;
+            case TY_MESSAGE_STATUS: {
+            } break;
+        }
+    }
+
+    count = (unsigned int)msgs.count;
+    if (count)
+        (*f)(msgs.values, count, udata);
+
+    release_batch_messages(msgs.values, msgs.count);
+    _hs_array_release(&msgs);
+    _hs_array_release(&offsets);
+    _hs_array_release(&strings);
+
+    return count;
+}
@@ -17,29 +17,62 @@
 #include "monitor.h"
 #include "system.h"
 #include "timer.h"
+#include "trace.h"
 
 struct callback {
     int id;
     ty_monitor_callback_func *f;
     void *udata;
+
+    // Filters, see ty_monitor_filter
+    unsigned int events;
+    ty_board_matcher *matcher;
+    ty_model *models;
+    unsigned int models_count;
+    ty_board *board;
+};
+
+struct pending_event {
+    ty_board *board;
+    ty_board_status previous_status;
 };
 
 struct ty_monitor {
     int drop_delay;
+    bool attach_serial;
+    bool coalesce_tasks;
+
+    bool batch_events;
+    int batch_delay;
+    _HS_ARRAY(struct pending_event) pending_events;
+    ty_timer *batch_timer;
 
     bool started;
     hs_monitor *device_monitor;
-    ty_timer *timer;
-    bool timer_running;
+    ty_timer_queue *drop_queue;
 
     _HS_ARRAY(struct callback) callbacks;
     int current_callback_id;
 
     ty_mutex refresh_mutex;
     ty_cond refresh_cond;
+    unsigned int refresh_waiters;
+    _HS_ARRAY(ty_board *) wake_boards;
+    bool wake_all;
     int refresh_callback_ret;
+    ty_monitor_stats stats;
+
+    // Hotplug stages of the device being processed, see ty_board_hotplug_timing
+    uint64_t refresh_start;
+    uint64_t event_time;
+    uint64_t device_time;
 
     _HS_ARRAY(ty_board *) boards;
+    uint64_t board_sequence;
+    bool boards_unsorted;
+    _hs_htable boards_by_location;
+    _hs_htable boards_by_serial;
+    _hs_htable boards_by_tag;
     _hs_htable ifaces;
 
     ty_thread_id main_thread_id;
@@ -47,49 +80,342 @@ struct ty_monitor {
 
 #define DROP_BOARD_DELAY 15000
 
-static int change_board_status(ty_board *board, ty_board_status status, ty_monitor_event event)
+static void release_callback(struct callback *callback)
 {
-    ty_monitor *monitor = board->monitor;
-    int r = 0;
+    ty_board_matcher_free(callback->matcher);
+    free(callback->models);
+    ty_board_unref(callback->board);
+}
 
-    // Set new board status, engage drop timer if needed
-    if (status == TY_BOARD_STATUS_MISSING && status != board->status) {
-        board->status = TY_BOARD_STATUS_MISSING;
-        board->missing_since = ty_millis();
+static void remove_board_callbacks(ty_monitor *monitor, ty_board *board)
+{
+    for (size_t i = monitor->callbacks.count; i-- > 0;) {
+        if (monitor->callbacks.values[i].board == board) {
+            release_callback(&monitor->callbacks.values[i]);
+            _hs_array_remove(&monitor->callbacks, i, 1);
+        }
+    }
+}
 
-        if (!monitor->timer_running) {
-            int timer_delay = ty_adjust_timeout(monitor->drop_delay, board->missing_since);
-            r = ty_timer_set(monitor->timer, timer_delay, TY_TIMER_ONESHOT);
-            if (r < 0)
-                return r;
-            monitor->timer_running = true;
+static bool match_callback(const struct callback *callback, ty_board *board,
+                           ty_monitor_event event)
+{
+    if (!(callback->events & (1u << event)))
+        return false;
+    if (callback->board && callback->board != board)
+        return false;
+    if (callback->models_count) {
+        unsigned int i;
+        for (i = 0; i < callback->models_count; i++) {
+            if (callback->models[i] == board->model)
+                break;
         }
-    } else {
-        board->status = status;
+        if (i == callback->models_count)
+            return false;
     }
+    if (callback->matcher && !ty_board_matcher_match(callback->matcher, board))
+        return false;
+
+    return true;
+}
+
+static int notify_callbacks(ty_monitor *monitor, ty_board *board, ty_monitor_event event)
+{
+    int r = 0;
 
     /* Notify callbacks and do some additional stuff as we go:
-       - Drop callback that return r > 0
+       - Drop callback that return r > 0, and board callbacks when the board is dropped
        - Stop calling them is one returns r < 0 */
     size_t remove_count = 0;
     for (size_t i = 0; i < monitor->callbacks.count; i++) {
         struct callback *callback_it = &monitor->callbacks.values[i - remove_count];
+        bool remove = false;
+
         if (remove_count)
             *callback_it = monitor->callbacks.values[i];
 
-        if (!r) {
+        if (!r && match_callback(callback_it, board, event)) {
             r = (*callback_it->f)(board, event, callback_it->udata);
             if (r > 0) {
-                remove_count++;
+                remove = true;
                 r = 0;
             }
         }
+        if (event == TY_MONITOR_EVENT_DROPPED && callback_it->board == board)
+            remove = true;
+
+        if (remove) {
+            release_callback(callback_it);
+            remove_count++;
+        }
     }
     monitor->callbacks.count -= remove_count;
 
     return r;
 }
 
+static int queue_board_event(ty_monitor *monitor, ty_board *board, ty_board_status previous_status)
+{
+    int r;
+
+    // Only the status at the beginning of the batch matters, see flush_board_events()
+    for (size_t i = 0; i < monitor->pending_events.count; i++) {
+        if (monitor->pending_events.values[i].board == board)
+            goto arm;
+    }
+
+    struct pending_event pending = {
+        .board = ty_board_ref(board),
+        .previous_status = previous_status
+    };
+    r = _hs_array_push(&monitor->pending_events, pending);
+    if (r < 0) {
+        ty_board_unref(board);
+        return ty_libhs_translate_error(r);
+    }
+
+arm:
+    // Restart the debounce window
+    if (monitor->batch_delay > 0) {
+        r = ty_timer_set(monitor->batch_timer, monitor->batch_delay, TY_TIMER_ONESHOT);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+static void start_board_hotplug(ty_monitor *monitor, ty_board *board)
+{
+    ty_mutex_lock(&monitor->refresh_mutex);
+    board->hotplug.event = monitor->event_time;
+    board->hotplug.device = monitor->device_time;
+    board->hotplug.board = ty_micros();
+    board->hotplug.callbacks = 0;
+    board->hotplug.wakeup = 0;
+    ty_mutex_unlock(&monitor->refresh_mutex);
+}
+
+static void finish_board_hotplug(ty_monitor *monitor, ty_board *board)
+{
+    ty_board_hotplug_timing timing;
+
+    ty_mutex_lock(&monitor->refresh_mutex);
+    board->hotplug.callbacks = ty_micros();
+    timing = board->hotplug;
+    ty_mutex_unlock(&monitor->refresh_mutex);
+
+    ty_log(TY_LOG_DEBUG, "Hotplug of board '%s': device +%" PRIu64 " us, board +%" PRIu64
+                         " us, callbacks +%" PRIu64 " us",
+           board->tag, timing.device - timing.event, timing.board - timing.device,
+           timing.callbacks - timing.board);
+}
+
+static int flush_board_events(ty_monitor *monitor)
+{
+    _HS_ARRAY(struct pending_event) pending_events;
+    int r = 0;
+
+    _hs_array_move(&monitor->pending_events, &pending_events);
+
+    /* Each board gets one event describing the difference between its status at the
+       beginning of the batch and its current status. Boards created with a status other
+       than ONLINE are the only exception, consumers get ADDED followed by DISAPPEARED. */
+    for (size_t i = 0; i < pending_events.count; i++) {
+        ty_board *board = pending_events.values[i].board;
+        ty_board_status previous_status = pending_events.values[i].previous_status;
+
+        if (!r) {
+            switch (board->status) {
+                case TY_BOARD_STATUS_ONLINE: {
+                    if (previous_status == TY_BOARD_STATUS_DROPPED) {
+                        r = notify_callbacks(monitor, board, TY_MONITOR_EVENT_ADDED);
+                    } else {
+                        r = notify_callbacks(monitor, board, TY_MONITOR_EVENT_CHANGED);
+                    }
+                } break;
+
+                case TY_BOARD_STATUS_MISSING: {
+                    if (previous_status == TY_BOARD_STATUS_DROPPED)
+                        r = notify_callbacks(monitor, board, TY_MONITOR_EVENT_ADDED);
+                    if (!r && previous_status != TY_BOARD_STATUS_MISSING)
+                        r = notify_callbacks(monitor, board, TY_MONITOR_EVENT_DISAPPEARED);
+                } break;
+
+                case TY_BOARD_STATUS_DROPPED: {
+                    // Nobody knows about boards created and dropped in the same batch
+                    if (previous_status != TY_BOARD_STATUS_DROPPED)
+                        r = notify_callbacks(monitor, board, TY_MONITOR_EVENT_DROPPED);
+                } break;
+            }
+        }
+
+        if (board->hotplug.board && !board->hotplug.callbacks)
+            finish_board_hotplug(monitor, board);
+
+        ty_board_unref(board);
+    }
+    _hs_array_release(&pending_events);
+
+    return r;
+}
+
+static void queue_board_wakeup(ty_monitor *monitor, ty_board *board)
+{
+    int r;
+
+    if (board->wait_pending)
+        return;
+
+    r = _hs_array_push(&monitor->wake_boards, board);
+    if (r < 0) {
+        // Waking up everyone is slower, but nobody gets stuck
+        monitor->wake_all = true;
+        return;
+    }
+    ty_board_ref(board);
+    board->wait_pending = true;
+}
+
+static void wake_waiters(ty_monitor *monitor)
+{
+    _HS_ARRAY(ty_board *) wake_boards;
+
+    /* Threads blocked in ty_board_wait_for() only need to wake up when their board changes,
+       instead of re-evaluating their condition after every refresh. The waiter count is
+       only stable under the mutex, a waiter may be about to sleep. */
+    ty_mutex_lock(&monitor->refresh_mutex);
+    if (!monitor->wake_boards.count && !monitor->wake_all && !monitor->refresh_waiters) {
+        ty_mutex_unlock(&monitor->refresh_mutex);
+        return;
+    }
+    for (size_t i = 0; i < monitor->wake_boards.count; i++) {
+        ty_board *board = monitor->wake_boards.values[i];
+
+        ty_cond_broadcast(&board->wait_cond);
+        board->wait_pending = false;
+    }
+    if (monitor->wake_all) {
+        for (size_t i = 0; i < monitor->boards.count; i++)
+            ty_cond_broadcast(&monitor->boards.values[i]->wait_cond);
+        monitor->wake_all = false;
+    }
+    if (monitor->refresh_waiters)
+        ty_cond_broadcast(&monitor->refresh_cond);
+    _hs_array_move(&monitor->wake_boards, &wake_boards);
+    ty_mutex_unlock(&monitor->refresh_mutex);
+
+    for (size_t i = 0; i < wake_boards.count; i++)
+        ty_board_unref(wake_boards.values[i]);
+    _hs_array_release(&wake_boards);
+}
+
+static int change_board_status(ty_board *board, ty_board_status status, ty_monitor_event event)
+{
+    ty_monitor *monitor = board->monitor;
+    ty_board_status previous_status = board->status;
+    int r;
+
+    queue_board_wakeup(monitor, board);
+
+    // Set new board status, schedule or cancel drop if needed
+    if (status == TY_BOARD_STATUS_MISSING && status != board->status) {
+        board->status = TY_BOARD_STATUS_MISSING;
+        board->missing_since = ty_millis();
+
+        r = ty_timer_queue_add(monitor->drop_queue, &board->drop_entry,
+                               board->missing_since + (uint64_t)monitor->drop_delay);
+        if (r < 0)
+            return r;
+    } else {
+        if (status != TY_BOARD_STATUS_MISSING)
+            ty_timer_queue_remove(monitor->drop_queue, &board->drop_entry);
+        board->status = status;
+    }
+
+    if (monitor->batch_events)
+        return queue_board_event(monitor, board, previous_status);
+
+    return notify_callbacks(monitor, board, event);
+}
+
+static int index_board(_hs_htable *table, uint32_t *rhash, uint32_t hash, ty_board *board)
+{
+    int r;
+
+    if (*rhash) {
+        _hs_htable_remove(table, *rhash, board);
+        *rhash = 0;
+    }
+    if (hash) {
+        r = _hs_htable_add(table, hash, board);
+        if (r < 0)
+            return ty_libhs_translate_error(r);
+        *rhash = hash;
+    }
+
+    return 0;
+}
+
+static int index_board_id(ty_monitor *monitor, ty_board *board)
+{
+    _ty_board_parse_id(board);
+
+    return index_board(&monitor->boards_by_serial, &board->monitor_serial_hash,
+                       _ty_board_hash_id_part(&board->id_parts[0]), board);
+}
+
+int _ty_monitor_index_board_tag(ty_board *board)
+{
+    ty_monitor *monitor = board->monitor;
+
+    return index_board(&monitor->boards_by_tag, &board->monitor_tag_hash,
+                       board->tag != board->id ? _hs_htable_hash_str(board->tag) : 0, board);
+}
+
+static int compare_board_sequences(const void *a, const void *b)
+{
+    const ty_board *board1 = *(const ty_board **)a;
+    const ty_board *board2 = *(const ty_board **)b;
+
+    return (board1->monitor_sequence > board2->monitor_sequence) -
+           (board1->monitor_sequence < board2->monitor_sequence);
+}
+
+// Restore discovery order once, instead of on every removal
+static void sort_boards(ty_monitor *monitor)
+{
+    if (!monitor->boards_unsorted)
+        return;
+
+    qsort(monitor->boards.values, monitor->boards.count, sizeof(*monitor->boards.values),
+          compare_board_sequences);
+    for (size_t i = 0; i < monitor->boards.count; i++)
+        monitor->boards.values[i]->monitor_index = i;
+    monitor->boards_unsorted = false;
+}
+
+static void unindex_board(ty_monitor *monitor, ty_board *board)
+{
+    /* Move the last board into the hole, ty_monitor_list() and ty_monitor_find() sort
+       the boards back into discovery order before they walk them. */
+    if (board->monitor_index < monitor->boards.count - 1) {
+        ty_board *last = monitor->boards.values[monitor->boards.count - 1];
+
+        monitor->boards.values[board->monitor_index] = last;
+        last->monitor_index = board->monitor_index;
+        monitor->boards_unsorted = true;
+    }
+    _hs_array_pop(&monitor->boards, 1);
+
+    index_board(&monitor->boards_by_location, &board->monitor_location_hash, 0, board);
+    index_board(&monitor->boards_by_serial, &board->monitor_serial_hash, 0, board);
+    index_board(&monitor->boards_by_tag, &board->monitor_tag_hash, 0, board);
+
+    // Batched events may never report the board as dropped, don't wait for that
+    remove_board_callbacks(monitor, board);
+}
+
 static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board **rboard)
 {
     ty_board *board;
@@ -109,6 +435,12 @@ static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board
     }
 
     r = ty_mutex_init(&board->ifaces_lock);
+    if (r < 0)
+        goto error;
+    r = ty_mutex_init(&board->tasks_lock);
+    if (r < 0)
+        goto error;
+    r = ty_cond_init(&board->wait_cond);
     if (r < 0)
         goto error;
 
@@ -126,10 +458,21 @@ static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board
         r = ty_libhs_translate_error(r);
         goto error;
     }
+    board->monitor_index = monitor->boards.count - 1;
+    board->monitor_sequence = monitor->board_sequence++;
+    r = index_board(&monitor->boards_by_location, &board->monitor_location_hash,
+                    _hs_htable_hash_str(board->location), board);
+    if (r < 0)
+        goto unindex;
+    r = index_board_id(monitor, board);
+    if (r < 0)
+        goto unindex;
 
     *rboard = board;
     return 1;
 
+unindex:
+    unindex_board(monitor, board);
 error:
     ty_board_unref(board);
     return r;
@@ -154,8 +497,11 @@ static int close_board(ty_board *board)
     for (size_t i = 0; i < ifaces.count; i++) {
         ty_board_interface *iface_it = ifaces.values[i];
 
-        if (iface_it->monitor_hnode.next)
-            _hs_htable_remove(&iface_it->monitor_hnode);
+        _ty_board_interface_detach(iface_it);
+        if (iface_it->monitor_hash) {
+            _hs_htable_remove(&board->monitor->ifaces, iface_it->monitor_hash, iface_it);
+            iface_it->monitor_hash = 0;
+        }
         ty_board_interface_unref(iface_it);
     }
     _hs_array_release(&ifaces);
@@ -170,21 +516,18 @@ static void drop_board(ty_board *board)
     // Change board status
     change_board_status(board, TY_BOARD_STATUS_DROPPED, TY_MONITOR_EVENT_DROPPED);
 
-    // Remove this board from the monitor list
+    // Remove this board from the monitor list and indexes
+    unindex_board(monitor, board);
     board->monitor = NULL;
-    for (size_t i = 0; i < monitor->boards.count; i++) {
-        if (monitor->boards.values[i] == board)
-            _hs_array_remove(&monitor->boards, i, 1);
-    }
 }
 
 static ty_board *find_monitor_board(ty_monitor *monitor, const char *location)
 {
-    for (size_t i = 0; i < monitor->boards.count; i++) {
-        ty_board *board_it = monitor->boards.values[i];
+    _hs_htable_foreach_hash(cur, &monitor->boards_by_location, _hs_htable_hash_str(location)) {
+        ty_board *board = cur;
 
-        if (strcmp(board_it->location, location) == 0)
-            return board_it;
+        if (strcmp(board->location, location) == 0)
+            return board;
     }
 
     return NULL;
@@ -192,8 +535,8 @@ static ty_board *find_monitor_board(ty_monitor *monitor, const char *location)
 
 static ty_board_interface *find_monitor_interface(ty_monitor *monitor, hs_device *dev)
 {
-   _hs_htable_foreach_hash(cur, &monitor->ifaces, _hs_htable_hash_ptr(dev)) {
-        ty_board_interface *iface = ty_container_of(cur, ty_board_interface, monitor_hnode);
+    _hs_htable_foreach_hash(cur, &monitor->ifaces, _hs_htable_hash_ptr(dev)) {
+        ty_board_interface *iface = cur;
 
         if (iface->dev == dev)
             return iface;
@@ -219,11 +562,17 @@ static int open_new_interface(hs_device *dev, ty_board_interface **riface)
         goto error;
     }
     iface->refcount = 1;
+    iface->appear_time = ty_millis();
 
     r = ty_mutex_init(&iface->open_lock);
+    if (r < 0)
+        goto error;
+    r = ty_mutex_init(&iface->attach_lock);
     if (r < 0)
         goto error;
     iface->dev = hs_device_ref(dev);
+    // Resolve the device node once, so that tag matching does not need to do it again
+    ty_path_get_key(dev->path, &iface->path_key);
 
     ty_error_mask(TY_ERROR_NOT_FOUND);
     r = (*class_vtable->load_interface)(iface);
@@ -261,6 +610,8 @@ static int update_or_create_board(ty_monitor *monitor, ty_board_interface *iface
             return r;
         if (update_tag_pointer)
             board->tag = board->id;
+        // The class may have changed the board id
+        index_board_id(monitor, board);
 
         /* The class function update_board() returns 1 if the interface is compatible with
            this board, or 0 if not. In the latter case, the old board is dropped and a new
@@ -318,8 +669,14 @@ static int register_interface(ty_board *board, ty_board_interface *iface)
         r = ty_libhs_translate_error(r);
         goto cleanup;
     }
-    _hs_htable_add(&board->monitor->ifaces, _hs_htable_hash_ptr(iface->dev),
-                   &iface->monitor_hnode);
+    r = _hs_htable_add(&board->monitor->ifaces, _hs_htable_hash_ptr(iface->dev), iface);
+    if (r < 0) {
+        _hs_array_pop(&board->ifaces, 1);
+        ty_board_interface_unref(iface);
+        r = ty_libhs_translate_error(r);
+        goto cleanup;
+    }
+    iface->monitor_hash = _hs_htable_hash_ptr(iface->dev);
 
     // Update board capabilities
     for (int i = 0; i < (int)TY_COUNTOF(board->cap2iface); i++) {
@@ -334,6 +691,38 @@ cleanup:
     return r;
 }
 
+static void attach_interface(ty_monitor *monitor, ty_board *board, ty_board_interface *iface)
+{
+    bool attach;
+    int r;
+
+    if (!(iface->capabilities & (1 << TY_BOARD_CAPABILITY_SERIAL)))
+        return;
+
+    // Boards coming back from an upload ask for this once, see ty_upload()
+    ty_mutex_lock(&board->ifaces_lock);
+    attach = monitor->attach_serial || board->attach_serial;
+    board->attach_serial = false;
+    ty_mutex_unlock(&board->ifaces_lock);
+    if (!attach)
+        return;
+
+    // Failure to attach is not fatal, the interface can still be opened later
+    ty_error_mask(TY_ERROR_ACCESS);
+    ty_error_mask(TY_ERROR_BUSY);
+    ty_error_mask(TY_ERROR_IO);
+    ty_error_mask(TY_ERROR_SYSTEM);
+    r = _ty_board_interface_attach(iface);
+    ty_error_unmask();
+    ty_error_unmask();
+    ty_error_unmask();
+    ty_error_unmask();
+
+    if (r < 0)
+        ty_log(TY_LOG_WARNING, "Cannot attach to '%s' early, its first output may be lost: %s",
+               iface->dev->path, ty_error_last_message());
+}
+
 static int add_interface_for_device(ty_monitor *monitor, hs_device *dev)
 {
     ty_board_interface *iface = NULL;
@@ -351,7 +740,17 @@ static int add_interface_for_device(ty_monitor *monitor, hs_device *dev)
     if (r < 0)
         goto error;
 
-    return change_board_status(board, TY_BOARD_STATUS_ONLINE, event);
+    attach_interface(monitor, board, iface);
+
+    if (board->status == TY_BOARD_STATUS_MISSING)
+        _ty_counter_add(&board->stats.reconnects, 1);
+
+    start_board_hotplug(monitor, board);
+    r = change_board_status(board, TY_BOARD_STATUS_ONLINE, event);
+    if (!monitor->batch_events)
+        finish_board_hotplug(monitor, board);
+
+    return r;
 
 error:
     if (event == TY_MONITOR_EVENT_ADDED)
@@ -372,8 +771,11 @@ static int remove_interface_with_device(ty_monitor *monitor, hs_device *dev)
         return 0;
     board = iface->board;
 
+    _ty_board_interface_detach(iface);
+
     // Unregister from monitor
-    _hs_htable_remove(&iface->monitor_hnode);
+    _hs_htable_remove(&monitor->ifaces, iface->monitor_hash, iface);
+    iface->monitor_hash = 0;
     ty_board_interface_unref(iface);
 
     ty_mutex_lock(&board->ifaces_lock);
@@ -401,11 +803,14 @@ static int remove_interface_with_device(ty_monitor *monitor, hs_device *dev)
     ty_mutex_unlock(&board->ifaces_lock);
 
     // Change status and trigger callbacks
+    start_board_hotplug(monitor, board);
     if (!board->ifaces.count) {
         r = close_board(board);
     } else {
         r = change_board_status(board, TY_BOARD_STATUS_ONLINE, TY_MONITOR_EVENT_CHANGED);
     }
+    if (!monitor->batch_events)
+        finish_board_hotplug(monitor, board);
 
     return r;
 }
@@ -414,6 +819,10 @@ static int device_callback(hs_device *dev, void *udata)
 {
     ty_monitor *monitor = udata;
 
+    monitor->device_time = ty_micros();
+    // Fall back to the start of the refresh when libhs does not know when the event came in
+    monitor->event_time = dev->event_time ? dev->event_time : monitor->refresh_start;
+
     switch (dev->status) {
         case HS_DEVICE_STATUS_ONLINE: {
             monitor->refresh_callback_ret = add_interface_for_device(monitor, dev);
@@ -455,19 +864,18 @@ int ty_monitor_new(ty_monitor **rmonitor)
         goto error;
     }
 
-    r = ty_timer_new(&monitor->timer);
+    r = ty_timer_queue_new(&monitor->drop_queue);
     if (r < 0)
         goto error;
-
-    r = ty_mutex_init(&monitor->refresh_mutex);
+    r = ty_timer_new(&monitor->batch_timer);
     if (r < 0)
         goto error;
 
-    r = ty_cond_init(&monitor->refresh_cond);
+    r = ty_mutex_init(&monitor->refresh_mutex);
     if (r < 0)
         goto error;
 
-    r = _hs_htable_init(&monitor->ifaces, 64);
+    r = ty_cond_init(&monitor->refresh_cond);
     if (r < 0)
         goto error;
 
@@ -486,13 +894,19 @@ void ty_monitor_free(ty_monitor *monitor)
     if (monitor) {
         ty_monitor_stop(monitor);
 
+        for (size_t i = 0; i < monitor->callbacks.count; i++)
+            release_callback(&monitor->callbacks.values[i]);
         _hs_array_release(&monitor->callbacks);
+        _hs_htable_release(&monitor->boards_by_location);
+        _hs_htable_release(&monitor->boards_by_serial);
+        _hs_htable_release(&monitor->boards_by_tag);
         _hs_htable_release(&monitor->ifaces);
 
         ty_cond_release(&monitor->refresh_cond);
         ty_mutex_release(&monitor->refresh_mutex);
         hs_monitor_free(monitor->device_monitor);
-        ty_timer_free(monitor->timer);
+        ty_timer_free(monitor->batch_timer);
+        ty_timer_queue_free(monitor->drop_queue);
     }
 
     free(monitor);
@@ -514,7 +928,16 @@ int ty_monitor_start(ty_monitor *monitor)
     }
     monitor->started = true;
 
+    monitor->refresh_start = ty_micros();
+    ty_trace_begin(TY_TRACE_MONITOR, "enumerate", NULL);
     r = hs_monitor_list(monitor->device_monitor, device_callback, monitor);
+    ty_trace_end(TY_TRACE_MONITOR, "enumerate");
+    if (r < 0)
+        goto error;
+
+    // Don't make the caller wait for the debounce delay to see the initial boards
+    ty_timer_set(monitor->batch_timer, -1, 0);
+    r = flush_board_events(monitor);
     if (r < 0)
         goto error;
 
@@ -532,26 +955,50 @@ void ty_monitor_stop(ty_monitor *monitor)
     if (!monitor->started)
         return;
 
-    // Stop device monitor and timer
+    // Stop device monitor and timers
     hs_monitor_stop(monitor->device_monitor);
-    ty_timer_set(monitor->timer, -1, 0);
-    monitor->timer_running = false;
+    ty_timer_queue_clear(monitor->drop_queue);
+    ty_timer_set(monitor->batch_timer, -1, 0);
+
+    // Forget about events nobody will ever see
+    for (size_t i = 0; i < monitor->pending_events.count; i++)
+        ty_board_unref(monitor->pending_events.values[i].board);
+    _hs_array_release(&monitor->pending_events);
+
+    // Waiting threads must notice these boards are not monitored anymore
+    monitor->wake_all = true;
+    wake_waiters(monitor);
+
+    // Board callbacks would outlive their boards
+    for (size_t i = monitor->callbacks.count; i-- > 0;) {
+        if (monitor->callbacks.values[i].board) {
+            release_callback(&monitor->callbacks.values[i]);
+            _hs_array_remove(&monitor->callbacks, i, 1);
+        }
+    }
 
     // Clear registered boards
     for (size_t i = 0; i < monitor->boards.count; i++) {
         ty_board *board_it = monitor->boards.values[i];
 
         board_it->monitor = NULL;
+        board_it->monitor_location_hash = 0;
+        board_it->monitor_serial_hash = 0;
+        board_it->monitor_tag_hash = 0;
         ty_board_unref(board_it);
     }
     _hs_array_release(&monitor->boards);
+    monitor->boards_unsorted = false;
+    _hs_htable_clear(&monitor->boards_by_location);
+    _hs_htable_clear(&monitor->boards_by_serial);
+    _hs_htable_clear(&monitor->boards_by_tag);
 
     // Clear registered interfaces
     _hs_htable_foreach(cur, &monitor->ifaces) {
-        ty_board_interface *iface_it = ty_container_of(cur, ty_board_interface, monitor_hnode);
+        ty_board_interface *iface_it = cur;
 
-        if (iface_it->monitor_hnode.next)
-            _hs_htable_remove(&iface_it->monitor_hnode);
+        _ty_board_interface_detach(iface_it);
+        iface_it->monitor_hash = 0;
         ty_board_interface_unref(iface_it);
     }
     _hs_htable_clear(&monitor->ifaces);
@@ -559,13 +1006,140 @@ void ty_monitor_stop(ty_monitor *monitor)
     monitor->started = false;
 }
 
+int ty_monitor_prepare_fork(ty_monitor *monitor)
+{
+    assert(monitor);
+
+    int r;
+
+    r = hs_monitor_prepare_fork(monitor->device_monitor);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    /* Events queued until now will only reach the child, process them before it exists. The
+       new source may repeat some of them later, which is harmless: known devices are not
+       added twice, and unknown devices cannot be removed. */
+    return ty_monitor_refresh(monitor);
+}
+
+int ty_monitor_finish_fork(ty_monitor *monitor, bool child)
+{
+    assert(monitor);
+
+    ty_timer *batch_timer;
+    int r;
+
+    hs_monitor_finish_fork(monitor->device_monitor, child);
+    if (!child)
+        return 0;
+
+    // Timers are shared with the parent too, arming or draining them would disturb it
+    r = ty_timer_new(&batch_timer);
+    if (r < 0)
+        return r;
+    if (monitor->batch_delay > 0 && monitor->pending_events.count) {
+        r = ty_timer_set(batch_timer, monitor->batch_delay, TY_TIMER_ONESHOT);
+        if (r < 0) {
+            ty_timer_free(batch_timer);
+            return r;
+        }
+    }
+    ty_timer_free(monitor->batch_timer);
+    monitor->batch_timer = batch_timer;
+
+    return ty_timer_queue_renew_timer(monitor->drop_queue);
+}
+
+void ty_monitor_set_attach_serial(ty_monitor *monitor, bool attach)
+{
+    assert(monitor);
+    monitor->attach_serial = attach;
+}
+
+void ty_monitor_set_task_coalescing(ty_monitor *monitor, bool coalesce)
+{
+    assert(monitor);
+    monitor->coalesce_tasks = coalesce;
+}
+
+bool _ty_monitor_coalesces_tasks(const ty_monitor *monitor)
+{
+    return monitor->coalesce_tasks;
+}
+
+void ty_monitor_set_batching(ty_monitor *monitor, bool enable, int debounce_delay)
+{
+    assert(monitor);
+    assert(enable || !monitor->pending_events.count);
+
+    monitor->batch_events = enable;
+    monitor->batch_delay = enable ? debounce_delay : 0;
+}
+
+void ty_monitor_get_stats(const ty_monitor *monitor, ty_monitor_stats *rstats)
+{
+    assert(monitor);
+    assert(rstats);
+
+    rstats->refreshes = _ty_counter_get(&monitor->stats.refreshes);
+    rstats->refresh_time = _ty_counter_get(&monitor->stats.refresh_time);
+}
+
 void ty_monitor_get_descriptors(const ty_monitor *monitor, ty_descriptor_set *set, int id)
 {
     assert(monitor);
     assert(set);
 
     ty_descriptor_set_add(set, hs_monitor_get_poll_handle(monitor->device_monitor), id);
-    ty_timer_get_descriptors(monitor->timer, set, id);
+    ty_timer_queue_get_descriptors(monitor->drop_queue, set, id);
+    ty_timer_get_descriptors(monitor->batch_timer, set, id);
+}
+
+static int add_callback(ty_monitor *monitor, const ty_monitor_filter *filter, ty_board *board,
+                        ty_monitor_callback_func *f, void *udata)
+{
+    struct callback callback = {0};
+    int r;
+
+    callback.f = f;
+    callback.udata = udata;
+    callback.events = UINT_MAX;
+    if (board)
+        callback.board = ty_board_ref(board);
+
+    if (filter) {
+        if (filter->events)
+            callback.events = filter->events;
+        if (filter->tag) {
+            r = ty_board_matcher_new(filter->tag, &callback.matcher);
+            if (r < 0)
+                goto error;
+        }
+        if (filter->models_count) {
+            callback.models = malloc(filter->models_count * sizeof(*callback.models));
+            if (!callback.models) {
+                r = ty_error(TY_ERROR_MEMORY, NULL);
+                goto error;
+            }
+            memcpy(callback.models, filter->models, filter->models_count * sizeof(*callback.models));
+            callback.models_count = filter->models_count;
+        }
+    }
+
+    r = _hs_array_push(&monitor->callbacks, callback);
+    if (r < 0) {
+        r = ty_libhs_translate_error(r);
+        goto error;
+    }
+
+    callback.id = monitor->current_callback_id++;
+    monitor->callbacks.values[monitor->callbacks.count - 1].id = callback.id;
+
+    return callback.id;
+
+error:
+    release_callback(&callback);
+    return r;
 }
 
 int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata)
@@ -573,12 +1147,33 @@ int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *
     assert(monitor);
     assert(f);
 
-    struct callback callback = {
-        .id = monitor->current_callback_id++,
-        .f = f,
-        .udata = udata
-    };
-    return ty_libhs_translate_error(_hs_array_push(&monitor->callbacks, callback));
+    return add_callback(monitor, NULL, NULL, f, udata);
+}
+
+int ty_monitor_register_filtered_callback(ty_monitor *monitor, const ty_monitor_filter *filter,
+                                          ty_monitor_callback_func *f, void *udata)
+{
+    assert(monitor);
+    assert(filter);
+    assert(f);
+
+    return add_callback(monitor, filter, NULL, f, udata);
+}
+
+int ty_monitor_register_board_callback(ty_monitor *monitor, ty_board *board, unsigned int events,
+                                       ty_monitor_callback_func *f, void *udata)
+{
+    assert(monitor);
+    assert(board);
+    assert(f);
+
+    ty_monitor_filter filter = {0};
+
+    if (board->monitor != monitor)
+        return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' is not monitored", board->tag);
+
+    filter.events = events;
+    return add_callback(monitor, &filter, board, f, udata);
 }
 
 void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
@@ -588,41 +1183,30 @@ void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
 
     for (size_t i = 0; i < monitor->callbacks.count; i++) {
         if (monitor->callbacks.values[i].id == id) {
+            release_callback(&monitor->callbacks.values[i]);
             _hs_array_remove(&monitor->callbacks, i, 1);
             break;
         }
     }
 }
 
-int ty_monitor_refresh(ty_monitor *monitor)
+static int refresh_monitor(ty_monitor *monitor)
 {
-    assert(monitor);
-
     int r;
 
-    if (ty_timer_rearm(monitor->timer)) {
-        int timer_delay = -1;
-
-        for (size_t i = 0; i < monitor->boards.count; i++) {
-            ty_board *board_it = monitor->boards.values[i];
-
-            if (board_it->status == TY_BOARD_STATUS_MISSING) {
-                int board_timeout = ty_adjust_timeout(monitor->drop_delay, board_it->missing_since);
-                /* Drop boards that are about to expire (< 20 ms) to deal with limited timer
-                   resolution (e.g. TickCount64() on Windows). */
-                if (board_timeout < 20) {
-                    drop_board(board_it);
-                    ty_board_unref(board_it);
-                } else if (board_timeout < timer_delay || timer_delay == -1) {
-                    timer_delay = board_timeout;
-                }
-            }
-        }
+    // Drop boards that have been missing for too long, the queue rearms the timer
+    for (;;) {
+        ty_timer_entry *entry;
 
-        r = ty_timer_set(monitor->timer, timer_delay, TY_TIMER_ONESHOT);
+        r = ty_timer_queue_pop(monitor->drop_queue, &entry);
         if (r < 0)
             return r;
-        monitor->timer_running = (timer_delay >= 0);
+        if (!r)
+            break;
+
+        ty_board *board = ty_container_of(entry, ty_board, drop_entry);
+        drop_board(board);
+        ty_board_unref(board);
     }
 
     r = hs_monitor_refresh(monitor->device_monitor, device_callback, monitor);
@@ -638,16 +1222,42 @@ int ty_monitor_refresh(ty_monitor *monitor)
         return ty_libhs_translate_error(r);
     }
 
-    ty_mutex_lock(&monitor->refresh_mutex);
-    ty_cond_broadcast(&monitor->refresh_cond);
-    ty_mutex_unlock(&monitor->refresh_mutex);
+    /* Without debounce delay, pending events are flushed at the end of each refresh. Otherwise
+       wait until the timer fires, it gets restarted by each new change. */
+    if ((monitor->batch_delay <= 0 || ty_timer_rearm(monitor->batch_timer)) &&
+            monitor->pending_events.count) {
+        r = flush_board_events(monitor);
+        if (r < 0)
+            return r;
+    }
+
+    wake_waiters(monitor);
 
     return 0;
 }
 
-int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout)
+int ty_monitor_refresh(ty_monitor *monitor)
 {
     assert(monitor);
+
+    uint64_t start;
+    int r;
+
+    start = ty_micros();
+    monitor->refresh_start = start;
+    ty_trace_begin(TY_TRACE_MONITOR, "refresh", NULL);
+    r = refresh_monitor(monitor);
+    ty_trace_end(TY_TRACE_MONITOR, "refresh");
+
+    _ty_counter_add(&monitor->stats.refreshes, 1);
+    _ty_counter_add(&monitor->stats.refresh_time, ty_micros() - start);
+
+    return r;
+}
+
+static int wait_refresh(ty_monitor *monitor, ty_cond *cond, ty_monitor_wait_func *f,
+                        void *udata, int timeout)
+{
     assert(f || (monitor->main_thread_id == ty_thread_get_self_id()));
 
     ty_descriptor_set set = {0};
@@ -656,15 +1266,26 @@ int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, i
 
     start = ty_millis();
     if (monitor->main_thread_id != ty_thread_get_self_id()) {
+        /* ty_task_cancel() and the pool deadline thread signal the condition to interrupt
+           the current task, no need to wake up periodically. */
+        _ty_task_set_wait(&monitor->refresh_mutex, cond);
         ty_mutex_lock(&monitor->refresh_mutex);
+        if (cond == &monitor->refresh_cond)
+            monitor->refresh_waiters++;
         while (!(r = (*f)(monitor, udata))) {
-            r = ty_cond_wait(&monitor->refresh_cond, &monitor->refresh_mutex,
-                             ty_adjust_timeout(timeout, start));
-            if (!r)
+            int adjusted_timeout = ty_adjust_timeout(timeout, start);
+
+            if (!adjusted_timeout || _ty_task_interrupted())
                 break;
+            ty_cond_wait(cond, &monitor->refresh_mutex, adjusted_timeout);
         }
+        if (cond == &monitor->refresh_cond)
+            monitor->refresh_waiters--;
         ty_mutex_unlock(&monitor->refresh_mutex);
+        _ty_task_clear_wait();
 
+        if (!r)
+            r = ty_task_check_canceled();
         return r;
     } else {
         ty_monitor_get_descriptors(monitor, &set, 1);
@@ -680,17 +1301,118 @@ int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, i
                     return r;
             }
 
-            r = ty_poll(&set, ty_adjust_timeout(timeout, start));
-        } while (r > 0);
+            r = ty_task_check_canceled();
+            if (r < 0)
+                return r;
+
+            r = ty_poll(&set, _ty_task_adjust_timeout(ty_adjust_timeout(timeout, start)));
+        } while (r > 0 || (!r && ty_adjust_timeout(timeout, start)));
         return r;
     }
 }
 
+int _ty_monitor_wait_board(ty_board *board, ty_monitor_wait_func *f, void *udata, int timeout)
+{
+    ty_monitor *monitor = board->monitor;
+    ty_board_hotplug_timing timing = {0};
+    uint64_t start;
+    int r;
+
+    start = ty_micros();
+    r = wait_refresh(monitor, &board->wait_cond, f, udata, timeout);
+    if (r <= 0)
+        return r;
+
+    // Only record the wakeup if the change happened while we were waiting
+    ty_mutex_lock(&monitor->refresh_mutex);
+    if (board->hotplug.callbacks && board->hotplug.event >= start && !board->hotplug.wakeup) {
+        board->hotplug.wakeup = ty_micros();
+        timing = board->hotplug;
+    }
+    ty_mutex_unlock(&monitor->refresh_mutex);
+
+    if (timing.wakeup)
+        ty_log(TY_LOG_DEBUG, "Woke up waiter on board '%s' %" PRIu64 " us after the event",
+               board->tag, timing.wakeup - timing.event);
+
+    return r;
+}
+
+void _ty_monitor_get_hotplug_timing(ty_board *board, ty_board_hotplug_timing *rtiming)
+{
+    ty_monitor *monitor = board->monitor;
+
+    ty_mutex_lock(&monitor->refresh_mutex);
+    *rtiming = board->hotplug;
+    ty_mutex_unlock(&monitor->refresh_mutex);
+}
+
+int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout)
+{
+    assert(monitor);
+    return wait_refresh(monitor, &monitor->refresh_cond, f, udata, timeout);
+}
+
+int ty_monitor_find(ty_monitor *monitor, const ty_board_matcher *matcher,
+                    ty_monitor_callback_func *f, void *udata)
+{
+    assert(monitor);
+    assert(matcher);
+    assert(f);
+
+    const struct _ty_board_id_part *serial = &matcher->parts[0];
+
+    /* Without a serial number in the tag, boards can match by model or location so we need
+       to check all of them. Otherwise, only boards with a custom tag equal to the tag or with
+       the same serial number need to be checked. */
+    if (matcher->tag && serial->ptr) {
+        _hs_htable_foreach_hash(cur, &monitor->boards_by_tag, _hs_htable_hash_str(matcher->tag)) {
+            ty_board *board = cur;
+
+            if (board->status == TY_BOARD_STATUS_ONLINE && strcmp(board->tag, matcher->tag) == 0) {
+                int r = (*f)(board, TY_MONITOR_EVENT_ADDED, udata);
+                if (r)
+                    return r;
+            }
+        }
+
+        _hs_htable_foreach_hash(cur, &monitor->boards_by_serial, _ty_board_hash_id_part(serial)) {
+            ty_board *board = cur;
+
+            // Skip boards already found by custom tag
+            if (board->tag != board->id && strcmp(board->tag, matcher->tag) == 0)
+                continue;
+
+            if (board->status == TY_BOARD_STATUS_ONLINE && ty_board_matcher_match(matcher, board)) {
+                int r = (*f)(board, TY_MONITOR_EVENT_ADDED, udata);
+                if (r)
+                    return r;
+            }
+        }
+
+        return 0;
+    }
+
+    sort_boards(monitor);
+    for (size_t i = 0; i < monitor->boards.count; i++) {
+        ty_board *board = monitor->boards.values[i];
+
+        if (board->status == TY_BOARD_STATUS_ONLINE && ty_board_matcher_match(matcher, board)) {
+            int r = (*f)(board, TY_MONITOR_EVENT_ADDED, udata);
+            if (r)
+                return r;
+        }
+    }
+
+    return 0;
+}
+
 int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata)
 {
     assert(monitor);
     assert(f);
 
+    sort_boards(monitor);
     for (size_t i = 0; i < monitor->boards.count; i++) {
         ty_board *board_it = monitor->boards.values[i];
 
@@ -12,10 +12,12 @@
 #define TY_MONITOR_H
 
 #include "common.h"
+#include "class.h"
 
 TY_C_BEGIN
 
 struct ty_board;
+struct ty_board_matcher;
 
 typedef struct ty_monitor ty_monitor;
 
@@ -26,6 +28,24 @@ typedef enum ty_monitor_event {
     TY_MONITOR_EVENT_DROPPED
 } ty_monitor_event;
 
+#define TY_MONITOR_EVENT_MASK(event) (1u << (event))
+
+typedef struct ty_monitor_filter {
+    // Mask of TY_MONITOR_EVENT_MASK() values, or 0 for all events
+    unsigned int events;
+    // Board tag, with the same syntax as ty_board_matches_tag(), or NULL for all boards
+    const char *tag;
+    // List of models the callback cares about, or NULL/0 for all models
+    const ty_model *models;
+    unsigned int models_count;
+} ty_monitor_filter;
+
+typedef struct ty_monitor_stats {
+    uint64_t refreshes;
+    // Total time spent in ty_monitor_refresh(), in microseconds
+    uint64_t refresh_time;
+} ty_monitor_stats;
+
 typedef int ty_monitor_callback_func(struct ty_board *board, ty_monitor_event event, void *udata);
 typedef int ty_monitor_wait_func(ty_monitor *monitor, void *udata);
 
@@ -34,16 +54,49 @@ TY_PUBLIC void ty_monitor_free(ty_monitor *monitor);
 
 TY_PUBLIC int ty_monitor_start(ty_monitor *monitor);
 TY_PUBLIC void ty_monitor_stop(ty_monitor *monitor);
+/* Share a started monitor with a child process: call ty_monitor_prepare_fork() right before
+   fork(), and ty_monitor_finish_fork() in both processes after it. The child keeps the boards
+   known at the time of the fork and both processes continue to get device events, without
+   enumerating devices again. */
+TY_PUBLIC int ty_monitor_prepare_fork(ty_monitor *monitor);
+TY_PUBLIC int ty_monitor_finish_fork(ty_monitor *monitor, bool child);
+
+/* Open serial interfaces as soon as they appear and buffer incoming data until they are
+   opened, so that early output (e.g. right after a reset) is not lost. Uploads do this for
+   the board they reset even when this is disabled. */
+TY_PUBLIC void ty_monitor_set_attach_serial(ty_monitor *monitor, bool attach);
+/* Coalesce status changes and emit at most one event per board (ADDED, CHANGED,
+   DISAPPEARED or DROPPED) once all pending device events have been processed. With
+   debounce_delay > 0, events are only delivered once no change has happened for this long. */
+TY_PUBLIC void ty_monitor_set_batching(ty_monitor *monitor, bool enable, int debounce_delay);
+/* Board tasks queued behind an identical one (same firmware and flags for uploads, any
+   reset or reboot) do not repeat the work, they finish with the outcome of the first. */
+TY_PUBLIC void ty_monitor_set_task_coalescing(ty_monitor *monitor, bool coalesce);
+
+TY_PUBLIC void ty_monitor_get_stats(const ty_monitor *monitor, ty_monitor_stats *rstats);
 
 TY_PUBLIC void ty_monitor_get_descriptors(const ty_monitor *monitor, struct ty_descriptor_set *set, int id);
 
 TY_PUBLIC int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata);
+/* Filters are checked before the callback is called, and the tag is compiled once. Board
+   callbacks are removed automatically after the board is dropped (or when the monitor
+   stops), even if TY_MONITOR_EVENT_DROPPED is not part of the event mask. */
+TY_PUBLIC int ty_monitor_register_filtered_callback(ty_monitor *monitor, const ty_monitor_filter *filter,
+                                                    ty_monitor_callback_func *f, void *udata);
+TY_PUBLIC int ty_monitor_register_board_callback(ty_monitor *monitor, struct ty_board *board,
+                                                 unsigned int events, ty_monitor_callback_func *f,
+                                                 void *udata);
 TY_PUBLIC void ty_monitor_deregister_callback(ty_monitor *monitor, int id);
 
 TY_PUBLIC int ty_monitor_refresh(ty_monitor *monitor);
 TY_PUBLIC int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout);
 
+/* ty_monitor_list() goes through online boards in the order they were discovered.
+   ty_monitor_find() only gives the ones that match, and uses the monitor indexes to skip
+   the others when the tag has a serial number. */
 TY_PUBLIC int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata);
+TY_PUBLIC int ty_monitor_find(ty_monitor *monitor, const struct ty_board_matcher *matcher,
+                              ty_monitor_callback_func *f, void *udata);
 
 TY_C_END
 
@@ -0,0 +1,54 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_POLLER_H
+#define TY_POLLER_H
+
+#include "common.h"
+#include "system.h"
+
+TY_C_BEGIN
+
+/* Persistent alternative to ty_descriptor_set and ty_poll(). Descriptors stay registered
+   between calls, there is no limit on their number (except on Windows, where
+   WaitForMultipleObjects() limits it to 64) and ty_poller_wait() returns all the ready
+   descriptors at once.
+
+   Like with ty_descriptor_set, several descriptors can share the same id. */
+
+typedef struct ty_poller ty_poller;
+
+enum {
+    /* Only report descriptors when they become ready (EPOLLET). This is only supported by
+       the epoll backend on Linux, other platforms ignore it and stay level-triggered. */
+    TY_POLLER_EDGE = 1
+};
+
+typedef struct ty_poller_event {
+    int id;
+    ty_descriptor desc;
+} ty_poller_event;
+
+TY_PUBLIC int ty_poller_new(ty_poller **rpoller);
+TY_PUBLIC void ty_poller_free(ty_poller *poller);
+
+TY_PUBLIC int ty_poller_add(ty_poller *poller, ty_descriptor desc, int id, int flags);
+TY_PUBLIC int ty_poller_add_set(ty_poller *poller, const ty_descriptor_set *set, int flags);
+TY_PUBLIC void ty_poller_remove(ty_poller *poller, int id);
+TY_PUBLIC void ty_poller_clear(ty_poller *poller);
+
+TY_PUBLIC unsigned int ty_poller_get_count(const ty_poller *poller);
+
+TY_PUBLIC int ty_poller_wait(ty_poller *poller, ty_poller_event *events, unsigned int max_events,
+                             int timeout);
+
+TY_C_END
+
+#endif
@@ -0,0 +1,213 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "../libhs/array.h"
+#include "poller.h"
+#include "system.h"
+
+struct poller_entry {
+    int fd;
+    int id;
+    // epoll rejects regular files and /dev/null, which poll() reports as always ready
+    bool always_ready;
+};
+
+struct ty_poller {
+    int epfd;
+
+    _HS_ARRAY(struct poller_entry) entries;
+    unsigned int always_ready_count;
+    _HS_ARRAY(struct epoll_event) events;
+};
+
+int ty_poller_new(ty_poller **rpoller)
+{
+    assert(rpoller);
+
+    ty_poller *poller;
+    int r;
+
+    poller = calloc(1, sizeof(*poller));
+    if (!poller) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    poller->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (poller->epfd < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "epoll_create1() failed: %s", strerror(errno));
+        goto error;
+    }
+
+    *rpoller = poller;
+    return 0;
+
+error:
+    ty_poller_free(poller);
+    return r;
+}
+
+void ty_poller_free(ty_poller *poller)
+{
+    if (poller) {
+        if (poller->epfd >= 0)
+            close(poller->epfd);
+
+        _hs_array_release(&poller->entries);
+        _hs_array_release(&poller->events);
+    }
+
+    free(poller);
+}
+
+int ty_poller_add(ty_poller *poller, ty_descriptor desc, int id, int flags)
+{
+    assert(poller);
+    assert(desc >= 0);
+
+    struct poller_entry entry;
+    struct epoll_event ev = {0};
+    int r;
+
+    r = _hs_array_grow(&poller->entries, 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    ev.events = EPOLLIN;
+    if (flags & TY_POLLER_EDGE)
+        ev.events |= EPOLLET;
+    ev.data.u64 = ((uint64_t)(uint32_t)desc << 32) | (uint32_t)id;
+
+    entry.fd = desc;
+    entry.id = id;
+    entry.always_ready = false;
+
+    r = epoll_ctl(poller->epfd, EPOLL_CTL_ADD, desc, &ev);
+    if (r < 0) {
+        if (errno != EPERM)
+            return ty_error(TY_ERROR_SYSTEM, "epoll_ctl() failed: %s", strerror(errno));
+
+        entry.always_ready = true;
+        poller->always_ready_count++;
+    }
+
+    poller->entries.values[poller->entries.count++] = entry;
+
+    return 0;
+}
+
+int ty_poller_add_set(ty_poller *poller, const ty_descriptor_set *set, int flags)
+{
+    assert(poller);
+    assert(set);
+
+    for (unsigned int i = 0; i < set->count; i++) {
+        int r = ty_poller_add(poller, set->desc[i], set->id[i], flags);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+void ty_poller_remove(ty_poller *poller, int id)
+{
+    assert(poller);
+
+    size_t count = 0;
+    for (size_t i = 0; i < poller->entries.count; i++) {
+        struct poller_entry *entry = &poller->entries.values[i];
+
+        if (entry->id == id) {
+            if (entry->always_ready) {
+                poller->always_ready_count--;
+                continue;
+            }
+
+            // Fails if the descriptor was closed in the mean time, which removes it anyway
+            epoll_ctl(poller->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+        } else {
+            poller->entries.values[count++] = *entry;
+        }
+    }
+    poller->entries.count = count;
+}
+
+void ty_poller_clear(ty_poller *poller)
+{
+    assert(poller);
+
+    for (size_t i = 0; i < poller->entries.count; i++) {
+        if (!poller->entries.values[i].always_ready)
+            epoll_ctl(poller->epfd, EPOLL_CTL_DEL, poller->entries.values[i].fd, NULL);
+    }
+    poller->entries.count = 0;
+    poller->always_ready_count = 0;
+}
+
+unsigned int ty_poller_get_count(const ty_poller *poller)
+{
+    assert(poller);
+    return (unsigned int)poller->entries.count;
+}
+
+int ty_poller_wait(ty_poller *poller, ty_poller_event *events, unsigned int max_events,
+                   int timeout)
+{
+    assert(poller);
+    assert(poller->entries.count);
+    assert(events);
+    assert(max_events);
+
+    int max = (int)TY_MIN(max_events, (unsigned int)INT_MAX);
+    uint64_t start;
+    int r;
+
+    r = _hs_array_grow(&poller->events, (size_t)max);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    if (timeout < 0)
+        timeout = -1;
+    // Don't wait for anything when some descriptors are always ready
+    if (poller->always_ready_count)
+        timeout = 0;
+
+    start = ty_millis();
+restart:
+    r = epoll_wait(poller->epfd, poller->events.values, max, ty_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "epoll_wait() failed: %s", strerror(errno));
+    }
+
+    for (int i = 0; i < r; i++) {
+        uint64_t data = poller->events.values[i].data.u64;
+
+        events[i].id = (int)(uint32_t)data;
+        events[i].desc = (int)(uint32_t)(data >> 32);
+    }
+
+    for (size_t i = 0; i < poller->entries.count && r < max && poller->always_ready_count; i++) {
+        const struct poller_entry *entry = &poller->entries.values[i];
+
+        if (entry->always_ready) {
+            events[r].id = entry->id;
+            events[r].desc = entry->fd;
+            r++;
+        }
+    }
+
+    return r;
+}
@@ -0,0 +1,261 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#ifdef __APPLE__
+    #include <sys/select.h>
+#else
+    #include <poll.h>
+#endif
+#include "../libhs/array.h"
+#include "poller.h"
+#include "system.h"
+
+/* Portable fallback for platforms without epoll. The descriptors are kept in a persistent
+   array, and the scan for ready descriptors starts where the previous one stopped so that
+   the last descriptors are not starved when max_events is small. poll() does not work with
+   devices on macOS, so we use select() there like ty_poll(). */
+
+struct ty_poller {
+#ifdef __APPLE__
+    _HS_ARRAY(int) fds;
+    int max_fd;
+#else
+    _HS_ARRAY(struct pollfd) fds;
+#endif
+    _HS_ARRAY(int) ids;
+
+    size_t scan_offset;
+};
+
+#ifdef __APPLE__
+    #define POLLER_FD(poller, i) ((poller)->fds.values[i])
+#else
+    #define POLLER_FD(poller, i) ((poller)->fds.values[i].fd)
+#endif
+
+int ty_poller_new(ty_poller **rpoller)
+{
+    assert(rpoller);
+
+    ty_poller *poller;
+
+    poller = calloc(1, sizeof(*poller));
+    if (!poller)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+#ifdef __APPLE__
+    poller->max_fd = -1;
+#endif
+
+    *rpoller = poller;
+    return 0;
+}
+
+void ty_poller_free(ty_poller *poller)
+{
+    if (poller) {
+        _hs_array_release(&poller->fds);
+        _hs_array_release(&poller->ids);
+    }
+
+    free(poller);
+}
+
+int ty_poller_add(ty_poller *poller, ty_descriptor desc, int id, int flags)
+{
+    assert(poller);
+    assert(desc >= 0);
+
+    // Edge-triggered mode is not available with poll() or select()
+    TY_UNUSED(flags);
+
+    int r;
+
+#ifdef __APPLE__
+    if (desc >= FD_SETSIZE)
+        return ty_error(TY_ERROR_SYSTEM, "Descriptor %d is too high for select()", desc);
+    r = _hs_array_push(&poller->fds, desc);
+#else
+    struct pollfd pfd = {0};
+    pfd.fd = desc;
+    pfd.events = POLLIN;
+    r = _hs_array_push(&poller->fds, pfd);
+#endif
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    r = _hs_array_push(&poller->ids, id);
+    if (r < 0) {
+        poller->fds.count--;
+        return ty_libhs_translate_error(r);
+    }
+
+#ifdef __APPLE__
+    if (desc > poller->max_fd)
+        poller->max_fd = desc;
+#endif
+
+    return 0;
+}
+
+int ty_poller_add_set(ty_poller *poller, const ty_descriptor_set *set, int flags)
+{
+    assert(poller);
+    assert(set);
+
+    for (unsigned int i = 0; i < set->count; i++) {
+        int r = ty_poller_add(poller, set->desc[i], set->id[i], flags);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+void ty_poller_remove(ty_poller *poller, int id)
+{
+    assert(poller);
+
+    size_t count = 0;
+#ifdef __APPLE__
+    poller->max_fd = -1;
+#endif
+    for (size_t i = 0; i < poller->ids.count; i++) {
+        if (poller->ids.values[i] != id) {
+            poller->fds.values[count] = poller->fds.values[i];
+            poller->ids.values[count] = poller->ids.values[i];
+#ifdef __APPLE__
+            if (poller->fds.values[count] > poller->max_fd)
+                poller->max_fd = poller->fds.values[count];
+#endif
+            count++;
+        }
+    }
+    poller->fds.count = count;
+    poller->ids.count = count;
+}
+
+void ty_poller_clear(ty_poller *poller)
+{
+    assert(poller);
+
+    poller->fds.count = 0;
+    poller->ids.count = 0;
+#ifdef __APPLE__
+    poller->max_fd = -1;
+#endif
+}
+
+unsigned int ty_poller_get_count(const ty_poller *poller)
+{
+    assert(poller);
+    return (unsigned int)poller->ids.count;
+}
+
+#ifdef __APPLE__
+
+static int wait_descriptors(ty_poller *poller, fd_set *fds, int timeout)
+{
+    uint64_t start;
+    struct timeval tv;
+    int r;
+
+    start = ty_millis();
+restart:
+    FD_ZERO(fds);
+    for (size_t i = 0; i < poller->fds.count; i++)
+        FD_SET(poller->fds.values[i], fds);
+
+    if (timeout >= 0) {
+        int adjusted_timeout = ty_adjust_timeout(timeout, start);
+        tv.tv_sec = adjusted_timeout / 1000;
+        tv.tv_usec = (adjusted_timeout % 1000) * 1000;
+        r = select(poller->max_fd + 1, fds, NULL, NULL, &tv);
+    } else {
+        r = select(poller->max_fd + 1, fds, NULL, NULL, NULL);
+    }
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "select() failed: %s", strerror(errno));
+    }
+
+    return r;
+}
+
+#else
+
+static int wait_descriptors(ty_poller *poller, int timeout)
+{
+    uint64_t start;
+    int r;
+
+    if (timeout < 0)
+        timeout = -1;
+
+    start = ty_millis();
+restart:
+    r = poll(poller->fds.values, (nfds_t)poller->fds.count, ty_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "poll() failed: %s", strerror(errno));
+    }
+
+    return r;
+}
+
+#endif
+
+int ty_poller_wait(ty_poller *poller, ty_poller_event *events, unsigned int max_events,
+                   int timeout)
+{
+    assert(poller);
+    assert(poller->ids.count);
+    assert(events);
+    assert(max_events);
+
+    unsigned int count = 0;
+    size_t i;
+    int r;
+
+#ifdef __APPLE__
+    fd_set fds;
+    r = wait_descriptors(poller, &fds, timeout);
+#else
+    r = wait_descriptors(poller, timeout);
+#endif
+    if (r <= 0)
+        return r;
+
+    if (poller->scan_offset >= poller->ids.count)
+        poller->scan_offset = 0;
+    i = poller->scan_offset;
+    do {
+#ifdef __APPLE__
+        bool ready = FD_ISSET(poller->fds.values[i], &fds);
+#else
+        bool ready = poller->fds.values[i].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL);
+#endif
+        if (ready) {
+            events[count].id = poller->ids.values[i];
+            events[count].desc = POLLER_FD(poller, i);
+            count++;
+        }
+
+        if (++i == poller->ids.count)
+            i = 0;
+    } while (i != poller->scan_offset && count < max_events);
+    poller->scan_offset = i;
+
+    return (int)count;
+}
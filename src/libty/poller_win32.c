@@ -0,0 +1,158 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include "../libhs/array.h"
+#include "poller.h"
+#include "system.h"
+
+struct ty_poller {
+    _HS_ARRAY(HANDLE) handles;
+    _HS_ARRAY(int) ids;
+};
+
+int ty_poller_new(ty_poller **rpoller)
+{
+    assert(rpoller);
+
+    ty_poller *poller;
+
+    poller = calloc(1, sizeof(*poller));
+    if (!poller)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    *rpoller = poller;
+    return 0;
+}
+
+void ty_poller_free(ty_poller *poller)
+{
+    if (poller) {
+        _hs_array_release(&poller->handles);
+        _hs_array_release(&poller->ids);
+    }
+
+    free(poller);
+}
+
+int ty_poller_add(ty_poller *poller, ty_descriptor desc, int id, int flags)
+{
+    assert(poller);
+    assert(desc);
+
+    // Waitable objects are level-triggered or auto-reset, there is nothing to change
+    TY_UNUSED(flags);
+
+    int r;
+
+    if (poller->handles.count >= MAXIMUM_WAIT_OBJECTS)
+        return ty_error(TY_ERROR_UNSUPPORTED, "Cannot wait on more than %d objects",
+                        MAXIMUM_WAIT_OBJECTS);
+
+    r = _hs_array_push(&poller->handles, desc);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    r = _hs_array_push(&poller->ids, id);
+    if (r < 0) {
+        poller->handles.count--;
+        return ty_libhs_translate_error(r);
+    }
+
+    return 0;
+}
+
+int ty_poller_add_set(ty_poller *poller, const ty_descriptor_set *set, int flags)
+{
+    assert(poller);
+    assert(set);
+
+    for (unsigned int i = 0; i < set->count; i++) {
+        int r = ty_poller_add(poller, set->desc[i], set->id[i], flags);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+void ty_poller_remove(ty_poller *poller, int id)
+{
+    assert(poller);
+
+    size_t count = 0;
+    for (size_t i = 0; i < poller->ids.count; i++) {
+        if (poller->ids.values[i] != id) {
+            poller->handles.values[count] = poller->handles.values[i];
+            poller->ids.values[count] = poller->ids.values[i];
+            count++;
+        }
+    }
+    poller->handles.count = count;
+    poller->ids.count = count;
+}
+
+void ty_poller_clear(ty_poller *poller)
+{
+    assert(poller);
+
+    poller->handles.count = 0;
+    poller->ids.count = 0;
+}
+
+unsigned int ty_poller_get_count(const ty_poller *poller)
+{
+    assert(poller);
+    return (unsigned int)poller->ids.count;
+}
+
+int ty_poller_wait(ty_poller *poller, ty_poller_event *events, unsigned int max_events,
+                   int timeout)
+{
+    assert(poller);
+    assert(poller->ids.count);
+    assert(events);
+    assert(max_events);
+
+    unsigned int count = 0;
+    DWORD ret;
+    size_t first;
+
+    ret = WaitForMultipleObjects((DWORD)poller->handles.count, poller->handles.values, FALSE,
+                                 timeout < 0 ? INFINITE : (DWORD)timeout);
+    switch (ret) {
+        case WAIT_FAILED: {
+            return ty_error(TY_ERROR_SYSTEM, "WaitForMultipleObjects() failed: %s",
+                            ty_win32_strerror(0));
+        } break;
+        case WAIT_TIMEOUT: {
+            return 0;
+        } break;
+    }
+    first = ret - WAIT_OBJECT_0;
+
+    events[count].id = poller->ids.values[first];
+    events[count].desc = poller->handles.values[first];
+    count++;
+
+    /* WaitForMultipleObjects() only reports the first signaled object, check the following
+       ones (wrapping around) so that objects with a high index do not starve. */
+    for (size_t i = (first + 1) % poller->handles.count; i != first && count < max_events;
+             i = (i + 1) % poller->handles.count) {
+        if (WaitForSingleObject(poller->handles.values[i], 0) == WAIT_OBJECT_0) {
+            events[count].id = poller->ids.values[i];
+            events[count].desc = poller->handles.values[i];
+            count++;
+        }
+    }
+
+    return (int)count;
+}
@@ -9,8 +9,14 @@
    See the LICENSE file for more details. */
 
 #include "common_priv.h"
+#include "../libhs/platform.h"
 #include "system.h"
 
+uint64_t ty_micros(void)
+{
+    return hs_micros();
+}
+
 int ty_adjust_timeout(int timeout, uint64_t start)
 {
     if (timeout < 0)
@@ -47,6 +47,13 @@ enum {
     TY_DESCRIPTOR_MODE_FILE = 8
 };
 
+/* Identifies the file behind a path (device and inode on POSIX systems), so that paths can
+   be compared later without calling stat() again. */
+typedef struct ty_path_key {
+    uint64_t dev;
+    uint64_t ino;
+} ty_path_key;
+
 typedef struct ty_descriptor_set {
     unsigned int count;
     ty_descriptor desc[64];
@@ -63,6 +70,9 @@ TY_PUBLIC char *ty_win32_strerror(unsigned long err);
 #endif
 
 TY_PUBLIC uint64_t ty_millis(void);
+/* Finer clock for short latency measurements, its origin is unrelated to ty_millis(). This
+   is the hs_micros() clock, libhs timestamps (e.g. hs_device event_time) use it too. */
+TY_PUBLIC uint64_t ty_micros(void);
 TY_PUBLIC void ty_delay(unsigned int ms);
 
 TY_PUBLIC int ty_adjust_timeout(int timeout, uint64_t start);
@@ -85,6 +95,7 @@ TY_PUBLIC unsigned int ty_standard_get_paths(ty_standard_path std_path, const ch
 TY_PUBLIC int ty_poll(const ty_descriptor_set *set, int timeout);
 
 TY_PUBLIC bool ty_compare_paths(const char *path1, const char *path2);
+TY_PUBLIC bool ty_path_get_key(const char *path, ty_path_key *rkey);
 
 TY_PUBLIC int ty_terminal_setup(int flags);
 TY_PUBLIC void ty_terminal_restore(void);
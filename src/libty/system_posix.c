@@ -61,7 +61,7 @@ uint64_t ty_millis(void)
         return 0;
     }
 
-    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 10000000;
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
 }
 
 #endif
@@ -372,6 +372,25 @@ bool ty_compare_paths(const char *path1, const char *path2)
     return sb1.st_dev == sb2.st_dev && sb1.st_ino == sb2.st_ino;
 }
 
+bool ty_path_get_key(const char *path, ty_path_key *rkey)
+{
+    assert(path);
+    assert(rkey);
+
+    struct stat sb;
+    int r;
+
+    r = stat(path, &sb);
+    if (r < 0) {
+        memset(rkey, 0, sizeof(*rkey));
+        return false;
+    }
+
+    rkey->dev = (uint64_t)sb.st_dev;
+    rkey->ino = (uint64_t)sb.st_ino;
+    return true;
+}
+
 int ty_terminal_setup(int flags)
 {
     struct termios tio;
@@ -100,6 +100,16 @@ bool ty_compare_paths(const char *path1, const char *path2)
     return strcasecmp(path1, path2) == 0;
 }
 
+bool ty_path_get_key(const char *path, ty_path_key *rkey)
+{
+    assert(path);
+    assert(rkey);
+
+    // Same reason as above, ty_compare_paths() does not need to touch the filesystem
+    memset(rkey, 0, sizeof(*rkey));
+    return false;
+}
+
 unsigned int ty_descriptor_get_modes(ty_descriptor desc)
 {
     DWORD tmp;
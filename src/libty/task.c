@@ -12,24 +12,280 @@
 #include "../libhs/array.h"
 #include "system.h"
 #include "task.h"
+#include "timer.h"
+#include "trace.h"
+
+/* Pending tasks are kept in one FIFO deque per priority, in the shared queue for tasks
+   started from outside the pool, or in the queue of the worker that started them. Idle
+   workers take the most urgent task from their own queue, then from the shared queue,
+   and steal from the other workers last.
+
+   Board tasks are coarse (they last for seconds), so all queues are protected by the pool
+   mutex, which is only held for O(1) operations.
+
+   Task deadlines go to a timer queue owned by the pool. A single thread, started with the
+   first deadline, waits on it and wakes up the tasks that expire, so that waiting tasks
+   can block without a timeout. */
+
+#define TASK_DEQUE_MIN_SIZE 16
+
+/* Ring buffer (the size is a power of two), so that taking the oldest task is O(1). Removing
+   the head of an _HS_ARRAY, as the single pool queue used to do, moves every other entry. */
+struct task_deque {
+    ty_task **tasks;
+    size_t size;
+    size_t start;
+    size_t count;
+};
+
+struct task_queue {
+    struct task_deque deques[TY_TASK_PRIORITY_COUNT];
+};
+
+struct pool_worker {
+    ty_pool *pool;
+    ty_thread thread;
+    struct task_queue queue;
+};
 
 struct ty_pool {
     int unused_timeout;
     unsigned int max_threads;
+    unsigned int min_threads;
 
     ty_mutex mutex;
 
-    _HS_ARRAY(ty_thread) worker_threads;
+    _HS_ARRAY(struct pool_worker *) workers;
     size_t busy_workers;
+    size_t steal_offset;
 
-    _HS_ARRAY(ty_task *) pending_tasks;
+    struct task_queue shared_queue;
+    size_t pending_counts[TY_TASK_PRIORITY_COUNT];
+    size_t pending_count;
     ty_cond pending_cond;
+    // Started tasks waiting for _ty_task_unblock(), see ty_task_start()
+    size_t held_count;
+
+    ty_timer_queue *deadline_queue;
+    ty_thread deadline_thread;
+    bool deadline_thread_started;
+    bool stop_deadlines;
+    ty_timer_entry stop_entry;
 
     bool init;
 };
 
 static ty_pool *default_pool;
 static TY_THREAD_LOCAL ty_task *current_task;
+static TY_THREAD_LOCAL struct pool_worker *current_worker;
+
+static int push_task(struct task_deque *deque, ty_task *task)
+{
+    if (deque->count == deque->size) {
+        size_t new_size = deque->size ? deque->size * 2 : TASK_DEQUE_MIN_SIZE;
+        ty_task **new_tasks;
+
+        new_tasks = malloc(new_size * sizeof(*new_tasks));
+        if (!new_tasks)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+        for (size_t i = 0; i < deque->count; i++)
+            new_tasks[i] = deque->tasks[(deque->start + i) & (deque->size - 1)];
+
+        free(deque->tasks);
+        deque->tasks = new_tasks;
+        deque->size = new_size;
+        deque->start = 0;
+    }
+
+    deque->tasks[(deque->start + deque->count) & (deque->size - 1)] = task;
+    deque->count++;
+
+    return 0;
+}
+
+static ty_task *pop_task(struct task_deque *deque)
+{
+    ty_task *task;
+
+    if (!deque->count)
+        return NULL;
+
+    task = deque->tasks[deque->start];
+    deque->start = (deque->start + 1) & (deque->size - 1);
+    deque->count--;
+
+    return task;
+}
+
+static void release_queue(struct task_queue *queue)
+{
+    for (unsigned int i = 0; i < TY_TASK_PRIORITY_COUNT; i++) {
+        struct task_deque *deque = &queue->deques[i];
+        ty_task *task;
+
+        while ((task = pop_task(deque)))
+            ty_task_unref(task);
+        free(deque->tasks);
+        memset(deque, 0, sizeof(*deque));
+    }
+}
+
+// Call with pool->mutex locked
+static ty_task *take_from_deque(ty_pool *pool, struct task_deque *deque)
+{
+    ty_task *task;
+
+    while ((task = pop_task(deque))) {
+        // ty_task_wait() may have claimed it to run it inline, drop the queue reference
+        if (task->queued) {
+            task->queued = false;
+            pool->pending_counts[task->priority]--;
+            pool->pending_count--;
+
+            return task;
+        }
+        ty_task_unref(task);
+    }
+
+    return NULL;
+}
+
+// Call with pool->mutex locked
+static ty_task *take_task(ty_pool *pool, struct pool_worker *worker)
+{
+    for (int priority = TY_TASK_PRIORITY_COUNT - 1; priority >= 0; priority--) {
+        ty_task *task;
+
+        if (!pool->pending_counts[priority])
+            continue;
+
+        task = take_from_deque(pool, &worker->queue.deques[priority]);
+        if (task)
+            return task;
+        task = take_from_deque(pool, &pool->shared_queue.deques[priority]);
+        if (task)
+            return task;
+
+        for (size_t i = 0; i < pool->workers.count; i++) {
+            struct pool_worker *victim;
+
+            victim = pool->workers.values[(pool->steal_offset + i) % pool->workers.count];
+            if (victim == worker)
+                continue;
+
+            task = take_from_deque(pool, &victim->queue.deques[priority]);
+            if (task) {
+                pool->steal_offset++;
+                return task;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Call with pool->mutex locked. Drop the leading claimed entries, and return true if
+   nothing is left in the queue. */
+static bool drain_claimed_tasks(struct task_queue *queue)
+{
+    bool empty = true;
+
+    for (unsigned int i = 0; i < TY_TASK_PRIORITY_COUNT; i++) {
+        struct task_deque *deque = &queue->deques[i];
+
+        while (deque->count && !deque->tasks[deque->start]->queued)
+            ty_task_unref(pop_task(deque));
+        if (deque->count)
+            empty = false;
+    }
+
+    return empty;
+}
+
+static void wake_waiting_task(ty_task *task);
+
+static int deadline_thread_main(void *udata)
+{
+    ty_pool *pool = udata;
+    ty_descriptor_set set = {0};
+
+    ty_timer_queue_get_descriptors(pool->deadline_queue, &set, 1);
+
+    ty_mutex_lock(&pool->mutex);
+    while (!pool->stop_deadlines) {
+        ty_timer_entry *entry;
+        int timeout;
+        int r;
+
+        r = ty_timer_queue_pop(pool->deadline_queue, &entry);
+        if (r > 0) {
+            if (entry == &pool->stop_entry)
+                continue;
+
+            // The queue reference is ours now
+            ty_task *task = ty_container_of(entry, ty_task, deadline_entry);
+            ty_mutex_unlock(&pool->mutex);
+
+            ty_mutex_lock(&task->mutex);
+            task->expired = true;
+            ty_mutex_unlock(&task->mutex);
+            wake_waiting_task(task);
+            ty_task_unref(task);
+
+            ty_mutex_lock(&pool->mutex);
+            continue;
+        }
+
+        // Don't rely on the timer if the queue failed to rearm it
+        timeout = ty_timer_queue_get_timeout(pool->deadline_queue);
+        ty_mutex_unlock(&pool->mutex);
+        ty_poll(&set, timeout);
+        ty_mutex_lock(&pool->mutex);
+    }
+    ty_mutex_unlock(&pool->mutex);
+
+    return 0;
+}
+
+// Call with pool->mutex locked
+static int start_deadline_thread(ty_pool *pool)
+{
+    int r;
+
+    if (pool->deadline_thread_started)
+        return 0;
+
+    if (!pool->deadline_queue) {
+        r = ty_timer_queue_new(&pool->deadline_queue);
+        if (r < 0)
+            return r;
+    }
+
+    r = ty_thread_create(&pool->deadline_thread, deadline_thread_main, pool);
+    if (r < 0)
+        return r;
+    pool->deadline_thread_started = true;
+
+    return 0;
+}
+
+static void stop_deadline_thread(ty_pool *pool)
+{
+    int r;
+
+    if (!pool->deadline_thread_started)
+        return;
+
+    ty_mutex_lock(&pool->mutex);
+    pool->stop_deadlines = true;
+    r = ty_timer_queue_add(pool->deadline_queue, &pool->stop_entry, 0);
+    ty_mutex_unlock(&pool->mutex);
+    // The thread does not block for long without a working timer, see deadline_thread_main()
+    TY_UNUSED(r);
+
+    ty_thread_join(&pool->deadline_thread);
+    pool->deadline_thread_started = false;
+}
 
 int ty_pool_new(ty_pool **rpool)
 {
@@ -68,14 +324,17 @@ void ty_pool_free(ty_pool *pool)
 {
     if (pool) {
         if (pool->init) {
+            stop_deadline_thread(pool);
+
             ty_mutex_lock(&pool->mutex);
 
-            for (size_t i = 0; i < pool->pending_tasks.count; i++) {
-                ty_task *task = pool->pending_tasks.values[i];
-                ty_task_unref(task);
-            }
-            _hs_array_release(&pool->pending_tasks);
+            release_queue(&pool->shared_queue);
+            for (size_t i = 0; i < pool->workers.count; i++)
+                release_queue(&pool->workers.values[i]->queue);
+            memset(pool->pending_counts, 0, sizeof(pool->pending_counts));
+            pool->pending_count = 0;
             pool->max_threads = 0;
+            pool->min_threads = 0;
             ty_cond_broadcast(&pool->pending_cond);
 
             /* This is a signal for worker threads to stop detaching themselves and
@@ -84,13 +343,29 @@ void ty_pool_free(ty_pool *pool)
 
             ty_mutex_unlock(&pool->mutex);
 
-            for (size_t i = 0; i < pool->worker_threads.count; i++) {
-                ty_thread *thread = &pool->worker_threads.values[i];
-                ty_thread_join(thread);
+            for (size_t i = 0; i < pool->workers.count; i++) {
+                struct pool_worker *worker = pool->workers.values[i];
+
+                ty_thread_join(&worker->thread);
+                release_queue(&worker->queue);
+                free(worker);
+            }
+            _hs_array_release(&pool->workers);
+
+            // Tasks that never ran still have their deadline queued
+            if (pool->deadline_queue) {
+                ty_timer_entry *entry;
+
+                while ((entry = ty_timer_queue_peek(pool->deadline_queue))) {
+                    ty_timer_queue_remove(pool->deadline_queue, entry);
+                    if (entry != &pool->stop_entry)
+                        ty_task_unref(ty_container_of(entry, ty_task, deadline_entry));
+                }
             }
-            _hs_array_release(&pool->worker_threads);
         }
 
+        ty_timer_queue_free(pool->deadline_queue);
+
         ty_cond_release(&pool->pending_cond);
         ty_mutex_release(&pool->mutex);
     }
@@ -108,13 +383,13 @@ int ty_pool_set_max_threads(ty_pool *pool, unsigned int max)
     ty_mutex_lock(&pool->mutex);
 
     if (max > pool->max_threads) {
-        size_t need_threads = pool->pending_tasks.count;
-        if (need_threads > (size_t)pool->max_threads - pool->worker_threads.count)
-            need_threads = (size_t)pool->max_threads - pool->worker_threads.count;
+        size_t need_threads = pool->pending_count;
+        if (need_threads > (size_t)max - pool->workers.count)
+            need_threads = (size_t)max - pool->workers.count;
         for (size_t i = 0; i < need_threads; i++) {
             r = start_worker_thread(pool);
             if (r < 0) {
-                if (pool->worker_threads.count)
+                if (pool->workers.count)
                     r = 0;
                 goto cleanup;
             }
@@ -136,6 +411,37 @@ unsigned int ty_pool_get_max_threads(ty_pool *pool)
     return pool->max_threads;
 }
 
+int ty_pool_set_min_threads(ty_pool *pool, unsigned int min)
+{
+    assert(pool);
+
+    int r;
+
+    ty_mutex_lock(&pool->mutex);
+
+    pool->min_threads = min;
+
+    // Pre-warm the workers, these ones never exit because of the idle timeout
+    while (pool->workers.count < pool->min_threads &&
+           pool->workers.count < pool->max_threads) {
+        r = start_worker_thread(pool);
+        if (r < 0)
+            goto cleanup;
+    }
+    ty_cond_broadcast(&pool->pending_cond);
+
+    r = 0;
+cleanup:
+    ty_mutex_unlock(&pool->mutex);
+    return r;
+}
+
+unsigned int ty_pool_get_min_threads(ty_pool *pool)
+{
+    assert(pool);
+    return pool->min_threads;
+}
+
 void ty_pool_set_idle_timeout(ty_pool *pool, int timeout)
 {
     assert(pool);
@@ -152,6 +458,19 @@ int ty_pool_get_idle_timeout(ty_pool *pool)
     return pool->unused_timeout;
 }
 
+void ty_pool_get_stats(ty_pool *pool, ty_pool_stats *rstats)
+{
+    assert(pool);
+    assert(rstats);
+
+    ty_mutex_lock(&pool->mutex);
+    rstats->threads = (unsigned int)pool->workers.count;
+    rstats->busy_threads = (unsigned int)pool->busy_workers;
+    rstats->pending_tasks = (unsigned int)pool->pending_count;
+    rstats->blocked_tasks = (unsigned int)pool->held_count;
+    ty_mutex_unlock(&pool->mutex);
+}
+
 static void cleanup_default_pool(void)
 {
     ty_pool_free(default_pool);
@@ -188,6 +507,8 @@ int ty_task_new(const char *name, int (*run)(ty_task *task), ty_task **rtask)
         goto error;
     }
     task->refcount = 1;
+    task->priority = TY_TASK_PRIORITY_NORMAL;
+    task->timeout = -1;
 
     task->task_run = run;
     task->name = strdup(name);
@@ -219,6 +540,36 @@ ty_task *ty_task_ref(ty_task *task)
     return task;
 }
 
+/* Unblock the tasks that depend on this one, they fail without running if the task
+   failed (or never ran at all). */
+static void release_dependents(ty_task *task, int ret)
+{
+    ty_task **dependents;
+    unsigned int dependents_count;
+
+    ty_mutex_lock(&task->mutex);
+    dependents = task->dependents;
+    dependents_count = task->dependents_count;
+    task->dependents = NULL;
+    task->dependents_count = 0;
+    ty_mutex_unlock(&task->mutex);
+
+    for (unsigned int i = 0; i < dependents_count; i++) {
+        ty_task *dependent = dependents[i];
+
+        if (ret < 0) {
+            ty_mutex_lock(&dependent->mutex);
+            if (!dependent->dependency_error)
+                dependent->dependency_error = ret;
+            ty_mutex_unlock(&dependent->mutex);
+        }
+
+        _ty_task_unblock(dependent);
+        ty_task_unref(dependent);
+    }
+    free(dependents);
+}
+
 void ty_task_unref(ty_task *task)
 {
     if (task) {
@@ -233,6 +584,9 @@ void ty_task_unref(ty_task *task)
         if (task->task_finalize)
             (*task->task_finalize)(task);
 
+        // Nothing is going to release them otherwise
+        release_dependents(task, TY_ERROR_CANCELED);
+
         free(task->name);
         ty_cond_release(&task->cond);
         ty_mutex_release(&task->mutex);
@@ -245,9 +599,8 @@ static void change_task_status(ty_task *task, ty_task_status status)
 {
     ty_message_data msg = {0};
 
-    task->status = status;
-
     ty_mutex_lock(&task->mutex);
+    task->status = status;
     ty_cond_broadcast(&task->cond);
     ty_mutex_unlock(&task->mutex);
 
@@ -258,53 +611,135 @@ static void change_task_status(ty_task *task, ty_task_status status)
     ty_message(&msg);
 }
 
+static int arm_task_deadline(ty_task *task)
+{
+    ty_pool *pool;
+    int r;
+
+    if (task->timeout < 0 || task->deadline)
+        return 0;
+
+    if (!task->pool) {
+        r = ty_pool_get_default(&task->pool);
+        if (r < 0)
+            return r;
+    }
+    pool = task->pool;
+
+    task->deadline = ty_millis() + (uint64_t)task->timeout;
+
+    ty_mutex_lock(&pool->mutex);
+    r = start_deadline_thread(pool);
+    if (!r)
+        r = ty_timer_queue_add(pool->deadline_queue, &task->deadline_entry, task->deadline);
+    if (!r)
+        ty_task_ref(task);
+    ty_mutex_unlock(&pool->mutex);
+
+    return r;
+}
+
+static void disarm_task_deadline(ty_task *task)
+{
+    ty_pool *pool = task->pool;
+    bool queued;
+
+    if (!task->deadline)
+        return;
+
+    ty_mutex_lock(&pool->mutex);
+    queued = ty_timer_entry_is_queued(&task->deadline_entry);
+    if (queued)
+        ty_timer_queue_remove(pool->deadline_queue, &task->deadline_entry);
+    ty_mutex_unlock(&pool->mutex);
+
+    if (queued)
+        ty_task_unref(task);
+}
+
 static void run_task(ty_task *task)
 {
     assert(task->status <= TY_TASK_STATUS_PENDING);
 
     ty_task *previous_task;
+    int r;
 
     previous_task = current_task;
     current_task = task;
+    r = arm_task_deadline(task);
+
+    if (task->status == TY_TASK_STATUS_PENDING)
+        ty_trace_async_end(TY_TRACE_TASK, "queued", task);
+    ty_trace_begin(TY_TRACE_TASK, "run", task->name);
 
+    task->start_time = ty_millis();
     change_task_status(task, TY_TASK_STATUS_RUNNING);
-    task->ret = (*task->task_run)(task);
+    /* Tasks canceled or expired before they get to run, or skipped because a dependency
+       failed, still go through finalization. */
+    if (!r)
+        r = ty_task_check_canceled();
+    if (!r && task->dependency_error) {
+        // The failed dependency has already reported the error
+        ty_log(TY_LOG_DEBUG, "Skipping task '%s' because a task it depends on failed",
+               task->name);
+        r = task->dependency_error;
+    }
+    task->ret = r < 0 ? r : (*task->task_run)(task);
     if (task->task_finalize) {
         (*task->task_finalize)(task);
         task->task_finalize = NULL;
     }
+    disarm_task_deadline(task);
+    task->finish_time = ty_millis();
     change_task_status(task, TY_TASK_STATUS_FINISHED);
 
+    ty_trace_end(TY_TRACE_TASK, "run");
+
+    release_dependents(task, task->ret);
+
     current_task = previous_task;
 }
 
 static int worker_thread_main(void *udata)
 {
-    ty_pool *pool = udata;
+    struct pool_worker *worker = udata;
+    ty_pool *pool = worker->pool;
+
+    current_worker = worker;
+
+    ty_mutex_lock(&pool->mutex);
 
     while (true) {
         uint64_t start;
         bool run;
-        ty_task *task;
+        ty_task *task = NULL;
 
-        ty_mutex_lock(&pool->mutex);
         pool->busy_workers--;
 
         run = true;
         start = ty_millis();
         while (true) {
-            if (pool->worker_threads.count > pool->max_threads)
-                goto timeout;
-            if (pool->pending_tasks.count) {
-                task = pool->pending_tasks.values[0];
-                _hs_array_remove(&pool->pending_tasks, 0, 1);
+            // Other workers can still steal the tasks in our queue, don't lose them
+            if (pool->workers.count > pool->max_threads && drain_claimed_tasks(&worker->queue))
+                goto exit;
+            if (pool->pending_count) {
+                task = take_task(pool, worker);
+                assert(task);
                 break;
             }
-            if (!run)
-                goto timeout;
+            if (!run) {
+                if (pool->workers.count > pool->min_threads &&
+                        drain_claimed_tasks(&worker->queue))
+                    goto exit;
+                start = ty_millis();
+            }
 
-            run = ty_cond_wait(&pool->pending_cond, &pool->mutex,
-                               ty_adjust_timeout(pool->unused_timeout, start));
+            if (pool->workers.count > pool->min_threads) {
+                run = ty_cond_wait(&pool->pending_cond, &pool->mutex,
+                                   ty_adjust_timeout(pool->unused_timeout, start));
+            } else {
+                run = ty_cond_wait(&pool->pending_cond, &pool->mutex, -1);
+            }
         }
 
         pool->busy_workers++;
@@ -312,20 +747,23 @@ static int worker_thread_main(void *udata)
 
         run_task(task);
         ty_task_unref(task);
+
+        ty_mutex_lock(&pool->mutex);
     }
 
-timeout:
+exit:
     if (pool->init) {
-        for (size_t i = 0; i < pool->worker_threads.count; i++) {
-            ty_thread *thread = &pool->worker_threads.values[i];
-            if (thread->thread_id == ty_thread_get_self_id()) {
-                ty_thread_detach(thread);
-                pool->worker_threads.values[i] =
-                    pool->worker_threads.values[pool->worker_threads.count - 1];
-                _hs_array_pop(&pool->worker_threads, 1);
+        for (size_t i = 0; i < pool->workers.count; i++) {
+            if (pool->workers.values[i] == worker) {
+                pool->workers.values[i] = pool->workers.values[pool->workers.count - 1];
+                _hs_array_pop(&pool->workers, 1);
                 break;
             }
         }
+
+        ty_thread_detach(&worker->thread);
+        release_queue(&worker->queue);
+        free(worker);
     }
     ty_mutex_unlock(&pool->mutex);
 
@@ -335,31 +773,73 @@ timeout:
 // Call with pool->mutex locked
 static int start_worker_thread(ty_pool *pool)
 {
-    ty_thread *thread;
+    struct pool_worker *worker;
     int r;
 
+    worker = calloc(1, sizeof(*worker));
+    if (!worker)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    worker->pool = pool;
+
     // Can't handle failure after ty_thread_create() so grow the array first
-    r = _hs_array_grow(&pool->worker_threads, 1);
-    if (r < 0)
+    r = _hs_array_grow(&pool->workers, 1);
+    if (r < 0) {
+        free(worker);
         return ty_libhs_translate_error(r);
-    thread = &pool->worker_threads.values[pool->worker_threads.count];
+    }
 
-    r = ty_thread_create(thread, worker_thread_main, pool);
-    if (r < 0)
+    r = ty_thread_create(&worker->thread, worker_thread_main, worker);
+    if (r < 0) {
+        free(worker);
         return r;
+    }
 
-    pool->worker_threads.count++;
+    pool->workers.values[pool->workers.count++] = worker;
     pool->busy_workers++;
 
     return 0;
 }
 
+// Call with pool->mutex locked
+static int push_pending_task(ty_pool *pool, ty_task *task)
+{
+    struct task_queue *queue;
+    int r;
+
+    /* Start a new worker unless enough workers are idle for all the pending tasks, so that
+       the task does not wait behind the ones they are about to take. */
+    if (pool->workers.count - pool->busy_workers <= pool->pending_count &&
+            pool->workers.count < pool->max_threads) {
+        r = start_worker_thread(pool);
+        if (r < 0)
+            return r;
+    }
+
+    if (current_worker && current_worker->pool == pool) {
+        queue = &current_worker->queue;
+    } else {
+        queue = &pool->shared_queue;
+    }
+    r = push_task(&queue->deques[task->priority], task);
+    if (r < 0)
+        return r;
+    ty_task_ref(task);
+    task->queued = true;
+    pool->pending_counts[task->priority]++;
+    pool->pending_count++;
+    ty_cond_signal(&pool->pending_cond);
+
+    return 0;
+}
+
 int ty_task_start(ty_task *task)
 {
     assert(task);
     assert(task->status == TY_TASK_STATUS_READY);
+    assert(task->priority < TY_TASK_PRIORITY_COUNT);
 
     ty_pool *pool;
+    bool held;
     int r;
 
     if (!task->pool) {
@@ -369,23 +849,26 @@ int ty_task_start(ty_task *task)
     }
     pool = task->pool;
 
+    r = arm_task_deadline(task);
+    if (r < 0)
+        return r;
+
     ty_mutex_lock(&pool->mutex);
 
-    if (pool->busy_workers == pool->worker_threads.count &&
-            pool->worker_threads.count < pool->max_threads) {
-        r = start_worker_thread(pool);
+    // Blocked tasks stay out of the pool until _ty_task_unblock() releases them
+    ty_mutex_lock(&task->mutex);
+    held = task->blockers;
+    task->held = held;
+    ty_mutex_unlock(&task->mutex);
+
+    if (held) {
+        pool->held_count++;
+    } else {
+        r = push_pending_task(pool, task);
         if (r < 0)
             goto cleanup;
     }
-
-    r = _hs_array_push(&pool->pending_tasks, task);
-    if (r < 0) {
-        r = ty_libhs_translate_error(r);
-        goto cleanup;
-    }
-    ty_task_ref(task);
-    ty_cond_signal(&pool->pending_cond);
-
+    ty_trace_async_begin(TY_TRACE_TASK, "queued", task, task->name);
     change_task_status(task, TY_TASK_STATUS_PENDING);
 
     r = 0;
@@ -394,6 +877,59 @@ cleanup:
     return r;
 }
 
+/* Take a pending task back from the pool so that it can run in the calling thread. Workers
+   clear the queued flag under the pool lock when they take a task. The queue entry stays
+   behind, and gets dropped when it reaches the front. */
+static bool claim_pending_task(ty_task *task)
+{
+    ty_pool *pool = task->pool;
+    bool claimed = false;
+
+    ty_mutex_lock(&pool->mutex);
+    if (task->queued) {
+        task->queued = false;
+        pool->pending_counts[task->priority]--;
+        pool->pending_count--;
+
+        claimed = true;
+    }
+    ty_mutex_unlock(&pool->mutex);
+
+    return claimed;
+}
+
+// Same as claim_pending_task(), for started tasks that are still blocked
+static bool claim_held_task(ty_task *task)
+{
+    ty_pool *pool = task->pool;
+    bool claimed;
+
+    if (!pool)
+        return false;
+
+    ty_mutex_lock(&pool->mutex);
+    ty_mutex_lock(&task->mutex);
+    claimed = task->held;
+    task->held = false;
+    ty_mutex_unlock(&task->mutex);
+    if (claimed)
+        pool->held_count--;
+    ty_mutex_unlock(&pool->mutex);
+
+    return claimed;
+}
+
+static bool is_task_blocked(ty_task *task)
+{
+    bool blocked;
+
+    ty_mutex_lock(&task->mutex);
+    blocked = task->blockers;
+    ty_mutex_unlock(&task->mutex);
+
+    return blocked;
+}
+
 int ty_task_wait(ty_task *task, ty_task_status status, int timeout)
 {
     assert(task);
@@ -405,29 +941,13 @@ int ty_task_wait(ty_task *task, ty_task_status status, int timeout)
     /* If the caller wants to wait until the task has finished without timing out, try
        to execute the task in this thread if it's not running already. */
     if (status == TY_TASK_STATUS_FINISHED && timeout < 0) {
-        if (task->status == TY_TASK_STATUS_PENDING) {
-            ty_pool *pool = task->pool;
-
-            ty_mutex_lock(&pool->mutex);
-            if (task->status == TY_TASK_STATUS_PENDING) {
-                for (size_t i = 0; i < pool->pending_tasks.count; i++) {
-                    if (pool->pending_tasks.values[i] == task) {
-                        _hs_array_remove(&pool->pending_tasks, i, 1);
-                        break;
-                    }
-                }
-                ty_task_unref(task);
-
-                task->status = TY_TASK_STATUS_READY;
-            }
-            ty_mutex_unlock(&pool->mutex);
-        }
-
-        if (task->status == TY_TASK_STATUS_READY) {
+        if ((task->status == TY_TASK_STATUS_PENDING && claim_pending_task(task)) ||
+                (task->status == TY_TASK_STATUS_READY && !is_task_blocked(task))) {
             run_task(task);
             return 1;
         }
-    } else if (task->status == TY_TASK_STATUS_READY) {
+    }
+    if (task->status == TY_TASK_STATUS_READY) {
         r = ty_task_start(task);
         if (r < 0)
             return r;
@@ -456,6 +976,234 @@ int ty_task_join(ty_task *task)
     return task->ret;
 }
 
+void ty_task_set_timeout(ty_task *task, int timeout)
+{
+    assert(task);
+    assert(task->status == TY_TASK_STATUS_READY);
+
+    task->timeout = timeout;
+}
+
+/* The waiting task does not hold task->mutex while it waits, and it does not leave
+   _ty_task_clear_wait() until we are done with its condition. */
+static void wake_waiting_task(ty_task *task)
+{
+    ty_mutex *wait_mutex;
+    ty_cond *wait_cond;
+
+    ty_mutex_lock(&task->mutex);
+    wait_mutex = task->wait_mutex;
+    wait_cond = task->wait_cond;
+    if (wait_cond)
+        task->wait_wakers++;
+    ty_mutex_unlock(&task->mutex);
+
+    if (wait_cond) {
+        ty_mutex_lock(wait_mutex);
+        ty_cond_broadcast(wait_cond);
+        ty_mutex_unlock(wait_mutex);
+
+        ty_mutex_lock(&task->mutex);
+        task->wait_wakers--;
+        ty_cond_broadcast(&task->cond);
+        ty_mutex_unlock(&task->mutex);
+    }
+}
+
+void ty_task_cancel(ty_task *task)
+{
+    assert(task);
+
+    ty_mutex_lock(&task->mutex);
+    task->canceled = true;
+    ty_mutex_unlock(&task->mutex);
+
+    wake_waiting_task(task);
+
+    /* Nobody needs to wait for a worker to pick up a pending task only to drop it, finish
+       it right away so that it releases its board and its worker slot. */
+    if (task->status == TY_TASK_STATUS_PENDING &&
+            (claim_pending_task(task) || claim_held_task(task)))
+        run_task(task);
+}
+
+static bool is_task_canceled(ty_task *task)
+{
+    bool canceled;
+
+    ty_mutex_lock(&task->mutex);
+    canceled = task->canceled;
+    ty_mutex_unlock(&task->mutex);
+
+    return canceled;
+}
+
+static bool is_task_expired(ty_task *task)
+{
+    bool expired;
+
+    if (!task->deadline)
+        return false;
+
+    ty_mutex_lock(&task->mutex);
+    expired = task->expired;
+    ty_mutex_unlock(&task->mutex);
+
+    return expired || ty_millis() >= task->deadline;
+}
+
+int ty_task_check_canceled(void)
+{
+    ty_task *task = current_task;
+
+    if (!task)
+        return 0;
+
+    if (is_task_canceled(task))
+        return ty_error(TY_ERROR_CANCELED, "Task '%s' was canceled", task->name);
+    if (is_task_expired(task))
+        return ty_error(TY_ERROR_TIMEOUT, "Task '%s' did not finish in time", task->name);
+
+    return 0;
+}
+
+// Same as ty_task_check_canceled() but without reporting anything
+bool _ty_task_interrupted(void)
+{
+    ty_task *task = current_task;
+
+    if (!task)
+        return false;
+
+    return is_task_canceled(task) || is_task_expired(task);
+}
+
+int ty_task_add_dependency(ty_task *task, ty_task *dependency)
+{
+    assert(task);
+    assert(dependency);
+    assert(task != dependency);
+    assert(task->status == TY_TASK_STATUS_READY);
+
+    ty_task **new_dependents;
+
+    if (_ty_board_task_precedes(task, dependency))
+        return ty_error(TY_ERROR_PARAM, "Task '%s' cannot depend on '%s', which runs after it",
+                        task->name, dependency->name);
+
+    ty_mutex_lock(&dependency->mutex);
+
+    // Too late to wait for it, but not too late to fail if it did
+    if (dependency->status == TY_TASK_STATUS_FINISHED) {
+        int ret = dependency->ret;
+        ty_mutex_unlock(&dependency->mutex);
+
+        if (ret < 0) {
+            ty_mutex_lock(&task->mutex);
+            if (!task->dependency_error)
+                task->dependency_error = ret;
+            ty_mutex_unlock(&task->mutex);
+        }
+
+        return 0;
+    }
+
+    new_dependents = realloc(dependency->dependents,
+                             (dependency->dependents_count + 1) * sizeof(*new_dependents));
+    if (!new_dependents) {
+        ty_mutex_unlock(&dependency->mutex);
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+    dependency->dependents = new_dependents;
+    dependency->dependents[dependency->dependents_count++] = ty_task_ref(task);
+    _ty_task_block(task);
+
+    ty_mutex_unlock(&dependency->mutex);
+
+    return 0;
+}
+
+void _ty_task_block(ty_task *task)
+{
+    assert(task);
+    assert(task->status == TY_TASK_STATUS_READY);
+
+    ty_mutex_lock(&task->mutex);
+    task->blockers++;
+    ty_mutex_unlock(&task->mutex);
+}
+
+void _ty_task_unblock(ty_task *task)
+{
+    assert(task);
+
+    bool submit;
+    int r;
+
+    ty_mutex_lock(&task->mutex);
+    assert(task->blockers);
+    submit = !--task->blockers && task->held;
+    if (submit)
+        task->held = false;
+    ty_mutex_unlock(&task->mutex);
+
+    if (submit) {
+        ty_pool *pool = task->pool;
+
+        ty_mutex_lock(&pool->mutex);
+        pool->held_count--;
+        r = push_pending_task(pool, task);
+        ty_mutex_unlock(&pool->mutex);
+
+        // We cannot report the failure to anyone, running the task here is the next best thing
+        if (r < 0)
+            run_task(task);
+    }
+}
+
+int _ty_task_adjust_timeout(int timeout)
+{
+    ty_task *task = current_task;
+
+    if (!task || !task->deadline)
+        return timeout;
+
+    uint64_t now = ty_millis();
+    int remaining = task->deadline > now ? (int)TY_MIN(task->deadline - now, INT_MAX) : 0;
+
+    if (timeout < 0 || remaining < timeout)
+        timeout = remaining;
+    return timeout;
+}
+
+void _ty_task_set_wait(ty_mutex *mutex, ty_cond *cond)
+{
+    ty_task *task = current_task;
+
+    if (!task)
+        return;
+
+    ty_mutex_lock(&task->mutex);
+    task->wait_mutex = mutex;
+    task->wait_cond = cond;
+    ty_mutex_unlock(&task->mutex);
+}
+
+void _ty_task_clear_wait(void)
+{
+    ty_task *task = current_task;
+
+    if (!task)
+        return;
+
+    ty_mutex_lock(&task->mutex);
+    task->wait_mutex = NULL;
+    task->wait_cond = NULL;
+    while (task->wait_wakers)
+        ty_cond_wait(&task->cond, &task->mutex, -1);
+    ty_mutex_unlock(&task->mutex);
+}
+
 ty_task *ty_task_get_current(void)
 {
     return current_task;
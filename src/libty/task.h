@@ -13,6 +13,7 @@
 
 #include "common.h"
 #include "thread.h"
+#include "timer.h"
 
 TY_C_BEGIN
 
@@ -20,6 +21,16 @@ struct ty_board;
 struct ty_firmware;
 
 typedef struct ty_pool ty_pool;
+typedef struct ty_task_graph ty_task_graph;
+
+// Workers pick pending tasks by priority first, and in submission order within a priority
+typedef enum ty_task_priority {
+    TY_TASK_PRIORITY_BULK,
+    TY_TASK_PRIORITY_NORMAL,
+    TY_TASK_PRIORITY_INTERACTIVE,
+
+    TY_TASK_PRIORITY_COUNT
+} ty_task_priority;
 
 typedef struct ty_task {
     unsigned int refcount;
@@ -27,6 +38,30 @@ typedef struct ty_task {
     char *name;
     ty_task_status status;
     ty_pool *pool;
+    ty_task_priority priority;
+    bool queued;
+
+    bool canceled;
+    int timeout;
+    uint64_t deadline;
+    // Set by the pool deadline thread, which holds a reference while the entry is queued
+    bool expired;
+    ty_timer_entry deadline_entry;
+    // Condition the running task waits on, see _ty_task_set_wait()
+    ty_mutex *wait_mutex;
+    ty_cond *wait_cond;
+    unsigned int wait_wakers;
+
+    unsigned int blockers;
+    bool held;
+
+    // Tasks blocked until this one finishes, see ty_task_add_dependency()
+    struct ty_task **dependents;
+    unsigned int dependents_count;
+    int dependency_error;
+
+    uint64_t start_time;
+    uint64_t finish_time;
 
     ty_message_func *user_callback;
     void *user_callback_udata;
@@ -49,12 +84,15 @@ typedef struct ty_task {
             struct ty_firmware **fws;
             unsigned int fws_count;
             int flags;
+            struct ty_task *coalesced;
         } upload;
 
         struct {
             struct ty_board *board;
-            char *buf;
+            const char *buf;
             size_t size;
+            void (*release)(void *udata);
+            void *release_udata;
         } send;
 
         struct {
@@ -62,25 +100,40 @@ typedef struct ty_task {
             FILE *fp;
             size_t size;
             char *filename;
+            int flags;
         } send_file;
 
         struct {
             struct ty_board *board;
+            struct ty_task *coalesced;
         } reset;
 
         struct {
             struct ty_board *board;
+            struct ty_task *coalesced;
         } reboot;
     } u;
 } ty_task;
 
+typedef struct ty_pool_stats {
+    unsigned int threads;
+    unsigned int busy_threads;
+    // Tasks waiting for a thread
+    unsigned int pending_tasks;
+    // Started tasks waiting for their dependencies, or for their turn on a board
+    unsigned int blocked_tasks;
+} ty_pool_stats;
+
 TY_PUBLIC int ty_pool_new(ty_pool **rpool);
 TY_PUBLIC void ty_pool_free(ty_pool *pool);
 
 TY_PUBLIC int ty_pool_set_max_threads(ty_pool *pool, unsigned int max);
 TY_PUBLIC unsigned int ty_pool_get_max_threads(ty_pool *pool);
+TY_PUBLIC int ty_pool_set_min_threads(ty_pool *pool, unsigned int min);
+TY_PUBLIC unsigned int ty_pool_get_min_threads(ty_pool *pool);
 TY_PUBLIC void ty_pool_set_idle_timeout(ty_pool *pool, int timeout);
 TY_PUBLIC int ty_pool_get_idle_timeout(ty_pool *pool);
+TY_PUBLIC void ty_pool_get_stats(ty_pool *pool, ty_pool_stats *rstats);
 
 TY_PUBLIC int ty_pool_get_default(ty_pool **rpool);
 
@@ -93,8 +146,39 @@ TY_PUBLIC int ty_task_start(ty_task *task);
 TY_PUBLIC int ty_task_wait(ty_task *task, ty_task_status status, int timeout);
 TY_PUBLIC int ty_task_join(ty_task *task);
 
+TY_PUBLIC void ty_task_set_timeout(ty_task *task, int timeout);
+TY_PUBLIC void ty_task_cancel(ty_task *task);
+TY_PUBLIC int ty_task_check_canceled(void);
+
+/* The task only runs once the dependency has finished, and fails with the same error
+   without running if the dependency fails. Dependencies must not form a cycle, use a task
+   graph to get this checked. Tasks for the same board already run in creation order, so a
+   board task cannot depend on one created after it (this fails with TY_ERROR_PARAM). */
+TY_PUBLIC int ty_task_add_dependency(ty_task *task, ty_task *dependency);
+
 TY_PUBLIC ty_task *ty_task_get_current(void);
 
+TY_PUBLIC int ty_task_graph_new(ty_task_graph **rgraph);
+TY_PUBLIC void ty_task_graph_free(ty_task_graph *graph);
+
+// Used for graph tasks without a pool, the default pool is used otherwise
+TY_PUBLIC void ty_task_graph_set_pool(ty_task_graph *graph, ty_pool *pool);
+
+TY_PUBLIC int ty_task_graph_add(ty_task_graph *graph, ty_task *task);
+TY_PUBLIC int ty_task_graph_add_dependency(ty_task_graph *graph, ty_task *task, ty_task *dependency);
+// The barrier task finishes once all the tasks added so far are done
+TY_PUBLIC int ty_task_graph_add_barrier(ty_task_graph *graph, ty_task **rbarrier);
+
+TY_PUBLIC int ty_task_graph_start(ty_task_graph *graph);
+TY_PUBLIC int ty_task_graph_wait(ty_task_graph *graph, int timeout);
+TY_PUBLIC int ty_task_graph_join(ty_task_graph *graph);
+
+/* Fill rtasks with the chain of tasks that determined when the graph finished, from the
+   first to the last, once all of them are done. Each task in the chain is the dependency
+   that finished last. Only the last max tasks are returned for longer chains. */
+TY_PUBLIC unsigned int ty_task_graph_get_critical_path(const ty_task_graph *graph,
+                                                       ty_task **rtasks, unsigned int max);
+
 TY_C_END
 
 #endif
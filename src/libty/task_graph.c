@@ -0,0 +1,360 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "../libhs/array.h"
+#include "system.h"
+#include "task.h"
+
+/* The graph keeps its own copy of the edges, so that cycles can be detected when they are
+   added and the critical path can be found once everything is done. The tasks themselves
+   only know about their dependents, see ty_task_add_dependency(). */
+
+struct graph_node {
+    ty_task *task;
+    _HS_ARRAY(size_t) dependencies;
+};
+
+struct ty_task_graph {
+    _HS_ARRAY(struct graph_node) nodes;
+    ty_pool *pool;
+};
+
+int ty_task_graph_new(ty_task_graph **rgraph)
+{
+    assert(rgraph);
+
+    ty_task_graph *graph;
+
+    graph = calloc(1, sizeof(*graph));
+    if (!graph)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    *rgraph = graph;
+    return 0;
+}
+
+void ty_task_graph_free(ty_task_graph *graph)
+{
+    if (graph) {
+        for (size_t i = 0; i < graph->nodes.count; i++) {
+            struct graph_node *node = &graph->nodes.values[i];
+
+            ty_task_unref(node->task);
+            _hs_array_release(&node->dependencies);
+        }
+        _hs_array_release(&graph->nodes);
+    }
+
+    free(graph);
+}
+
+void ty_task_graph_set_pool(ty_task_graph *graph, ty_pool *pool)
+{
+    assert(graph);
+    graph->pool = pool;
+}
+
+static size_t find_node(const ty_task_graph *graph, const ty_task *task)
+{
+    for (size_t i = 0; i < graph->nodes.count; i++) {
+        if (graph->nodes.values[i].task == task)
+            return i;
+    }
+
+    return SIZE_MAX;
+}
+
+static int add_node(ty_task_graph *graph, ty_task *task, size_t *rindex)
+{
+    struct graph_node *node;
+    size_t idx;
+    int r;
+
+    idx = find_node(graph, task);
+    if (idx == SIZE_MAX) {
+        r = _hs_array_grow(&graph->nodes, 1);
+        if (r < 0)
+            return ty_libhs_translate_error(r);
+
+        idx = graph->nodes.count++;
+        node = &graph->nodes.values[idx];
+        memset(node, 0, sizeof(*node));
+        node->task = ty_task_ref(task);
+    }
+
+    if (rindex)
+        *rindex = idx;
+    return 0;
+}
+
+int ty_task_graph_add(ty_task_graph *graph, ty_task *task)
+{
+    assert(graph);
+    assert(task);
+
+    return add_node(graph, task, NULL);
+}
+
+// Depth-first search along dependencies, visited is a scratch array with one entry per node
+static bool depends_on(const ty_task_graph *graph, size_t from, size_t to, bool *visited)
+{
+    const struct graph_node *node = &graph->nodes.values[from];
+
+    if (from == to)
+        return true;
+    if (visited[from])
+        return false;
+    visited[from] = true;
+
+    for (size_t i = 0; i < node->dependencies.count; i++) {
+        if (depends_on(graph, node->dependencies.values[i], to, visited))
+            return true;
+    }
+
+    return false;
+}
+
+int ty_task_graph_add_dependency(ty_task_graph *graph, ty_task *task, ty_task *dependency)
+{
+    assert(graph);
+    assert(task);
+    assert(dependency);
+
+    size_t task_idx, dependency_idx;
+    struct graph_node *node;
+    bool *visited;
+    bool cycle;
+    int r;
+
+    r = add_node(graph, task, &task_idx);
+    if (r < 0)
+        return r;
+    r = add_node(graph, dependency, &dependency_idx);
+    if (r < 0)
+        return r;
+    node = &graph->nodes.values[task_idx];
+
+    for (size_t i = 0; i < node->dependencies.count; i++) {
+        if (node->dependencies.values[i] == dependency_idx)
+            return 0;
+    }
+
+    visited = calloc(graph->nodes.count, sizeof(*visited));
+    if (!visited)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    cycle = depends_on(graph, dependency_idx, task_idx, visited);
+    free(visited);
+    if (cycle)
+        return ty_error(TY_ERROR_PARAM, "Making task '%s' depend on '%s' would create a cycle",
+                        task->name, dependency->name);
+
+    r = _hs_array_push(&node->dependencies, dependency_idx);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    r = ty_task_add_dependency(task, dependency);
+    if (r < 0) {
+        _hs_array_pop(&node->dependencies, 1);
+        return r;
+    }
+
+    return 0;
+}
+
+static int run_barrier(ty_task *task)
+{
+    TY_UNUSED(task);
+    return 0;
+}
+
+int ty_task_graph_add_barrier(ty_task_graph *graph, ty_task **rbarrier)
+{
+    assert(graph);
+
+    ty_task *barrier;
+    size_t count;
+    int r;
+
+    r = ty_task_new("barrier", run_barrier, &barrier);
+    if (r < 0)
+        return r;
+
+    // Fan-in from everything added so far, the barrier itself comes last
+    count = graph->nodes.count;
+    r = ty_task_graph_add(graph, barrier);
+    if (r < 0)
+        goto cleanup;
+    for (size_t i = 0; i < count; i++) {
+        r = ty_task_graph_add_dependency(graph, barrier, graph->nodes.values[i].task);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    if (rbarrier)
+        *rbarrier = barrier;
+    r = 0;
+cleanup:
+    // The graph holds its own reference, if it got that far
+    ty_task_unref(barrier);
+    return r;
+}
+
+int ty_task_graph_start(ty_task_graph *graph)
+{
+    assert(graph);
+
+    int r;
+
+    /* Blocked tasks stay out of the pool until their dependencies are done, so starting
+       everything right away lets independent chains (e.g. one per board) overlap. */
+    for (size_t i = 0; i < graph->nodes.count; i++) {
+        ty_task *task = graph->nodes.values[i].task;
+
+        if (task->status != TY_TASK_STATUS_READY)
+            continue;
+
+        if (!task->pool && graph->pool)
+            task->pool = graph->pool;
+        r = ty_task_start(task);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+int ty_task_graph_wait(ty_task_graph *graph, int timeout)
+{
+    assert(graph);
+
+    uint64_t start;
+    int r;
+
+    r = ty_task_graph_start(graph);
+    if (r < 0)
+        return r;
+
+    start = ty_millis();
+    for (size_t i = 0; i < graph->nodes.count; i++) {
+        r = ty_task_wait(graph->nodes.values[i].task, TY_TASK_STATUS_FINISHED,
+                         ty_adjust_timeout(timeout, start));
+        if (r <= 0)
+            return r;
+    }
+
+    return 1;
+}
+
+static void log_critical_path(const ty_task_graph *graph)
+{
+    ty_task *path[32];
+    unsigned int count;
+    char buf[512];
+    size_t len = 0;
+
+    count = ty_task_graph_get_critical_path(graph, path, TY_COUNTOF(path));
+    if (!count)
+        return;
+
+    for (unsigned int i = 0; i < count && len < sizeof(buf); i++) {
+        len += (size_t)snprintf(buf + len, sizeof(buf) - len, "%s%s (%" PRIu64 " ms)",
+                                i ? " -> " : "", path[i]->name,
+                                path[i]->finish_time - path[i]->start_time);
+    }
+    ty_log(TY_LOG_DEBUG, "Critical path: %s, %" PRIu64 " ms total", buf,
+           path[count - 1]->finish_time - path[0]->start_time);
+}
+
+int ty_task_graph_join(ty_task_graph *graph)
+{
+    assert(graph);
+
+    int r;
+
+    r = ty_task_graph_wait(graph, -1);
+    if (r < 0)
+        return r;
+
+    log_critical_path(graph);
+
+    // Report the first failure, dependents of a failed task fail with the same error
+    for (size_t i = 0; i < graph->nodes.count; i++) {
+        ty_task *task = graph->nodes.values[i].task;
+
+        if (task->ret < 0)
+            return task->ret;
+    }
+
+    return 0;
+}
+
+unsigned int ty_task_graph_get_critical_path(const ty_task_graph *graph, ty_task **rtasks,
+                                             unsigned int max)
+{
+    assert(graph);
+    assert(rtasks || !max);
+
+    bool *has_dependents;
+    size_t idx = SIZE_MAX;
+    unsigned int count = 0;
+
+    has_dependents = calloc(graph->nodes.count + 1, sizeof(*has_dependents));
+    if (!has_dependents)
+        return 0;
+    for (size_t i = 0; i < graph->nodes.count; i++) {
+        const struct graph_node *node = &graph->nodes.values[i];
+
+        for (size_t j = 0; j < node->dependencies.count; j++)
+            has_dependents[node->dependencies.values[j]] = true;
+    }
+
+    /* Start from the task that finished last, and walk back. Timestamps are not precise
+       enough to tell a task from its dependents, so only consider the final ones. */
+    for (size_t i = 0; i < graph->nodes.count; i++) {
+        const ty_task *task = graph->nodes.values[i].task;
+
+        if (task->status != TY_TASK_STATUS_FINISHED) {
+            idx = SIZE_MAX;
+            break;
+        }
+        if (has_dependents[i])
+            continue;
+        if (idx == SIZE_MAX || task->finish_time > graph->nodes.values[idx].task->finish_time)
+            idx = i;
+    }
+    free(has_dependents);
+
+    while (idx != SIZE_MAX && count < max) {
+        const struct graph_node *node = &graph->nodes.values[idx];
+        size_t next = SIZE_MAX;
+
+        rtasks[count++] = node->task;
+
+        for (size_t i = 0; i < node->dependencies.count; i++) {
+            size_t dep = node->dependencies.values[i];
+
+            if (next == SIZE_MAX ||
+                    graph->nodes.values[dep].task->finish_time >
+                    graph->nodes.values[next].task->finish_time)
+                next = dep;
+        }
+        idx = next;
+    }
+
+    // We walked from the end, put the chain back in order
+    for (unsigned int i = 0; i < count / 2; i++) {
+        ty_task *tmp = rtasks[i];
+        rtasks[i] = rtasks[count - i - 1];
+        rtasks[count - i - 1] = tmp;
+    }
+
+    return count;
+}
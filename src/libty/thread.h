@@ -83,6 +83,8 @@ TY_PUBLIC int ty_thread_join(ty_thread *thread);
 TY_PUBLIC void ty_thread_detach(ty_thread *thread);
 
 TY_PUBLIC ty_thread_id ty_thread_get_self_id(void);
+// Number of threads started with ty_thread_create() that are still running
+TY_PUBLIC unsigned int ty_thread_get_count(void);
 
 TY_PUBLIC int ty_mutex_init(ty_mutex *mutex);
 TY_PUBLIC void ty_mutex_release(ty_mutex *mutex);
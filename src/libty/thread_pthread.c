@@ -15,6 +15,8 @@
 
 static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t thread_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t thread_atfork_once = PTHREAD_ONCE_INIT;
+static unsigned int thread_count;
 
 struct thread_context {
     ty_thread *thread;
@@ -27,12 +29,44 @@ static void *thread_proc(void *udata)
 {
     struct thread_context ctx = *(struct thread_context *)udata;
 
+    int r;
+
     pthread_mutex_lock(&thread_mutex);
     ctx.thread->init = true;
+    thread_count++;
     pthread_cond_broadcast(&thread_cond);
     pthread_mutex_unlock(&thread_mutex);
 
-    return (void *)(intptr_t)(*ctx.f)(ctx.udata);
+    r = (*ctx.f)(ctx.udata);
+    _ty_trace_release_thread();
+
+    pthread_mutex_lock(&thread_mutex);
+    thread_count--;
+    pthread_mutex_unlock(&thread_mutex);
+
+    return (void *)(intptr_t)r;
+}
+
+static void lock_threads(void)
+{
+    pthread_mutex_lock(&thread_mutex);
+}
+
+static void unlock_threads(void)
+{
+    pthread_mutex_unlock(&thread_mutex);
+}
+
+// Only the thread that called fork() exists in the child
+static void reset_threads(void)
+{
+    thread_count = 0;
+    pthread_mutex_unlock(&thread_mutex);
+}
+
+static void register_atfork(void)
+{
+    pthread_atfork(lock_threads, unlock_threads, reset_threads);
 }
 
 int ty_thread_create(ty_thread *thread, ty_thread_func *f, void *udata)
@@ -44,6 +78,8 @@ int ty_thread_create(ty_thread *thread, ty_thread_func *f, void *udata)
     ctx.f = f;
     ctx.udata = udata;
 
+    pthread_once(&thread_atfork_once, register_atfork);
+
     thread->init = false;
     r = pthread_create(&thread->thread_id, NULL, thread_proc, &ctx);
     if (r < 0)
@@ -86,6 +122,17 @@ ty_thread_id ty_thread_get_self_id(void)
     return pthread_self();
 }
 
+unsigned int ty_thread_get_count(void)
+{
+    unsigned int count;
+
+    pthread_mutex_lock(&thread_mutex);
+    count = thread_count;
+    pthread_mutex_unlock(&thread_mutex);
+
+    return count;
+}
+
 int ty_mutex_init(ty_mutex *mutex)
 {
     int r;
@@ -178,11 +225,15 @@ bool ty_cond_wait(ty_cond *cond, ty_mutex *mutex, int timeout)
         r = pthread_cond_timedwait_relative_np(&cond->cond, &mutex->mutex, &ts);
 #else
         struct timespec ts;
-        uint64_t end;
 
-        end = ty_millis() + (uint64_t)timeout;
-        ts.tv_sec = (time_t)(end / 1000);
-        ts.tv_nsec = (long)(end % 1000 * 1000000);
+        // Use the clock the condition is bound to, ty_millis() may use CLOCK_MONOTONIC_RAW
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += (time_t)(timeout / 1000);
+        ts.tv_nsec += (long)(timeout % 1000 * 1000000);
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
 
         r = pthread_cond_timedwait(&cond->cond, &mutex->mutex, &ts);
 #endif
@@ -24,6 +24,8 @@ static WakeConditionVariable_func *WakeConditionVariable_;
 static WakeAllConditionVariable_func *WakeAllConditionVariable_;
 static SleepConditionVariableCS_func *SleepConditionVariableCS_;
 
+static volatile LONG thread_count;
+
 struct thread_context {
     ty_thread *thread;
 
@@ -38,9 +40,13 @@ static unsigned int __stdcall thread_proc(void *udata)
     struct thread_context ctx = *(struct thread_context *)udata;
     union { DWORD dw; int i; } code;
 
+    InterlockedIncrement(&thread_count);
     SetEvent(ctx.ev);
 
     code.i = (*ctx.f)(ctx.udata);
+    _ty_trace_release_thread();
+
+    InterlockedDecrement(&thread_count);
     return code.dw;
 }
 
@@ -106,6 +112,11 @@ ty_thread_id ty_thread_get_self_id()
     return GetCurrentThreadId();
 }
 
+unsigned int ty_thread_get_count(void)
+{
+    return (unsigned int)InterlockedCompareExchange(&thread_count, 0, 0);
+}
+
 int ty_mutex_init(ty_mutex *mutex)
 {
     InitializeCriticalSection((CRITICAL_SECTION *)&mutex->mutex);
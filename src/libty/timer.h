@@ -31,6 +31,41 @@ TY_PUBLIC void ty_timer_get_descriptors(const ty_timer *timer, struct ty_descrip
 TY_PUBLIC int ty_timer_set(ty_timer *timer, int value, int flags);
 TY_PUBLIC uint64_t ty_timer_rearm(ty_timer *timer);
 
+/* Deadline scheduler built on top of a single ty_timer. Entries are meant to be embedded
+   in the objects they belong to, deadlines use the ty_millis() clock. Adding, removing and
+   popping entries costs O(log n), and the underlying timer is only reprogrammed when the
+   earliest deadline moves forward. */
+typedef struct ty_timer_queue ty_timer_queue;
+
+typedef struct ty_timer_entry {
+    uint64_t deadline;
+
+    // Private, 0 when the entry is not queued
+    size_t queue_index;
+} ty_timer_entry;
+
+TY_PUBLIC int ty_timer_queue_new(ty_timer_queue **rqueue);
+TY_PUBLIC void ty_timer_queue_free(ty_timer_queue *queue);
+
+TY_PUBLIC void ty_timer_queue_get_descriptors(const ty_timer_queue *queue,
+                                              struct ty_descriptor_set *set, int id);
+
+TY_PUBLIC int ty_timer_queue_add(ty_timer_queue *queue, ty_timer_entry *entry, uint64_t deadline);
+TY_PUBLIC void ty_timer_queue_remove(ty_timer_queue *queue, ty_timer_entry *entry);
+TY_PUBLIC void ty_timer_queue_clear(ty_timer_queue *queue);
+// Timers are shared after fork(), use this in the child to give the queue its own timer
+TY_PUBLIC int ty_timer_queue_renew_timer(ty_timer_queue *queue);
+static inline bool ty_timer_entry_is_queued(const ty_timer_entry *entry)
+{
+    return entry->queue_index;
+}
+
+TY_PUBLIC size_t ty_timer_queue_get_count(const ty_timer_queue *queue);
+TY_PUBLIC int ty_timer_queue_get_timeout(const ty_timer_queue *queue);
+TY_PUBLIC ty_timer_entry *ty_timer_queue_peek(const ty_timer_queue *queue);
+
+TY_PUBLIC int ty_timer_queue_pop(ty_timer_queue *queue, ty_timer_entry **rentry);
+
 TY_C_END
 
 #endif
@@ -0,0 +1,273 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "../libhs/array.h"
+#include "system.h"
+#include "timer.h"
+
+/* Entries that are about to expire are popped right away to deal with limited timer
+   resolution (e.g. TickCount64() on Windows). */
+#define QUEUE_SLACK 20
+
+struct ty_timer_queue {
+    ty_timer *timer;
+    uint64_t timer_deadline;
+
+    // Binary min-heap ordered by deadline
+    _HS_ARRAY(ty_timer_entry *) heap;
+};
+
+int ty_timer_queue_new(ty_timer_queue **rqueue)
+{
+    assert(rqueue);
+
+    ty_timer_queue *queue;
+    int r;
+
+    queue = calloc(1, sizeof(*queue));
+    if (!queue) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    r = ty_timer_new(&queue->timer);
+    if (r < 0)
+        goto error;
+
+    *rqueue = queue;
+    return 0;
+
+error:
+    ty_timer_queue_free(queue);
+    return r;
+}
+
+void ty_timer_queue_free(ty_timer_queue *queue)
+{
+    if (queue) {
+        ty_timer_queue_clear(queue);
+        _hs_array_release(&queue->heap);
+        ty_timer_free(queue->timer);
+    }
+
+    free(queue);
+}
+
+void ty_timer_queue_get_descriptors(const ty_timer_queue *queue, ty_descriptor_set *set, int id)
+{
+    assert(queue);
+    assert(set);
+
+    ty_timer_get_descriptors(queue->timer, set, id);
+}
+
+static void put_entry(ty_timer_queue *queue, size_t idx, ty_timer_entry *entry)
+{
+    queue->heap.values[idx] = entry;
+    entry->queue_index = idx + 1;
+}
+
+static void sift_up(ty_timer_queue *queue, size_t idx)
+{
+    ty_timer_entry *entry = queue->heap.values[idx];
+
+    while (idx) {
+        size_t parent = (idx - 1) / 2;
+        if (queue->heap.values[parent]->deadline <= entry->deadline)
+            break;
+
+        put_entry(queue, idx, queue->heap.values[parent]);
+        idx = parent;
+    }
+    put_entry(queue, idx, entry);
+}
+
+static void sift_down(ty_timer_queue *queue, size_t idx)
+{
+    ty_timer_entry *entry = queue->heap.values[idx];
+
+    for (;;) {
+        size_t child = idx * 2 + 1;
+        if (child >= queue->heap.count)
+            break;
+        if (child + 1 < queue->heap.count &&
+                queue->heap.values[child + 1]->deadline < queue->heap.values[child]->deadline)
+            child++;
+        if (entry->deadline <= queue->heap.values[child]->deadline)
+            break;
+
+        put_entry(queue, idx, queue->heap.values[child]);
+        idx = child;
+    }
+    put_entry(queue, idx, entry);
+}
+
+static int get_delay(uint64_t deadline)
+{
+    uint64_t now = ty_millis();
+
+    if (deadline <= now)
+        return 0;
+    return (int)TY_MIN(deadline - now, INT_MAX);
+}
+
+static int arm_timer(ty_timer_queue *queue, uint64_t deadline)
+{
+    int r;
+
+    r = ty_timer_set(queue->timer, get_delay(deadline), TY_TIMER_ONESHOT);
+    if (r < 0)
+        return r;
+    queue->timer_deadline = deadline;
+
+    return 0;
+}
+
+int ty_timer_queue_add(ty_timer_queue *queue, ty_timer_entry *entry, uint64_t deadline)
+{
+    assert(queue);
+    assert(entry);
+
+    int r;
+
+    if (entry->queue_index)
+        ty_timer_queue_remove(queue, entry);
+
+    r = _hs_array_grow(&queue->heap, 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    entry->deadline = deadline;
+    queue->heap.values[queue->heap.count++] = entry;
+    sift_up(queue, queue->heap.count - 1);
+
+    /* Removing entries never disarms the timer, so it can fire too early but never too late.
+       ty_timer_queue_pop() takes care of moving it forward. */
+    if (!queue->timer_deadline || deadline < queue->timer_deadline) {
+        r = arm_timer(queue, deadline);
+        if (r < 0) {
+            ty_timer_queue_remove(queue, entry);
+            return r;
+        }
+    }
+
+    return 0;
+}
+
+void ty_timer_queue_remove(ty_timer_queue *queue, ty_timer_entry *entry)
+{
+    assert(queue);
+    assert(entry);
+
+    if (!entry->queue_index)
+        return;
+
+    size_t idx = entry->queue_index - 1;
+    ty_timer_entry *last;
+
+    assert(idx < queue->heap.count && queue->heap.values[idx] == entry);
+
+    entry->queue_index = 0;
+    last = queue->heap.values[--queue->heap.count];
+    if (last != entry) {
+        put_entry(queue, idx, last);
+        if (idx && queue->heap.values[(idx - 1) / 2]->deadline > last->deadline) {
+            sift_up(queue, idx);
+        } else {
+            sift_down(queue, idx);
+        }
+    }
+}
+
+void ty_timer_queue_clear(ty_timer_queue *queue)
+{
+    assert(queue);
+
+    for (size_t i = 0; i < queue->heap.count; i++)
+        queue->heap.values[i]->queue_index = 0;
+    queue->heap.count = 0;
+
+    ty_timer_set(queue->timer, -1, 0);
+    queue->timer_deadline = 0;
+}
+
+int ty_timer_queue_renew_timer(ty_timer_queue *queue)
+{
+    assert(queue);
+
+    ty_timer *timer;
+    int r;
+
+    r = ty_timer_new(&timer);
+    if (r < 0)
+        return r;
+    ty_timer_free(queue->timer);
+    queue->timer = timer;
+    queue->timer_deadline = 0;
+
+    if (queue->heap.count)
+        return arm_timer(queue, queue->heap.values[0]->deadline);
+    return 0;
+}
+
+size_t ty_timer_queue_get_count(const ty_timer_queue *queue)
+{
+    assert(queue);
+    return queue->heap.count;
+}
+
+int ty_timer_queue_get_timeout(const ty_timer_queue *queue)
+{
+    assert(queue);
+
+    if (!queue->heap.count)
+        return -1;
+    return get_delay(queue->heap.values[0]->deadline);
+}
+
+ty_timer_entry *ty_timer_queue_peek(const ty_timer_queue *queue)
+{
+    assert(queue);
+    return queue->heap.count ? queue->heap.values[0] : NULL;
+}
+
+int ty_timer_queue_pop(ty_timer_queue *queue, ty_timer_entry **rentry)
+{
+    assert(queue);
+    assert(rentry);
+
+    if (queue->heap.count) {
+        ty_timer_entry *entry = queue->heap.values[0];
+
+        if (entry->deadline < ty_millis() + QUEUE_SLACK) {
+            ty_timer_queue_remove(queue, entry);
+            *rentry = entry;
+            return 1;
+        }
+    }
+
+    // Nothing left to expire, reprogram the timer for the next deadline (if any)
+    uint64_t ticks = ty_timer_rearm(queue->timer);
+    if (queue->heap.count) {
+        uint64_t deadline = queue->heap.values[0]->deadline;
+
+        if (ticks || deadline != queue->timer_deadline) {
+            int r = arm_timer(queue, deadline);
+            if (r < 0)
+                return r;
+        }
+    } else if (queue->timer_deadline) {
+        ty_timer_set(queue->timer, -1, 0);
+        queue->timer_deadline = 0;
+    }
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#ifdef _WIN32
+    // Need that for InterlockedX functions
+    #include <windows.h>
+#endif
+#include "system.h"
+#include "thread.h"
+#include "trace.h"
+
+#define TRACE_RING_SIZE 4096
+
+struct trace_event {
+    uint64_t time;
+    const char *category;
+    const char *name;
+    const void *id;
+    char phase;
+    char arg[47];
+};
+
+/* Each thread writes to its own ring, the lock is only contended while the trace is being
+   written out. Rings are never freed: detached pool workers may still be using them when
+   the process exits. Instead, threads started with ty_thread_create() give their ring back
+   when they end, so the number of rings follows the number of concurrent threads. */
+struct trace_ring {
+    struct trace_ring *next;
+    unsigned int tid;
+    bool used;
+
+    ty_mutex mutex;
+    uint64_t count;
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+static bool trace_enabled;
+static struct trace_ring *trace_rings;
+static unsigned int trace_rings_count;
+static TY_THREAD_LOCAL struct trace_ring *current_ring;
+
+void ty_trace_set_enabled(bool enable)
+{
+#ifdef _MSC_VER
+    *(volatile bool *)&trace_enabled = enable;
+#else
+    __atomic_store_n(&trace_enabled, enable, __ATOMIC_RELAXED);
+#endif
+}
+
+bool ty_trace_is_enabled(void)
+{
+#ifdef _MSC_VER
+    return *(volatile bool *)&trace_enabled;
+#else
+    return __atomic_load_n(&trace_enabled, __ATOMIC_RELAXED);
+#endif
+}
+
+static struct trace_ring *first_ring(void)
+{
+#ifdef _MSC_VER
+    return *(struct trace_ring *volatile *)&trace_rings;
+#else
+    return __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static bool acquire_ring(struct trace_ring *ring)
+{
+#ifdef _MSC_VER
+    return !InterlockedCompareExchange8((volatile char *)&ring->used, 1, 0);
+#else
+    bool used = false;
+    return __atomic_compare_exchange_n(&ring->used, &used, true, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#endif
+}
+
+static struct trace_ring *get_ring(void)
+{
+    struct trace_ring *ring = current_ring;
+
+    if (ring)
+        return ring;
+
+    // Events left by the previous owner stay, it used the ring before us
+    for (ring = first_ring(); ring; ring = ring->next) {
+        if (acquire_ring(ring)) {
+            current_ring = ring;
+            return ring;
+        }
+    }
+
+    ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+    if (ty_mutex_init(&ring->mutex) < 0) {
+        free(ring);
+        return NULL;
+    }
+    ring->used = true;
+
+#ifdef _MSC_VER
+    ring->tid = (unsigned int)InterlockedIncrement((LONG *)&trace_rings_count);
+    do {
+        ring->next = trace_rings;
+    } while (InterlockedCompareExchangePointer((PVOID *)&trace_rings, ring, ring->next) != ring->next);
+#else
+    ring->tid = __atomic_add_fetch(&trace_rings_count, 1, __ATOMIC_RELAXED);
+    ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        continue;
+#endif
+
+    current_ring = ring;
+    return ring;
+}
+
+void _ty_trace_release_thread(void)
+{
+    struct trace_ring *ring = current_ring;
+
+    if (!ring)
+        return;
+    current_ring = NULL;
+
+#ifdef _MSC_VER
+    InterlockedExchange8((volatile char *)&ring->used, 0);
+#else
+    __atomic_store_n(&ring->used, false, __ATOMIC_RELEASE);
+#endif
+}
+
+static void record_event(char phase, const char *category, const char *name, const void *id,
+                         const char *arg)
+{
+    struct trace_ring *ring;
+    struct trace_event *ev;
+    uint64_t now;
+
+    if (!ty_trace_is_enabled())
+        return;
+
+    ring = get_ring();
+    if (!ring)
+        return;
+    now = ty_micros();
+
+    ty_mutex_lock(&ring->mutex);
+
+    ev = &ring->events[ring->count++ % TRACE_RING_SIZE];
+    ev->time = now;
+    ev->category = category;
+    ev->name = name;
+    ev->id = id;
+    ev->phase = phase;
+    if (arg) {
+        strncpy(ev->arg, arg, sizeof(ev->arg) - 1);
+        ev->arg[sizeof(ev->arg) - 1] = 0;
+    } else {
+        ev->arg[0] = 0;
+    }
+
+    ty_mutex_unlock(&ring->mutex);
+}
+
+void ty_trace_begin(const char *category, const char *name, const char *arg)
+{
+    record_event('B', category, name, NULL, arg);
+}
+
+void ty_trace_end(const char *category, const char *name)
+{
+    record_event('E', category, name, NULL, NULL);
+}
+
+void ty_trace_async_begin(const char *category, const char *name, const void *id, const char *arg)
+{
+    record_event('b', category, name, id, arg);
+}
+
+void ty_trace_async_end(const char *category, const char *name, const void *id)
+{
+    record_event('e', category, name, id, NULL);
+}
+
+void ty_trace_clear(void)
+{
+    for (struct trace_ring *ring = first_ring(); ring; ring = ring->next) {
+        ty_mutex_lock(&ring->mutex);
+        ring->count = 0;
+        ty_mutex_unlock(&ring->mutex);
+    }
+}
+
+static void write_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (const char *ptr = str; *ptr; ptr++) {
+        unsigned char c = (unsigned char)*ptr;
+
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void write_event(FILE *fp, const struct trace_ring *ring, const struct trace_event *ev)
+{
+    fputs(",\n{\"name\":", fp);
+    write_json_string(fp, ev->name);
+    fputs(",\"cat\":", fp);
+    write_json_string(fp, ev->category);
+    fprintf(fp, ",\"ph\":\"%c\",\"ts\":%" PRIu64 ",\"pid\":1,\"tid\":%u",
+            ev->phase, ev->time, ring->tid);
+    if (ev->phase == 'b' || ev->phase == 'e')
+        fprintf(fp, ",\"id\":\"%p\"", ev->id);
+    if (ev->arg[0]) {
+        fputs(",\"args\":{\"arg\":", fp);
+        write_json_string(fp, ev->arg);
+        fputc('}', fp);
+    }
+    fputc('}', fp);
+}
+
+int ty_trace_write(FILE *fp)
+{
+    assert(fp);
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"libty\"}}", fp);
+
+    for (struct trace_ring *ring = first_ring(); ring; ring = ring->next) {
+        uint64_t start;
+
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                    "\"args\":{\"name\":\"Thread %u\"}}", ring->tid, ring->tid);
+
+        ty_mutex_lock(&ring->mutex);
+        start = ring->count > TRACE_RING_SIZE ? ring->count - TRACE_RING_SIZE : 0;
+        for (uint64_t i = start; i < ring->count; i++)
+            write_event(fp, ring, &ring->events[i % TRACE_RING_SIZE]);
+        ty_mutex_unlock(&ring->mutex);
+    }
+
+    fputs("\n]}\n", fp);
+
+    if (ferror(fp))
+        return ty_error(TY_ERROR_IO, "I/O error while writing trace");
+    return 0;
+}
+
+int ty_trace_save(const char *filename)
+{
+    assert(filename);
+
+    FILE *fp;
+    int r;
+
+    fp = fopen(filename, "w");
+    if (!fp)
+        return ty_error(errno == EACCES ? TY_ERROR_ACCESS : TY_ERROR_IO,
+                        "Failed to open '%s' for writing: %s", filename, strerror(errno));
+
+    r = ty_trace_write(fp);
+    if (fclose(fp) && !r)
+        r = ty_error(TY_ERROR_IO, "I/O error while writing '%s'", filename);
+
+    return r;
+}
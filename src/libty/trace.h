@@ -0,0 +1,45 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_TRACE_H
+#define TY_TRACE_H
+
+#include "common.h"
+
+TY_C_BEGIN
+
+/* Categories used by libty, category and name strings must outlive the trace (use string
+   literals). Arguments are copied, and truncated if needed. */
+#define TY_TRACE_TASK "task"
+#define TY_TRACE_WAIT "wait"
+#define TY_TRACE_IO "io"
+#define TY_TRACE_MONITOR "monitor"
+
+/* Events are recorded in a fixed-size ring buffer per thread, so older events get dropped
+   on long runs. Recording functions do nothing (and cost next to nothing) unless tracing
+   is enabled. */
+TY_PUBLIC void ty_trace_set_enabled(bool enable);
+TY_PUBLIC bool ty_trace_is_enabled(void);
+TY_PUBLIC void ty_trace_clear(void);
+
+TY_PUBLIC void ty_trace_begin(const char *category, const char *name, const char *arg);
+TY_PUBLIC void ty_trace_end(const char *category, const char *name);
+// Async spans can start and end on different threads, the id ties them together
+TY_PUBLIC void ty_trace_async_begin(const char *category, const char *name, const void *id,
+                                    const char *arg);
+TY_PUBLIC void ty_trace_async_end(const char *category, const char *name, const void *id);
+
+// Chrome trace event format, which Perfetto and chrome://tracing can open
+TY_PUBLIC int ty_trace_write(FILE *fp);
+TY_PUBLIC int ty_trace_save(const char *filename);
+
+TY_C_END
+
+#endif
@@ -0,0 +1,710 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <string.h>
+#include "xfer.h"
+
+#define XFER_FLAG 0x7E
+#define XFER_ESCAPE 0x7D
+
+#define XFER_SENDER_BLOCK_SIZE 1024
+#define XFER_SENDER_WINDOW 16
+
+// Time before an unacknowledged block is sent again
+#define XFER_RETRANSMIT_DELAY 300
+// Minimum delay before resending a block reported missing by a selective acknowledgement
+#define XFER_GAP_DELAY 20
+// Give up if the receiver does not make any progress for this long
+#define XFER_LINK_TIMEOUT 5000
+#define XFER_HANDSHAKE_DELAY 500
+#define XFER_HANDSHAKE_ATTEMPTS 4
+
+enum {
+    XFER_RECEIVER_IDLE,
+    XFER_RECEIVER_RUNNING,
+    XFER_RECEIVER_DONE
+};
+
+enum {
+    XFER_BLOCK_UNSENT,
+    XFER_BLOCK_SENT,
+    XFER_BLOCK_ACKED
+};
+
+struct xfer_sender {
+    const ty_xfer_link *link;
+    const ty_xfer_source *src;
+
+    ty_xfer_decoder decoder;
+    uint8_t rx_buf[256];
+    size_t rx_offset;
+    size_t rx_len;
+
+    uint16_t block_size;
+    uint8_t window;
+    uint32_t blocks_count;
+
+    uint32_t base;
+    uint32_t next;
+    uint8_t block_states[TY_XFER_MAX_WINDOW];
+    uint32_t block_times[TY_XFER_MAX_WINDOW];
+    uint32_t progress_time;
+
+    uint8_t frame_buf[TY_XFER_MAX_ENCODED_SIZE(TY_XFER_MAX_BLOCK_SIZE)];
+    uint8_t block_buf[TY_XFER_MAX_BLOCK_SIZE];
+};
+
+static void xfer_put_u16(uint8_t *ptr, uint16_t value)
+{
+    ptr[0] = (uint8_t)value;
+    ptr[1] = (uint8_t)(value >> 8);
+}
+
+static void xfer_put_u32(uint8_t *ptr, uint32_t value)
+{
+    for (unsigned int i = 0; i < 4; i++)
+        ptr[i] = (uint8_t)(value >> (i * 8));
+}
+
+static void xfer_put_u64(uint8_t *ptr, uint64_t value)
+{
+    for (unsigned int i = 0; i < 8; i++)
+        ptr[i] = (uint8_t)(value >> (i * 8));
+}
+
+static uint16_t xfer_get_u16(const uint8_t *ptr)
+{
+    return (uint16_t)(ptr[0] | (ptr[1] << 8));
+}
+
+static uint32_t xfer_get_u32(const uint8_t *ptr)
+{
+    uint32_t value = 0;
+    for (unsigned int i = 0; i < 4; i++)
+        value |= (uint32_t)ptr[i] << (i * 8);
+    return value;
+}
+
+static uint64_t xfer_get_u64(const uint8_t *ptr)
+{
+    uint64_t value = 0;
+    for (unsigned int i = 0; i < 8; i++)
+        value |= (uint64_t)ptr[i] << (i * 8);
+    return value;
+}
+
+uint32_t ty_xfer_crc32(uint32_t crc, const uint8_t *buf, size_t size)
+{
+    // Nibble table, a good compromise between speed and size for small boards
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+        0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ buf[i]) & 0xF] ^ (crc >> 4);
+        crc = table[(crc ^ (uint32_t)(buf[i] >> 4)) & 0xF] ^ (crc >> 4);
+    }
+
+    return ~crc;
+}
+
+static size_t xfer_escape(const uint8_t *buf, size_t size, uint8_t *out)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        if (buf[i] == XFER_FLAG || buf[i] == XFER_ESCAPE) {
+            out[len++] = XFER_ESCAPE;
+            out[len++] = (uint8_t)(buf[i] ^ 0x20);
+        } else {
+            out[len++] = buf[i];
+        }
+    }
+
+    return len;
+}
+
+size_t ty_xfer_encode(ty_xfer_frame_type type, uint16_t seq, const uint8_t *payload,
+                      size_t size, uint8_t *out)
+{
+    uint8_t header[5];
+    uint8_t trailer[4];
+    uint32_t crc;
+    size_t len;
+
+    header[0] = (uint8_t)type;
+    xfer_put_u16(header + 1, seq);
+    xfer_put_u16(header + 3, (uint16_t)size);
+    crc = ty_xfer_crc32(0, header, sizeof(header));
+    crc = ty_xfer_crc32(crc, payload, size);
+    xfer_put_u32(trailer, crc);
+
+    /* The leading flag terminates any garbage the receiver may have buffered, such as
+       text output by the board before the transfer. */
+    len = 0;
+    out[len++] = XFER_FLAG;
+    len += xfer_escape(header, sizeof(header), out + len);
+    len += xfer_escape(payload, size, out + len);
+    len += xfer_escape(trailer, sizeof(trailer), out + len);
+    out[len++] = XFER_FLAG;
+
+    return len;
+}
+
+void ty_xfer_decoder_init(ty_xfer_decoder *dec)
+{
+    dec->len = 0;
+    dec->escape = false;
+    dec->overflow = false;
+    dec->errors = 0;
+}
+
+bool ty_xfer_decode(ty_xfer_decoder *dec, uint8_t byte, ty_xfer_frame *rframe)
+{
+    if (byte == XFER_FLAG) {
+        size_t len = dec->len;
+        bool overflow = dec->overflow;
+        size_t size;
+
+        dec->len = 0;
+        dec->escape = false;
+        dec->overflow = false;
+
+        if (!len)
+            return false;
+        if (overflow || len < TY_XFER_FRAME_OVERHEAD)
+            goto error;
+
+        size = xfer_get_u16(dec->buf + 3);
+        if (size != len - TY_XFER_FRAME_OVERHEAD)
+            goto error;
+        if (ty_xfer_crc32(0, dec->buf, len - 4) != xfer_get_u32(dec->buf + len - 4))
+            goto error;
+
+        rframe->type = (ty_xfer_frame_type)dec->buf[0];
+        rframe->seq = xfer_get_u16(dec->buf + 1);
+        rframe->payload = dec->buf + 5;
+        rframe->size = size;
+        return true;
+
+error:
+        dec->errors++;
+        return false;
+    }
+
+    if (byte == XFER_ESCAPE) {
+        dec->escape = true;
+        return false;
+    }
+    if (dec->escape) {
+        byte ^= 0x20;
+        dec->escape = false;
+    }
+
+    if (dec->len < sizeof(dec->buf)) {
+        dec->buf[dec->len++] = byte;
+    } else {
+        dec->overflow = true;
+    }
+    return false;
+}
+
+static int xfer_write_frame(const ty_xfer_link *link, ty_xfer_frame_type type, uint16_t seq,
+                            const uint8_t *payload, size_t size, uint8_t *buf)
+{
+    size_t len = ty_xfer_encode(type, seq, payload, size, buf);
+    return (*link->write)(link->udata, buf, len) < 0 ? TY_XFER_ERROR_LINK : 0;
+}
+
+static int xfer_send_block(struct xfer_sender *sender, uint32_t idx)
+{
+    const ty_xfer_source *src = sender->src;
+    uint64_t offset = (uint64_t)idx * sender->block_size;
+    size_t size;
+    unsigned int slot = idx % sender->window;
+
+    size = (size_t)(src->size - offset < sender->block_size ? src->size - offset : sender->block_size);
+    if ((*src->read)(src->udata, offset, sender->block_buf, size) < 0)
+        return TY_XFER_ERROR_LINK;
+
+    sender->block_states[slot] = XFER_BLOCK_SENT;
+    sender->block_times[slot] = (*sender->link->millis)(sender->link->udata);
+
+    return xfer_write_frame(sender->link, TY_XFER_FRAME_DATA, (uint16_t)idx,
+                            sender->block_buf, size, sender->frame_buf);
+}
+
+// Returns 1 and fills rframe if a frame is available, 0 if the timeout expired
+static int xfer_read_frame(struct xfer_sender *sender, ty_xfer_frame *rframe, int timeout)
+{
+    const ty_xfer_link *link = sender->link;
+    uint32_t start = (*link->millis)(link->udata);
+
+    for (;;) {
+        int adjusted_timeout;
+        int r;
+
+        while (sender->rx_offset < sender->rx_len) {
+            uint8_t byte = sender->rx_buf[sender->rx_offset++];
+
+            if (ty_xfer_decode(&sender->decoder, byte, rframe)) {
+                if (rframe->type == TY_XFER_FRAME_ABORT)
+                    return TY_XFER_ERROR_ABORTED;
+                return 1;
+            }
+        }
+
+        adjusted_timeout = timeout;
+        if (timeout > 0) {
+            adjusted_timeout = timeout - (int)((*link->millis)(link->udata) - start);
+            if (adjusted_timeout < 0)
+                adjusted_timeout = 0;
+        }
+
+        r = (*link->read)(link->udata, sender->rx_buf, sizeof(sender->rx_buf), adjusted_timeout);
+        if (r < 0)
+            return TY_XFER_ERROR_LINK;
+        if (!r)
+            return 0;
+
+        sender->rx_offset = 0;
+        sender->rx_len = (size_t)r;
+    }
+}
+
+static int xfer_handshake(struct xfer_sender *sender)
+{
+    const ty_xfer_link *link = sender->link;
+    uint8_t payload[12];
+    ty_xfer_frame frame;
+    int r;
+
+    payload[0] = TY_XFER_VERSION;
+    xfer_put_u16(payload + 1, XFER_SENDER_BLOCK_SIZE < TY_XFER_MAX_BLOCK_SIZE
+                              ? XFER_SENDER_BLOCK_SIZE : TY_XFER_MAX_BLOCK_SIZE);
+    payload[3] = XFER_SENDER_WINDOW;
+    xfer_put_u64(payload + 4, sender->src->size);
+
+    for (unsigned int i = 0; i < XFER_HANDSHAKE_ATTEMPTS; i++) {
+        uint32_t start = (*link->millis)(link->udata);
+
+        r = xfer_write_frame(link, TY_XFER_FRAME_HELLO, 0, payload, sizeof(payload),
+                             sender->frame_buf);
+        if (r < 0)
+            return r;
+
+        while ((*link->millis)(link->udata) - start < XFER_HANDSHAKE_DELAY) {
+            r = xfer_read_frame(sender, &frame, XFER_HANDSHAKE_DELAY);
+            if (r < 0)
+                return r;
+            if (!r)
+                break;
+
+            if (frame.type == TY_XFER_FRAME_ACCEPT && frame.size >= 4) {
+                if (frame.payload[0] != TY_XFER_VERSION)
+                    return TY_XFER_ERROR_UNSUPPORTED;
+
+                sender->block_size = xfer_get_u16(frame.payload + 1);
+                sender->window = frame.payload[3];
+                if (!sender->block_size || sender->block_size > TY_XFER_MAX_BLOCK_SIZE ||
+                        !sender->window || sender->window > TY_XFER_MAX_WINDOW)
+                    return TY_XFER_ERROR_UNSUPPORTED;
+
+                return 0;
+            }
+        }
+    }
+
+    return TY_XFER_ERROR_UNSUPPORTED;
+}
+
+static void xfer_handle_ack(struct xfer_sender *sender, const ty_xfer_frame *frame, uint32_t now)
+{
+    uint32_t ack;
+    uint32_t mask;
+    uint32_t highest;
+
+    ack = sender->base + (uint16_t)(frame->seq - (uint16_t)sender->base);
+    if (ack > sender->next || frame->size < 4)
+        return;
+    mask = xfer_get_u32(frame->payload);
+
+    if (ack > sender->base) {
+        for (uint32_t idx = sender->base; idx < ack; idx++)
+            sender->block_states[idx % sender->window] = XFER_BLOCK_UNSENT;
+        sender->base = ack;
+        sender->progress_time = now;
+
+        if (sender->src->progress) {
+            uint64_t value = (uint64_t)sender->base * sender->block_size;
+            if (value > sender->src->size)
+                value = sender->src->size;
+            (*sender->src->progress)(sender->src->udata, value, sender->src->size);
+        }
+    }
+
+    /* Bit i of the mask tells us the receiver got block ack + 1 + i. Blocks below the
+       highest one received are probably lost, mark them for early retransmission. */
+    highest = ack;
+    for (uint32_t i = 0; i < 32 && ack + 1 + i < sender->next; i++) {
+        uint32_t idx = ack + 1 + i;
+
+        if (mask & (1u << i)) {
+            sender->block_states[idx % sender->window] = XFER_BLOCK_ACKED;
+            highest = idx;
+        }
+    }
+    for (uint32_t idx = ack; idx < highest; idx++) {
+        unsigned int slot = idx % sender->window;
+
+        if (sender->block_states[slot] == XFER_BLOCK_SENT &&
+                now - sender->block_times[slot] >= XFER_GAP_DELAY)
+            sender->block_times[slot] = now - XFER_RETRANSMIT_DELAY;
+    }
+}
+
+static int xfer_send_blocks(struct xfer_sender *sender)
+{
+    const ty_xfer_link *link = sender->link;
+    int r;
+
+    sender->base = 0;
+    sender->next = 0;
+    memset(sender->block_states, 0, sizeof(sender->block_states));
+    sender->progress_time = (*link->millis)(link->udata);
+
+    while (sender->base < sender->blocks_count) {
+        ty_xfer_frame frame;
+        uint32_t now;
+        int timeout;
+
+        while (sender->next < sender->blocks_count &&
+               sender->next - sender->base < sender->window) {
+            r = xfer_send_block(sender, sender->next);
+            if (r < 0)
+                return r;
+            sender->next++;
+        }
+
+        // Don't wait for acknowledgements if we can keep the link busy
+        timeout = (sender->next < sender->blocks_count &&
+                   sender->next - sender->base < sender->window) ? 0 : 10;
+        do {
+            r = xfer_read_frame(sender, &frame, timeout);
+            if (r < 0)
+                return r;
+            if (r && frame.type == TY_XFER_FRAME_ACK)
+                xfer_handle_ack(sender, &frame, (*link->millis)(link->udata));
+            timeout = 0;
+        } while (r);
+
+        now = (*link->millis)(link->udata);
+        if (now - sender->progress_time >= XFER_LINK_TIMEOUT)
+            return TY_XFER_ERROR_TIMEOUT;
+
+        for (uint32_t idx = sender->base; idx < sender->next; idx++) {
+            unsigned int slot = idx % sender->window;
+
+            if (sender->block_states[slot] == XFER_BLOCK_SENT &&
+                    now - sender->block_times[slot] >= XFER_RETRANSMIT_DELAY) {
+                r = xfer_send_block(sender, idx);
+                if (r < 0)
+                    return r;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int xfer_finish(struct xfer_sender *sender, uint32_t crc)
+{
+    const ty_xfer_link *link = sender->link;
+    uint8_t payload[12];
+    ty_xfer_frame frame;
+    int r;
+
+    xfer_put_u64(payload, sender->src->size);
+    xfer_put_u32(payload + 8, crc);
+
+    for (unsigned int i = 0; i < XFER_HANDSHAKE_ATTEMPTS; i++) {
+        uint32_t start = (*link->millis)(link->udata);
+
+        r = xfer_write_frame(link, TY_XFER_FRAME_END, (uint16_t)sender->blocks_count,
+                             payload, sizeof(payload), sender->frame_buf);
+        if (r < 0)
+            return r;
+
+        while ((*link->millis)(link->udata) - start < XFER_HANDSHAKE_DELAY) {
+            r = xfer_read_frame(sender, &frame, XFER_HANDSHAKE_DELAY);
+            if (r < 0)
+                return r;
+            if (!r)
+                break;
+
+            if (frame.type == TY_XFER_FRAME_DONE && frame.size >= 1)
+                return frame.payload[0] ? TY_XFER_ERROR_CHECKSUM : 0;
+        }
+    }
+
+    return TY_XFER_ERROR_TIMEOUT;
+}
+
+static int xfer_compute_crc(struct xfer_sender *sender, uint32_t *rcrc)
+{
+    const ty_xfer_source *src = sender->src;
+    uint32_t crc = 0;
+
+    for (uint64_t offset = 0; offset < src->size; offset += sizeof(sender->block_buf)) {
+        size_t size = (size_t)(src->size - offset < sizeof(sender->block_buf)
+                               ? src->size - offset : sizeof(sender->block_buf));
+
+        if ((*src->read)(src->udata, offset, sender->block_buf, size) < 0)
+            return TY_XFER_ERROR_LINK;
+        crc = ty_xfer_crc32(crc, sender->block_buf, size);
+    }
+
+    *rcrc = crc;
+    return 0;
+}
+
+int ty_xfer_send(const ty_xfer_link *link, const ty_xfer_source *src)
+{
+    struct xfer_sender sender;
+    uint32_t crc;
+    int r;
+
+    memset(&sender, 0, sizeof(sender));
+    sender.link = link;
+    sender.src = src;
+    ty_xfer_decoder_init(&sender.decoder);
+
+    r = xfer_compute_crc(&sender, &crc);
+    if (r < 0)
+        return r;
+
+    r = xfer_handshake(&sender);
+    if (r < 0)
+        goto error;
+    sender.blocks_count = (uint32_t)((src->size + sender.block_size - 1) / sender.block_size);
+
+    r = xfer_send_blocks(&sender);
+    if (r < 0)
+        goto error;
+
+    return xfer_finish(&sender, crc);
+
+error:
+    if (r != TY_XFER_ERROR_LINK && r != TY_XFER_ERROR_ABORTED)
+        xfer_write_frame(link, TY_XFER_FRAME_ABORT, 0, NULL, 0, sender.frame_buf);
+    return r;
+}
+
+void ty_xfer_receiver_init(ty_xfer_receiver *recv, const ty_xfer_link *link,
+                           int (*data)(void *udata, const uint8_t *buf, size_t size),
+                           void *udata)
+{
+    memset(recv, 0, sizeof(*recv));
+
+    recv->link = link;
+    recv->data = data;
+    recv->udata = udata;
+    ty_xfer_decoder_init(&recv->decoder);
+    recv->state = XFER_RECEIVER_IDLE;
+}
+
+static int xfer_reply(ty_xfer_receiver *recv, ty_xfer_frame_type type, uint16_t seq,
+                      const uint8_t *payload, size_t size)
+{
+    uint8_t buf[TY_XFER_MAX_ENCODED_SIZE(12)];
+    return xfer_write_frame(recv->link, type, seq, payload, size, buf);
+}
+
+static int xfer_deliver(ty_xfer_receiver *recv, const uint8_t *buf, size_t size)
+{
+    if (recv->received + size > recv->size)
+        return TY_XFER_ERROR_ABORTED;
+    if ((*recv->data)(recv->udata, buf, size) < 0)
+        return TY_XFER_ERROR_LINK;
+
+    recv->received += size;
+    recv->crc = ty_xfer_crc32(recv->crc, buf, size);
+    recv->next_seq++;
+    recv->pending_mask >>= 1;
+    recv->pending_head = (recv->pending_head + 1) % recv->window;
+
+    return 0;
+}
+
+static int xfer_receive_data(ty_xfer_receiver *recv, const ty_xfer_frame *frame)
+{
+    uint16_t offset = (uint16_t)(frame->seq - recv->next_seq);
+    uint8_t payload[4];
+    int r;
+
+    if (offset < recv->window) {
+        // Every block is full, except for the last one
+        uint64_t start = recv->received + (uint64_t)offset * recv->block_size;
+        uint64_t expected_size;
+
+        if (start >= recv->size)
+            return 0;
+        expected_size = recv->size - start;
+        if (expected_size > recv->block_size)
+            expected_size = recv->block_size;
+        if (frame->size != expected_size)
+            return 0;
+    }
+
+    if (!offset) {
+        r = xfer_deliver(recv, frame->payload, frame->size);
+        if (r < 0)
+            return r;
+
+        // Bit 0 of the pending mask now matches next_seq, flush buffered blocks
+        while (recv->pending_mask & 1) {
+            unsigned int slot = recv->pending_head;
+
+            r = xfer_deliver(recv, recv->pending_blocks[slot], recv->pending_sizes[slot]);
+            if (r < 0)
+                return r;
+        }
+    } else if (offset < recv->window) {
+        unsigned int slot = (recv->pending_head + offset) % recv->window;
+
+        memcpy(recv->pending_blocks[slot], frame->payload, frame->size);
+        recv->pending_sizes[slot] = (uint16_t)frame->size;
+        recv->pending_mask |= 1u << offset;
+    }
+
+    // Duplicate and out-of-window blocks still get an acknowledgement, it may have been lost
+    xfer_put_u32(payload, recv->pending_mask >> 1);
+    return xfer_reply(recv, TY_XFER_FRAME_ACK, recv->next_seq, payload, sizeof(payload));
+}
+
+static int xfer_receive_frame(ty_xfer_receiver *recv, const ty_xfer_frame *frame)
+{
+    uint8_t payload[4];
+    int r;
+
+    switch (frame->type) {
+        case TY_XFER_FRAME_HELLO: {
+            uint16_t block_size;
+            uint8_t window;
+
+            if (frame->size < 12)
+                return 0;
+            if (frame->payload[0] != TY_XFER_VERSION) {
+                r = xfer_reply(recv, TY_XFER_FRAME_ABORT, 0, NULL, 0);
+                return r < 0 ? r : 0;
+            }
+
+            /* The sender only starts sending data once it gets our ACCEPT reply, so a HELLO
+               frame always means we need to (re)start from scratch. */
+            block_size = xfer_get_u16(frame->payload + 1);
+            window = frame->payload[3];
+            if (block_size > TY_XFER_MAX_BLOCK_SIZE)
+                block_size = TY_XFER_MAX_BLOCK_SIZE;
+            if (window > TY_XFER_RECEIVER_WINDOW)
+                window = TY_XFER_RECEIVER_WINDOW;
+            if (!block_size || !window)
+                return 0;
+
+            recv->state = XFER_RECEIVER_RUNNING;
+            recv->block_size = block_size;
+            recv->window = window;
+            recv->size = xfer_get_u64(frame->payload + 4);
+            recv->next_seq = 0;
+            recv->pending_mask = 0;
+            recv->pending_head = 0;
+            recv->received = 0;
+            recv->crc = 0;
+
+            payload[0] = TY_XFER_VERSION;
+            xfer_put_u16(payload + 1, recv->block_size);
+            payload[3] = recv->window;
+            r = xfer_reply(recv, TY_XFER_FRAME_ACCEPT, 0, payload, 4);
+            return r < 0 ? r : 0;
+        } break;
+
+        case TY_XFER_FRAME_DATA: {
+            if (recv->state != XFER_RECEIVER_RUNNING)
+                return 0;
+
+            r = xfer_receive_data(recv, frame);
+            if (r < 0) {
+                xfer_reply(recv, TY_XFER_FRAME_ABORT, 0, NULL, 0);
+                recv->state = XFER_RECEIVER_IDLE;
+                return r;
+            }
+            return 0;
+        } break;
+
+        case TY_XFER_FRAME_END: {
+            bool valid;
+
+            if (recv->state == XFER_RECEIVER_IDLE || frame->size < 12)
+                return 0;
+            // The sender only ends the transfer once everything is acknowledged
+            if (recv->state == XFER_RECEIVER_RUNNING && recv->received < recv->size)
+                return 0;
+
+            valid = xfer_get_u64(frame->payload) == recv->received &&
+                    xfer_get_u32(frame->payload + 8) == recv->crc;
+
+            payload[0] = valid ? 0 : 1;
+            r = xfer_reply(recv, TY_XFER_FRAME_DONE, frame->seq, payload, 1);
+            if (r < 0)
+                return r;
+
+            // Report completion once, repeated END frames only mean our reply was lost
+            if (recv->state == XFER_RECEIVER_DONE)
+                return 0;
+            recv->state = XFER_RECEIVER_DONE;
+            return valid ? 1 : TY_XFER_ERROR_CHECKSUM;
+        } break;
+
+        case TY_XFER_FRAME_ABORT: {
+            if (recv->state != XFER_RECEIVER_RUNNING)
+                return 0;
+
+            recv->state = XFER_RECEIVER_IDLE;
+            return TY_XFER_ERROR_ABORTED;
+        } break;
+
+        default: {
+            return 0;
+        } break;
+    }
+}
+
+int ty_xfer_receiver_process(ty_xfer_receiver *recv, const uint8_t *buf, size_t size)
+{
+    int ret = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        ty_xfer_frame frame;
+        int r;
+
+        if (!ty_xfer_decode(&recv->decoder, buf[i], &frame))
+            continue;
+
+        r = xfer_receive_frame(recv, &frame);
+        if (r < 0)
+            return r;
+        if (r)
+            ret = r;
+    }
+
+    return ret;
+}
@@ -0,0 +1,152 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_XFER_H
+#define TY_XFER_H
+
+/* Framed and acknowledged transfer protocol for serial links, with CRC-checked blocks, a
+   sliding window and selective retransmission.
+
+   This file and xfer.c do not depend on the rest of libty or on the standard library
+   beyond memcpy/memset, so you can copy them to your board project and use the receiver
+   (ty_xfer_receiver) there, see contrib/arduino/xfer_receiver for an example. Reduce
+   TY_XFER_MAX_BLOCK_SIZE and TY_XFER_RECEIVER_WINDOW to save RAM on small boards, the
+   sender adapts to the receiver limits during negotiation.
+
+   Frames are delimited by 0x7E bytes and escaped HDLC-style (0x7D, byte ^ 0x20). The
+   unescaped content is: type (1 byte), sequence (2 bytes), payload size (2 bytes), payload,
+   and CRC-32 of everything before it (4 bytes). Integers are little-endian. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TY_PUBLIC
+    #define TY_PUBLIC
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TY_XFER_VERSION 1
+
+#ifndef TY_XFER_MAX_BLOCK_SIZE
+    #define TY_XFER_MAX_BLOCK_SIZE 1024
+#endif
+#define TY_XFER_MAX_WINDOW 32
+#ifndef TY_XFER_RECEIVER_WINDOW
+    #define TY_XFER_RECEIVER_WINDOW 8
+#endif
+#if TY_XFER_RECEIVER_WINDOW > TY_XFER_MAX_WINDOW
+    #error "TY_XFER_RECEIVER_WINDOW cannot be larger than TY_XFER_MAX_WINDOW"
+#endif
+
+#define TY_XFER_FRAME_OVERHEAD 9
+#define TY_XFER_MAX_ENCODED_SIZE(size) (2 + 2 * (TY_XFER_FRAME_OVERHEAD + (size)))
+
+typedef enum ty_xfer_frame_type {
+    TY_XFER_FRAME_HELLO  = 'H',
+    TY_XFER_FRAME_ACCEPT = 'A',
+    TY_XFER_FRAME_DATA   = 'D',
+    TY_XFER_FRAME_ACK    = 'K',
+    TY_XFER_FRAME_END    = 'E',
+    TY_XFER_FRAME_DONE   = 'F',
+    TY_XFER_FRAME_ABORT  = 'X'
+} ty_xfer_frame_type;
+
+typedef enum ty_xfer_status {
+    TY_XFER_OK                = 0,
+    // A link or data callback failed, the callback is responsible for error details
+    TY_XFER_ERROR_LINK        = -1,
+    TY_XFER_ERROR_TIMEOUT     = -2,
+    TY_XFER_ERROR_UNSUPPORTED = -3,
+    TY_XFER_ERROR_ABORTED     = -4,
+    TY_XFER_ERROR_CHECKSUM    = -5
+} ty_xfer_status;
+
+typedef struct ty_xfer_frame {
+    ty_xfer_frame_type type;
+    uint16_t seq;
+
+    const uint8_t *payload;
+    size_t size;
+} ty_xfer_frame;
+
+typedef struct ty_xfer_decoder {
+    uint8_t buf[TY_XFER_FRAME_OVERHEAD + TY_XFER_MAX_BLOCK_SIZE];
+    size_t len;
+    bool escape;
+    bool overflow;
+
+    unsigned int errors;
+} ty_xfer_decoder;
+
+typedef struct ty_xfer_link {
+    // Write all the bytes or fail, return 0 on success and a negative value on error
+    int (*write)(void *udata, const uint8_t *buf, size_t size);
+    // Return the number of bytes read, 0 on timeout and a negative value on error
+    int (*read)(void *udata, uint8_t *buf, size_t size, int timeout);
+    uint32_t (*millis)(void *udata);
+
+    void *udata;
+} ty_xfer_link;
+
+typedef struct ty_xfer_source {
+    // Read exactly size bytes at offset, blocks may be read again for retransmission
+    int (*read)(void *udata, uint64_t offset, uint8_t *buf, size_t size);
+    void (*progress)(void *udata, uint64_t value, uint64_t max);
+
+    uint64_t size;
+    void *udata;
+} ty_xfer_source;
+
+typedef struct ty_xfer_receiver {
+    const ty_xfer_link *link;
+    // Called with in-order data, return 0 to continue or a negative value to abort
+    int (*data)(void *udata, const uint8_t *buf, size_t size);
+    void *udata;
+
+    ty_xfer_decoder decoder;
+
+    int state;
+    uint16_t block_size;
+    uint8_t window;
+    uint64_t size;
+
+    uint16_t next_seq;
+    uint32_t pending_mask;
+    unsigned int pending_head;
+    uint16_t pending_sizes[TY_XFER_RECEIVER_WINDOW];
+    uint8_t pending_blocks[TY_XFER_RECEIVER_WINDOW][TY_XFER_MAX_BLOCK_SIZE];
+
+    uint64_t received;
+    uint32_t crc;
+} ty_xfer_receiver;
+
+TY_PUBLIC uint32_t ty_xfer_crc32(uint32_t crc, const uint8_t *buf, size_t size);
+
+TY_PUBLIC size_t ty_xfer_encode(ty_xfer_frame_type type, uint16_t seq, const uint8_t *payload,
+                                size_t size, uint8_t *out);
+TY_PUBLIC void ty_xfer_decoder_init(ty_xfer_decoder *dec);
+TY_PUBLIC bool ty_xfer_decode(ty_xfer_decoder *dec, uint8_t byte, ty_xfer_frame *rframe);
+
+TY_PUBLIC int ty_xfer_send(const ty_xfer_link *link, const ty_xfer_source *src);
+
+TY_PUBLIC void ty_xfer_receiver_init(ty_xfer_receiver *recv, const ty_xfer_link *link,
+                                     int (*data)(void *udata, const uint8_t *buf, size_t size),
+                                     void *udata);
+TY_PUBLIC int ty_xfer_receiver_process(ty_xfer_receiver *recv, const uint8_t *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
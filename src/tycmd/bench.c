@@ -0,0 +1,255 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../libty/system.h"
+#include "main.h"
+
+#define BENCH_TRANSITION_TIMEOUT 15000
+
+enum bench_stage {
+    BENCH_STAGE_ENUMERATE,
+    BENCH_STAGE_DEVICE,
+    BENCH_STAGE_BOARD,
+    BENCH_STAGE_CALLBACKS,
+    BENCH_STAGE_WAKEUP,
+    BENCH_STAGE_TOTAL,
+
+    BENCH_STAGE_COUNT
+};
+
+static const char *const bench_stage_names[] = {
+    "command -> event",
+    "event -> device",
+    "device -> board",
+    "board -> callbacks",
+    "callbacks -> wakeup",
+    "total"
+};
+
+struct bench_phase {
+    const char *name;
+    int (*command)(ty_board *board);
+    ty_board_capability capability;
+
+    uint64_t *samples[BENCH_STAGE_COUNT];
+    unsigned int count;
+};
+
+static unsigned int bench_cycles = 10;
+
+static void print_bench_usage(FILE *f)
+{
+    fprintf(f, "usage: %s bench hotplug [options]\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Bench options:\n"
+               "   -n, --cycles <count>     Number of reboot/reset cycles (default: %u)\n\n"
+               "The board is rebooted to the bootloader and reset again for each cycle, and\n"
+               "the time each hotplug stage takes is reported as percentiles.\n",
+            bench_cycles);
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    uint64_t sample1 = *(const uint64_t *)a;
+    uint64_t sample2 = *(const uint64_t *)b;
+
+    return (sample1 > sample2) - (sample1 < sample2);
+}
+
+// Nearest-rank percentile, samples must be sorted
+static double get_percentile(const uint64_t *samples, unsigned int count, unsigned int percent)
+{
+    unsigned int rank = (count * percent + 99) / 100;
+    return (double)samples[rank ? rank - 1 : 0] / 1000.0;
+}
+
+static int run_transition(ty_board *board, struct bench_phase *phase)
+{
+    ty_board_hotplug_timing timing;
+    uint64_t start;
+    uint64_t values[BENCH_STAGE_COUNT];
+    int r;
+
+    start = ty_micros();
+    r = (*phase->command)(board);
+    if (r < 0)
+        return r;
+
+    r = ty_board_wait_for(board, phase->capability, BENCH_TRANSITION_TIMEOUT);
+    if (r < 0)
+        return r;
+    if (!r)
+        return ty_error(TY_ERROR_TIMEOUT, "Board '%s' did not come back in time",
+                        ty_board_get_tag(board));
+
+    ty_board_get_hotplug_timing(board, &timing);
+    if (!timing.wakeup || timing.event < start) {
+        ty_log(TY_LOG_WARNING, "Missing hotplug timestamps for '%s', ignoring transition",
+               ty_board_get_tag(board));
+        return 0;
+    }
+
+    values[BENCH_STAGE_ENUMERATE] = timing.event - start;
+    values[BENCH_STAGE_DEVICE] = timing.device - timing.event;
+    values[BENCH_STAGE_BOARD] = timing.board - timing.device;
+    values[BENCH_STAGE_CALLBACKS] = timing.callbacks - timing.board;
+    values[BENCH_STAGE_WAKEUP] = timing.wakeup - timing.callbacks;
+    values[BENCH_STAGE_TOTAL] = timing.wakeup - start;
+
+    for (unsigned int i = 0; i < BENCH_STAGE_COUNT; i++)
+        phase->samples[i][phase->count] = values[i];
+    phase->count++;
+
+    return 0;
+}
+
+static void print_phase(struct bench_phase *phase)
+{
+    printf("%s (%u samples, in ms):\n", phase->name, phase->count);
+    if (!phase->count)
+        return;
+
+    printf("   %-22s %10s %10s %10s %10s\n", "", "p50", "p90", "p99", "max");
+    for (unsigned int i = 0; i < BENCH_STAGE_COUNT; i++) {
+        uint64_t *samples = phase->samples[i];
+
+        qsort(samples, phase->count, sizeof(*samples), compare_samples);
+        printf("   %-22s %10.3f %10.3f %10.3f %10.3f\n", bench_stage_names[i],
+               get_percentile(samples, phase->count, 50),
+               get_percentile(samples, phase->count, 90),
+               get_percentile(samples, phase->count, 99),
+               (double)samples[phase->count - 1] / 1000.0);
+    }
+}
+
+static int bench_hotplug(ty_board *board)
+{
+    struct bench_phase phases[] = {
+        {"Reboot to bootloader", ty_board_reboot, TY_BOARD_CAPABILITY_UPLOAD},
+        {"Reset to firmware", ty_board_reset, TY_BOARD_CAPABILITY_RUN}
+    };
+    int r;
+
+    for (unsigned int i = 0; i < TY_COUNTOF(phases); i++) {
+        for (unsigned int j = 0; j < BENCH_STAGE_COUNT; j++) {
+            phases[i].samples[j] = calloc(bench_cycles, sizeof(uint64_t));
+            if (!phases[i].samples[j]) {
+                r = ty_error(TY_ERROR_MEMORY, NULL);
+                goto cleanup;
+            }
+        }
+    }
+
+    // Start from the firmware, so that each cycle goes through both transitions
+    if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_RUN)) {
+        r = ty_board_reset(board);
+        if (r < 0)
+            goto cleanup;
+        r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RUN, BENCH_TRANSITION_TIMEOUT);
+        if (r < 0)
+            goto cleanup;
+        if (!r) {
+            r = ty_error(TY_ERROR_TIMEOUT, "Board '%s' did not come back in time",
+                         ty_board_get_tag(board));
+            goto cleanup;
+        }
+    }
+
+    for (unsigned int i = 0; i < bench_cycles; i++) {
+        ty_log(TY_LOG_INFO, "Cycle %u/%u", i + 1, bench_cycles);
+
+        for (unsigned int j = 0; j < TY_COUNTOF(phases); j++) {
+            r = run_transition(board, &phases[j]);
+            if (r < 0)
+                goto cleanup;
+        }
+    }
+
+    for (unsigned int i = 0; i < TY_COUNTOF(phases); i++) {
+        if (i)
+            printf("\n");
+        print_phase(&phases[i]);
+    }
+
+    r = 0;
+cleanup:
+    for (unsigned int i = 0; i < TY_COUNTOF(phases); i++) {
+        for (unsigned int j = 0; j < BENCH_STAGE_COUNT; j++)
+            free(phases[i].samples[j]);
+    }
+    return r;
+}
+
+int bench(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *mode;
+    ty_board *board = NULL;
+    int r;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_bench_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--cycles") == 0 || strcmp(opt, "-n") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            long cycles;
+
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '--cycles' takes an argument");
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+
+            cycles = strtol(value, NULL, 10);
+            if (cycles <= 0 || cycles > 100000) {
+                ty_log(TY_LOG_ERROR, "--cycles must be between 1 and 100000");
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+            bench_cycles = (unsigned int)cycles;
+        } else if (!parse_common_option(&optl, opt)) {
+            print_bench_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    mode = ty_optline_consume_non_option(&optl);
+    if (!mode) {
+        ty_log(TY_LOG_ERROR, "Missing benchmark mode");
+        print_bench_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    if (strcmp(mode, "hotplug") != 0) {
+        ty_log(TY_LOG_ERROR, "Unknown benchmark mode '%s'", mode);
+        print_bench_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "Too many positional arguments");
+        print_bench_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    r = get_board(&board);
+    if (r < 0)
+        goto cleanup;
+
+    r = bench_hotplug(board);
+
+cleanup:
+    ty_board_unref(board);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
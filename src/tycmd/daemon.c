@@ -0,0 +1,768 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+#include "../libty/system.h"
+#include "../libty/thread.h"
+#include "main.h"
+
+/* The daemon keeps a started monitor around, and runs each forwarded command in a forked
+   child that inherits it. Boards are known before the command even starts, so there is
+   no enumeration to wait for. The client passes its working directory, its arguments and
+   its standard descriptors, forwards the signals it gets to the child, and exits with the
+   status of the child.
+
+   Right before the fork, the device monitor opens a second source of device events for the
+   daemon, and the child keeps the original one (see ty_monitor_prepare_fork()). Both keep
+   up with hotplug events on their own and nothing has to be enumerated again. Only one
+   command runs at a time, clients that come in the meantime are told to run the command
+   themselves. The same goes for platforms where the monitor cannot be shared, and for
+   daemons that run threads, which would not survive the fork. */
+
+#define DAEMON_MAX_REQUEST_SIZE 65536
+#define DAEMON_REQUEST_TIMEOUT 2000
+
+static const char *const daemon_commands[] = {
+    "list",
+    "monitor",
+    "reset",
+    "send",
+    "upload",
+    NULL
+};
+
+static const char *daemon_socket_path = NULL;
+
+static bool is_daemon_command(const char *name)
+{
+    for (unsigned int i = 0; daemon_commands[i]; i++) {
+        if (strcmp(daemon_commands[i], name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static void print_daemon_usage(FILE *f)
+{
+    fprintf(f, "usage: %s daemon [options]\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Daemon options:\n"
+               "       --socket <path>      Listen on <path> instead of the default socket\n\n"
+               "The list, monitor, reset, send and upload commands use the daemon when it runs.\n"
+               "Set TYCMD_DAEMON_SOCKET to another socket path, or to an empty string to\n"
+               "disable this.\n");
+}
+
+#ifndef _WIN32
+
+struct daemon_request {
+    char *buf;
+    const char *cwd;
+    int argc;
+    char **argv;
+    int fds[3];
+};
+
+static int daemon_signal_pipe[2] = {-1, -1};
+static volatile pid_t daemon_forward_pid;
+
+static void get_fallback_dir(char *buf, size_t size)
+{
+    snprintf(buf, size, "/tmp/%s-%u", TY_CONFIG_TYCMD_EXECUTABLE, (unsigned int)getuid());
+}
+
+static bool get_socket_path(char *buf, size_t size)
+{
+    const char *path;
+
+    path = daemon_socket_path ? daemon_socket_path : getenv("TYCMD_DAEMON_SOCKET");
+    if (path) {
+        if (!*path)
+            return false;
+        snprintf(buf, size, "%s", path);
+    } else {
+        const char *dir = getenv("XDG_RUNTIME_DIR");
+
+        if (dir && *dir) {
+            snprintf(buf, size, "%s/%s.sock", dir, TY_CONFIG_TYCMD_EXECUTABLE);
+        } else {
+            char fallback_dir[128];
+
+            get_fallback_dir(fallback_dir, sizeof(fallback_dir));
+            snprintf(buf, size, "%s/daemon.sock", fallback_dir);
+        }
+    }
+
+    return strlen(buf) < sizeof(((struct sockaddr_un *)0)->sun_path);
+}
+
+static void fill_socket_address(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+}
+
+static bool write_full(int fd, const void *buf, size_t size)
+{
+    while (size) {
+        ssize_t r = write(fd, buf, size);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        buf = (const uint8_t *)buf + r;
+        size -= (size_t)r;
+    }
+
+    return true;
+}
+
+static bool read_full(int fd, void *buf, size_t size)
+{
+    while (size) {
+        ssize_t r = read(fd, buf, size);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (!r)
+            return false;
+
+        buf = (uint8_t *)buf + r;
+        size -= (size_t)r;
+    }
+
+    return true;
+}
+
+static bool check_peer(int fd)
+{
+#ifdef __linux__
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return false;
+    return cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+
+    if (getpeereid(fd, &uid, &gid) < 0)
+        return false;
+    return uid == getuid();
+#endif
+}
+
+// Client side
+
+static void forward_signal(int sig)
+{
+    if (daemon_forward_pid > 0)
+        kill(daemon_forward_pid, sig);
+}
+
+static int send_request(int fd, int argc, char *argv[])
+{
+    char cwd[4096];
+    char *buf = NULL;
+    size_t size;
+    struct msghdr msg = {0};
+    struct iovec iov[2];
+    uint32_t size32;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char *ptr;
+    int r;
+
+    if (!getcwd(cwd, sizeof(cwd)))
+        return 0;
+
+    size = strlen(cwd) + 1;
+    for (int i = 0; i < argc; i++)
+        size += strlen(argv[i]) + 1;
+    if (size > DAEMON_MAX_REQUEST_SIZE)
+        return 0;
+
+    buf = malloc(size);
+    if (!buf)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    ptr = buf;
+    ptr = stpcpy(ptr, cwd) + 1;
+    for (int i = 0; i < argc; i++)
+        ptr = stpcpy(ptr, argv[i]) + 1;
+
+    size32 = (uint32_t)size;
+    iov[0].iov_base = &size32;
+    iov[0].iov_len = sizeof(size32);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = size;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(fd, &msg, 0) != (ssize_t)(sizeof(size32) + size)) {
+        r = 0;
+        goto cleanup;
+    }
+
+    r = 1;
+cleanup:
+    free(buf);
+    return r;
+}
+
+bool forward_daemon_command(int argc, char *argv[], int *rcode)
+{
+    char path[256];
+    struct sockaddr_un addr;
+    int fd = -1;
+    int32_t pid, status;
+    struct sigaction sa = {0}, old_sa[3];
+    static const int forwarded_signals[] = {SIGINT, SIGTERM, SIGHUP};
+    bool forwarded = false;
+    int r;
+
+    if (!is_daemon_command(argv[0]) || !get_socket_path(path, sizeof(path)))
+        return false;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // No daemon running, nothing to say about it
+    fill_socket_address(&addr, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto cleanup;
+
+    // Our descriptors and signals must not go to someone else's process
+    if (!check_peer(fd)) {
+        ty_log(TY_LOG_WARNING, "Ignoring daemon socket '%s' from another user", path);
+        goto cleanup;
+    }
+
+    r = send_request(fd, argc, argv);
+    if (r <= 0) {
+        if (r < 0) {
+            *rcode = EXIT_FAILURE;
+            forwarded = true;
+        }
+        goto cleanup;
+    }
+
+    // A zero PID means the daemon is busy, do it ourselves
+    if (!read_full(fd, &pid, sizeof(pid)) || pid <= 0)
+        goto cleanup;
+    forwarded = true;
+
+    daemon_forward_pid = (pid_t)pid;
+    sa.sa_handler = forward_signal;
+    sigemptyset(&sa.sa_mask);
+    for (unsigned int i = 0; i < TY_COUNTOF(forwarded_signals); i++)
+        sigaction(forwarded_signals[i], &sa, &old_sa[i]);
+
+    if (read_full(fd, &status, sizeof(status))) {
+        if (WIFEXITED(status)) {
+            *rcode = WEXITSTATUS(status);
+        } else if (WIFSIGNALED(status)) {
+            *rcode = 128 + WTERMSIG(status);
+        } else {
+            *rcode = EXIT_FAILURE;
+        }
+    } else {
+        ty_log(TY_LOG_ERROR, "Lost connection to the daemon");
+        *rcode = EXIT_FAILURE;
+    }
+
+    for (unsigned int i = 0; i < TY_COUNTOF(forwarded_signals); i++)
+        sigaction(forwarded_signals[i], &old_sa[i], NULL);
+    daemon_forward_pid = 0;
+
+cleanup:
+    close(fd);
+    return forwarded;
+}
+
+// Daemon side
+
+static void daemon_signal_handler(int sig)
+{
+    int saved_errno = errno;
+    char c = (char)sig;
+
+    if (write(daemon_signal_pipe[1], &c, 1) < 0) {
+        // The pipe is full, a wakeup is already pending
+    }
+    errno = saved_errno;
+}
+
+static int setup_signals(void)
+{
+    struct sigaction sa = {0};
+
+    if (pipe(daemon_signal_pipe) < 0)
+        return ty_error(TY_ERROR_SYSTEM, "pipe() failed: %s", strerror(errno));
+    for (unsigned int i = 0; i < 2; i++) {
+        fcntl(daemon_signal_pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(daemon_signal_pipe[i], F_SETFL, O_NONBLOCK);
+    }
+
+    sa.sa_handler = daemon_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    // Clients may go away before we send them the exit status
+    signal(SIGPIPE, SIG_IGN);
+
+    return 0;
+}
+
+/* /tmp is shared, keep the fallback socket in a directory that belongs to us and that
+   nobody else can get into (or replace the socket in). */
+static int prepare_socket_dir(const char *path)
+{
+    char dir[128];
+    size_t len;
+    struct stat sb;
+
+    get_fallback_dir(dir, sizeof(dir));
+    len = strlen(dir);
+    if (strncmp(path, dir, len) != 0 || path[len] != '/')
+        return 0;
+
+    if (mkdir(dir, S_IRWXU) < 0 && errno != EEXIST)
+        return ty_error(TY_ERROR_SYSTEM, "Failed to create '%s': %s", dir, strerror(errno));
+    if (lstat(dir, &sb) < 0)
+        return ty_error(TY_ERROR_SYSTEM, "Failed to stat '%s': %s", dir, strerror(errno));
+    if (!S_ISDIR(sb.st_mode) || sb.st_uid != getuid() || (sb.st_mode & (S_IRWXG | S_IRWXO)))
+        return ty_error(TY_ERROR_ACCESS, "Directory '%s' is not private to this user", dir);
+
+    return 0;
+}
+
+static int open_listen_socket(const char *path, int *rfd)
+{
+    struct sockaddr_un addr;
+    int fd;
+    int r;
+
+    r = prepare_socket_dir(path);
+    if (r < 0)
+        return r;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return ty_error(TY_ERROR_SYSTEM, "socket() failed: %s", strerror(errno));
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    fill_socket_address(&addr, path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int probe_fd;
+
+        if (errno != EADDRINUSE) {
+            r = ty_error(TY_ERROR_SYSTEM, "Failed to bind to '%s': %s", path, strerror(errno));
+            goto error;
+        }
+
+        // Leftover socket from a daemon that did not exit cleanly?
+        probe_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe_fd >= 0 && connect(probe_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            close(probe_fd);
+            r = ty_error(TY_ERROR_EXISTS, "Daemon is already running on '%s'", path);
+            goto error;
+        }
+        close(probe_fd);
+
+        unlink(path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            r = ty_error(TY_ERROR_SYSTEM, "Failed to bind to '%s': %s", path, strerror(errno));
+            goto error;
+        }
+    }
+    chmod(path, S_IRUSR | S_IWUSR);
+
+    if (listen(fd, 16) < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "listen() failed: %s", strerror(errno));
+        unlink(path);
+        goto error;
+    }
+
+    *rfd = fd;
+    return 0;
+
+error:
+    close(fd);
+    return r;
+}
+
+static void release_request(struct daemon_request *req)
+{
+    for (unsigned int i = 0; i < TY_COUNTOF(req->fds); i++) {
+        if (req->fds[i] >= 0)
+            close(req->fds[i]);
+    }
+    free(req->argv);
+    free(req->buf);
+}
+
+// Returns 1 if a request was received, 0 if the client sent garbage or went away
+static int receive_request(int fd, struct daemon_request *req)
+{
+    struct msghdr msg = {0};
+    struct iovec iov;
+    uint32_t size;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    char *ptr, *end;
+
+    memset(req, 0, sizeof(*req));
+    req->fds[0] = req->fds[1] = req->fds[2] = -1;
+
+    iov.iov_base = &size;
+    iov.iov_len = sizeof(size);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    // The descriptors come with the first byte
+    if (recvmsg(fd, &msg, MSG_WAITALL) != sizeof(size) || (msg.msg_flags & MSG_CTRUNC))
+        return 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+                cmsg->cmsg_len == CMSG_LEN(sizeof(req->fds)))
+            memcpy(req->fds, CMSG_DATA(cmsg), sizeof(req->fds));
+    }
+    if (req->fds[0] < 0 || req->fds[1] < 0 || req->fds[2] < 0)
+        return 0;
+    if (!size || size > DAEMON_MAX_REQUEST_SIZE)
+        return 0;
+
+    req->buf = malloc(size);
+    req->argv = calloc(size + 1, sizeof(*req->argv));
+    if (!req->buf || !req->argv)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    if (!read_full(fd, req->buf, size) || req->buf[size - 1])
+        return 0;
+
+    ptr = req->buf;
+    end = req->buf + size;
+    req->cwd = ptr;
+    ptr += strlen(ptr) + 1;
+    while (ptr < end) {
+        req->argv[req->argc++] = ptr;
+        ptr += strlen(ptr) + 1;
+    }
+    if (!req->argc || !is_daemon_command(req->argv[0]))
+        return 0;
+
+    return 1;
+}
+
+static void run_request(struct daemon_request *req, ty_monitor *monitor)
+{
+    int r;
+
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    close(daemon_signal_pipe[0]);
+    close(daemon_signal_pipe[1]);
+
+    // Detach from the terminal of the daemon, if any, the client has its own
+    setsid();
+
+    for (int i = 0; i < 3; i++) {
+        dup2(req->fds[i], i);
+        close(req->fds[i]);
+    }
+
+    if (chdir(req->cwd) < 0) {
+        ty_error(TY_ERROR_SYSTEM, "Failed to change directory to '%s': %s", req->cwd,
+                 strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    r = ty_monitor_finish_fork(monitor, true);
+    if (r < 0)
+        exit(EXIT_FAILURE);
+
+    set_monitor(monitor);
+    exit(run_command(req->argc, req->argv));
+}
+
+static int serve_client(int listen_fd, ty_monitor *monitor, pid_t *rpid, int *rconn)
+{
+    struct daemon_request req;
+    struct timeval tv;
+    int conn;
+    int32_t pid = 0;
+    int r;
+
+    conn = accept(listen_fd, NULL, NULL);
+    if (conn < 0)
+        return 0;
+    fcntl(conn, F_SETFD, FD_CLOEXEC);
+
+    if (!check_peer(conn)) {
+        close(conn);
+        return 0;
+    }
+
+    // Don't let a stuck client block everyone else
+    tv.tv_sec = DAEMON_REQUEST_TIMEOUT / 1000;
+    tv.tv_usec = (DAEMON_REQUEST_TIMEOUT % 1000) * 1000;
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    r = receive_request(conn, &req);
+    if (r <= 0)
+        goto cleanup;
+
+    // Busy, or unable to fork safely: the client will run the command itself
+    if (*rpid || ty_thread_get_count()) {
+        write_full(conn, &pid, sizeof(pid));
+        r = 0;
+        goto cleanup;
+    }
+    r = ty_monitor_prepare_fork(monitor);
+    if (r < 0) {
+        write_full(conn, &pid, sizeof(pid));
+        r = 0;
+        goto cleanup;
+    }
+
+    fflush(NULL);
+    pid = (int32_t)fork();
+    if (!pid) {
+        close(listen_fd);
+        close(conn);
+        run_request(&req, monitor);
+    }
+    r = ty_monitor_finish_fork(monitor, false);
+    if (r < 0)
+        goto cleanup;
+    if (pid < 0) {
+        ty_error(TY_ERROR_SYSTEM, "fork() failed: %s", strerror(errno));
+
+        pid = 0;
+        write_full(conn, &pid, sizeof(pid));
+        r = 0;
+        goto cleanup;
+    }
+
+    if (!write_full(conn, &pid, sizeof(pid))) {
+        // The client is gone already, there is nobody to report to
+        kill((pid_t)pid, SIGTERM);
+    }
+
+    *rpid = (pid_t)pid;
+    *rconn = conn;
+    conn = -1;
+    r = 0;
+
+cleanup:
+    release_request(&req);
+    if (conn >= 0)
+        close(conn);
+    return r;
+}
+
+static void reap_child(pid_t *rpid, int *rconn)
+{
+    int status;
+    int32_t status32;
+    pid_t r;
+
+    r = waitpid(*rpid, &status, WNOHANG);
+    if (r <= 0)
+        return;
+
+    status32 = (int32_t)status;
+    write_full(*rconn, &status32, sizeof(status32));
+    close(*rconn);
+    *rconn = -1;
+    *rpid = 0;
+}
+
+static int run_daemon(const char *path)
+{
+    ty_monitor *monitor = NULL;
+    int listen_fd = -1;
+    pid_t child_pid = 0;
+    int child_conn = -1;
+    int r;
+
+    r = setup_signals();
+    if (r < 0)
+        goto cleanup;
+
+    r = ty_monitor_new(&monitor);
+    if (r < 0)
+        goto cleanup;
+    r = ty_monitor_start(monitor);
+    if (r < 0)
+        goto cleanup;
+
+    r = open_listen_socket(path, &listen_fd);
+    if (r < 0)
+        goto cleanup;
+
+    ty_log(TY_LOG_INFO, "Listening on '%s'", path);
+
+    while (true) {
+        ty_descriptor_set set = {0};
+        char sigs[16];
+        ssize_t len;
+
+        ty_descriptor_set_add(&set, daemon_signal_pipe[0], 1);
+        ty_descriptor_set_add(&set, listen_fd, 2);
+        ty_monitor_get_descriptors(monitor, &set, 3);
+
+        r = ty_poll(&set, -1);
+        if (r < 0)
+            goto cleanup;
+
+        switch (r) {
+            case 1: {
+                len = read(daemon_signal_pipe[0], sigs, sizeof(sigs));
+                for (ssize_t i = 0; i < len; i++) {
+                    if (sigs[i] != SIGCHLD) {
+                        r = 0;
+                        goto cleanup;
+                    }
+                }
+
+                if (child_pid)
+                    reap_child(&child_pid, &child_conn);
+            } break;
+
+            case 2: {
+                r = serve_client(listen_fd, monitor, &child_pid, &child_conn);
+                if (r < 0)
+                    goto cleanup;
+            } break;
+
+            case 3: {
+                r = ty_monitor_refresh(monitor);
+                if (r < 0)
+                    goto cleanup;
+            } break;
+        }
+    }
+
+cleanup:
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path);
+    }
+    if (child_pid) {
+        kill(child_pid, SIGTERM);
+        waitpid(child_pid, NULL, 0);
+        close(child_conn);
+    }
+    ty_monitor_free(monitor);
+    return r;
+}
+
+#else
+
+bool forward_daemon_command(int argc, char *argv[], int *rcode)
+{
+    TY_UNUSED(argc);
+    TY_UNUSED(argv);
+    TY_UNUSED(rcode);
+
+    return false;
+}
+
+#endif
+
+int daemon_main(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    int r;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_daemon_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--socket") == 0) {
+            daemon_socket_path = ty_optline_get_value(&optl);
+            if (!daemon_socket_path) {
+                ty_log(TY_LOG_ERROR, "Option '--socket' takes an argument");
+                print_daemon_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (!parse_common_option(&optl, opt)) {
+            print_daemon_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "No positional argument is allowed");
+        print_daemon_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+#ifndef _WIN32
+    char path[256];
+
+    if (!get_socket_path(path, sizeof(path))) {
+        ty_log(TY_LOG_ERROR, "Missing or invalid daemon socket path");
+        return EXIT_FAILURE;
+    }
+
+    r = run_daemon(path);
+#else
+    r = ty_error(TY_ERROR_UNSUPPORTED, "The daemon is not supported on this platform");
+#endif
+
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -24,6 +24,7 @@ enum collection_type {
 static enum output_format list_output = OUTPUT_PLAIN;
 static bool list_verbose = false;
 static bool list_watch = false;
+static bool list_stats = false;
 
 static enum collection_type list_collections[8];
 static unsigned int list_collection_depth;
@@ -38,7 +39,8 @@ static void print_list_usage(FILE *f)
 
     fprintf(f, "List options:\n"
                "   -O, --output <format>    Output format, must be plain (default) or json\n"
-               "   -v, --verbose            Print detailed information about devices\n\n"
+               "   -v, --verbose            Print detailed information about devices\n"
+               "       --stats              Print I/O counters of each device, needs --watch\n\n"
                "   -w, --watch              Watch devices dynamically\n");
 }
 
@@ -141,6 +143,28 @@ static int print_interface_info(ty_board_interface *iface, void *udata)
     return 0;
 }
 
+static void print_stats(ty_board *board)
+{
+    ty_board_stats stats;
+
+    ty_board_get_stats(board, &stats);
+
+    start_collection("stats", COLLECTION_OBJECT);
+    print_field("read_calls", "%" PRIu64, stats.read_calls);
+    print_field("read_bytes", "%" PRIu64, stats.read_bytes);
+    print_field("read_full", "%" PRIu64, stats.read_full);
+    print_field("write_calls", "%" PRIu64, stats.write_calls);
+    print_field("write_bytes", "%" PRIu64, stats.write_bytes);
+    print_field("write_short", "%" PRIu64, stats.write_short);
+    print_field("io_errors", "%" PRIu64, stats.io_errors);
+    print_field("dropped_bytes", "%" PRIu64, stats.dropped_bytes);
+    print_field("reconnects", "%" PRIu64, stats.reconnects);
+    print_field("uploads", "%" PRIu64, stats.uploads);
+    print_field("upload_failures", "%" PRIu64, stats.upload_failures);
+    print_field("upload_time", "%" PRIu64, stats.upload_time);
+    end_collection();
+}
+
 static int list_callback(ty_board *board, ty_monitor_event event, void *udata)
 {
     TY_UNUSED(event);
@@ -189,6 +213,8 @@ static int list_callback(ty_board *board, ty_monitor_event event, void *udata)
         ty_board_list_interfaces(board, print_interface_info, NULL);
         end_collection();
     }
+    if (list_stats && (event != TY_MONITOR_EVENT_DROPPED || list_output != OUTPUT_PLAIN))
+        print_stats(board);
 
     end_collection();
     printf("\n");
@@ -230,6 +256,8 @@ int list(int argc, char *argv[])
             list_verbose = true;
         } else if (strcmp(opt, "--watch") == 0 || strcmp(opt, "-w") == 0) {
             list_watch = true;
+        } else if (strcmp(opt, "--stats") == 0) {
+            list_stats = true;
         } else if (!parse_common_option(&optl, opt)) {
             print_list_usage(stderr);
             return EXIT_FAILURE;
@@ -240,6 +268,12 @@ int list(int argc, char *argv[])
         print_list_usage(stderr);
         return EXIT_FAILURE;
     }
+    // Counters belong to this process, a one-shot list has nothing to show
+    if (list_stats && !list_watch) {
+        ty_log(TY_LOG_ERROR, "Option '--stats' can only be used with '--watch'");
+        print_list_usage(stderr);
+        return EXIT_FAILURE;
+    }
 
     r = get_monitor(&monitor);
     if (r < 0)
@@ -250,6 +284,9 @@ int list(int argc, char *argv[])
         return EXIT_FAILURE;
 
     if (list_watch) {
+        // Report one line per board and refresh, even when a device burst comes in
+        ty_monitor_set_batching(monitor, true, 0);
+
         r = ty_monitor_register_callback(monitor, list_callback, NULL);
         if (r < 0)
             return EXIT_FAILURE;
@@ -14,6 +14,7 @@
 #endif
 #include "../libhs/common.h"
 #include "../libty/system.h"
+#include "../libty/trace.h"
 #include "main.h"
 
 struct command {
@@ -22,26 +23,34 @@ struct command {
     const char *description;
 };
 
+int bench(int argc, char *argv[]);
+int daemon_main(int argc, char *argv[]);
 int identify(int argc, char *argv[]);
 int list(int argc, char *argv[]);
 int monitor(int argc, char *argv[]);
 int reset(int argc, char *argv[]);
+int send_file(int argc, char *argv[]);
 int upload(int argc, char *argv[]);
 
 static const struct command commands[] = {
-    {"identify", identify, "Identify models compatible with firmware"},
-    {"list",     list,     "List available boards"},
-    {"monitor",  monitor,  "Open serial (or emulated) connection with board"},
-    {"reset",    reset,    "Reset board"},
-    {"upload",   upload,   "Upload new firmware"},
+    {"bench",    bench,       "Measure hotplug latency across reboot cycles"},
+    {"daemon",   daemon_main, "Share device discovery with other invocations"},
+    {"identify", identify,    "Identify models compatible with firmware"},
+    {"list",     list,        "List available boards"},
+    {"monitor",  monitor,     "Open serial (or emulated) connection with board"},
+    {"reset",    reset,       "Reset board"},
+    {"send",     send_file,   "Send file to board through its serial interface"},
+    {"upload",   upload,      "Upload new firmware"},
     {0}
 };
 
 const char *tycmd_executable_name;
 
 static const char *main_board_tag = NULL;
+static const char *main_trace_filename = NULL;
 
 static ty_monitor *main_board_monitor;
+static int main_board_callback = -1;
 static ty_board *main_board;
 
 static void print_version(FILE *f)
@@ -74,7 +83,8 @@ void print_common_options(FILE *f)
                "       --help               Show help message\n"
                "       --version            Display version information\n\n"
                "   -B, --board <tag>        Work with board <tag> instead of first detected\n"
-               "   -q, --quiet              Disable output, use -qqq to silence errors\n");
+               "   -q, --quiet              Disable output, use -qqq to silence errors\n"
+               "       --trace <file>       Save Chrome/Perfetto trace of the command to <file>\n");
 }
 
 static inline unsigned int get_board_priority(ty_board *board)
@@ -88,8 +98,8 @@ static int board_callback(ty_board *board, ty_monitor_event event, void *udata)
 
     switch (event) {
         case TY_MONITOR_EVENT_ADDED: {
-            if ((!main_board || get_board_priority(board) > get_board_priority(main_board))
-                    && ty_board_matches_tag(board, main_board_tag)) {
+            // The monitor only gives us boards that match main_board_tag
+            if (!main_board || get_board_priority(board) > get_board_priority(main_board)) {
                 ty_board_unref(main_board);
                 main_board = ty_board_ref(board);
             }
@@ -112,32 +122,59 @@ static int board_callback(ty_board *board, ty_monitor_event event, void *udata)
 
 static int init_monitor()
 {
-    if (main_board_monitor)
+    if (main_board_callback >= 0)
         return 0;
 
-    ty_monitor *monitor = NULL;
+    ty_monitor *monitor = main_board_monitor;
+    ty_monitor_filter filter = {0};
     int r;
 
-    r = ty_monitor_new(&monitor);
-    if (r < 0)
-        goto error;
-
-    r = ty_monitor_register_callback(monitor, board_callback, NULL);
-    if (r < 0)
-        goto error;
+    if (!monitor) {
+        r = ty_monitor_new(&monitor);
+        if (r < 0)
+            goto error;
+    }
 
-    r = ty_monitor_start(monitor);
+    filter.events = TY_MONITOR_EVENT_MASK(TY_MONITOR_EVENT_ADDED) |
+                    TY_MONITOR_EVENT_MASK(TY_MONITOR_EVENT_DROPPED);
+    filter.tag = main_board_tag;
+    r = ty_monitor_register_filtered_callback(monitor, &filter, board_callback, NULL);
     if (r < 0)
         goto error;
+    main_board_callback = r;
+
+    if (monitor == main_board_monitor) {
+        ty_board_matcher *matcher;
+
+        // Commands run by the daemon get a monitor that already knows about the boards
+        r = ty_board_matcher_new(main_board_tag, &matcher);
+        if (r < 0)
+            goto error;
+        r = ty_monitor_find(monitor, matcher, board_callback, NULL);
+        ty_board_matcher_free(matcher);
+        if (r < 0)
+            goto error;
+    } else {
+        r = ty_monitor_start(monitor);
+        if (r < 0)
+            goto error;
+    }
 
     main_board_monitor = monitor;
     return 0;
 
 error:
-    ty_monitor_free(monitor);
+    if (monitor != main_board_monitor)
+        ty_monitor_free(monitor);
     return r;
 }
 
+void set_monitor(ty_monitor *monitor)
+{
+    assert(!main_board_monitor);
+    main_board_monitor = monitor;
+}
+
 int get_monitor(ty_monitor **rmonitor)
 {
     int r = init_monitor();
@@ -166,6 +203,29 @@ int get_board(ty_board **rboard)
     return 0;
 }
 
+int run_command(int argc, char *argv[])
+{
+    const struct command *cmd;
+
+    for (cmd = commands; cmd->name; cmd++) {
+        if (strcmp(cmd->name, argv[0]) == 0)
+            break;
+    }
+    if (!cmd->name) {
+        ty_log(TY_LOG_ERROR, "Unknown command '%s'", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return (*cmd->f)(argc, argv);
+}
+
+// Also runs in daemon children, they exit() once the forwarded command is done
+static void save_trace(void)
+{
+    ty_trace_set_enabled(false);
+    ty_trace_save(main_trace_filename);
+}
+
 bool parse_common_option(ty_optline_context *optl, char *arg)
 {
     if (strcmp(arg, "--board") == 0 || strcmp(arg, "-B") == 0) {
@@ -178,6 +238,19 @@ bool parse_common_option(ty_optline_context *optl, char *arg)
     } else if (strcmp(arg, "--quiet") == 0 || strcmp(arg, "-q") == 0) {
         ty_config_verbosity--;
         return true;
+    } else if (strcmp(arg, "--trace") == 0) {
+        bool registered = main_trace_filename;
+
+        main_trace_filename = ty_optline_get_value(optl);
+        if (!main_trace_filename) {
+            ty_log(TY_LOG_ERROR, "Option '--trace' takes an argument");
+            return false;
+        }
+
+        if (!registered)
+            atexit(save_trace);
+        ty_trace_set_enabled(true);
+        return true;
     } else {
         ty_log(TY_LOG_ERROR, "Unknown option '%s'", arg);
         return false;
@@ -202,6 +275,9 @@ int main(int argc, char *argv[])
     }
 
     hs_log_set_handler(ty_libhs_log_handler, NULL);
+    // Nobody sees libhs debug messages without TYTOOLS_DEBUG, don't even format them
+    if (!getenv("TYTOOLS_DEBUG"))
+        hs_log_set_level(HS_LOG_WARNING);
     r = ty_models_load_patch(NULL);
     if (r == TY_ERROR_MEMORY)
         return EXIT_FAILURE;
@@ -234,7 +310,8 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    r = (*cmd->f)(argc - 1, argv + 1);
+    if (!forward_daemon_command(argc - 1, argv + 1, &r))
+        r = (*cmd->f)(argc - 1, argv + 1);
 
     ty_board_unref(main_board);
     ty_monitor_free(main_board_monitor);
@@ -25,8 +25,12 @@ void print_common_options(FILE *f);
 bool parse_common_option(ty_optline_context *optl, char *arg);
 
 int get_monitor(ty_monitor **rmonitor);
+void set_monitor(ty_monitor *monitor);
 int get_board(ty_board **rboard);
 
+int run_command(int argc, char *argv[]);
+bool forward_daemon_command(int argc, char *argv[], int *rcode);
+
 TY_C_END
 
 #endif
@@ -15,6 +15,7 @@
 #endif
 #include "../libhs/device.h"
 #include "../libhs/serial.h"
+#include "../libty/poller.h"
 #include "../libty/system.h"
 #include "main.h"
 
@@ -34,6 +35,8 @@ static int monitor_directions = DIRECTION_INPUT | DIRECTION_OUTPUT;
 static bool monitor_reconnect = false;
 static int monitor_timeout_eof = 200;
 
+static ty_poller *monitor_poller;
+
 #ifdef _WIN32
 static bool monitor_fake_echo;
 
@@ -61,7 +64,8 @@ static void print_monitor_usage(FILE *f)
                "   -D, --direction <dir>    Open serial connection in given direction\n"
                "                            Supports input, output, both (default)\n"
                "       --timeout-eof <ms>   Time before closing after EOF on standard input\n"
-               "                            Defaults to %d ms, use -1 to disable\n\n", monitor_timeout_eof);
+               "                            Defaults to %d ms, use -1 to disable\n"
+               "       --low-latency        Reduce serial latency at the cost of CPU time\n\n", monitor_timeout_eof);
 
     fprintf(f, "Serial settings:\n"
                "   -b, --baudrate <rate>    Use baudrate for serial port\n"
@@ -211,33 +215,34 @@ static int open_serial_interface(ty_board *board, ty_board_interface **riface)
     return 0;
 }
 
-static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board)
+static int fill_poller(ty_poller *poller, ty_board *board)
 {
+    ty_descriptor_set set = {0};
     ty_board_interface *iface = NULL;
     int r;
 
-    ty_descriptor_set_clear(set);
+    ty_poller_clear(poller);
 
     // Board events / state changes
-    ty_monitor_get_descriptors(ty_board_get_monitor(board), set, 1);
+    ty_monitor_get_descriptors(ty_board_get_monitor(board), &set, 1);
 
     r = open_serial_interface(board, &iface);
     if (r < 0)
         return r;
 
     if (monitor_directions & DIRECTION_INPUT)
-        ty_board_interface_get_descriptors(iface, set, 2);
+        ty_board_interface_get_descriptors(iface, &set, 2);
 #ifdef _WIN32
     if (monitor_directions & DIRECTION_OUTPUT) {
         if (monitor_input_available) {
-            ty_descriptor_set_add(set, monitor_input_available, 3);
+            ty_descriptor_set_add(&set, monitor_input_available, 3);
         } else {
-            ty_descriptor_set_add(set, GetStdHandle(STD_INPUT_HANDLE), 3);
+            ty_descriptor_set_add(&set, GetStdHandle(STD_INPUT_HANDLE), 3);
         }
     }
 #else
     if (monitor_directions & DIRECTION_OUTPUT)
-        ty_descriptor_set_add(set, STDIN_FILENO, 3);
+        ty_descriptor_set_add(&set, STDIN_FILENO, 3);
 #endif
 
     /* ty_board_interface_unref() keeps iface->open_count > 0 so the device file does not
@@ -245,133 +250,169 @@ static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board)
        device is closed anyway so we don't leak anything. */
     ty_board_interface_unref(iface);
 
+    return ty_poller_add_set(poller, &set, 0);
+}
+
+static int write_output(int outfd, const char *buf, size_t len)
+{
+    ssize_t r;
+
+#ifdef _WIN32
+    r = write(outfd, buf, (unsigned int)len);
+#else
+    r = write(outfd, buf, len);
+#endif
+    if (r < 0) {
+        if (errno == EIO)
+            return ty_error(TY_ERROR_IO, "I/O error on standard output");
+        return ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
+                        strerror(errno));
+    }
+
     return 0;
 }
 
+static void disable_events(int *disabled, int id)
+{
+    ty_poller_remove(monitor_poller, id);
+    *disabled |= 1 << id;
+}
+
 static int loop(ty_board *board, int outfd)
 {
-    ty_descriptor_set set = {0};
+    ty_poller_event events[8];
+    int disabled;
     int timeout;
     char buf[BUFFER_SIZE];
     ssize_t r;
 
 restart:
-    r = fill_descriptor_set(&set, board);
+    r = fill_poller(monitor_poller, board);
     if (r < 0)
         return (int)r;
+    disabled = 0;
     timeout = -1;
 
     ty_log(TY_LOG_INFO, "Monitoring '%s'", ty_board_get_tag(board));
 
-    while (true) {
-        if (!set.count)
-            return 0;
-
-        r = ty_poll(&set, timeout);
+    /* The monitor may have buffered some data before we opened the interface (see
+       ty_monitor_set_attach_serial), and poll will not tell us about it. */
+    if (monitor_directions & DIRECTION_INPUT) {
+        while ((r = ty_board_serial_read(board, buf, sizeof(buf), 0)) > 0) {
+            r = write_output(outfd, buf, (size_t)r);
+            if (r < 0)
+                return (int)r;
+        }
         if (r < 0)
             return (int)r;
+    }
+
+    while (true) {
+        int count;
 
-        switch (r) {
-            case 0: {
-                return 0;
-            } break;
+        if (!ty_poller_get_count(monitor_poller))
+            return 0;
 
-            case 1: {
-                r = ty_monitor_refresh(ty_board_get_monitor(board));
-                if (r < 0)
-                    return (int)r;
+        /* Handle all the ready descriptors at once, events for descriptors removed by a
+           previous event of the same batch are ignored. */
+        count = ty_poller_wait(monitor_poller, events, (unsigned int)TY_COUNTOF(events), timeout);
+        if (count <= 0)
+            return count;
 
-                if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_SERIAL)) {
-                    if (!monitor_reconnect)
-                        return 0;
+        for (int i = 0; i < count; i++) {
+            if (disabled & (1 << events[i].id))
+                continue;
 
-                    ty_log(TY_LOG_INFO, "Waiting for '%s'...", ty_board_get_tag(board));
-                    r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_SERIAL, -1);
+            switch (events[i].id) {
+                case 1: {
+                    r = ty_monitor_refresh(ty_board_get_monitor(board));
                     if (r < 0)
                         return (int)r;
 
-                    goto restart;
-                }
-            } break;
-
-            case 2: {
-                r = ty_board_serial_read(board, buf, sizeof(buf), 0);
-                if (r < 0) {
-                    if (r == TY_ERROR_IO && monitor_reconnect) {
-                        timeout = ERROR_IO_TIMEOUT;
-                        ty_descriptor_set_remove(&set, 2);
-                        ty_descriptor_set_remove(&set, 3);
-                        break;
+                    if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_SERIAL)) {
+                        if (!monitor_reconnect)
+                            return 0;
+
+                        ty_log(TY_LOG_INFO, "Waiting for '%s'...", ty_board_get_tag(board));
+                        r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_SERIAL, -1);
+                        if (r < 0)
+                            return (int)r;
+
+                        goto restart;
+                    }
+                } break;
+
+                case 2: {
+                    r = ty_board_serial_read(board, buf, sizeof(buf), 0);
+                    if (r < 0) {
+                        if (r == TY_ERROR_IO && monitor_reconnect) {
+                            timeout = ERROR_IO_TIMEOUT;
+                            disable_events(&disabled, 2);
+                            disable_events(&disabled, 3);
+                            break;
+                        }
+                        return (int)r;
                     }
-                    return (int)r;
-                }
 
+                    r = write_output(outfd, buf, (size_t)r);
+                    if (r < 0)
+                        return (int)r;
+                } break;
+
+                case 3: {
 #ifdef _WIN32
-                r = write(outfd, buf, (unsigned int)r);
-#else
-                r = write(outfd, buf, (size_t)r);
-#endif
-                if (r < 0) {
-                    if (errno == EIO)
-                        return ty_error(TY_ERROR_IO, "I/O error on standard output");
-                    return ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
-                                    strerror(errno));
-                }
-            } break;
-
-            case 3: {
-#ifdef _WIN32
-                if (monitor_input_available) {
-                    if (monitor_input_ret < 0)
-                        return (int)monitor_input_ret;
+                    if (monitor_input_available) {
+                        if (monitor_input_ret < 0)
+                            return (int)monitor_input_ret;
 
-                    memcpy(buf, monitor_input_line, (size_t)monitor_input_ret);
-                    r = monitor_input_ret;
+                        memcpy(buf, monitor_input_line, (size_t)monitor_input_ret);
+                        r = monitor_input_ret;
 
-                    ResetEvent(monitor_input_available);
-                    SetEvent(monitor_input_processed);
-                } else {
-                    r = read(STDIN_FILENO, buf, sizeof(buf));
-                }
+                        ResetEvent(monitor_input_available);
+                        SetEvent(monitor_input_processed);
+                    } else {
+                        r = read(STDIN_FILENO, buf, sizeof(buf));
+                    }
 #else
-                r = read(STDIN_FILENO, buf, sizeof(buf));
+                    r = read(STDIN_FILENO, buf, sizeof(buf));
 #endif
-                if (r < 0) {
-                    if (errno == EIO)
-                        return ty_error(TY_ERROR_IO, "I/O error on standard input");
-                    return ty_error(TY_ERROR_IO, "Failed to read from standard input: %s",
-                                    strerror(errno));
-                }
-                if (!r) {
-                    if (monitor_timeout_eof >= 0) {
-                        /* EOF reached, don't listen to stdin anymore, and start timeout to give some
-                           time for the device to send any data before closing down. */
-                        timeout = monitor_timeout_eof;
-                        ty_descriptor_set_remove(&set, 1);
-                        ty_descriptor_set_remove(&set, 3);
+                    if (r < 0) {
+                        if (errno == EIO)
+                            return ty_error(TY_ERROR_IO, "I/O error on standard input");
+                        return ty_error(TY_ERROR_IO, "Failed to read from standard input: %s",
+                                        strerror(errno));
+                    }
+                    if (!r) {
+                        if (monitor_timeout_eof >= 0) {
+                            /* EOF reached, don't listen to stdin anymore, and start timeout to give some
+                               time for the device to send any data before closing down. */
+                            timeout = monitor_timeout_eof;
+                            disable_events(&disabled, 1);
+                            disable_events(&disabled, 3);
+                        }
+                        break;
                     }
-                    break;
-                }
 
 #ifdef _WIN32
-                if (monitor_fake_echo) {
-                    r = write(outfd, buf, (unsigned int)r);
-                    if (r < 0)
-                        return (int)r;
-                }
+                    if (monitor_fake_echo) {
+                        r = write(outfd, buf, (unsigned int)r);
+                        if (r < 0)
+                            return (int)r;
+                    }
 #endif
 
-                r = ty_board_serial_write(board, buf, (size_t)r);
-                if (r < 0) {
-                    if (r == TY_ERROR_IO && monitor_reconnect) {
-                        timeout = ERROR_IO_TIMEOUT;
-                        ty_descriptor_set_remove(&set, 2);
-                        ty_descriptor_set_remove(&set, 3);
-                        break;
+                    r = ty_board_serial_write(board, buf, (size_t)r);
+                    if (r < 0) {
+                        if (r == TY_ERROR_IO && monitor_reconnect) {
+                            timeout = ERROR_IO_TIMEOUT;
+                            disable_events(&disabled, 2);
+                            disable_events(&disabled, 3);
+                            break;
+                        }
+                        return (int)r;
                     }
-                    return (int)r;
-                }
-            } break;
+                } break;
+            }
         }
     }
 }
@@ -496,6 +537,8 @@ int monitor(int argc, char *argv[])
                 print_monitor_usage(stderr);
                 return EXIT_FAILURE;
             }
+        } else if (strcmp(opt, "--low-latency") == 0) {
+            monitor_serial_config.latency = HS_SERIAL_CONFIG_LATENCY_LOW;
         } else if (strcmp(opt, "--raw") == 0 || strcmp(opt, "-r") == 0) {
             monitor_term_flags |= TY_TERMINAL_RAW;
         } else if (strcmp(opt, "--reconnect") == 0 || strcmp(opt, "-R") == 0) {
@@ -569,12 +612,21 @@ int monitor(int argc, char *argv[])
     if (r < 0)
         goto cleanup;
 
+    r = ty_poller_new(&monitor_poller);
+    if (r < 0)
+        goto cleanup;
+
+    // Don't miss the first bytes sent by the board when it comes back
+    if (monitor_reconnect)
+        ty_monitor_set_attach_serial(ty_board_get_monitor(board), true);
+
     r = loop(board, outfd);
 
 cleanup:
 #ifdef _WIN32
     stop_stdin_thread();
 #endif
+    ty_poller_free(monitor_poller);
     ty_board_unref(board);
     return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,78 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../libty/task.h"
+#include "main.h"
+
+static int send_flags = 0;
+
+static void print_send_usage(FILE *f)
+{
+    fprintf(f, "usage: %s send [options] <file>\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Send options:\n"
+               "       --framed             Use framed transfer with acknowledgements\n"
+               "                            The board must run a compatible receiver\n\n"
+               "The file is sent as-is to the serial (or emulated) interface of the board. Binary\n"
+               "data cannot be sent through the emulated serial interface.\n");
+}
+
+int send_file(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *filename;
+    ty_board *board = NULL;
+    ty_task *task = NULL;
+    int r;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_send_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--framed") == 0) {
+            send_flags |= TY_SEND_FRAMED;
+        } else if (!parse_common_option(&optl, opt)) {
+            print_send_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    filename = ty_optline_consume_non_option(&optl);
+    if (!filename) {
+        ty_log(TY_LOG_ERROR, "Missing file to send");
+        print_send_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "Only one file can be sent at a time");
+        print_send_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    r = get_board(&board);
+    if (r < 0)
+        goto cleanup;
+
+    r = ty_send_file(board, filename, send_flags, &task);
+    if (r < 0)
+        goto cleanup;
+
+    r = ty_task_join(task);
+
+cleanup:
+    ty_task_unref(task);
+    ty_board_unref(board);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -96,7 +96,10 @@ int upload(int argc, char *argv[])
     if (r < 0)
         goto cleanup;
 
+    // Keep terminal output out of the way of HalfKay transfers, it works fine without
+    ty_message_start_async();
     r = ty_task_join(task);
+    ty_message_stop_async();
 
 cleanup:
     ty_task_unref(task);
@@ -349,7 +349,11 @@ TaskInterface Board::sendSerial(const QByteArray &buf)
     ty_task *task;
     int r;
 
-    r = ty_send(board_, buf.data(), buf.size(), &task);
+    /* QByteArray is implicitly shared, so this copy only bumps the reference count and
+       libty releases it once the task is done with the data. */
+    auto payload = new QByteArray(buf);
+    r = ty_send(board_, payload->constData(), payload->size(),
+                [](void *udata) { delete static_cast<QByteArray *>(udata); }, payload, &task);
     if (r < 0)
         return watchTask(make_task<FailedTask>(ty_error_last_message()));
     task->pool = pool_;
@@ -367,7 +371,7 @@ TaskInterface Board::sendFile(const QString &filename)
     ty_task *task;
     int r;
 
-    r = ty_send_file(board_, filename.toLocal8Bit().constData(), &task);
+    r = ty_send_file(board_, filename.toLocal8Bit().constData(), 0, &task);
     if (r < 0)
         return watchTask(make_task<FailedTask>(ty_error_last_message()));
     task->pool = pool_;
@@ -10,6 +10,9 @@
 
 #include <QDir>
 #include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QPointer>
 
 #ifdef _WIN32
@@ -23,6 +26,7 @@
 #include "selector_dialog.hpp"
 #include "monitor.hpp"
 #include "tycommander.hpp"
+#include "../libty/task.h"
 
 using namespace std;
 
@@ -36,7 +40,8 @@ const QHash<QString, void (ClientHandler::*)(const QStringList &)> ClientHandler
     {"reboot",  &ClientHandler::reboot},
     {"upload",  &ClientHandler::upload},
     {"attach",  &ClientHandler::attach},
-    {"detach",  &ClientHandler::detach}
+    {"detach",  &ClientHandler::detach},
+    {"metrics", &ClientHandler::metrics}
 };
 
 ClientHandler::ClientHandler(unique_ptr<SessionPeer> peer, QObject *parent)
@@ -44,6 +49,7 @@ ClientHandler::ClientHandler(unique_ptr<SessionPeer> peer, QObject *parent)
 {
     connect(peer_.get(), &SessionPeer::closed, this, &ClientHandler::closed);
     connect(peer_.get(), &SessionPeer::received, this, &ClientHandler::execute);
+    connect(&metrics_timer_, &QTimer::timeout, this, &ClientHandler::sendMetrics);
 
 #ifdef _WIN32
     peer_->send({"allowsetforegroundwindow", QString::number(GetCurrentProcessId())});
@@ -256,6 +262,181 @@ void ClientHandler::detach(const QStringList &)
     notifyFinished(true);
 }
 
+void ClientHandler::metrics(const QStringList &parameters)
+{
+    if (!tyCommander->monitor()->monitor()) {
+        notifyLog(TY_LOG_ERROR, tr("Board monitor is not running"));
+        notifyFinished(false);
+        return;
+    }
+
+    int interval = 0;
+    metrics_json_ = false;
+    for (auto &param: parameters) {
+        bool numeric;
+        auto value = param.toInt(&numeric);
+
+        if (param == "prometheus") {
+            metrics_json_ = false;
+        } else if (param == "json") {
+            metrics_json_ = true;
+        } else if (numeric && value > 0) {
+            interval = value;
+        } else {
+            notifyLog(TY_LOG_ERROR, tr("Invalid metrics parameter '%1'").arg(param));
+            notifyFinished(false);
+            return;
+        }
+    }
+
+    sendMetrics();
+
+    // With an interval (in seconds), keep sending snapshots until the client goes away
+    if (interval) {
+        metrics_timer_.start(interval * 1000);
+    } else {
+        notifyFinished(true);
+    }
+}
+
+static QString escapeMetricsLabel(QString value)
+{
+    return value.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+}
+
+QString ClientHandler::formatPrometheusMetrics()
+{
+    auto monitor = tyCommander->monitor();
+    QString out;
+
+    auto add_header = [&](const char *name, const char *type, const char *help) {
+        out += QString("# HELP tycommander_%1 %2\n").arg(name, help);
+        out += QString("# TYPE tycommander_%1 %2\n").arg(name, type);
+    };
+
+    unsigned int online = 0, missing = 0;
+    for (auto &board: *monitor) {
+        if (ty_board_get_status(board->board()) == TY_BOARD_STATUS_ONLINE) {
+            online++;
+        } else {
+            missing++;
+        }
+    }
+    add_header("boards", "gauge", "Number of known boards by status");
+    out += QString("tycommander_boards{status=\"online\"} %1\n").arg(online);
+    out += QString("tycommander_boards{status=\"missing\"} %1\n").arg(missing);
+
+    // Entries without a type belong to the same family as the previous one
+    static const struct {
+        const char *name;
+        const char *family;
+        const char *type;
+        const char *help;
+        uint64_t ty_board_stats::*field;
+        double scale;
+    } board_metrics[] = {
+        {"board_read_bytes_total", "board_read_bytes_total", "counter", "Bytes read from the board", &ty_board_stats::read_bytes, 1.0},
+        {"board_read_full_total", "board_read_full_total", "counter", "Reads that filled the whole buffer", &ty_board_stats::read_full, 1.0},
+        {"board_write_bytes_total", "board_write_bytes_total", "counter", "Bytes written to the board", &ty_board_stats::write_bytes, 1.0},
+        {"board_write_short_total", "board_write_short_total", "counter", "Writes that timed out before completion", &ty_board_stats::write_short, 1.0},
+        {"board_io_errors_total", "board_io_errors_total", "counter", "Failed I/O calls", &ty_board_stats::io_errors, 1.0},
+        {"board_dropped_bytes_total", "board_dropped_bytes_total", "counter", "Serial bytes lost before being read", &ty_board_stats::dropped_bytes, 1.0},
+        {"board_reconnects_total", "board_reconnects_total", "counter", "Times the board came back after going missing", &ty_board_stats::reconnects, 1.0},
+        {"board_upload_failures_total", "board_upload_failures_total", "counter", "Failed uploads", &ty_board_stats::upload_failures, 1.0},
+        {"board_upload_seconds_sum", "board_upload_seconds", "summary", "Time spent uploading", &ty_board_stats::upload_time, 0.001},
+        {"board_upload_seconds_count", nullptr, nullptr, nullptr, &ty_board_stats::uploads, 1.0}
+    };
+
+    vector<pair<QString, ty_board_stats>> stats;
+    for (auto &board: *monitor) {
+        ty_board_stats board_stats;
+        ty_board_get_stats(board->board(), &board_stats);
+        stats.emplace_back(escapeMetricsLabel(board->tag()), board_stats);
+    }
+    for (auto &metric: board_metrics) {
+        if (metric.type)
+            add_header(metric.family, metric.type, metric.help);
+        for (auto &board: stats) {
+            out += QString("tycommander_%1{board=\"%2\"} %3\n")
+                   .arg(metric.name, board.first)
+                   .arg(static_cast<double>(board.second.*metric.field) * metric.scale, 0, 'g', 15);
+        }
+    }
+
+    ty_pool_stats pool_stats;
+    ty_pool_get_stats(monitor->pool(), &pool_stats);
+    add_header("tasks", "gauge", "Board tasks by state");
+    out += QString("tycommander_tasks{state=\"running\"} %1\n").arg(pool_stats.busy_threads);
+    out += QString("tycommander_tasks{state=\"pending\"} %1\n").arg(pool_stats.pending_tasks);
+    out += QString("tycommander_tasks{state=\"blocked\"} %1\n").arg(pool_stats.blocked_tasks);
+
+    ty_monitor_stats monitor_stats;
+    ty_monitor_get_stats(monitor->monitor(), &monitor_stats);
+    add_header("monitor_refresh_seconds", "summary", "Time spent processing device events");
+    out += QString("tycommander_monitor_refresh_seconds_sum %1\n")
+           .arg(static_cast<double>(monitor_stats.refresh_time) / 1000000.0, 0, 'g', 15);
+    out += QString("tycommander_monitor_refresh_seconds_count %1\n").arg(monitor_stats.refreshes);
+
+    return out;
+}
+
+QString ClientHandler::formatJsonMetrics()
+{
+    auto monitor = tyCommander->monitor();
+    QJsonObject json;
+
+    unsigned int online = 0, missing = 0;
+    QJsonArray boards;
+    for (auto &board: *monitor) {
+        ty_board_stats stats;
+        ty_board_get_stats(board->board(), &stats);
+
+        bool board_online = ty_board_get_status(board->board()) == TY_BOARD_STATUS_ONLINE;
+        if (board_online) {
+            online++;
+        } else {
+            missing++;
+        }
+
+        // JSON numbers are doubles, that is plenty for these counters
+        boards.append(QJsonObject{
+            {"tag", board->tag()},
+            {"status", board_online ? "online" : "missing"},
+            {"read_bytes", static_cast<double>(stats.read_bytes)},
+            {"read_full", static_cast<double>(stats.read_full)},
+            {"write_bytes", static_cast<double>(stats.write_bytes)},
+            {"write_short", static_cast<double>(stats.write_short)},
+            {"io_errors", static_cast<double>(stats.io_errors)},
+            {"dropped_bytes", static_cast<double>(stats.dropped_bytes)},
+            {"reconnects", static_cast<double>(stats.reconnects)},
+            {"uploads", static_cast<double>(stats.uploads)},
+            {"upload_failures", static_cast<double>(stats.upload_failures)},
+            {"upload_time", static_cast<double>(stats.upload_time)}
+        });
+    }
+    json["boards"] = QJsonObject{{"online", static_cast<int>(online)},
+                                 {"missing", static_cast<int>(missing)}};
+    json["board_stats"] = boards;
+
+    ty_pool_stats pool_stats;
+    ty_pool_get_stats(monitor->pool(), &pool_stats);
+    json["tasks"] = QJsonObject{{"running", static_cast<int>(pool_stats.busy_threads)},
+                                {"pending", static_cast<int>(pool_stats.pending_tasks)},
+                                {"blocked", static_cast<int>(pool_stats.blocked_tasks)}};
+
+    ty_monitor_stats monitor_stats;
+    ty_monitor_get_stats(monitor->monitor(), &monitor_stats);
+    json["monitor"] = QJsonObject{{"refreshes", static_cast<double>(monitor_stats.refreshes)},
+                                  {"refresh_time", static_cast<double>(monitor_stats.refresh_time)}};
+
+    return QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact)) + "\n";
+}
+
+void ClientHandler::sendMetrics()
+{
+    peer_->send({"metrics", metrics_json_ ? formatJsonMetrics() : formatPrometheusMetrics()});
+}
+
 /* This function is static because it can be called after the client is gone (and the
    handler destroyed), such as if the user does not wait for the board selection dialog.
    This means we cannot use notify*() methods in there, hence the use of pseudo-tasks
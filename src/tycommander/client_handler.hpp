@@ -12,6 +12,7 @@
 #define CLIENT_HANDLER_HH
 
 #include <QHash>
+#include <QTimer>
 
 #include <memory>
 #include <vector>
@@ -38,6 +39,9 @@ class ClientHandler : public QObject {
     unsigned int finished_tasks_ = 0;
     unsigned int error_count_ = 0;
 
+    QTimer metrics_timer_;
+    bool metrics_json_ = false;
+
 public:
     ClientHandler(std::unique_ptr<SessionPeer> peer, QObject *parent = nullptr);
 
@@ -57,6 +61,11 @@ private:
     void upload(const QStringList &parameters);
     void attach(const QStringList &parameters);
     void detach(const QStringList &parameters);
+    void metrics(const QStringList &parameters);
+
+    static QString formatPrometheusMetrics();
+    static QString formatJsonMetrics();
+    void sendMetrics();
 
     static std::vector<TaskInterface> makeUploadTasks(
         const std::vector<std::shared_ptr<Board>> &boards, const QStringList &filenames);
@@ -16,6 +16,7 @@
 #include <QToolButton>
 #include <QUrl>
 
+#include "../libty/trace.h"
 #include "about_dialog.hpp"
 #include "arduino_dialog.hpp"
 #include "board.hpp"
@@ -127,6 +128,9 @@ MainWindow::MainWindow(QWidget *parent)
 
     // Tools menu
     connect(actionArduinoTool, &QAction::triggered, this, &MainWindow::openArduinoTool);
+    actionRecordTrace->setChecked(ty_trace_is_enabled());
+    connect(actionRecordTrace, &QAction::triggered, this, &MainWindow::setRecordTrace);
+    connect(actionExportTrace, &QAction::triggered, this, &MainWindow::exportTrace);
     connect(actionResetApp, &QAction::triggered, tyCommander, &TyCommander::resetMonitor);
     connect(actionResetSettingsApp, &QAction::triggered, this,
             [=]() { tyCommander->clearSettingsAndResetWithConfirmation(this); });
@@ -586,6 +590,25 @@ void MainWindow::openArduinoTool()
     arduino_dialog_->show();
 }
 
+void MainWindow::setRecordTrace(bool enable)
+{
+    // Start from a clean slate, the previous recording would be mixed up with the new one
+    if (enable && !ty_trace_is_enabled())
+        ty_trace_clear();
+    ty_trace_set_enabled(enable);
+}
+
+void MainWindow::exportTrace()
+{
+    auto filename = QFileDialog::getSaveFileName(this, tr("Export Trace"), "tycommander.json",
+                                                 tr("Trace Files (*.json);;All Files (*)"));
+    if (filename.isEmpty())
+        return;
+
+    if (ty_trace_save(QDir::toNativeSeparators(filename).toLocal8Bit().constData()) < 0)
+        showErrorMessage(ty_error_last_message());
+}
+
 void MainWindow::openPreferences()
 {
     PreferencesDialog(this).exec();
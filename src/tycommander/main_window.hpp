@@ -89,6 +89,8 @@ public slots:
 
     void openCloneWindow();
     void openArduinoTool();
+    void setRecordTrace(bool enable);
+    void exportTrace();
     void openPreferences();
     void openAboutDialog();
 
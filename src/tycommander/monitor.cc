@@ -181,6 +181,11 @@ bool Monitor::start()
         if (r < 0)
             return false;
         unique_ptr<ty_monitor, decltype(&ty_monitor_free)> monitor_ptr(monitor, ty_monitor_free);
+        // Clients fire commands without waiting, repeated uploads or resets only happen once
+        ty_monitor_set_task_coalescing(monitor, true);
+        /* A hub full of boards rebooting generates lots of device events, get one event
+           per board and per refresh instead. */
+        ty_monitor_set_batching(monitor, true, 0);
 
         r = ty_monitor_register_callback(monitor, handleEvent, this);
         if (r < 0)
@@ -366,7 +371,13 @@ bool Monitor::setData(const QModelIndex &index, const QVariant &value, int role)
 void Monitor::refresh(ty_descriptor desc)
 {
     Q_UNUSED(desc);
+
+    // Views get a single update once all the events of the batch have been handled
+    batch_refresh_ = true;
     ty_monitor_refresh(monitor_);
+    batch_refresh_ = false;
+
+    flushDirtyRows();
 }
 
 int Monitor::handleEvent(ty_board *board, ty_monitor_event event, void *udata)
@@ -459,17 +470,40 @@ void Monitor::handleChangedEvent(ty_board *board)
 
 void Monitor::refreshBoardItem(iterator it)
 {
-    auto index = createIndex(it - boards_.begin(), 0);
+    if (it == boards_.end())
+        return;
+    int row = static_cast<int>(it - boards_.begin());
+
+    if (batch_refresh_) {
+        dirty_first_ = dirty_first_ >= 0 ? min(dirty_first_, row) : row;
+        dirty_last_ = max(dirty_last_, row);
+        return;
+    }
+
+    auto index = createIndex(row, 0);
     dataChanged(index, index);
 }
 
 void Monitor::removeBoardItem(iterator it)
 {
+    // Rows are about to move, don't report changes on the wrong ones
+    flushDirtyRows();
+
     beginRemoveRows(QModelIndex(), it - boards_.begin(), it - boards_.begin());
     boards_.erase(it);
     endRemoveRows();
 }
 
+void Monitor::flushDirtyRows()
+{
+    if (dirty_first_ < 0)
+        return;
+
+    dataChanged(createIndex(dirty_first_, 0), createIndex(dirty_last_, 0));
+    dirty_first_ = -1;
+    dirty_last_ = -1;
+}
+
 void Monitor::configureBoardDatabase(Board &board)
 {
     board.setDatabase(db_.subDatabase(board.id()));
@@ -45,6 +45,11 @@ class Monitor : public QAbstractListModel {
 
     std::vector<std::shared_ptr<Board>> boards_;
 
+    // Rows changed by the monitor refresh in progress, see refresh()
+    bool batch_refresh_ = false;
+    int dirty_first_ = -1;
+    int dirty_last_ = -1;
+
 public:
     typedef decltype(boards_)::iterator iterator;
     typedef decltype(boards_)::const_iterator const_iterator;
@@ -85,6 +90,7 @@ public:
     void stop();
 
     ty_monitor *monitor() const { return monitor_; }
+    ty_pool *pool() const { return pool_; }
 
     iterator begin() { return boards_.begin(); }
     iterator end() { return boards_.end(); }
@@ -136,6 +142,7 @@ private:
 
     void refreshBoardItem(iterator it);
     void removeBoardItem(iterator it);
+    void flushDirtyRows();
 
     void configureBoardDatabase(Board &board);
 };
@@ -48,6 +48,7 @@ static const ClientCommand commands[] = {
     {"upload",    &TyCommander::executeRemoteCommand, QT_TR_NOOP("[<firmwares>]"), QT_TR_NOOP("Upload current or new firmware")},
     {"attach",    &TyCommander::executeRemoteCommand, NULL,                        QT_TR_NOOP("Attach serial monitor")},
     {"detach",    &TyCommander::executeRemoteCommand, NULL,                        QT_TR_NOOP("Detach serial monitor")},
+    {"metrics",   &TyCommander::executeRemoteCommand, QT_TR_NOOP("[json] [<sec>]"),  QT_TR_NOOP("Print board and task metrics")},
     {"integrate", &TyCommander::integrateArduino,     NULL,                        NULL},
     {"restore",   &TyCommander::integrateArduino,     NULL,                        NULL},
     // Hidden command for Arduino 1.0.6 integration
@@ -635,6 +636,13 @@ void TyCommander::processServerAnswer(const QStringList &arguments)
         msg.u.progress.max = parameters[3].toULongLong();
 
         ty_message(&msg);
+    } else if (cmd == "metrics") {
+        if (parameters.count() < 1)
+            goto error;
+
+        // Metrics are the command output, even in quiet mode
+        fputs(parameters[0].toUtf8().constData(), stdout);
+        fflush(stdout);
     } else if (cmd == "start") {
         if (!wait_)
             exit(0);
@@ -0,0 +1,145 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Measure the cost of the device table used by hs_monitor (add, lookup and remove) with
+   10, 100 and 1000 devices, using sysfs-like keys that share long prefixes. */
+
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../src/libhs/common.h"
+#include "../../src/libhs/device.h"
+#include "../../src/libhs/monitor_priv.h"
+
+static const unsigned int device_counts[] = {10, 100, 1000};
+
+static uint64_t get_nanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static hs_device **create_devices(unsigned int count)
+{
+    hs_device **devices = calloc(count, sizeof(*devices));
+    if (!devices)
+        return NULL;
+
+    for (unsigned int i = 0; i < count; i++) {
+        hs_device *dev = calloc(1, sizeof(*dev));
+        char key[128];
+
+        if (!dev)
+            goto error;
+        devices[i] = dev;
+
+        snprintf(key, sizeof(key),
+                 "/devices/pci0000:00/0000:00:14.0/usb1/1-%u/1-%u.%u/1-%u.%u:1.0/hidraw/hidraw%u",
+                 i / 16, i / 16, i % 16, i / 16, i % 16, i);
+        dev->refcount = 1;
+        dev->status = HS_DEVICE_STATUS_ONLINE;
+        dev->key = strdup(key);
+        if (!dev->key)
+            goto error;
+    }
+
+    return devices;
+
+error:
+    for (unsigned int i = 0; i < count; i++)
+        hs_device_unref(devices[i]);
+    free(devices);
+    return NULL;
+}
+
+static int run_bench(unsigned int count, unsigned int rounds)
+{
+    hs_device **devices = create_devices(count);
+    _hs_htable table = {0};
+    uint64_t add_time = 0, find_time = 0, remove_time = 0;
+    unsigned int found = 0;
+
+    if (!devices) {
+        fprintf(stderr, "Failed to create devices\n");
+        return 1;
+    }
+
+    for (unsigned int i = 0; i < rounds; i++) {
+        uint64_t start;
+
+        start = get_nanos();
+        for (unsigned int j = 0; j < count; j++) {
+            if (_hs_monitor_add(&table, devices[j], NULL, NULL) < 0) {
+                fprintf(stderr, "Failed to add device\n");
+                return 1;
+            }
+        }
+        add_time += get_nanos() - start;
+
+        // Half of the lookups miss because of the interface number
+        start = get_nanos();
+        for (unsigned int j = 0; j < count; j++) {
+            found += _hs_monitor_has_device(&table, devices[j]->key, 0);
+            found += _hs_monitor_has_device(&table, devices[j]->key, 1);
+        }
+        find_time += get_nanos() - start;
+
+        start = get_nanos();
+        for (unsigned int j = 0; j < count; j++)
+            _hs_monitor_remove(&table, devices[j]->key, 0, NULL, NULL);
+        remove_time += get_nanos() - start;
+
+        // Removal marks devices as disconnected
+        for (unsigned int j = 0; j < count; j++)
+            devices[j]->status = HS_DEVICE_STATUS_ONLINE;
+    }
+
+    printf("%5u devices  add %6.1f ns  lookup %6.1f ns  remove %6.1f ns  (%u hits)\n", count,
+           (double)add_time / (rounds * count), (double)find_time / (rounds * count * 2),
+           (double)remove_time / (rounds * count), found / rounds);
+
+    _hs_htable_release(&table);
+    for (unsigned int i = 0; i < count; i++)
+        hs_device_unref(devices[i]);
+    free(devices);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int total = 1000000;
+
+    if (argc >= 2) {
+        total = (unsigned int)strtoul(argv[1], NULL, 10);
+        if (!total) {
+            fprintf(stderr, "usage: %s [operations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("Device table performance (about %u operations per size)\n\n", total);
+
+    for (size_t i = 0; i < sizeof(device_counts) / sizeof(*device_counts); i++) {
+        unsigned int count = device_counts[i];
+        unsigned int rounds = total / count ? total / count : 1;
+
+        if (run_bench(count, rounds))
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Measure serial round-trip latency (ping-pong) against an echo thread running on the
+   master side of a pseudo-terminal, for each hs_serial_config_latency mode. */
+
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../src/libhs/common.h"
+#include "../../src/libhs/device.h"
+#include "../../src/libhs/serial.h"
+
+#define MESSAGE_SIZE 16
+#define WARMUP_ROUNDS 100
+
+static volatile int echo_run = 1;
+
+static void *echo_thread(void *udata)
+{
+    int master_fd = *(int *)udata;
+    uint8_t buf[256];
+
+    while (echo_run) {
+        struct pollfd pfd = {master_fd, POLLIN, 0};
+        ssize_t r;
+
+        r = poll(&pfd, 1, 100);
+        if (r <= 0)
+            continue;
+
+        r = read(master_fd, buf, sizeof(buf));
+        if (r <= 0)
+            break;
+        if (write(master_fd, buf, (size_t)r) != r)
+            break;
+    }
+
+    return NULL;
+}
+
+static uint64_t get_micros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int ping_pong(hs_port *port, uint64_t *rtime)
+{
+    uint8_t msg[MESSAGE_SIZE], buf[MESSAGE_SIZE];
+    size_t received = 0;
+    uint64_t start;
+    ssize_t r;
+
+    memset(msg, 'x', sizeof(msg));
+
+    start = get_micros();
+    r = hs_serial_write(port, msg, sizeof(msg), 1000);
+    if (r < (ssize_t)sizeof(msg))
+        return r < 0 ? (int)r : HS_ERROR_IO;
+    while (received < sizeof(buf)) {
+        r = hs_serial_read(port, buf + received, sizeof(buf) - received, 1000);
+        if (r <= 0)
+            return r < 0 ? (int)r : HS_ERROR_IO;
+        received += (size_t)r;
+    }
+    *rtime = get_micros() - start;
+
+    return 0;
+}
+
+static int run_mode(hs_port *port, const char *name, hs_serial_config_latency latency,
+                    uint64_t *times, unsigned int rounds)
+{
+    hs_serial_config config = {0};
+    uint64_t sum = 0;
+    int r;
+
+    config.latency = latency;
+    r = hs_serial_set_config(port, &config);
+    if (r < 0)
+        return r;
+
+    for (unsigned int i = 0; i < WARMUP_ROUNDS; i++) {
+        r = ping_pong(port, &times[0]);
+        if (r < 0)
+            return r;
+    }
+    for (unsigned int i = 0; i < rounds; i++) {
+        r = ping_pong(port, &times[i]);
+        if (r < 0)
+            return r;
+        sum += times[i];
+    }
+
+    qsort(times, rounds, sizeof(*times), compare_u64);
+    printf("%-10s  min %6" PRIu64 " us  median %6" PRIu64 " us  p99 %6" PRIu64
+           " us  max %6" PRIu64 " us  avg %6" PRIu64 " us\n", name, times[0],
+           times[rounds / 2], times[rounds * 99 / 100], times[rounds - 1], sum / rounds);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int rounds = 2000;
+    int master_fd = -1;
+    hs_device *dev = NULL;
+    hs_port *port = NULL;
+    uint64_t *times = NULL;
+    pthread_t thread;
+    bool thread_started = false;
+    int r;
+
+    if (argc > 1) {
+        rounds = (unsigned int)strtoul(argv[1], NULL, 10);
+        if (!rounds) {
+            fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0 || grantpt(master_fd) < 0 || unlockpt(master_fd) < 0) {
+        fprintf(stderr, "Failed to create pseudo-terminal: %s\n", strerror(errno));
+        r = 1;
+        goto cleanup;
+    }
+
+    /* There is no monitor for pseudo-terminals, build the device by hand */
+    dev = (hs_device *)calloc(1, sizeof(*dev));
+    if (!dev) {
+        r = 1;
+        goto cleanup;
+    }
+    dev->refcount = 1;
+    dev->type = HS_DEVICE_TYPE_SERIAL;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+    dev->key = strdup(ptsname(master_fd));
+    dev->location = strdup("pty");
+    dev->path = strdup(ptsname(master_fd));
+    if (!dev->key || !dev->location || !dev->path) {
+        r = 1;
+        goto cleanup;
+    }
+
+    r = hs_port_open(dev, HS_PORT_MODE_RW, &port);
+    if (r < 0) {
+        r = 1;
+        goto cleanup;
+    }
+
+    if (pthread_create(&thread, NULL, echo_thread, &master_fd)) {
+        fprintf(stderr, "Failed to start echo thread\n");
+        r = 1;
+        goto cleanup;
+    }
+    thread_started = true;
+
+    times = (uint64_t *)malloc(rounds * sizeof(*times));
+    if (!times) {
+        r = 1;
+        goto cleanup;
+    }
+
+    printf("Serial round-trip latency (%u rounds of %d bytes) on '%s'\n\n",
+           rounds, MESSAGE_SIZE, dev->path);
+    if (run_mode(port, "normal", HS_SERIAL_CONFIG_LATENCY_NORMAL, times, rounds) < 0 ||
+            run_mode(port, "low", HS_SERIAL_CONFIG_LATENCY_LOW, times, rounds) < 0 ||
+            run_mode(port, "busy-poll", HS_SERIAL_CONFIG_LATENCY_BUSY_POLL, times, rounds) < 0) {
+        r = 1;
+        goto cleanup;
+    }
+
+    r = 0;
+cleanup:
+    free(times);
+    if (thread_started) {
+        echo_run = 0;
+        pthread_join(thread, NULL);
+    }
+    hs_port_close(port);
+    hs_device_unref(dev);
+    if (master_fd >= 0)
+        close(master_fd);
+    return r;
+}
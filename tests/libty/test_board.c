@@ -0,0 +1,573 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _WIN32
+    #ifndef _GNU_SOURCE
+        #define _GNU_SOURCE
+    #endif
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+#include "test_libty.h"
+#include "../../src/libhs/serial.h"
+#include "../../src/libty/board_priv.h"
+#include "../../src/libty/class_priv.h"
+#include "../../src/libty/monitor.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/task.h"
+
+static ty_board *create_board(const char *id, const char *location)
+{
+    ty_board *board = calloc(1, sizeof(*board));
+    if (!board)
+        return NULL;
+    board->refcount = 1;
+
+    board->id = strdup(id);
+    board->location = strdup(location);
+    board->tag = board->id;
+    if (!board->id || !board->location || ty_mutex_init(&board->ifaces_lock) < 0 ||
+            ty_mutex_init(&board->tasks_lock) < 0 || ty_cond_init(&board->wait_cond) < 0) {
+        ty_board_unref(board);
+        return NULL;
+    }
+    _ty_board_parse_id(board);
+
+    return board;
+}
+
+// There is no monitor to build interfaces for us
+static ty_board_interface *add_interface(ty_board *board, const struct _ty_class_vtable *vtable,
+                                         int capabilities)
+{
+    ty_board_interface *iface;
+
+    iface = calloc(1, sizeof(*iface));
+    if (!iface)
+        return NULL;
+    iface->refcount = 1;
+    iface->class_vtable = vtable;
+    iface->board = board;
+    iface->name = "test";
+    iface->capabilities = capabilities;
+    if (ty_mutex_init(&iface->open_lock) < 0 || ty_mutex_init(&iface->attach_lock) < 0 ||
+            _hs_array_push(&board->ifaces, iface) < 0) {
+        ty_board_interface_unref(iface);
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < TY_BOARD_CAPABILITY_COUNT; i++) {
+        if (capabilities & (1 << i))
+            board->cap2iface[i] = iface;
+    }
+    board->capabilities |= capabilities;
+
+    return iface;
+}
+
+// Return 1 or 0, or -1 if the compiled matcher and ty_board_matches_tag() disagree
+static int match_tag(const char *tag, ty_board *board)
+{
+    ty_board_matcher *matcher;
+    bool match;
+
+    if (ty_board_matcher_new(tag, &matcher) < 0)
+        return -1;
+    match = ty_board_matcher_match(matcher, board);
+    ty_board_matcher_free(matcher);
+
+    if (match != ty_board_matches_tag(board, tag))
+        return -1;
+    return match;
+}
+
+static void test_board_matcher(void)
+{
+    ty_board *board = create_board("1234-Teensy", "usb-1-2");
+
+    ASSERT(board);
+    if (!board)
+        return;
+
+    ASSERT(match_tag(NULL, board) == 1);
+    ASSERT(match_tag("1234-Teensy", board) == 1);
+    ASSERT(match_tag("1234", board) == 1);
+    ASSERT(match_tag("-Teensy", board) == 1);
+    ASSERT(match_tag("@usb-1-2", board) == 1);
+    ASSERT(match_tag("1234@usb-1-2", board) == 1);
+    ASSERT(match_tag("1234-Teensy@usb-1-2", board) == 1);
+
+    ASSERT(match_tag("123", board) == 0);
+    ASSERT(match_tag("12345", board) == 0);
+    ASSERT(match_tag("1234-Generic", board) == 0);
+    ASSERT(match_tag("@usb-1-3", board) == 0);
+    ASSERT(match_tag("4321@usb-1-2", board) == 0);
+
+    ASSERT(ty_board_set_tag(board, "foo") == 0);
+    ASSERT(match_tag("foo", board) == 1);
+    ASSERT(match_tag("1234", board) == 1);
+    ASSERT(match_tag("bar", board) == 0);
+
+    ty_board_unref(board);
+}
+
+static int run_counter(ty_task *task)
+{
+    ty_board_interface *iface = task->result;
+
+    for (unsigned int i = 0; i < 10000; i++)
+        _ty_board_interface_count_io(iface, true, 16, 16);
+
+    return 0;
+}
+
+static void test_board_stats(void)
+{
+    ty_board *board = create_board("1234-Teensy", "usb-1-2");
+    ty_board_interface iface = {0};
+    ty_task *tasks[4] = {0};
+    ty_board_stats stats;
+
+    ASSERT(board);
+    if (!board)
+        return;
+    iface.board = board;
+
+    _ty_board_interface_count_io(&iface, false, 64, 64);
+    _ty_board_interface_count_io(&iface, false, 10, 64);
+    _ty_board_interface_count_io(&iface, false, 0, 64);
+    _ty_board_interface_count_io(&iface, false, TY_ERROR_IO, 64);
+    _ty_board_interface_count_io(&iface, true, 5, 8);
+
+    ty_board_interface_get_stats(&iface, &stats);
+    ASSERT(stats.read_calls == 4);
+    ASSERT(stats.read_bytes == 74);
+    ASSERT(stats.read_full == 1);
+    ASSERT(stats.write_calls == 1);
+    ASSERT(stats.write_bytes == 5);
+    ASSERT(stats.write_short == 1);
+    ASSERT(stats.io_errors == 1);
+
+    // Counters must not lose updates made concurrently
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        if (ty_task_new("counter", run_counter, &tasks[i]) < 0)
+            continue;
+        tasks[i]->result = &iface;
+        ty_task_start(tasks[i]);
+    }
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        ASSERT(tasks[i] && ty_task_join(tasks[i]) == 0);
+        ty_task_unref(tasks[i]);
+    }
+
+    ty_board_get_stats(board, &stats);
+    ASSERT(stats.write_calls == 1 + TY_COUNTOF(tasks) * 10000);
+    ASSERT(stats.write_bytes == 5 + TY_COUNTOF(tasks) * 10000 * 16);
+    ASSERT(stats.write_short == 1);
+    ASSERT(stats.read_calls == 4);
+
+    ty_board_unref(board);
+}
+
+static int ignore_event(ty_board *board, ty_monitor_event event, void *udata)
+{
+    TY_UNUSED(board);
+    TY_UNUSED(event);
+    TY_UNUSED(udata);
+
+    return 0;
+}
+
+static void test_board_callback_ref(void)
+{
+    ty_monitor *monitor;
+    ty_board *board;
+    int id;
+
+    if (ty_monitor_new(&monitor) < 0)
+        return;
+
+    board = create_board("1234-Teensy", "usb-1-2");
+    ASSERT(board);
+    if (!board)
+        goto cleanup;
+    board->monitor = monitor;
+
+    // Board callbacks keep their board alive until they go away
+    id = ty_monitor_register_board_callback(monitor, board, 0, ignore_event, NULL);
+    ASSERT(id >= 0);
+    ASSERT(board->refcount == 2);
+    ty_monitor_deregister_callback(monitor, id);
+    ASSERT(board->refcount == 1);
+
+    ASSERT(ty_monitor_register_board_callback(monitor, board, 0, ignore_event, NULL) >= 0);
+    ASSERT(board->refcount == 2);
+
+cleanup:
+    ty_monitor_free(monitor);
+    if (board) {
+        ASSERT(board->refcount == 1);
+        board->monitor = NULL;
+        ty_board_unref(board);
+    }
+}
+
+static void test_board_dependencies(void)
+{
+    ty_board *board = create_board("1234-Teensy", "usb-1-2");
+    ty_task_graph *graph = NULL;
+    ty_task *tasks[3] = {0};
+
+    ASSERT(board);
+    if (!board)
+        return;
+
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        ASSERT(ty_send(board, "x", 1, NULL, NULL, &tasks[i]) == 0);
+        if (!tasks[i])
+            goto cleanup;
+    }
+    ASSERT(ty_task_graph_new(&graph) == 0);
+    if (!graph)
+        goto cleanup;
+
+    // The first task would wait forever for the second one, which waits for it on the board
+    ty_error_mask(TY_ERROR_PARAM);
+    ASSERT(ty_task_add_dependency(tasks[0], tasks[1]) == TY_ERROR_PARAM);
+    ASSERT(ty_task_graph_add_dependency(graph, tasks[1], tasks[2]) == TY_ERROR_PARAM);
+    ty_error_unmask();
+
+    ASSERT(ty_task_add_dependency(tasks[2], tasks[0]) == 0);
+    ASSERT(ty_task_graph_add_dependency(graph, tasks[2], tasks[1]) == 0);
+
+cleanup:
+    ty_task_graph_free(graph);
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++)
+        ty_task_unref(tasks[i]);
+    ty_board_unref(board);
+}
+
+static unsigned int reset_calls;
+static unsigned int reset_failures;
+
+static int fake_open_interface(ty_board_interface *iface)
+{
+    TY_UNUSED(iface);
+    return 0;
+}
+
+static void fake_close_interface(ty_board_interface *iface)
+{
+    TY_UNUSED(iface);
+}
+
+// Tasks for the same board never run concurrently, no need for atomics
+static int fake_reset(ty_board_interface *iface)
+{
+    TY_UNUSED(iface);
+
+    int r = 0;
+
+    reset_calls++;
+    if (reset_failures) {
+        reset_failures--;
+
+        ty_error_mask(TY_ERROR_IO);
+        r = ty_error(TY_ERROR_IO, "Reset failed");
+        ty_error_unmask();
+    }
+
+    return r;
+}
+
+static const struct _ty_class_vtable fake_class_vtable = {
+    .open_interface = fake_open_interface,
+    .close_interface = fake_close_interface,
+    .reset = fake_reset
+};
+
+// Queue identical resets, the first ones fail, and return how many times the board was reset
+static int run_resets(ty_board *board, unsigned int failures, int rets[3])
+{
+    ty_task *tasks[3] = {0};
+    int r;
+
+    reset_calls = 0;
+    reset_failures = failures;
+
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        r = ty_reset(board, &tasks[i]);
+        if (r < 0)
+            goto cleanup;
+    }
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++)
+        ty_task_start(tasks[i]);
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        // Don't join, the wait would refresh the monitor from this thread
+        if (ty_task_wait(tasks[i], TY_TASK_STATUS_FINISHED, 5000) != 1) {
+            r = -1;
+            goto cleanup;
+        }
+        rets[i] = tasks[i]->ret;
+    }
+
+    r = (int)reset_calls;
+cleanup:
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++)
+        ty_task_unref(tasks[i]);
+    return r;
+}
+
+static void test_board_coalesce(void)
+{
+    ty_monitor *monitor;
+    ty_board *board;
+    int rets[3];
+
+    if (ty_monitor_new(&monitor) < 0)
+        return;
+    ty_monitor_set_task_coalescing(monitor, true);
+
+    board = create_board("1234-Teensy", "usb-1-2");
+    ASSERT(board);
+    if (!board)
+        goto cleanup;
+    board->monitor = monitor;
+    board->status = TY_BOARD_STATUS_ONLINE;
+    ASSERT(add_interface(board, &fake_class_vtable,
+                         (1 << TY_BOARD_CAPABILITY_RUN) | (1 << TY_BOARD_CAPABILITY_RESET)));
+
+    ASSERT(run_resets(board, 0, rets) == 1);
+    ASSERT(rets[0] == 0 && rets[1] == 0 && rets[2] == 0);
+
+    // Failures are not shared, the next identical task runs for real
+    ASSERT(run_resets(board, 1, rets) == 2);
+    ASSERT(rets[0] == TY_ERROR_IO && rets[1] == 0 && rets[2] == 0);
+
+    ASSERT(run_resets(board, 3, rets) == 3);
+    ASSERT(rets[0] == TY_ERROR_IO && rets[1] == TY_ERROR_IO && rets[2] == TY_ERROR_IO);
+
+cleanup:
+    ty_board_unref(board);
+    ty_monitor_free(monitor);
+}
+
+#ifndef _WIN32
+
+static int pty_open_interface(ty_board_interface *iface)
+{
+    int r = hs_port_open(iface->dev, HS_PORT_MODE_RW, &iface->port);
+    return r < 0 ? ty_libhs_translate_error(r) : 0;
+}
+
+static void pty_close_interface(ty_board_interface *iface)
+{
+    hs_port_close(iface->port);
+    iface->port = NULL;
+}
+
+static const struct _ty_class_vtable pty_class_vtable = {
+    .open_interface = pty_open_interface,
+    .close_interface = pty_close_interface
+};
+
+// Serial interface backed by a pseudo-terminal
+static ty_board_interface *add_pty_interface(ty_board *board, int master)
+{
+    ty_board_interface *iface;
+    hs_device *dev;
+
+    dev = calloc(1, sizeof(*dev));
+    assert(dev);
+
+    dev->refcount = 1;
+    dev->type = HS_DEVICE_TYPE_SERIAL;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+    dev->key = strdup(ptsname(master));
+    dev->location = strdup("pty");
+    dev->path = strdup(ptsname(master));
+
+    iface = add_interface(board, &pty_class_vtable, 1 << TY_BOARD_CAPABILITY_SERIAL);
+    if (!iface) {
+        hs_device_unref(dev);
+        return NULL;
+    }
+    iface->dev = dev;
+
+    return iface;
+}
+
+// Read what the board side received, until nothing comes for a while
+static size_t drain_pty(int master, char *buf, size_t size, int timeout)
+{
+    size_t len = 0;
+
+    while (true) {
+        struct pollfd pfd = {master, POLLIN, 0};
+        char discard[4096];
+        ssize_t r;
+
+        if (poll(&pfd, 1, timeout) <= 0)
+            break;
+
+        if (buf && len < size) {
+            r = read(master, buf + len, size - len);
+        } else {
+            r = read(master, discard, sizeof(discard));
+        }
+        if (r <= 0)
+            break;
+        if (buf)
+            len += (size_t)r;
+    }
+
+    return len;
+}
+
+static void test_board_send_cancel(void)
+{
+    const size_t size = 1024 * 1024;
+    ty_board *board = create_board("1234-Teensy", "usb-1-2");
+    ty_board_interface *iface = NULL;
+    char *buf = NULL;
+    char received[64];
+    size_t received_len = 0;
+    ty_task *task = NULL;
+    int master;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    ASSERT(board && master >= 0 && !grantpt(master) && !unlockpt(master));
+    if (!board || master < 0)
+        goto cleanup;
+    iface = add_pty_interface(board, master);
+    buf = malloc(size);
+    ASSERT(iface && buf);
+    if (!iface || !buf)
+        goto cleanup;
+    memset(buf, 'x', size);
+
+    // Keep the port open across sends, like a serial monitor would
+    ASSERT(ty_board_interface_open(iface) == 0);
+
+    ASSERT(ty_send(board, buf, size, NULL, NULL, &task) == 0);
+    if (!task)
+        goto close;
+    ty_task_start(task);
+
+    // Let the transfer get going before we cancel it
+    for (size_t len = 0; len < 65536;) {
+        struct pollfd pfd = {master, POLLIN, 0};
+        char discard[4096];
+        ssize_t r;
+
+        if (poll(&pfd, 1, 5000) <= 0)
+            break;
+        r = read(master, discard, sizeof(discard));
+        if (r <= 0)
+            break;
+        len += (size_t)r;
+    }
+    ty_task_cancel(task);
+    while (!ty_task_wait(task, TY_TASK_STATUS_FINISHED, 0))
+        drain_pty(master, NULL, 0, 10);
+    drain_pty(master, NULL, 0, 100);
+
+    ASSERT(task->ret == TY_ERROR_CANCELED);
+    ASSERT(hs_serial_get_queued(iface->port) == 0);
+    ty_task_unref(task);
+    task = NULL;
+
+    // Nothing must be left of the canceled buffer once it is gone
+    memset(buf, 'z', size);
+    free(buf);
+    buf = NULL;
+
+    ASSERT(ty_send(board, "hello", 5, NULL, NULL, &task) == 0);
+    if (task) {
+        ASSERT(ty_task_join(task) == 0);
+        received_len = drain_pty(master, received, sizeof(received), 200);
+    }
+    ASSERT(received_len == 5 && !memcmp(received, "hello", 5));
+
+close:
+    ty_board_interface_close(iface);
+cleanup:
+    ty_task_unref(task);
+    free(buf);
+    if (master >= 0)
+        close(master);
+    ty_board_unref(board);
+}
+
+static void test_board_queue(void)
+{
+    ty_board *board = create_board("1234-Teensy", "usb-1-2");
+    ty_task *tasks[4] = {0};
+    ty_board_stats stats;
+    char received[64];
+    size_t received_len = 0;
+    int master;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    ASSERT(board && master >= 0 && !grantpt(master) && !unlockpt(master));
+    if (!board || master < 0)
+        goto cleanup;
+    ASSERT(add_pty_interface(board, master));
+
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        ASSERT(ty_send(board, &"abcd"[i], 1, NULL, NULL, &tasks[i]) == 0);
+        if (!tasks[i])
+            goto cleanup;
+    }
+
+    /* Board tasks run in creation order whatever the start order, and canceling the
+       running task or a queued one lets the next ones go. */
+    ty_task_cancel(tasks[0]);
+    for (unsigned int i = TY_COUNTOF(tasks) - 1; i > 0; i--)
+        ty_task_start(tasks[i]);
+    ty_task_cancel(tasks[2]);
+    ty_task_start(tasks[0]);
+
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++)
+        ASSERT(ty_task_wait(tasks[i], TY_TASK_STATUS_FINISHED, 5000) == 1);
+    received_len = drain_pty(master, received, sizeof(received), 200);
+
+    ASSERT(tasks[0]->ret == TY_ERROR_CANCELED && tasks[2]->ret == TY_ERROR_CANCELED);
+    ASSERT(tasks[1]->ret == 0 && tasks[3]->ret == 0);
+    ASSERT(received_len == 2 && !memcmp(received, "bd", 2));
+    ASSERT(!board->current_task && !board->pending_tasks.count);
+
+    ty_board_get_stats(board, &stats);
+    ASSERT(stats.write_bytes == 2 && stats.write_calls >= 2);
+    ASSERT(!stats.write_short);
+
+cleanup:
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++)
+        ty_task_unref(tasks[i]);
+    if (master >= 0)
+        close(master);
+    ty_board_unref(board);
+}
+
+#endif
+
+void test_board(void)
+{
+    test_board_matcher();
+    test_board_stats();
+    test_board_callback_ref();
+    test_board_dependencies();
+    test_board_coalesce();
+#ifndef _WIN32
+    test_board_queue();
+    test_board_send_cancel();
+#endif
+}
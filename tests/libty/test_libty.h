@@ -29,6 +29,8 @@ TY_C_BEGIN
 
 void report_test(bool pred, const char *file, unsigned int line, const char *fn,
                  const char *pred_fmt, ...) TY_PRINTF_FORMAT(5, 6);
+// Print the summary, and return the exit code of the test program
+int conclude_tests(void);
 
 TY_C_END
 
@@ -0,0 +1,312 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/task.h"
+#include "../../src/libty/thread.h"
+
+#define PRODUCER_COUNT 4
+#define PRODUCER_MESSAGES 50
+
+static ty_mutex record_mutex;
+static ty_thread_id record_thread;
+static unsigned int record_logs, record_progress, record_dropped;
+static int record_last[PRODUCER_COUNT];
+static bool record_ordered;
+static bool record_blocked;
+static uint64_t record_progress_first, record_progress_last;
+
+static void record_message(const ty_message_data *msg, void *udata)
+{
+    TY_UNUSED(udata);
+
+    ty_mutex_lock(&record_mutex);
+
+    if (msg->type == TY_MESSAGE_LOG) {
+        unsigned int producer;
+        int idx;
+
+        record_thread = ty_thread_get_self_id();
+
+        if (sscanf(msg->u.log.msg, "producer %u message %d", &producer, &idx) == 2 &&
+                producer < PRODUCER_COUNT) {
+            if (idx != record_last[producer] + 1)
+                record_ordered = false;
+            record_last[producer] = idx;
+            record_logs++;
+        } else if (strstr(msg->u.log.msg, "Dropped")) {
+            unsigned int dropped;
+            if (sscanf(msg->u.log.msg, "Dropped %u", &dropped) == 1)
+                record_dropped += dropped;
+        }
+    } else if (msg->type == TY_MESSAGE_PROGRESS) {
+        if (!record_progress++)
+            record_progress_first = msg->u.progress.value;
+        record_progress_last = msg->u.progress.value;
+    }
+
+    // Simulate a handler stuck on a slow terminal, give up if messages are not queued
+    for (unsigned int i = 0; record_blocked && i < 2000; i++) {
+        ty_mutex_unlock(&record_mutex);
+        ty_delay(1);
+        ty_mutex_lock(&record_mutex);
+    }
+
+    ty_mutex_unlock(&record_mutex);
+}
+
+static void reset_records(void)
+{
+    record_logs = 0;
+    record_progress = 0;
+    record_dropped = 0;
+    for (unsigned int i = 0; i < PRODUCER_COUNT; i++)
+        record_last[i] = -1;
+    record_ordered = true;
+    record_blocked = false;
+}
+
+static int run_producer(ty_task *task)
+{
+    unsigned int producer = (unsigned int)(uintptr_t)task->result;
+
+    for (int i = 0; i < PRODUCER_MESSAGES; i++) {
+        ty_log(TY_LOG_INFO, "producer %u message %d", producer, i);
+        ty_progress("Producing", (uint64_t)i, PRODUCER_MESSAGES);
+    }
+
+    return 0;
+}
+
+static void test_message_async(void)
+{
+    ty_task *tasks[PRODUCER_COUNT] = {0};
+
+    reset_records();
+
+    ASSERT(ty_message_start_async() == 0);
+    for (unsigned int i = 0; i < PRODUCER_COUNT; i++) {
+        if (ty_task_new("producer", run_producer, &tasks[i]) < 0)
+            continue;
+        tasks[i]->result = (void *)(uintptr_t)i;
+        ty_task_start(tasks[i]);
+    }
+    for (unsigned int i = 0; i < PRODUCER_COUNT; i++) {
+        ASSERT(tasks[i] && ty_task_join(tasks[i]) == 0);
+        ty_task_unref(tasks[i]);
+    }
+    ty_message_stop_async();
+
+    ty_mutex_lock(&record_mutex);
+    ASSERT(record_logs + record_dropped >= PRODUCER_COUNT * PRODUCER_MESSAGES);
+    ASSERT(record_progress > 0);
+    ASSERT(record_ordered || record_dropped);
+    ty_mutex_unlock(&record_mutex);
+
+    // Back to synchronous delivery
+    ty_log(TY_LOG_INFO, "producer 0 message %d", record_last[0] + 1);
+    ASSERT(record_thread == ty_thread_get_self_id());
+}
+
+// Dropped progress updates would be counted with the logs
+static int run_log_producer(ty_task *task)
+{
+    unsigned int producer = (unsigned int)(uintptr_t)task->result;
+
+    for (int i = 0; i < PRODUCER_MESSAGES; i++)
+        ty_log(TY_LOG_INFO, "producer %u message %d", producer, i);
+
+    return 0;
+}
+
+static void test_message_stop(void)
+{
+    ty_task *tasks[PRODUCER_COUNT] = {0};
+
+    reset_records();
+
+    // Stop while producers are busy, messages they already queued must not get lost
+    ASSERT(ty_message_start_async() == 0);
+    for (unsigned int i = 0; i < PRODUCER_COUNT; i++) {
+        if (ty_task_new("producer", run_log_producer, &tasks[i]) < 0)
+            continue;
+        tasks[i]->result = (void *)(uintptr_t)i;
+        ty_task_start(tasks[i]);
+    }
+    ty_delay(2);
+    ty_message_stop_async();
+    for (unsigned int i = 0; i < PRODUCER_COUNT; i++) {
+        ASSERT(tasks[i] && ty_task_join(tasks[i]) == 0);
+        ty_task_unref(tasks[i]);
+    }
+
+    ty_mutex_lock(&record_mutex);
+    ASSERT(record_logs + record_dropped == PRODUCER_COUNT * PRODUCER_MESSAGES);
+    ty_mutex_unlock(&record_mutex);
+}
+
+static void test_message_overflow(void)
+{
+    reset_records();
+
+    ASSERT(ty_message_start_async() == 0);
+
+    /* The first message blocks the drain thread, the queue fills up behind it. Synchronous
+       delivery would block this thread instead, and nothing would get dropped. */
+    record_blocked = true;
+    for (int i = 0; i < 1000; i++)
+        ty_log(TY_LOG_INFO, "producer 0 message %d", i);
+
+    ty_mutex_lock(&record_mutex);
+    record_blocked = false;
+    ty_mutex_unlock(&record_mutex);
+    ty_message_stop_async();
+
+    ASSERT(record_dropped > 0);
+    ASSERT(record_logs + record_dropped == 1000);
+}
+
+static void test_message_progress(void)
+{
+    // Percentage limit only
+    reset_records();
+    ty_progress_set_rate_limit(0, 10);
+    for (uint64_t i = 0; i <= 1000; i++)
+        ty_progress("Counting", i, 1000);
+    ASSERT(record_progress == 11);
+    ASSERT(record_progress_first == 0);
+    ASSERT(record_progress_last == 1000);
+
+    // Nothing in between with a long interval, but 0% and 100% always get through
+    reset_records();
+    ty_progress_set_rate_limit(60000, 0);
+    for (uint64_t i = 0; i <= 1000; i++)
+        ty_progress("Counting", i, 1000);
+    ASSERT(record_progress == 2);
+    ASSERT(record_progress_last == 1000);
+
+    // A new operation resets the limit
+    reset_records();
+    ty_progress("Counting", 500, 1000);
+    ty_progress("Sending", 500, 1000);
+    ty_progress("Sending", 600, 1000);
+    ASSERT(record_progress == 2);
+
+    reset_records();
+    ty_progress_set_rate_limit(0, 0);
+    for (uint64_t i = 0; i <= 1000; i++)
+        ty_progress("Counting", i, 1000);
+    ASSERT(record_progress == 1001);
+
+    ty_progress_set_rate_limit(100, 5);
+}
+
+struct batch_counts {
+    unsigned int flushes;
+    unsigned int logs;
+    unsigned int progress;
+    unsigned int status;
+    uint64_t last_progress;
+    bool ctx;
+};
+
+static void count_batch(const ty_message_data *msgs, unsigned int count, void *udata)
+{
+    struct batch_counts *counts = udata;
+
+    counts->flushes++;
+    for (unsigned int i = 0; i < count; i++) {
+        switch (msgs[i].type) {
+            case TY_MESSAGE_LOG: {
+                counts->logs++;
+            } break;
+            case TY_MESSAGE_PROGRESS: {
+                counts->progress++;
+                counts->last_progress = msgs[i].u.progress.value;
+            } break;
+            case TY_MESSAGE_STATUS: {
+                counts->status++;
+            } break;
+        }
+        if (msgs[i].ctx && strcmp(msgs[i].ctx, "batched") == 0)
+            counts->ctx = true;
+    }
+}
+
+static int run_batched(ty_task *task)
+{
+    TY_UNUSED(task);
+
+    ty_log(TY_LOG_INFO, "Starting");
+    for (uint64_t i = 0; i <= 100; i++)
+        ty_progress("Working", i, 100);
+    ty_log(TY_LOG_INFO, "Done");
+
+    return 0;
+}
+
+static void test_message_batch(void)
+{
+    ty_message_batch *batch;
+    ty_task *tasks[3] = {0};
+    struct batch_counts counts = {0};
+
+    if (ty_message_batch_new(&batch) < 0) {
+        ASSERT(false);
+        return;
+    }
+    ty_progress_set_rate_limit(0, 0);
+
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        if (ty_task_new("batched", run_batched, &tasks[i]) < 0)
+            continue;
+        tasks[i]->user_callback = ty_message_batch_add;
+        tasks[i]->user_callback_udata = batch;
+        ty_task_start(tasks[i]);
+    }
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        ASSERT(tasks[i] && ty_task_join(tasks[i]) == 0);
+        ty_task_unref(tasks[i]);
+    }
+
+    // The batch keeps the tasks alive until they are flushed
+    ASSERT(ty_message_batch_flush(batch, count_batch, &counts) > 0);
+    ASSERT(counts.flushes == 1);
+    ASSERT(counts.logs == 2 * TY_COUNTOF(tasks));
+    ASSERT(counts.progress == TY_COUNTOF(tasks));
+    ASSERT(counts.last_progress == 100);
+    ASSERT(counts.status == 3 * TY_COUNTOF(tasks));
+    ASSERT(counts.ctx);
+
+    ASSERT(ty_message_batch_flush(batch, count_batch, &counts) == 0);
+    ASSERT(counts.flushes == 1);
+
+    ty_progress_set_rate_limit(100, 5);
+    ty_message_batch_free(batch);
+}
+
+void test_message(void)
+{
+    if (ty_mutex_init(&record_mutex) < 0) {
+        ASSERT(false);
+        return;
+    }
+    ty_message_redirect(record_message, NULL);
+
+    test_message_async();
+    test_message_stop();
+    test_message_overflow();
+    test_message_progress();
+    test_message_batch();
+
+    ty_message_redirect(ty_message_default_handler, NULL);
+    ty_mutex_release(&record_mutex);
+}
@@ -0,0 +1,248 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+#include "test_libty.h"
+#include "../../src/libty/poller.h"
+
+#ifndef _WIN32
+
+#define PIPE_COUNT 100
+
+static int pipes[PIPE_COUNT][2];
+
+static bool open_pipes(void)
+{
+    for (unsigned int i = 0; i < PIPE_COUNT; i++) {
+        if (pipe(pipes[i]) < 0) {
+            while (i--) {
+                close(pipes[i][0]);
+                close(pipes[i][1]);
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void close_pipes(void)
+{
+    for (unsigned int i = 0; i < PIPE_COUNT; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+}
+
+static ty_poller *create_poller(int flags)
+{
+    ty_poller *poller;
+
+    if (ty_poller_new(&poller) < 0)
+        return NULL;
+    for (int i = 0; i < PIPE_COUNT; i++) {
+        if (ty_poller_add(poller, pipes[i][0], i + 1, flags) < 0) {
+            ty_poller_free(poller);
+            return NULL;
+        }
+    }
+
+    return poller;
+}
+
+static void test_poller_batch(void)
+{
+    ty_poller *poller = create_poller(0);
+    ty_poller_event events[PIPE_COUNT];
+    bool seen[PIPE_COUNT + 1] = {0};
+    int r;
+
+    ASSERT(poller);
+    if (!poller)
+        return;
+    ASSERT(ty_poller_get_count(poller) == PIPE_COUNT);
+
+    r = ty_poller_wait(poller, events, PIPE_COUNT, 0);
+    ASSERT(r == 0);
+
+    // Descriptors beyond the old limit of 64 must be reported too, in a single call
+    ASSERT(write(pipes[3][1], "a", 1) == 1);
+    ASSERT(write(pipes[70][1], "a", 1) == 1);
+    ASSERT(write(pipes[99][1], "a", 1) == 1);
+    r = ty_poller_wait(poller, events, PIPE_COUNT, 1000);
+    ASSERT(r == 3);
+    for (int i = 0; i < r; i++) {
+        ASSERT(events[i].desc == pipes[events[i].id - 1][0]);
+        seen[events[i].id] = true;
+    }
+    ASSERT(seen[4] && seen[71] && seen[100]);
+
+    // Removed descriptors are not reported anymore
+    ty_poller_remove(poller, 71);
+    ASSERT(ty_poller_get_count(poller) == PIPE_COUNT - 1);
+    r = ty_poller_wait(poller, events, PIPE_COUNT, 0);
+    ASSERT(r == 2);
+    for (int i = 0; i < r; i++)
+        ASSERT(events[i].id != 71);
+
+    ty_poller_free(poller);
+}
+
+static void test_poller_fairness(void)
+{
+    ty_poller *poller = create_poller(0);
+    ty_poller_event events[10];
+    bool seen[PIPE_COUNT + 1] = {0};
+    unsigned int seen_count = 0;
+
+    ASSERT(poller);
+    if (!poller)
+        return;
+
+    for (unsigned int i = 0; i < PIPE_COUNT; i++)
+        ASSERT(write(pipes[i][1], "a", 1) == 1);
+
+    /* Nothing is drained, so a naive implementation would keep returning the same first
+       descriptors over and over. */
+    for (unsigned int i = 0; i < PIPE_COUNT / TY_COUNTOF(events); i++) {
+        int r = ty_poller_wait(poller, events, TY_COUNTOF(events), 0);
+        ASSERT(r == (int)TY_COUNTOF(events));
+
+        for (int j = 0; j < r; j++) {
+            if (!seen[events[j].id]) {
+                seen[events[j].id] = true;
+                seen_count++;
+            }
+        }
+    }
+    ASSERT(seen_count == PIPE_COUNT);
+
+    ty_poller_free(poller);
+}
+
+// epoll refuses these, poll() says they are always ready
+static void test_poller_files(void)
+{
+    ty_poller *poller = NULL;
+    ty_poller_event events[4];
+    FILE *fp;
+    int null_fd;
+    int r;
+
+    fp = tmpfile();
+    null_fd = open("/dev/null", O_RDONLY);
+    ASSERT(fp && null_fd >= 0);
+    if (!fp || null_fd < 0)
+        goto cleanup;
+
+    ASSERT(ty_poller_new(&poller) == 0);
+    if (!poller)
+        goto cleanup;
+    ASSERT(ty_poller_add(poller, fileno(fp), 1, 0) == 0);
+    ASSERT(ty_poller_add(poller, null_fd, 2, 0) == 0);
+    ASSERT(ty_poller_add(poller, pipes[0][0], 3, 0) == 0);
+
+    // This must not block even though the pipe has nothing to say
+    r = ty_poller_wait(poller, events, TY_COUNTOF(events), -1);
+    ASSERT(r == 2);
+    ASSERT(r == 2 && events[0].id + events[1].id == 3);
+
+    ASSERT(write(pipes[0][1], "a", 1) == 1);
+    r = ty_poller_wait(poller, events, TY_COUNTOF(events), -1);
+    ASSERT(r == 3 && events[0].id == 3);
+
+    ty_poller_remove(poller, 1);
+    ty_poller_remove(poller, 2);
+    ASSERT(ty_poller_get_count(poller) == 1);
+    r = ty_poller_wait(poller, events, TY_COUNTOF(events), 0);
+    ASSERT(r == 1 && events[0].id == 3);
+
+cleanup:
+    ty_poller_free(poller);
+    if (null_fd >= 0)
+        close(null_fd);
+    if (fp)
+        fclose(fp);
+}
+
+#ifdef __linux__
+
+static void test_poller_edge(void)
+{
+    ty_poller *poller = create_poller(TY_POLLER_EDGE);
+    ty_poller_event events[4];
+    char buf[4];
+    int r;
+
+    ASSERT(poller);
+    if (!poller)
+        return;
+
+    ASSERT(write(pipes[0][1], "a", 1) == 1);
+    r = ty_poller_wait(poller, events, TY_COUNTOF(events), 1000);
+    ASSERT(r == 1 && events[0].id == 1);
+
+    // Still readable, but no new data arrived
+    r = ty_poller_wait(poller, events, TY_COUNTOF(events), 0);
+    ASSERT(r == 0);
+
+    ASSERT(write(pipes[0][1], "b", 1) == 1);
+    r = ty_poller_wait(poller, events, TY_COUNTOF(events), 1000);
+    ASSERT(r == 1 && events[0].id == 1);
+    ASSERT(read(pipes[0][0], buf, sizeof(buf)) == 2);
+
+    ty_poller_free(poller);
+}
+
+#endif
+
+void test_poller(void)
+{
+    if (!open_pipes()) {
+        ASSERT(false);
+        return;
+    }
+    test_poller_batch();
+    close_pipes();
+
+    if (!open_pipes()) {
+        ASSERT(false);
+        return;
+    }
+    test_poller_fairness();
+    close_pipes();
+
+    if (!open_pipes()) {
+        ASSERT(false);
+        return;
+    }
+    test_poller_files();
+    close_pipes();
+
+#ifdef __linux__
+    if (!open_pipes()) {
+        ASSERT(false);
+        return;
+    }
+    test_poller_edge();
+    close_pipes();
+#endif
+}
+
+#else
+
+void test_poller(void)
+{
+}
+
+#endif
@@ -0,0 +1,547 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/common_priv.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/monitor.h"
+#include "../../src/libty/task.h"
+
+#define BATCH_SIZE 1000
+
+static ty_mutex gate_mutex;
+static ty_cond gate_cond;
+static bool gate_open;
+
+static ty_mutex order_mutex;
+static int order[8];
+static unsigned int order_count;
+
+static unsigned int batch_count;
+
+static int run_gate(ty_task *task)
+{
+    TY_UNUSED(task);
+
+    ty_mutex_lock(&gate_mutex);
+    while (!gate_open)
+        ty_cond_wait(&gate_cond, &gate_mutex, -1);
+    ty_mutex_unlock(&gate_mutex);
+
+    return 0;
+}
+
+static int run_record(ty_task *task)
+{
+    ty_mutex_lock(&order_mutex);
+    if (order_count < TY_COUNTOF(order))
+        order[order_count++] = (int)task->priority;
+    ty_mutex_unlock(&order_mutex);
+
+    return 0;
+}
+
+static int run_count(ty_task *task)
+{
+    TY_UNUSED(task);
+
+    ty_mutex_lock(&order_mutex);
+    batch_count++;
+    ty_mutex_unlock(&order_mutex);
+
+    return 0;
+}
+
+static int run_until_canceled(ty_task *task)
+{
+    int r;
+
+    TY_UNUSED(task);
+
+    // Error masks are per-thread, and this runs in a worker
+    ty_error_mask(TY_ERROR_CANCELED);
+    ty_error_mask(TY_ERROR_TIMEOUT);
+    while (!(r = ty_task_check_canceled()))
+        ty_delay(5);
+    ty_error_unmask();
+    ty_error_unmask();
+
+    return r;
+}
+
+static int never_ready(ty_monitor *monitor, void *udata)
+{
+    TY_UNUSED(monitor);
+    TY_UNUSED(udata);
+
+    return 0;
+}
+
+static int run_monitor_wait(ty_task *task)
+{
+    ty_monitor *monitor = task->result;
+    int r;
+
+    ty_error_mask(TY_ERROR_CANCELED);
+    ty_error_mask(TY_ERROR_TIMEOUT);
+    r = ty_monitor_wait(monitor, never_ready, NULL, -1);
+    ty_error_unmask();
+    ty_error_unmask();
+
+    task->result = NULL;
+    return r;
+}
+
+static ty_monitor *wakeup_monitor;
+static uint64_t wakeup_generation;
+
+static int generation_changed(ty_monitor *monitor, void *udata)
+{
+    TY_UNUSED(monitor);
+
+    return _ty_counter_get(&wakeup_generation) != (uint64_t)(size_t)udata;
+}
+
+static int run_generation_wait(ty_task *task)
+{
+    void *generation = task->result;
+
+    task->result = NULL;
+    return ty_monitor_wait(wakeup_monitor, generation_changed, generation, -1);
+}
+
+static int run_sleep(ty_task *task)
+{
+    ty_delay((unsigned int)(size_t)task->result);
+    task->result = NULL;
+
+    return 0;
+}
+
+static int run_fail(ty_task *task)
+{
+    TY_UNUSED(task);
+    return TY_ERROR_IO;
+}
+
+static ty_task *new_sleep_task(const char *name, unsigned int delay)
+{
+    ty_task *task;
+
+    if (ty_task_new(name, run_sleep, &task) < 0)
+        return NULL;
+    task->result = (void *)(size_t)delay;
+
+    return task;
+}
+
+static ty_task *start_task(ty_pool *pool, int (*run)(ty_task *task), ty_task_priority priority)
+{
+    ty_task *task;
+
+    if (ty_task_new("test", run, &task) < 0)
+        return NULL;
+    task->pool = pool;
+    task->priority = priority;
+
+    if (ty_task_start(task) < 0) {
+        ty_task_unref(task);
+        return NULL;
+    }
+
+    return task;
+}
+
+static void open_gate(void)
+{
+    ty_mutex_lock(&gate_mutex);
+    gate_open = true;
+    ty_cond_broadcast(&gate_cond);
+    ty_mutex_unlock(&gate_mutex);
+}
+
+static void test_task_priorities(void)
+{
+    ty_pool *pool;
+    ty_task *gate, *tasks[4];
+
+    ASSERT(ty_pool_new(&pool) == 0);
+    ASSERT(ty_pool_set_max_threads(pool, 1) == 0);
+
+    // Keep the only worker busy while the other tasks pile up
+    gate_open = false;
+    gate = start_task(pool, run_gate, TY_TASK_PRIORITY_NORMAL);
+    ASSERT(gate);
+    ASSERT(ty_task_wait(gate, TY_TASK_STATUS_RUNNING, 1000) == 1);
+
+    order_count = 0;
+    tasks[0] = start_task(pool, run_record, TY_TASK_PRIORITY_BULK);
+    tasks[1] = start_task(pool, run_record, TY_TASK_PRIORITY_NORMAL);
+    tasks[2] = start_task(pool, run_record, TY_TASK_PRIORITY_INTERACTIVE);
+    tasks[3] = start_task(pool, run_record, TY_TASK_PRIORITY_BULK);
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++)
+        ASSERT(tasks[i] && tasks[i]->status == TY_TASK_STATUS_PENDING);
+
+    open_gate();
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        if (tasks[i])
+            ASSERT(ty_task_wait(tasks[i], TY_TASK_STATUS_FINISHED, 1000) == 1);
+    }
+
+    ASSERT(order_count == 4);
+    ASSERT(order[0] == TY_TASK_PRIORITY_INTERACTIVE);
+    ASSERT(order[1] == TY_TASK_PRIORITY_NORMAL);
+    ASSERT(order[2] == TY_TASK_PRIORITY_BULK && order[3] == TY_TASK_PRIORITY_BULK);
+
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++)
+        ty_task_unref(tasks[i]);
+    ty_task_unref(gate);
+    ty_pool_free(pool);
+}
+
+static void test_task_join_pending(void)
+{
+    ty_pool *pool;
+    ty_task *gate, *task;
+
+    ASSERT(ty_pool_new(&pool) == 0);
+    ASSERT(ty_pool_set_max_threads(pool, 1) == 0);
+
+    gate_open = false;
+    gate = start_task(pool, run_gate, TY_TASK_PRIORITY_NORMAL);
+    ASSERT(gate);
+    ASSERT(ty_task_wait(gate, TY_TASK_STATUS_RUNNING, 1000) == 1);
+
+    // The worker is stuck, so the pending task must run in this thread
+    order_count = 0;
+    task = start_task(pool, run_record, TY_TASK_PRIORITY_BULK);
+    ASSERT(task);
+    ASSERT(ty_task_join(task) == 0);
+    ASSERT(order_count == 1);
+
+    // The worker must skip the task we claimed
+    open_gate();
+    ASSERT(ty_task_join(gate) == 0);
+    ASSERT(order_count == 1);
+
+    ty_task_unref(task);
+    ty_task_unref(gate);
+    ty_pool_free(pool);
+}
+
+static void test_task_cancel(void)
+{
+    ty_pool *pool;
+    ty_task *gate, *pending, *running;
+
+    ASSERT(ty_pool_new(&pool) == 0);
+    ASSERT(ty_pool_set_max_threads(pool, 1) == 0);
+
+    gate_open = false;
+    gate = start_task(pool, run_gate, TY_TASK_PRIORITY_NORMAL);
+    ASSERT(gate);
+    ASSERT(ty_task_wait(gate, TY_TASK_STATUS_RUNNING, 1000) == 1);
+
+    // Canceling a pending task finishes it right away, without running it
+    order_count = 0;
+    pending = start_task(pool, run_record, TY_TASK_PRIORITY_NORMAL);
+    ASSERT(pending);
+    ty_error_mask(TY_ERROR_CANCELED);
+    ty_task_cancel(pending);
+    ty_error_unmask();
+    ASSERT(pending->status == TY_TASK_STATUS_FINISHED);
+    ASSERT(pending->ret == TY_ERROR_CANCELED);
+    ASSERT(order_count == 0);
+
+    open_gate();
+    ASSERT(ty_task_join(gate) == 0);
+
+    running = start_task(pool, run_until_canceled, TY_TASK_PRIORITY_NORMAL);
+    ASSERT(running);
+    ASSERT(ty_task_wait(running, TY_TASK_STATUS_RUNNING, 1000) == 1);
+    ty_task_cancel(running);
+    ASSERT(ty_task_wait(running, TY_TASK_STATUS_FINISHED, 1000) == 1);
+    ASSERT(running->ret == TY_ERROR_CANCELED);
+
+    ty_task_unref(running);
+    ty_task_unref(pending);
+    ty_task_unref(gate);
+    ty_pool_free(pool);
+}
+
+static void test_task_timeout(void)
+{
+    ty_pool *pool;
+    ty_task *task;
+    uint64_t start;
+
+    ASSERT(ty_pool_new(&pool) == 0);
+
+    ASSERT(ty_task_new("test", run_until_canceled, &task) == 0);
+    task->pool = pool;
+    ty_task_set_timeout(task, 50);
+
+    start = ty_millis();
+    ASSERT(ty_task_start(task) == 0);
+    ASSERT(ty_task_wait(task, TY_TASK_STATUS_FINISHED, 1000) == 1);
+    ASSERT(task->ret == TY_ERROR_TIMEOUT);
+    ASSERT(ty_millis() - start >= 50);
+
+    ty_task_unref(task);
+    ty_pool_free(pool);
+}
+
+static void test_task_cancel_wait(void)
+{
+    ty_monitor *monitor;
+    ty_pool *pool;
+    ty_task *task;
+    uint64_t start;
+
+    if (ty_monitor_new(&monitor) < 0)
+        return;
+    ASSERT(ty_pool_new(&pool) == 0);
+
+    // Nothing wakes up the waiting task but ty_task_cancel()
+    ASSERT(ty_task_new("test", run_monitor_wait, &task) == 0);
+    task->pool = pool;
+    task->result = monitor;
+    ASSERT(ty_task_start(task) == 0);
+    ASSERT(ty_task_wait(task, TY_TASK_STATUS_RUNNING, 1000) == 1);
+    ty_delay(20);
+
+    start = ty_millis();
+    ty_task_cancel(task);
+    ASSERT(ty_task_wait(task, TY_TASK_STATUS_FINISHED, 1000) == 1);
+    ASSERT(task->ret == TY_ERROR_CANCELED);
+    ASSERT(ty_millis() - start < 50);
+    ty_task_unref(task);
+
+    // Same thing with a deadline
+    ASSERT(ty_task_new("test", run_monitor_wait, &task) == 0);
+    task->pool = pool;
+    task->result = monitor;
+    ty_task_set_timeout(task, 30);
+
+    start = ty_millis();
+    ASSERT(ty_task_start(task) == 0);
+    ASSERT(ty_task_wait(task, TY_TASK_STATUS_FINISHED, 1000) == 1);
+    ASSERT(task->ret == TY_ERROR_TIMEOUT);
+    ASSERT(ty_millis() - start >= 30 && ty_millis() - start < 80);
+    ty_task_unref(task);
+
+    ty_pool_free(pool);
+    ty_monitor_free(monitor);
+}
+
+static void test_task_monitor_wakeup(void)
+{
+    ty_monitor *monitor;
+    ty_pool *pool;
+    unsigned int finished = 0;
+
+    if (ty_monitor_new(&monitor) < 0)
+        return;
+    ASSERT(ty_pool_new(&pool) == 0);
+    wakeup_monitor = monitor;
+
+    // A single refresh must wake up a waiter, even one that is just going to sleep
+    for (unsigned int i = 0; i < 100; i++) {
+        ty_task *task;
+
+        if (ty_task_new("test", run_generation_wait, &task) < 0)
+            break;
+        task->pool = pool;
+        task->result = (void *)(size_t)_ty_counter_get(&wakeup_generation);
+        if (ty_task_start(task) < 0) {
+            ty_task_unref(task);
+            break;
+        }
+        if (i % 2)
+            ty_task_wait(task, TY_TASK_STATUS_RUNNING, 1000);
+
+        _ty_counter_add(&wakeup_generation, 1);
+        ty_monitor_refresh(monitor);
+
+        if (ty_task_wait(task, TY_TASK_STATUS_FINISHED, 1000) == 1 && task->ret == 1)
+            finished++;
+        ty_task_cancel(task);
+        ty_task_unref(task);
+    }
+    ASSERT(finished == 100);
+
+    ty_pool_free(pool);
+    ty_monitor_free(monitor);
+}
+
+static void test_task_block(void)
+{
+    ty_pool *pool;
+    ty_task *task, *canceled;
+    ty_pool_stats stats;
+
+    ASSERT(ty_pool_new(&pool) == 0);
+
+    order_count = 0;
+    ASSERT(ty_task_new("test", run_record, &task) == 0);
+    task->pool = pool;
+    _ty_task_block(task);
+    _ty_task_block(task);
+
+    // Started but blocked tasks do not reach the pool
+    ASSERT(ty_task_start(task) == 0);
+    ASSERT(!ty_task_wait(task, TY_TASK_STATUS_RUNNING, 50));
+    ty_pool_get_stats(pool, &stats);
+    ASSERT(stats.blocked_tasks == 1 && !stats.pending_tasks);
+    _ty_task_unblock(task);
+    ASSERT(!ty_task_wait(task, TY_TASK_STATUS_RUNNING, 50));
+    _ty_task_unblock(task);
+    ASSERT(ty_task_wait(task, TY_TASK_STATUS_FINISHED, 1000) == 1);
+    ASSERT(order_count == 1);
+    ty_pool_get_stats(pool, &stats);
+    ASSERT(!stats.blocked_tasks && !stats.pending_tasks);
+
+    // Canceling a blocked task finishes it, the final unblock must not run it again
+    ASSERT(ty_task_new("test", run_record, &canceled) == 0);
+    canceled->pool = pool;
+    _ty_task_block(canceled);
+    ASSERT(ty_task_start(canceled) == 0);
+    ty_error_mask(TY_ERROR_CANCELED);
+    ty_task_cancel(canceled);
+    ty_error_unmask();
+    ASSERT(canceled->status == TY_TASK_STATUS_FINISHED);
+    ASSERT(canceled->ret == TY_ERROR_CANCELED);
+    _ty_task_unblock(canceled);
+    ASSERT(order_count == 1);
+    ty_pool_get_stats(pool, &stats);
+    ASSERT(!stats.blocked_tasks);
+
+    ty_task_unref(canceled);
+    ty_task_unref(task);
+    ty_pool_free(pool);
+}
+
+static void test_task_graph(void)
+{
+    ty_pool *pool;
+    ty_task_graph *graph;
+    ty_task *a, *b, *c, *barrier, *d, *path[8];
+    unsigned int path_len;
+
+    ASSERT(ty_pool_new(&pool) == 0);
+    ASSERT(ty_task_graph_new(&graph) == 0);
+    ty_task_graph_set_pool(graph, pool);
+
+    // Fan-out from a to b and c, fan-in to d through a barrier
+    a = new_sleep_task("a", 20);
+    b = new_sleep_task("b", 60);
+    c = new_sleep_task("c", 10);
+    d = new_sleep_task("d", 0);
+    ASSERT(a && b && c && d);
+    ASSERT(ty_task_graph_add_dependency(graph, b, a) == 0);
+    ASSERT(ty_task_graph_add_dependency(graph, c, a) == 0);
+    ASSERT(ty_task_graph_add_barrier(graph, &barrier) == 0);
+    ASSERT(ty_task_graph_add_dependency(graph, d, barrier) == 0);
+
+    ty_error_mask(TY_ERROR_PARAM);
+    ASSERT(ty_task_graph_add_dependency(graph, a, d) == TY_ERROR_PARAM);
+    ty_error_unmask();
+
+    ASSERT(ty_task_graph_join(graph) == 0);
+    ASSERT(b->start_time >= a->finish_time && c->start_time >= a->finish_time);
+    ASSERT(d->start_time >= b->finish_time && d->start_time >= c->finish_time);
+
+    path_len = ty_task_graph_get_critical_path(graph, path, TY_COUNTOF(path));
+    ASSERT(path_len == 4);
+    ASSERT(path[0] == a && path[1] == b && path[2] == barrier && path[3] == d);
+
+    ty_task_unref(d);
+    ty_task_unref(c);
+    ty_task_unref(b);
+    ty_task_unref(a);
+    ty_task_graph_free(graph);
+
+    // Failures propagate to dependents, independent tasks still run
+    ASSERT(ty_task_graph_new(&graph) == 0);
+    ty_task_graph_set_pool(graph, pool);
+
+    ASSERT(ty_task_new("a", run_fail, &a) == 0);
+    b = new_sleep_task("b", 0);
+    c = new_sleep_task("c", 0);
+    ASSERT(b && c);
+    ASSERT(ty_task_graph_add_dependency(graph, b, a) == 0);
+    ASSERT(ty_task_graph_add(graph, c) == 0);
+
+    ASSERT(ty_task_graph_join(graph) == TY_ERROR_IO);
+    ASSERT(b->ret == TY_ERROR_IO && !b->result);
+    ASSERT(c->ret == 0);
+
+    ty_task_unref(c);
+    ty_task_unref(b);
+    ty_task_unref(a);
+    ty_task_graph_free(graph);
+
+    ty_pool_free(pool);
+}
+
+static void test_task_batch(void)
+{
+    ty_pool *pool;
+    ty_task **tasks;
+    unsigned int finished = 0;
+
+    tasks = calloc(BATCH_SIZE, sizeof(*tasks));
+    ASSERT(tasks);
+    if (!tasks)
+        return;
+
+    ASSERT(ty_pool_new(&pool) == 0);
+    ASSERT(ty_pool_set_max_threads(pool, 4) == 0);
+    ASSERT(ty_pool_set_min_threads(pool, 2) == 0);
+    ASSERT(ty_pool_get_min_threads(pool) == 2);
+
+    batch_count = 0;
+    for (unsigned int i = 0; i < BATCH_SIZE; i++)
+        tasks[i] = start_task(pool, run_count, (ty_task_priority)(i % TY_TASK_PRIORITY_COUNT));
+    for (unsigned int i = 0; i < BATCH_SIZE; i++) {
+        if (tasks[i] && ty_task_wait(tasks[i], TY_TASK_STATUS_FINISHED, 5000) == 1)
+            finished++;
+        ty_task_unref(tasks[i]);
+    }
+
+    ASSERT(finished == BATCH_SIZE);
+    ASSERT(batch_count == BATCH_SIZE);
+
+    ty_pool_free(pool);
+    free(tasks);
+}
+
+void test_task(void)
+{
+    if (ty_mutex_init(&gate_mutex) < 0 || ty_cond_init(&gate_cond) < 0 ||
+            ty_mutex_init(&order_mutex) < 0) {
+        ASSERT(false);
+        return;
+    }
+
+    test_task_priorities();
+    test_task_join_pending();
+    test_task_cancel();
+    test_task_timeout();
+    test_task_cancel_wait();
+    test_task_monitor_wakeup();
+    test_task_block();
+    test_task_graph();
+    test_task_batch();
+
+    ty_mutex_release(&order_mutex);
+    ty_cond_release(&gate_cond);
+    ty_mutex_release(&gate_mutex);
+}
@@ -0,0 +1,100 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/timer.h"
+
+#define ENTRY_COUNT 200
+
+static void test_timer_queue_order(void)
+{
+    ty_timer_queue *queue;
+    ty_timer_entry entries[ENTRY_COUNT] = {0};
+    ty_timer_entry *entry;
+    uint64_t base = ty_millis() - 1000;
+    uint64_t previous = 0;
+    unsigned int popped = 0;
+    bool ordered = true;
+    int r;
+
+    if (ty_timer_queue_new(&queue) < 0) {
+        ASSERT(false);
+        return;
+    }
+
+    // Scramble deadlines, all of them in the past
+    for (unsigned int i = 0; i < ENTRY_COUNT; i++)
+        ASSERT(ty_timer_queue_add(queue, &entries[i], base + (i * 37) % ENTRY_COUNT) == 0);
+    ASSERT(ty_timer_queue_get_count(queue) == ENTRY_COUNT);
+    ASSERT(ty_timer_queue_get_timeout(queue) == 0);
+
+    // Reschedule and remove a few entries
+    ASSERT(ty_timer_queue_add(queue, &entries[10], base + 500) == 0);
+    ty_timer_queue_remove(queue, &entries[20]);
+    ty_timer_queue_remove(queue, &entries[20]);
+    ASSERT(!ty_timer_entry_is_queued(&entries[20]));
+    ASSERT(ty_timer_queue_get_count(queue) == ENTRY_COUNT - 1);
+
+    while ((r = ty_timer_queue_pop(queue, &entry)) > 0) {
+        if (entry->deadline < previous || entry == &entries[20])
+            ordered = false;
+        previous = entry->deadline;
+        popped++;
+    }
+    ASSERT(r == 0);
+    ASSERT(ordered);
+    ASSERT(popped == ENTRY_COUNT - 1);
+    ASSERT(previous == base + 500);
+    ASSERT(ty_timer_queue_get_timeout(queue) == -1);
+
+    ty_timer_queue_free(queue);
+}
+
+static void test_timer_queue_future(void)
+{
+    ty_timer_queue *queue;
+    ty_timer_entry near = {0}, far = {0};
+    ty_timer_entry *entry;
+    int timeout;
+
+    if (ty_timer_queue_new(&queue) < 0) {
+        ASSERT(false);
+        return;
+    }
+
+    ASSERT(ty_timer_queue_add(queue, &far, ty_millis() + 60000) == 0);
+    ASSERT(ty_timer_queue_add(queue, &near, ty_millis() + 5000) == 0);
+    timeout = ty_timer_queue_get_timeout(queue);
+    ASSERT(timeout > 4000 && timeout <= 5000);
+
+    // Nothing has expired yet
+    ASSERT(ty_timer_queue_pop(queue, &entry) == 0);
+    ASSERT(ty_timer_queue_get_count(queue) == 2);
+
+    ASSERT(ty_timer_queue_peek(queue) == &near);
+    ty_timer_queue_remove(queue, &near);
+    ASSERT(ty_timer_queue_peek(queue) == &far);
+    timeout = ty_timer_queue_get_timeout(queue);
+    ASSERT(timeout > 55000 && timeout <= 60000);
+
+    ty_timer_queue_clear(queue);
+    ASSERT(!ty_timer_queue_peek(queue));
+    ASSERT(!ty_timer_entry_is_queued(&far));
+    ASSERT(ty_timer_queue_get_timeout(queue) == -1);
+
+    ty_timer_queue_free(queue);
+}
+
+void test_timer(void)
+{
+    test_timer_queue_order();
+    test_timer_queue_future();
+}
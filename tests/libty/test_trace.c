@@ -0,0 +1,178 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/task.h"
+#include "../../src/libty/thread.h"
+#include "../../src/libty/trace.h"
+
+static char *dump_trace(void)
+{
+    FILE *fp;
+    long len;
+    char *json = NULL;
+
+    fp = tmpfile();
+    if (!fp)
+        return NULL;
+    if (ty_trace_write(fp) < 0)
+        goto cleanup;
+
+    len = ftell(fp);
+    if (len < 0)
+        goto cleanup;
+    rewind(fp);
+
+    json = calloc(1, (size_t)len + 1);
+    if (json && fread(json, 1, (size_t)len, fp) != (size_t)len) {
+        free(json);
+        json = NULL;
+    }
+
+cleanup:
+    fclose(fp);
+    return json;
+}
+
+static unsigned int count_occurrences(const char *str, const char *needle)
+{
+    unsigned int count = 0;
+
+    while ((str = strstr(str, needle))) {
+        count++;
+        str += strlen(needle);
+    }
+
+    return count;
+}
+
+static int run_nothing(ty_task *task)
+{
+    TY_UNUSED(task);
+    return 0;
+}
+
+static void test_trace_events(void)
+{
+    ty_task *task;
+    char *json;
+
+    ty_trace_set_enabled(true);
+    ty_trace_clear();
+
+    ty_trace_begin(TY_TRACE_IO, "outer", "quote \" and \\ backslash");
+    ty_trace_begin(TY_TRACE_IO, "inner", NULL);
+    ty_trace_end(TY_TRACE_IO, "inner");
+    ty_trace_end(TY_TRACE_IO, "outer");
+
+    if (ty_task_new("traced", run_nothing, &task) == 0) {
+        ASSERT(ty_task_join(task) == 0);
+        ty_task_unref(task);
+    } else {
+        ASSERT(false);
+    }
+
+    ty_trace_set_enabled(false);
+    ty_trace_begin(TY_TRACE_IO, "ignored", NULL);
+
+    json = dump_trace();
+    ASSERT(json);
+    if (json) {
+        ASSERT(strncmp(json, "{\"displayTimeUnit\"", 18) == 0);
+        ASSERT(strstr(json, "{\"name\":\"outer\",\"cat\":\"io\",\"ph\":\"B\""));
+        ASSERT(strstr(json, "\"args\":{\"arg\":\"quote \\\" and \\\\ backslash\"}"));
+        ASSERT(count_occurrences(json, "\"ph\":\"B\"") == 3);
+        ASSERT(count_occurrences(json, "\"ph\":\"E\"") == 3);
+        ASSERT(strstr(json, "\"name\":\"run\",\"cat\":\"task\",\"ph\":\"B\""));
+        ASSERT(strstr(json, "\"args\":{\"arg\":\"traced\"}"));
+        ASSERT(!strstr(json, "ignored"));
+        ASSERT(strcmp(json + strlen(json) - 4, "\n]}\n") == 0);
+    }
+    free(json);
+}
+
+static void test_trace_wrap(void)
+{
+    char *json;
+
+    ty_trace_set_enabled(true);
+    ty_trace_clear();
+
+    // Older events are dropped once the ring is full
+    ty_trace_begin(TY_TRACE_IO, "first", NULL);
+    for (unsigned int i = 0; i < 10000; i++)
+        ty_trace_end(TY_TRACE_IO, "filler");
+
+    ty_trace_set_enabled(false);
+
+    json = dump_trace();
+    ASSERT(json);
+    if (json) {
+        ASSERT(!strstr(json, "\"first\""));
+        ASSERT(count_occurrences(json, "\"filler\"") > 1000);
+        ASSERT(count_occurrences(json, "\"filler\"") < 10000);
+    }
+    free(json);
+
+    ty_trace_clear();
+}
+
+static int run_traced_thread(void *udata)
+{
+    TY_UNUSED(udata);
+
+    ty_trace_begin(TY_TRACE_IO, "thread", NULL);
+    ty_trace_end(TY_TRACE_IO, "thread");
+
+    return 0;
+}
+
+static void test_trace_reuse(void)
+{
+    unsigned int threads, joined = 0;
+    char *json;
+
+    ty_trace_set_enabled(true);
+    ty_trace_clear();
+
+    json = dump_trace();
+    threads = json ? count_occurrences(json, "\"thread_name\"") : 0;
+    free(json);
+
+    // Threads that come and go one at a time share a single new ring
+    for (unsigned int i = 0; i < 20; i++) {
+        ty_thread thread;
+
+        if (ty_thread_create(&thread, run_traced_thread, NULL) < 0)
+            break;
+        if (ty_thread_join(&thread) == 0)
+            joined++;
+    }
+    ASSERT(joined == 20);
+
+    ty_trace_set_enabled(false);
+
+    json = dump_trace();
+    ASSERT(json);
+    if (json) {
+        ASSERT(count_occurrences(json, "\"thread_name\"") <= threads + 1);
+        ASSERT(count_occurrences(json, "\"name\":\"thread\"") == 40);
+    }
+    free(json);
+
+    ty_trace_clear();
+}
+
+void test_trace(void)
+{
+    test_trace_events();
+    test_trace_wrap();
+    test_trace_reuse();
+}
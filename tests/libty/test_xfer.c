@@ -0,0 +1,441 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _WIN32
+    #ifndef _GNU_SOURCE
+        #define _GNU_SOURCE
+    #endif
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <pthread.h>
+    #include <unistd.h>
+#endif
+#include "test_libty.h"
+#include "../../src/libhs/device.h"
+#include "../../src/libhs/serial.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/xfer.h"
+
+struct loopback {
+    ty_xfer_link sender_link;
+    ty_xfer_link receiver_link;
+    ty_xfer_source src;
+    ty_xfer_receiver recv;
+
+    const uint8_t *data;
+    uint8_t *received;
+    size_t received_len;
+    int recv_status;
+
+    uint32_t clock;
+    uint8_t ack_buf[65536];
+    size_t ack_offset;
+    size_t ack_len;
+
+    bool receiver_alive;
+    unsigned int writes;
+    unsigned int drop_every;
+    unsigned int corrupt_every;
+};
+
+static int loopback_sender_write(void *udata, const uint8_t *buf, size_t size)
+{
+    struct loopback *lb = udata;
+    uint8_t tmp[TY_XFER_MAX_ENCODED_SIZE(TY_XFER_MAX_BLOCK_SIZE)];
+    int r;
+
+    lb->writes++;
+    lb->clock++;
+
+    if (!lb->receiver_alive)
+        return 0;
+    if (lb->drop_every && !(lb->writes % lb->drop_every))
+        return 0;
+    if (lb->corrupt_every && !(lb->writes % lb->corrupt_every) && size > 4) {
+        memcpy(tmp, buf, size);
+        tmp[size / 2] ^= 0x5A;
+        buf = tmp;
+    }
+
+    r = ty_xfer_receiver_process(&lb->recv, buf, size);
+    if (r)
+        lb->recv_status = r;
+    return 0;
+}
+
+static int loopback_sender_read(void *udata, uint8_t *buf, size_t size, int timeout)
+{
+    struct loopback *lb = udata;
+
+    if (lb->ack_offset == lb->ack_len) {
+        lb->clock += (uint32_t)(timeout > 0 ? timeout : 1);
+        return 0;
+    }
+
+    size = TY_MIN(size, lb->ack_len - lb->ack_offset);
+    memcpy(buf, lb->ack_buf + lb->ack_offset, size);
+    lb->ack_offset += size;
+    if (lb->ack_offset == lb->ack_len) {
+        lb->ack_offset = 0;
+        lb->ack_len = 0;
+    }
+
+    return (int)size;
+}
+
+static uint32_t loopback_millis(void *udata)
+{
+    struct loopback *lb = udata;
+    return lb->clock;
+}
+
+static int loopback_receiver_write(void *udata, const uint8_t *buf, size_t size)
+{
+    struct loopback *lb = udata;
+
+    if (lb->ack_len + size > sizeof(lb->ack_buf))
+        return -1;
+    memcpy(lb->ack_buf + lb->ack_len, buf, size);
+    lb->ack_len += size;
+
+    return 0;
+}
+
+static int loopback_source_read(void *udata, uint64_t offset, uint8_t *buf, size_t size)
+{
+    struct loopback *lb = udata;
+    memcpy(buf, lb->data + offset, size);
+    return 0;
+}
+
+static int loopback_receiver_data(void *udata, const uint8_t *buf, size_t size)
+{
+    struct loopback *lb = udata;
+    memcpy(lb->received + lb->received_len, buf, size);
+    lb->received_len += size;
+    return 0;
+}
+
+static struct loopback *init_loopback(const uint8_t *data, size_t size)
+{
+    struct loopback *lb = calloc(1, sizeof(*lb));
+    assert(lb);
+
+    lb->sender_link.write = loopback_sender_write;
+    lb->sender_link.read = loopback_sender_read;
+    lb->sender_link.millis = loopback_millis;
+    lb->sender_link.udata = lb;
+    lb->receiver_link.write = loopback_receiver_write;
+    lb->receiver_link.millis = loopback_millis;
+    lb->receiver_link.udata = lb;
+
+    lb->src.read = loopback_source_read;
+    lb->src.size = size;
+    lb->src.udata = lb;
+
+    lb->data = data;
+    lb->received = malloc(size);
+    assert(lb->received);
+    lb->receiver_alive = true;
+    ty_xfer_receiver_init(&lb->recv, &lb->receiver_link, loopback_receiver_data, lb);
+
+    return lb;
+}
+
+static void free_loopback(struct loopback *lb)
+{
+    free(lb->received);
+    free(lb);
+}
+
+static uint8_t *make_test_data(size_t size)
+{
+    uint8_t *data = malloc(size);
+    uint32_t state = 42;
+
+    assert(data);
+    for (size_t i = 0; i < size; i++) {
+        state = state * 1103515245 + 12345;
+        data[i] = (uint8_t)(state >> 16);
+    }
+
+    return data;
+}
+
+static void test_xfer_crc32(void)
+{
+    ASSERT(ty_xfer_crc32(0, (const uint8_t *)"123456789", 9) == 0xCBF43926);
+    ASSERT(ty_xfer_crc32(ty_xfer_crc32(0, (const uint8_t *)"1234", 4),
+                         (const uint8_t *)"56789", 5) == 0xCBF43926);
+    ASSERT(ty_xfer_crc32(0, NULL, 0) == 0);
+}
+
+static void test_xfer_framing(void)
+{
+    const uint8_t payload[] = {0x7E, 0x00, 0x7D, 0x5E, 0xFF, 0x7E};
+    uint8_t buf[TY_XFER_MAX_ENCODED_SIZE(sizeof(payload))];
+    ty_xfer_decoder dec;
+    ty_xfer_frame frame;
+    unsigned int frames;
+    size_t len;
+
+    len = ty_xfer_encode(TY_XFER_FRAME_DATA, 0x1234, payload, sizeof(payload), buf);
+    ASSERT(len <= sizeof(buf));
+
+    // Leading garbage (such as board output) must be ignored
+    ty_xfer_decoder_init(&dec);
+    frames = 0;
+    for (const char *ptr = "Hello World\n"; *ptr; ptr++)
+        frames += ty_xfer_decode(&dec, (uint8_t)*ptr, &frame);
+    for (size_t i = 0; i < len; i++)
+        frames += ty_xfer_decode(&dec, buf[i], &frame);
+    ASSERT(frames == 1);
+    ASSERT(frame.type == TY_XFER_FRAME_DATA);
+    ASSERT(frame.seq == 0x1234);
+    ASSERT(frame.size == sizeof(payload) && !memcmp(frame.payload, payload, sizeof(payload)));
+
+    buf[len / 2] ^= 0x01;
+    ty_xfer_decoder_init(&dec);
+    frames = 0;
+    for (size_t i = 0; i < len; i++)
+        frames += ty_xfer_decode(&dec, buf[i], &frame);
+    ASSERT(!frames);
+    ASSERT(dec.errors == 1);
+}
+
+static void test_xfer_loopback(void)
+{
+    const size_t size = 100000;
+    uint8_t *data = make_test_data(size);
+
+    {
+        struct loopback *lb = init_loopback(data, size);
+
+        ASSERT(ty_xfer_send(&lb->sender_link, &lb->src) == TY_XFER_OK);
+        ASSERT(lb->recv_status == 1);
+        ASSERT(lb->received_len == size && !memcmp(lb->received, data, size));
+
+        free_loopback(lb);
+    }
+
+    // Lost and corrupted frames (including handshake frames) must be sent again
+    {
+        struct loopback *lb = init_loopback(data, size);
+        lb->drop_every = 7;
+        lb->corrupt_every = 11;
+
+        ASSERT(ty_xfer_send(&lb->sender_link, &lb->src) == TY_XFER_OK);
+        ASSERT(lb->recv_status == 1);
+        ASSERT(lb->received_len == size && !memcmp(lb->received, data, size));
+
+        free_loopback(lb);
+    }
+
+    // Small files fit in a single partial block
+    {
+        struct loopback *lb = init_loopback(data, 10);
+
+        ASSERT(ty_xfer_send(&lb->sender_link, &lb->src) == TY_XFER_OK);
+        ASSERT(lb->received_len == 10 && !memcmp(lb->received, data, 10));
+
+        free_loopback(lb);
+    }
+
+    {
+        struct loopback *lb = init_loopback(data, size);
+        lb->receiver_alive = false;
+
+        ASSERT(ty_xfer_send(&lb->sender_link, &lb->src) == TY_XFER_ERROR_UNSUPPORTED);
+
+        free_loopback(lb);
+    }
+
+    free(data);
+}
+
+#ifndef _WIN32
+
+struct pty_receiver {
+    int fd;
+    ty_xfer_link link;
+    ty_xfer_receiver recv;
+
+    uint8_t *received;
+    size_t received_len;
+    int status;
+};
+
+struct pty_sender {
+    hs_port *port;
+    const uint8_t *data;
+};
+
+static int pty_receiver_write(void *udata, const uint8_t *buf, size_t size)
+{
+    struct pty_receiver *pr = udata;
+
+    while (size) {
+        ssize_t r = write(pr->fd, buf, size);
+        if (r < 0)
+            return -1;
+        buf += r;
+        size -= (size_t)r;
+    }
+
+    return 0;
+}
+
+static int pty_receiver_data(void *udata, const uint8_t *buf, size_t size)
+{
+    struct pty_receiver *pr = udata;
+    memcpy(pr->received + pr->received_len, buf, size);
+    pr->received_len += size;
+    return 0;
+}
+
+static void *pty_receiver_thread(void *udata)
+{
+    struct pty_receiver *pr = udata;
+    uint64_t start = ty_millis();
+
+    // Give up after a while, so that a broken sender cannot hang the tests
+    while (!pr->status && ty_millis() - start < 20000) {
+        struct pollfd pfd = {pr->fd, POLLIN, 0};
+        uint8_t buf[4096];
+        ssize_t r;
+
+        r = poll(&pfd, 1, 100);
+        if (r <= 0)
+            continue;
+        r = read(pr->fd, buf, sizeof(buf));
+        if (r <= 0)
+            break;
+
+        pr->status = ty_xfer_receiver_process(&pr->recv, buf, (size_t)r);
+    }
+
+    return NULL;
+}
+
+static int pty_sender_write(void *udata, const uint8_t *buf, size_t size)
+{
+    struct pty_sender *ps = udata;
+
+    while (size) {
+        ssize_t r = hs_serial_write(ps->port, buf, size, 5000);
+        if (r <= 0)
+            return -1;
+        buf += r;
+        size -= (size_t)r;
+    }
+
+    return 0;
+}
+
+static int pty_sender_read(void *udata, uint8_t *buf, size_t size, int timeout)
+{
+    struct pty_sender *ps = udata;
+    return (int)hs_serial_read(ps->port, buf, size, timeout);
+}
+
+static uint32_t pty_millis(void *udata)
+{
+    TY_UNUSED(udata);
+    return (uint32_t)ty_millis();
+}
+
+static int pty_source_read(void *udata, uint64_t offset, uint8_t *buf, size_t size)
+{
+    struct pty_sender *ps = udata;
+    memcpy(buf, ps->data + offset, size);
+    return 0;
+}
+
+static void test_xfer_pty(void)
+{
+    const size_t size = 262144;
+    uint8_t *data = make_test_data(size);
+    struct pty_receiver *pr;
+    struct pty_sender ps = {0};
+    ty_xfer_link link = {0};
+    ty_xfer_source src = {0};
+    hs_device *dev;
+    pthread_t thread;
+    int r;
+
+    pr = calloc(1, sizeof(*pr));
+    assert(pr);
+    pr->received = malloc(size);
+    assert(pr->received);
+
+    pr->fd = posix_openpt(O_RDWR | O_NOCTTY);
+    ASSERT(pr->fd >= 0 && !grantpt(pr->fd) && !unlockpt(pr->fd));
+    if (pr->fd < 0)
+        goto cleanup;
+
+    // There is no monitor for pseudo-terminals, build the device by hand
+    dev = calloc(1, sizeof(*dev));
+    assert(dev);
+    dev->refcount = 1;
+    dev->type = HS_DEVICE_TYPE_SERIAL;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+    dev->key = strdup(ptsname(pr->fd));
+    dev->location = strdup("pty");
+    dev->path = strdup(ptsname(pr->fd));
+    r = hs_port_open(dev, HS_PORT_MODE_RW, &ps.port);
+    hs_device_unref(dev);
+    ASSERT(r >= 0);
+    if (r < 0)
+        goto cleanup;
+    ps.data = data;
+
+    pr->link.write = pty_receiver_write;
+    pr->link.millis = pty_millis;
+    pr->link.udata = pr;
+    ty_xfer_receiver_init(&pr->recv, &pr->link, pty_receiver_data, pr);
+    r = pthread_create(&thread, NULL, pty_receiver_thread, pr);
+    ASSERT(!r);
+    if (r)
+        goto cleanup;
+
+    link.write = pty_sender_write;
+    link.read = pty_sender_read;
+    link.millis = pty_millis;
+    link.udata = &ps;
+    src.read = pty_source_read;
+    src.size = size;
+    src.udata = &ps;
+
+    ASSERT(ty_xfer_send(&link, &src) == TY_XFER_OK);
+    pthread_join(thread, NULL);
+
+    ASSERT(pr->status == 1);
+    ASSERT(pr->received_len == size && !memcmp(pr->received, data, size));
+
+cleanup:
+    hs_port_close(ps.port);
+    if (pr->fd >= 0)
+        close(pr->fd);
+    free(pr->received);
+    free(pr);
+    free(data);
+}
+
+#endif
+
+void test_xfer(void)
+{
+    test_xfer_crc32();
+    test_xfer_framing();
+    test_xfer_loopback();
+#ifndef _WIN32
+    test_xfer_pty();
+#endif
+}
@@ -0,0 +1,135 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _WIN32
+    #include <signal.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+#include "test_libty.h"
+#include "../../src/tycmd/main.h"
+
+int daemon_main(int argc, char *argv[]);
+
+// Just enough of tycmd around daemon.c to run forwarded commands
+
+const char *tycmd_executable_name = "tycmd";
+
+static char expected_cwd[4096];
+
+void print_common_options(FILE *f)
+{
+    TY_UNUSED(f);
+}
+
+bool parse_common_option(ty_optline_context *optl, char *arg)
+{
+    TY_UNUSED(optl);
+    TY_UNUSED(arg);
+
+    return false;
+}
+
+void set_monitor(ty_monitor *monitor)
+{
+    TY_UNUSED(monitor);
+}
+
+#ifndef _WIN32
+
+// Runs in the daemon child, the exit code tells the client what it got
+int run_command(int argc, char *argv[])
+{
+    char cwd[4096];
+
+    if (!getcwd(cwd, sizeof(cwd)) || strcmp(cwd, expected_cwd) != 0)
+        return 10;
+    if (argc != 2 || strcmp(argv[0], "list") != 0)
+        return 11;
+
+    return atoi(argv[1]);
+}
+
+static void test_daemon_forward(char *path)
+{
+    char *daemon_argv[] = {"daemon", "--socket", path, NULL};
+    char *argv1[] = {"list", "42", NULL};
+    char *argv2[] = {"list", "7", NULL};
+    pid_t daemon_pid;
+    bool forwarded = false;
+    int code = -1;
+    int status = 0;
+
+    // Nobody is listening yet
+    ASSERT(!forward_daemon_command(2, argv1, &code));
+    ASSERT(code == -1);
+
+    fflush(NULL);
+    daemon_pid = fork();
+    if (!daemon_pid)
+        _exit(daemon_main(3, daemon_argv));
+    ASSERT(daemon_pid > 0);
+    if (daemon_pid < 0)
+        return;
+
+    // The socket may not be listening right away
+    for (unsigned int i = 0; i < 200 && !forwarded; i++) {
+        forwarded = forward_daemon_command(2, argv1, &code);
+        if (!forwarded)
+            usleep(10000);
+    }
+    ASSERT(forwarded);
+    ASSERT(code == 42);
+
+    // The daemon is ready for the next command once the previous one has reported back
+    code = -1;
+    ASSERT(forward_daemon_command(2, argv2, &code));
+    ASSERT(code == 7);
+
+    kill(daemon_pid, SIGTERM);
+    waitpid(daemon_pid, &status, 0);
+    ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    ASSERT(access(path, F_OK) < 0);
+}
+
+void test_daemon(void)
+{
+    char path[256];
+
+    if (!getcwd(expected_cwd, sizeof(expected_cwd))) {
+        ASSERT(false);
+        return;
+    }
+
+    snprintf(path, sizeof(path), "/tmp/test_tycmd-%u.sock", (unsigned int)getpid());
+    unlink(path);
+    setenv("TYCMD_DAEMON_SOCKET", path, 1);
+
+    test_daemon_forward(path);
+
+    unsetenv("TYCMD_DAEMON_SOCKET");
+    unlink(path);
+}
+
+#else
+
+int run_command(int argc, char *argv[])
+{
+    TY_UNUSED(argc);
+    TY_UNUSED(argv);
+
+    return 0;
+}
+
+void test_daemon(void)
+{
+}
+
+#endif